@@ -2,6 +2,7 @@
 #define MMSS_IPINT_ASYNC_PUSH_SINK_HELPER_H_
 
 #include <deque>
+#include <cstdint>
 #include <stdexcept>
 #include <algorithm>
 #include <boost/function.hpp>
@@ -21,28 +22,71 @@ class CAsyncPushSinkHelper : public NLogging::WithLogger
 {
     typedef boost::function1<void, ITV8::MFF::IMultimediaBuffer*> FHandler;
 public:
-    CAsyncPushSinkHelper(DECLARE_LOGGER_ARG, NExecutors::PReactor reactor, FHandler handler)
+    // Queue budget. The queue may exceed it by one key frame, since the
+    // latest key frame is never dropped.
+    struct SLimits
+    {
+        SLimits()
+            : MaxBytes(32 * 1024 * 1024)
+            , MaxDurationMs(3000)
+            , MaxBuffers(1024)
+        {
+        }
+
+        size_t MaxBytes;
+        ITV8::timestamp_t MaxDurationMs;
+        size_t MaxBuffers; // safety net against sources with broken timestamps
+    };
+
+    struct SDropStatistics
+    {
+        SDropStatistics()
+            : KeyFrames(0)
+            , DeltaFrames(0)
+            , Overflows(0)
+        {
+        }
+
+        std::uint64_t KeyFrames;     // including audio and other independent buffers
+        std::uint64_t DeltaFrames;
+        std::uint64_t Overflows;     // times the queue went over budget
+    };
+
+    CAsyncPushSinkHelper(DECLARE_LOGGER_ARG, NExecutors::PReactor reactor, FHandler handler,
+        const SLimits& limits = SLimits())
         : NLogging::WithLogger(GET_LOGGER_PTR)
         , m_reactor(reactor)
         , m_handler(handler)
+        , m_limits(limits)
+        , m_bytes(0)
         , m_isHandling(false)
         , m_isActive(false)
+        , m_waitForKeyFrame(false)
+        , m_isOverflowing(false)
     {
     }
+    // Не строим здесь настоящих кадров, как в CSamplesLimitedQueue: это слишком
+    // дорого. Для прореживания достаточно признака ключевого кадра, размера и
+    // метки времени, которые отдаёт сам IMultimediaBuffer.
     void Enqueue(ITV8::MFF::IMultimediaBuffer* s)
     {
         boost::mutex::scoped_lock lock(m_mutex);
-        m_queue.push_back(s); // TODO: ограничение размера; прореживание.
-        // Вообще-то здесь надо было бы использовать CSamplesLimitedQueue.
-        // проблема в том, что он оперирует настоящими кадрами.
-        // А чтобы построить настоящий кадр из этого добра (ITV8::MFF::IMultimediaBuffer),
-        // нужно потратить много CPU-шного времени.
-        // поэтому просто ограничиваем очередь фиксированным размером.
-        if (m_queue.size() > 64)
+        const SEntry entry = MakeEntry(s);
+        if (m_waitForKeyFrame)
         {
-            _err_ << "CAsyncPushSinkHelper::Enqueue(): queue size limit exceeded. Draining the queue.";
-            Drain(lock);
+            // Дельта-кадры после выброшенных всё равно не декодируются.
+            if (!entry.Key)
+            {
+                DropEntry(entry);
+                return;
+            }
+            m_waitForKeyFrame = false;
         }
+
+        m_queue.push_back(entry);
+        m_bytes += entry.Size;
+        if (IsOverBudget())
+            Shrink();
         CheckHandling(lock);
     }
     void Activate(bool active)
@@ -51,6 +95,11 @@ public:
         m_isActive = active;
         CheckHandling(lock); // при необходимости планируем запуск обработчика
     }
+    SDropStatistics GetDropStatistics()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_dropStatistics;
+    }
     ~CAsyncPushSinkHelper()
     {
         boost::mutex::scoped_lock lock(m_mutex);
@@ -60,22 +109,111 @@ public:
         Drain(lock);
     }
 private:
+    // Сколько буферов обрабатываем за одну постановку в реактор.
+    static const size_t HANDLE_BATCH_SIZE = 8;
+
+    struct SEntry
+    {
+        ITV8::MFF::IMultimediaBuffer* Buffer;
+        size_t Size;
+        ITV8::timestamp_t Timestamp;
+        bool Key;
+    };
+
     NExecutors::PReactor m_reactor;
     FHandler m_handler;
+    const SLimits m_limits;
     boost::mutex m_mutex;
     boost::condition m_condition;
-    typedef std::deque<ITV8::MFF::IMultimediaBuffer*> TQueue;
+    typedef std::deque<SEntry> TQueue;
     TQueue m_queue;
+    size_t m_bytes;
+    SDropStatistics m_dropStatistics;
     bool m_isHandling; // обработчик запланирован или исполняется
     bool m_isActive; // флаг того, что при поступлении новых данных обработчик будет запланирован
+    bool m_waitForKeyFrame; // хвост текущей GOP выброшен, ждём следующий ключевой кадр
+    bool m_isOverflowing;
 private:
+    static SEntry MakeEntry(ITV8::MFF::IMultimediaBuffer* s)
+    {
+        SEntry entry = { s, 0, s->GetTimeStamp(), true };
+        if (ITV8::MFF::ICompressedBuffer* compressed = ITV8::contract_cast<ITV8::MFF::ICompressedBuffer>(s))
+        {
+            entry.Size = compressed->GetBufferSize();
+            entry.Key = compressed->IsKeyFrame();
+        }
+        else if (ITV8::MFF::IAudioBuffer* audio = ITV8::contract_cast<ITV8::MFF::IAudioBuffer>(s))
+        {
+            entry.Size = audio->GetBufferSize();
+        }
+        return entry;
+    }
+    bool IsOverBudget() const
+    {
+        if (m_queue.size() > m_limits.MaxBuffers || m_bytes > m_limits.MaxBytes)
+            return true;
+        const ITV8::timestamp_t first = m_queue.front().Timestamp;
+        const ITV8::timestamp_t last = m_queue.back().Timestamp;
+        return last > first && last - first > m_limits.MaxDurationMs;
+    }
+    void DropEntry(const SEntry& entry)
+    {
+        if (entry.Key)
+            ++m_dropStatistics.KeyFrames;
+        else
+            ++m_dropStatistics.DeltaFrames;
+        entry.Buffer->Destroy();
+    }
+    void PopFront()
+    {
+        m_bytes -= m_queue.front().Size;
+        DropEntry(m_queue.front());
+        m_queue.pop_front();
+    }
+    void PopBack()
+    {
+        m_bytes -= m_queue.back().Size;
+        DropEntry(m_queue.back());
+        m_queue.pop_back();
+    }
+    // Выбрасываем сначала самые старые GOP целиком, чтобы очередь всегда
+    // начиналась с ключевого кадра. Если осталась одна GOP, срезаем её хвост
+    // из дельта-кадров, а до следующего ключевого кадра отбрасываем входящие.
+    void Shrink()
+    {
+        if (!m_isOverflowing)
+        {
+            m_isOverflowing = true;
+            ++m_dropStatistics.Overflows;
+            _wrn_ << "CAsyncPushSinkHelper::Enqueue(): queue budget exceeded with " << m_queue.size()
+                << " buffers, " << m_bytes << " bytes. Dropping frames.";
+        }
+
+        while (m_queue.size() > 1 && IsOverBudget())
+        {
+            const auto nextKey = std::find_if(m_queue.begin() + 1, m_queue.end(),
+                [](const SEntry& e) { return e.Key; });
+            if (nextKey != m_queue.end())
+            {
+                const size_t count = nextKey - m_queue.begin();
+                for (size_t i = 0; i < count; ++i)
+                    PopFront();
+            }
+            else
+            {
+                PopBack();
+                m_waitForKeyFrame = true;
+            }
+        }
+    }
     void Drain(boost::mutex::scoped_lock& lock)
     {
         if (!lock)
             throw std::logic_error("lock should have been acquired");
         for (const auto& it : m_queue)
-            it->Destroy();
+            it.Buffer->Destroy();
         m_queue.clear();
+        m_bytes = 0;
     }
     void CheckHandling(boost::mutex::scoped_lock& lock)
     {
@@ -106,14 +244,15 @@ private:
     void Handle()
     {
         boost::mutex::scoped_lock lock(m_mutex);
-        if (!m_queue.empty() && m_isActive)
+        for (size_t i = 0; i < HANDLE_BATCH_SIZE && !m_queue.empty() && m_isActive; ++i)
         {
-            ITV8::MFF::IMultimediaBuffer* s = m_queue.front();
+            const SEntry entry = m_queue.front();
             m_queue.pop_front();
+            m_bytes -= entry.Size;
             lock.unlock();
             try
             {
-                m_handler(s);
+                m_handler(entry.Buffer);
             }
             catch (...)
             {
@@ -121,6 +260,12 @@ private:
             }
             lock.lock();
         }
+        if (m_queue.empty() && m_isOverflowing)
+        {
+            m_isOverflowing = false;
+            _wrn_ << "CAsyncPushSinkHelper::Handle(): queue caught up. Dropped so far: "
+                << m_dropStatistics.KeyFrames << " key, " << m_dropStatistics.DeltaFrames << " delta frames";
+        }
         if (!m_queue.empty() && m_isActive)
             PostHandle(lock);
         else
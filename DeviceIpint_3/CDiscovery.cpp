@@ -99,7 +99,9 @@ std::string getFakeGenericDescription(const std::string& brand, const std::strin
     Json::Value& videoStreamingElement = videoSourceElement["videoStreamings"]["items"][0U];
     videoStreamingElement["name"] = "profile";
 
-    return std::move(root.toStyledString());
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    return Json::writeString(writer, root);
 }
 
 bool fillDiscoveryOffer(DECLARE_LOGGER_ARG, const ITV8::GDRV::IDeviceSearchResult& data, CosTrading::Offer& offer)
@@ -424,7 +424,8 @@ CachedHistoryRequester2::CachedHistoryRequester2(NLogging::ILogger* logger, cons
 CachedHistoryRequester2::~CachedHistoryRequester2()
 {
     stop();
-    _dbg_ << "Destroyed";
+    _dbgf_("Destroyed, device searches performed {}, coalesced {}, trimmed {}, merged {}",
+        m_searchStatistics.Performed, m_searchStatistics.Coalesced, m_searchStatistics.Trimmed, m_searchStatistics.Merged);
 }
 
 CachedHistoryRequester2::HistoryRequest CachedHistoryRequester2::pickRequestLocked()
@@ -534,7 +535,10 @@ void CachedHistoryRequester2::addSearchJobLocked(historyInterval_t requestedInte
 
     using namespace boost;
     if (!icl::is_empty(m_searchingRange) && icl::contains(m_searchingRange, requestedInterval))
+    {
+        ++m_searchStatistics.Coalesced;
         return;
+    }
 
     if (isReachedRequestsDepth(__FUNCTION__))
         return;
@@ -545,8 +549,25 @@ void CachedHistoryRequester2::addSearchJobLocked(historyInterval_t requestedInte
     if (RT_UPDATE_CACHE_REQUEST == type)
         splittedIntervals |= requestedInterval;
     else 
+    {
         splittedIntervals = splitIntervalLocked(requestedInterval);
 
+        // records for the part which is searching now will be in history when that search finishes,
+        // so request only the uncovered remainder
+        if (!icl::is_empty(m_searchingRange) && icl::intersects(splittedIntervals, m_searchingRange))
+        {
+            splittedIntervals -= m_searchingRange;
+
+            if (splittedIntervals.empty())
+                ++m_searchStatistics.Coalesced;
+            else
+                ++m_searchStatistics.Trimmed;
+
+            _dbgf_("Requested interval {} intersects searching range {}, remainder {}", rangeToString(requestedInterval),
+                rangeToString(m_searchingRange), rangesToString(splittedIntervals));
+        }
+    }
+
     if (splittedIntervals.empty())
     {
         if (icl::is_empty(m_searchingRange) && m_requests.empty())
@@ -581,6 +602,7 @@ void CachedHistoryRequester2::addSearchJobLocked(historyInterval_t requestedInte
                     m_requests.insert(newRequest);
                 }
 
+                ++m_searchStatistics.Merged;
                 _dbgf_("Request queue already contains requested interval {}, requestType {}", rangeToString(*interval), requestTypeToString(type));
 
                 if (icl::is_empty(m_searchingRange) && m_requests.empty())
@@ -602,6 +624,7 @@ void CachedHistoryRequester2::addSearchJobLocked(historyInterval_t requestedInte
                 r.type = type;
 
             m_requests.insert(r);
+            ++m_searchStatistics.Merged;
             _dbgf_("Added request merged {}, requestType {}, size {}", rangeToString(r.interval),
                 requestTypeToString(type), m_requests.size());
             return;
@@ -637,6 +660,7 @@ void CachedHistoryRequester2::doRecordingSearch(CachedHistoryRequester2::History
 
     m_stopDeviceSearchSignal.disconnect_all_slots();
     m_searchingRange = requestedInterval;
+    ++m_searchStatistics.Performed;
     _dbgf_("Start Ipint search: requested interval {}", rangeToString(requestedInterval));
     NLogging::StopWatch sw;
 
@@ -883,6 +907,7 @@ bool CachedHistoryRequester2::getRecordings(historyInterval_t requestedInterval,
 
     if (!boost::icl::is_empty(m_searchingRange) && boost::icl::contains(m_searchingRange, requestedInterval))
     {
+        ++m_searchStatistics.Coalesced;
         _dbg_ << "Requested interval now is searching: " << rangeToString(requestedInterval);
         return true;
     }    
@@ -1196,6 +1221,12 @@ void CachedHistoryRequester2::clearCache()
     m_performedRequests.Clear();
 }
 
+CachedHistoryRequester2::SSearchStatistics CachedHistoryRequester2::getSearchStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_searchStatistics;
+}
+
 void CachedHistoryRequester2::UT_tweak(const STweaks& tweaks)
 {
     m_tweaks = tweaks;
@@ -330,6 +330,20 @@ public:
         historyIntervalSet_t m_performedEmptyRequests;
     };
 
+    // Counters of device searches performed and saved by coalescing incoming requests
+    // with the search in progress and with the queued ones.
+    struct SSearchStatistics
+    {
+        // Searches actually sent to device.
+        uint64_t Performed = 0;
+        // Requests fully served by the search in progress, without a search of their own.
+        uint64_t Coalesced = 0;
+        // Requests trimmed to the part which is not covered by the search in progress.
+        uint64_t Trimmed = 0;
+        // Requests merged into a queued one, which is still to be searched.
+        uint64_t Merged = 0;
+    };
+
     typedef std::function<void(const historyInterval_t&, historyIntervalSetHandler_t, finishedHandler_t, boost::signals2::signal<void()>&)> recordingSearchHandler_t;
 
 public:
@@ -356,6 +370,8 @@ public:
     // Performs stop and after clear cache.
     void clearCache();
 
+    SSearchStatistics getSearchStatistics();
+
     void UT_tweak(const STweaks& tweaks);
 
 private:
@@ -408,6 +424,7 @@ private:
     boost::signals2::signal<void()> m_stopDeviceSearchSignal;
 
     uint16_t    m_unsuccessIpintSearchCount;
+    SSearchStatistics m_searchStatistics;
 };
 
 typedef boost::shared_ptr<ITV8::Utility::RecordingRange> RecordingRangeSP;
@@ -0,0 +1,236 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "../AsyncPushSinkHelper.h"
+#include "TestUtils.h"
+
+using namespace IPINT30;
+
+namespace
+{
+
+const ITV8::timestamp_t FRAME_DURATION_MS = 40;
+const ITV8::uint32_t FRAME_SIZE = 1000;
+
+class FakeCompressedBuffer : public ITV8::MFF::ICompressedBuffer
+{
+public:
+    FakeCompressedBuffer(int id, bool key, std::atomic<int>& destroyed)
+        : m_id(id)
+        , m_key(key)
+        , m_destroyed(destroyed)
+    {
+    }
+
+    int GetId() const { return m_id; }
+
+    ITV8::timestamp_t GetTimeStamp() override { return m_id * FRAME_DURATION_MS; }
+    char const* GetName() override { return "fake"; }
+    ITV8::MFF::BufferTypes GetBufferType() override { return ITV8::MFF::Compressed; }
+    void Destroy() override
+    {
+        ++m_destroyed;
+        delete this;
+    }
+
+    ITV8::uint8_t* GetBuffer() override { return nullptr; }
+    ITV8::uint32_t GetBufferSize() override { return FRAME_SIZE; }
+    ITV8::bool_t IsKeyFrame() override { return m_key; }
+
+    ITV8_BEGIN_CONTRACT_MAP()
+        ITV8_CONTRACT_ENTRY2(ITV8::IContract, ITV8::MFF::ICompressedBuffer)
+        ITV8_CONTRACT_ENTRY(ITV8::MFF::IMultimediaBuffer)
+        ITV8_CONTRACT_ENTRY(ITV8::MFF::ICompressedBuffer)
+    ITV8_END_CONTRACT_MAP()
+
+private:
+    const int m_id;
+    const bool m_key;
+    std::atomic<int>& m_destroyed;
+};
+
+struct SDelivered
+{
+    int Id;
+    bool Key;
+};
+
+class Fixture : public DeviceIpint_3::UnitTesting::BasicFixture
+{
+public:
+    Fixture()
+        : m_produced(0)
+        , m_destroyed(0)
+        , m_handlerDelay(0)
+    {
+    }
+
+    std::unique_ptr<CAsyncPushSinkHelper> CreateHelper(const CAsyncPushSinkHelper::SLimits& limits)
+    {
+        return std::unique_ptr<CAsyncPushSinkHelper>(new CAsyncPushSinkHelper(GetLogger(),
+            NCorbaHelpers::GetReactorFromPool(), [this](ITV8::MFF::IMultimediaBuffer* b) { Handle(b); }, limits));
+    }
+
+    // Feeds frames with ids [first, first + count), a key frame every gopSize frames.
+    void Produce(CAsyncPushSinkHelper& helper, int first, int count, int gopSize)
+    {
+        for (int id = first; id < first + count; ++id)
+        {
+            helper.Enqueue(new FakeCompressedBuffer(id, 0 == id % gopSize, m_destroyed));
+            ++m_produced;
+        }
+    }
+
+    bool WaitAllConsumed(std::chrono::milliseconds timeout = std::chrono::milliseconds(10000))
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (m_destroyed != m_produced)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return true;
+    }
+
+    std::vector<SDelivered> Delivered()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_delivered;
+    }
+
+    // Every delta frame must follow its predecessor, otherwise the decoder
+    // would get a reference it has never seen.
+    static void CheckDecodable(const std::vector<SDelivered>& frames)
+    {
+        BOOST_REQUIRE(!frames.empty());
+        BOOST_CHECK(frames.front().Key);
+        for (size_t i = 1; i < frames.size(); ++i)
+        {
+            if (!frames[i].Key)
+                BOOST_CHECK_EQUAL(frames[i - 1].Id + 1, frames[i].Id);
+        }
+    }
+
+private:
+    void Handle(ITV8::MFF::IMultimediaBuffer* b)
+    {
+        if (m_handlerDelay.count() > 0)
+            std::this_thread::sleep_for(m_handlerDelay);
+
+        FakeCompressedBuffer* frame = static_cast<FakeCompressedBuffer*>(
+            ITV8::contract_cast<ITV8::MFF::ICompressedBuffer>(b));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_delivered.push_back({ frame->GetId(), frame->IsKeyFrame() });
+        }
+        b->Destroy();
+    }
+
+protected:
+    int m_produced;
+    std::atomic<int> m_destroyed;
+    std::chrono::milliseconds m_handlerDelay;
+
+private:
+    std::mutex m_mutex;
+    std::vector<SDelivered> m_delivered;
+};
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(TestAsyncPushSinkHelper, Fixture)
+
+BOOST_AUTO_TEST_CASE(StalledConsumerKeepsLatestGops)
+{
+    CAsyncPushSinkHelper::SLimits limits;
+    limits.MaxDurationMs = 1000;
+    auto helper = CreateHelper(limits);
+
+    // 4 seconds of video while the consumer is stalled.
+    Produce(*helper, 0, 100, 10);
+
+    const auto stats = helper->GetDropStatistics();
+    BOOST_CHECK_EQUAL(1u, stats.Overflows);
+    BOOST_CHECK_GT(stats.KeyFrames, 0u);
+    BOOST_CHECK_GT(stats.DeltaFrames, 0u);
+
+    helper->Activate(true);
+    BOOST_REQUIRE(WaitAllConsumed());
+
+    const auto delivered = Delivered();
+    CheckDecodable(delivered);
+    BOOST_CHECK_EQUAL(99, delivered.back().Id);
+    BOOST_CHECK_LE((delivered.back().Id - delivered.front().Id) * FRAME_DURATION_MS, limits.MaxDurationMs);
+    BOOST_CHECK_EQUAL(static_cast<std::uint64_t>(m_produced - delivered.size()), stats.KeyFrames + stats.DeltaFrames);
+}
+
+BOOST_AUTO_TEST_CASE(ByteBudgetCutsGopTailUntilNextKeyFrame)
+{
+    CAsyncPushSinkHelper::SLimits limits;
+    limits.MaxBytes = 5 * FRAME_SIZE;
+    auto helper = CreateHelper(limits);
+
+    // A key frame with 20 delta frames: only the head of the GOP fits.
+    Produce(*helper, 0, 21, 21);
+
+    auto stats = helper->GetDropStatistics();
+    BOOST_CHECK_EQUAL(0u, stats.KeyFrames);
+    BOOST_CHECK_EQUAL(16u, stats.DeltaFrames);
+
+    helper->Activate(true);
+    BOOST_REQUIRE(WaitAllConsumed());
+
+    auto delivered = Delivered();
+    BOOST_REQUIRE_EQUAL(5u, delivered.size());
+    CheckDecodable(delivered);
+
+    // The consumer has caught up: the next GOP passes untouched.
+    Produce(*helper, 21, 3, 21);
+    BOOST_REQUIRE(WaitAllConsumed());
+
+    delivered = Delivered();
+    BOOST_REQUIRE_EQUAL(8u, delivered.size());
+    BOOST_CHECK_EQUAL(21, delivered[5].Id);
+    BOOST_CHECK(delivered[5].Key);
+    CheckDecodable(delivered);
+}
+
+BOOST_AUTO_TEST_CASE(SlowConsumerGetsDecodableStream)
+{
+    CAsyncPushSinkHelper::SLimits limits;
+    limits.MaxDurationMs = 400;
+    auto helper = CreateHelper(limits);
+    helper->Activate(true);
+
+    m_handlerDelay = std::chrono::milliseconds(5);
+    for (int i = 0; i < 10; ++i)
+    {
+        Produce(*helper, i * 25, 25, 12);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    BOOST_REQUIRE(WaitAllConsumed());
+
+    const auto delivered = Delivered();
+    const auto stats = helper->GetDropStatistics();
+    CheckDecodable(delivered);
+    BOOST_CHECK_GT(stats.DeltaFrames, 0u);
+    BOOST_CHECK_EQUAL(static_cast<std::uint64_t>(m_produced - delivered.size()), stats.KeyFrames + stats.DeltaFrames);
+}
+
+BOOST_AUTO_TEST_CASE(DestructorReleasesQueuedBuffers)
+{
+    auto helper = CreateHelper(CAsyncPushSinkHelper::SLimits());
+    Produce(*helper, 0, 30, 10);
+    helper.reset();
+
+    BOOST_CHECK_EQUAL(m_produced, m_destroyed.load());
+    BOOST_CHECK(Delivered().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
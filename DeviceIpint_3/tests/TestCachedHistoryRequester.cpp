@@ -1,5 +1,7 @@
+#include <condition_variable>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #define BOOST_TEST_MAIN
 #include <boost/test/unit_test.hpp>
@@ -7,6 +9,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread/thread.hpp>
 #include <Logging/log2.h>
+#include <ItvSdk/include/IErrorService.h>
 
 #include "../CachedHistoryRequester.h"
 #include "../TimeStampHelpers.h"
@@ -708,4 +711,143 @@ BOOST_AUTO_TEST_CASE(testRequestDevice2)
     BOOST_CHECK_EQUAL(intervalSet.iterative_size(), 2ull);
 }
 
-BOOST_AUTO_TEST_SUITE_END() // TestCachedHistoryRequester
\ No newline at end of file
+BOOST_AUTO_TEST_SUITE_END() // TestCachedHistoryRequester
+
+namespace
+{
+// Device searcher which holds search until requester asks to stop it.
+struct MockPendingSearcher
+{
+    void operator()(const historyInterval_t& interval, historyIntervalSetHandler_t, finishedHandler_t finished,
+        boost::signals2::signal<void()>& stopSignal)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_requested.push_back(interval);
+        m_finished.push_back(finished);
+        stopSignal.connect([this, finished]()
+            {
+                m_cancelThread = std::thread([finished]() { finished(ITV8::EOperationCancelled); });
+            });
+        m_condition.notify_all();
+    }
+
+    bool waitRequests(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_condition.wait_for(lock, std::chrono::seconds(5), [this, count]() { return m_requested.size() >= count; });
+    }
+
+    // Completes the search at index successfully, the way a device reports its end.
+    void finish(size_t index)
+    {
+        finishedHandler_t finished;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            finished = m_finished.at(index);
+        }
+        finished(ITV8::ENotError);
+    }
+
+    void join()
+    {
+        if (m_cancelThread.joinable())
+            m_cancelThread.join();
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<historyInterval_t> m_requested;
+    std::vector<finishedHandler_t> m_finished;
+    std::thread m_cancelThread;
+};
+
+// Requests are added to the queue on the executor, so their counters are polled.
+template <typename TPredicate>
+bool waitStatistics(CachedHistoryRequester2& requester, TPredicate predicate)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!predicate(requester.getSearchStatistics()))
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(TestCachedHistoryRequester2)
+
+BOOST_AUTO_TEST_CASE(testRequestCoveredBySearchInProgress)
+{
+    auto dynExec = NExecutors::CreateDynamicThreadPool(NLogging::CreateLogger(), "DeviceIpint", NExecutors::IDynamicThreadPool::UNLIMITED_QUEUE_LENGTH, 2, 1024);
+    MockPendingSearcher searcher;
+    CachedHistoryRequester2 requester(GET_LOGGER_PTR, "test", dynExec, 0, 0, std::ref(searcher));
+
+    const historyInterval_t searching(toIpintTime("20211120T080000"), toIpintTime("20211120T140000"));
+    historyIntervalSet_t result;
+    bool hasFullRequestedHistory = true;
+    BOOST_TEST(requester.getRecordings(searching, 0, 0, result, hasFullRequestedHistory));
+    BOOST_TEST(!hasFullRequestedHistory);
+    BOOST_REQUIRE(searcher.waitRequests(1));
+    BOOST_CHECK_EQUAL(searching, searcher.m_requested.front());
+
+    const historyInterval_t covered(toIpintTime("20211120T100000"), toIpintTime("20211120T101000"));
+    BOOST_TEST(requester.getRecordings(covered, 0, 0, result, hasFullRequestedHistory));
+    BOOST_TEST(!hasFullRequestedHistory);
+
+    const auto statistics = requester.getSearchStatistics();
+    BOOST_CHECK_EQUAL(1u, statistics.Performed);
+    BOOST_CHECK_EQUAL(1u, statistics.Coalesced);
+    BOOST_CHECK_EQUAL(0u, statistics.Merged);
+    BOOST_CHECK_EQUAL(size_t(1u), searcher.m_requested.size());
+
+    requester.stop();
+    searcher.join();
+}
+
+BOOST_AUTO_TEST_CASE(testRequestTrimmedBySearchInProgress)
+{
+    auto dynExec = NExecutors::CreateDynamicThreadPool(NLogging::CreateLogger(), "DeviceIpint", NExecutors::IDynamicThreadPool::UNLIMITED_QUEUE_LENGTH, 2, 1024);
+    MockPendingSearcher searcher;
+    CachedHistoryRequester2 requester(GET_LOGGER_PTR, "test", dynExec, 0, 0, std::ref(searcher));
+
+    // every request is taken as it comes, not as a repetition of the previous one
+    CachedHistoryRequester2::STweaks tweaks;
+    tweaks.RecentRequestInterval = std::chrono::milliseconds(0);
+    requester.UT_tweak(tweaks);
+
+    const historyInterval_t searching(toIpintTime("20211120T080000"), toIpintTime("20211120T140000"));
+    historyIntervalSet_t result;
+    bool hasFullRequestedHistory = true;
+    BOOST_TEST(requester.getRecordings(searching, 0, 0, result, hasFullRequestedHistory));
+    BOOST_REQUIRE(searcher.waitRequests(1));
+    BOOST_CHECK_EQUAL(searching, searcher.m_requested.front());
+
+    // Both the request and its normalized day overlap the search in progress. They are trimmed to
+    // the remainder, which is merged into the day queued by the first request.
+    const historyInterval_t overlapping(toIpintTime("20211120T120000"), toIpintTime("20211120T160000"));
+    BOOST_TEST(requester.getRecordings(overlapping, 0, 0, result, hasFullRequestedHistory));
+    BOOST_TEST(!hasFullRequestedHistory);
+    BOOST_REQUIRE(waitStatistics(requester, [](const CachedHistoryRequester2::SSearchStatistics& s) { return s.Trimmed >= 2u; }));
+
+    auto statistics = requester.getSearchStatistics();
+    BOOST_CHECK_EQUAL(1u, statistics.Performed);
+    BOOST_CHECK_EQUAL(0u, statistics.Coalesced);
+    BOOST_CHECK_EQUAL(2u, statistics.Trimmed);
+    BOOST_CHECK_EQUAL(2u, statistics.Merged);
+
+    // The next device search skips the range the first one has covered.
+    searcher.finish(0);
+    BOOST_REQUIRE(searcher.waitRequests(2));
+    BOOST_TEST(boost::icl::disjoint(searching, searcher.m_requested[1]));
+
+    statistics = requester.getSearchStatistics();
+    BOOST_CHECK_EQUAL(2u, statistics.Performed);
+    BOOST_CHECK_EQUAL(0u, statistics.Coalesced);
+
+    requester.stop();
+    searcher.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END() // TestCachedHistoryRequester2
@@ -76,10 +76,10 @@ namespace ArchivePlugin
     const char* const VIDEO_SOURCE = "SourceEndpoint.video";
 
     CArchiveContentImpl::CArchiveContentImpl(NCorbaHelpers::IContainerNamed* c, const NWebGrpc::PGrpcManager grpcManager,
-                    const NPluginUtility::PRigthsChecker rightsChecker, const std::string& hlsContentPath,
+                    const NPluginUtility::PRigthsChecker rightsChecker,
                     UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache)
             :   m_container(c, NCorbaHelpers::ShareOwnership())
-            ,   m_hlsManager(c, hlsContentPath, cache)
+            ,   m_hlsManager(c, cache)
             ,   m_connectors(c)
             ,   m_grpcManager(grpcManager)
             ,   m_rightsChecker(rightsChecker)
@@ -1122,8 +1122,8 @@ namespace NHttp
 {
     IServlet* CreateArchiveServlet(NCorbaHelpers::IContainerNamed* c,
         const NWebGrpc::PGrpcManager grpcManager, const NPluginUtility::PRigthsChecker rightsChecker,
-        const std::string& hlsContentPath, UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache)
+        UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache)
     {
-        return new ArchivePlugin::CArchiveContentImpl(c, grpcManager, rightsChecker, hlsContentPath, rtspUrls, cache);
+        return new ArchivePlugin::CArchiveContentImpl(c, grpcManager, rightsChecker, rtspUrls, cache);
     }
 }
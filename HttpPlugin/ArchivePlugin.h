@@ -196,7 +196,7 @@ private:
 
 public:
     CArchiveContentImpl(NCorbaHelpers::IContainerNamed* c, const NWebGrpc::PGrpcManager grpcManager,
-        const NPluginUtility::PRigthsChecker rightsChecker, const std::string& hlsContentPath,
+        const NPluginUtility::PRigthsChecker rightsChecker,
         UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache);
 
     ~CArchiveContentImpl();
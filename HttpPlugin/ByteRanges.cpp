@@ -0,0 +1,207 @@
+#include <limits>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include "ByteRanges.h"
+
+namespace
+{
+    const char* const BYTES_UNIT = "bytes=";
+    const char* const CRLF = "\r\n";
+
+    // Many small ranges are a cheap way to amplify a request, so a longer
+    // list is ignored and the whole file is sent instead.
+    const std::size_t MAX_RANGES = 32;
+
+    bool ParsePosition(const std::string& s, std::uint64_t& value)
+    {
+        if (s.empty())
+            return false;
+
+        value = 0;
+        for (char c : s)
+        {
+            if (c < '0' || c > '9')
+                return false;
+
+            const std::uint64_t digit = static_cast<std::uint64_t>(c - '0');
+            if (value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10)
+                return false;
+            value = value * 10 + digit;
+        }
+        return true;
+    }
+}
+
+namespace NContext
+{
+    const char* const BYTERANGES_BOUNDARY = "ngpbyteranges";
+
+    ERangeStatus ParseByteRanges(const std::string& header, std::uint64_t size, std::vector<SByteRange>& ranges)
+    {
+        ranges.clear();
+
+        std::string spec(boost::algorithm::trim_copy(header));
+        if (!boost::algorithm::istarts_with(spec, BYTES_UNIT))
+            return RANGE_ABSENT;
+        spec.erase(0, std::strlen(BYTES_UNIT));
+
+        std::vector<std::string> items;
+        boost::algorithm::split(items, spec, boost::is_any_of(","));
+
+        bool anyItem = false;
+        for (std::string& item : items)
+        {
+            boost::algorithm::trim(item);
+            if (item.empty())
+                continue;
+            anyItem = true;
+
+            const std::size_t dash = item.find('-');
+            if (std::string::npos == dash)
+                return RANGE_ABSENT;
+
+            const std::string first(boost::algorithm::trim_copy(item.substr(0, dash)));
+            const std::string last(boost::algorithm::trim_copy(item.substr(dash + 1)));
+
+            SByteRange r;
+            if (first.empty())
+            {
+                std::uint64_t suffix = 0;
+                if (!ParsePosition(last, suffix))
+                    return RANGE_ABSENT;
+                if (0 == suffix || 0 == size)
+                    continue;
+
+                r.First = size > suffix ? size - suffix : 0;
+                r.Last = size - 1;
+            }
+            else
+            {
+                if (!ParsePosition(first, r.First))
+                    return RANGE_ABSENT;
+
+                if (last.empty())
+                    r.Last = size - 1;
+                else if (!ParsePosition(last, r.Last) || r.Last < r.First)
+                    return RANGE_ABSENT;
+
+                if (r.First >= size)
+                    continue;
+                r.Last = std::min(r.Last, size - 1);
+            }
+
+            ranges.push_back(r);
+        }
+
+        if (!anyItem || ranges.size() > MAX_RANGES)
+        {
+            ranges.clear();
+            return RANGE_ABSENT;
+        }
+
+        if (ranges.empty())
+            return RANGE_NOT_SATISFIABLE;
+
+        std::sort(ranges.begin(), ranges.end(),
+            [](const SByteRange& a, const SByteRange& b) { return a.First < b.First; });
+
+        std::vector<SByteRange> merged;
+        merged.reserve(ranges.size());
+        for (const SByteRange& r : ranges)
+        {
+            if (!merged.empty() && r.First <= merged.back().Last + 1)
+                merged.back().Last = std::max(merged.back().Last, r.Last);
+            else
+                merged.push_back(r);
+        }
+        ranges.swap(merged);
+
+        return RANGE_SATISFIABLE;
+    }
+
+    std::string MakeContentRange(const SByteRange& range, std::uint64_t size)
+    {
+        return "bytes " + std::to_string(range.First) + "-" + std::to_string(range.Last) + "/" + std::to_string(size);
+    }
+
+    CRangeReader::CRangeReader(const boost::filesystem::path& filePath, std::uint64_t size,
+        const std::vector<SByteRange>& ranges, const std::string& contentType)
+        : m_filePath(filePath)
+        , m_contentLength(0)
+        , m_multipart(ranges.size() > 1)
+        , m_part(0)
+        , m_partDone(0)
+        , m_headerDone(false)
+    {
+        if (ranges.empty())
+        {
+            if (size > 0)
+                m_parts.push_back({ std::string(), 0, size });
+        }
+        else if (!m_multipart)
+        {
+            m_parts.push_back({ std::string(), ranges.front().First, ranges.front().Length() });
+        }
+        else
+        {
+            for (const SByteRange& r : ranges)
+            {
+                std::string h;
+                h.append(CRLF).append("--").append(BYTERANGES_BOUNDARY).append(CRLF)
+                    .append("Content-Type: ").append(contentType).append(CRLF)
+                    .append("Content-Range: ").append(MakeContentRange(r, size)).append(CRLF)
+                    .append(CRLF);
+                m_parts.push_back({ h, r.First, r.Length() });
+            }
+            m_parts.push_back({ std::string(CRLF).append("--").append(BYTERANGES_BOUNDARY).append("--").append(CRLF), 0, 0 });
+        }
+
+        for (const SPart& p : m_parts)
+            m_contentLength += p.Header.size() + p.Length;
+    }
+
+    bool CRangeReader::Open()
+    {
+        m_fs.open(m_filePath.c_str(), std::ios::binary | std::ios::in);
+        return m_fs.good();
+    }
+
+    bool CRangeReader::ReadChunk(std::vector<char>& buffer, std::size_t maxSize)
+    {
+        buffer.clear();
+        while (buffer.size() < maxSize && !Finished())
+        {
+            const SPart& p = m_parts[m_part];
+            if (!m_headerDone)
+            {
+                buffer.insert(buffer.end(), p.Header.begin(), p.Header.end());
+                m_headerDone = true;
+                if (p.Length > 0 && !m_fs.seekg(static_cast<std::streamoff>(p.Offset)))
+                    return false;
+            }
+
+            const std::size_t count = static_cast<std::size_t>(
+                std::min<std::uint64_t>(maxSize > buffer.size() ? maxSize - buffer.size() : 0, p.Length - m_partDone));
+            if (count > 0)
+            {
+                const std::size_t offset = buffer.size();
+                buffer.resize(offset + count);
+                m_fs.read(&buffer[offset], static_cast<std::streamsize>(count));
+                if (static_cast<std::size_t>(m_fs.gcount()) != count)
+                    return false;
+                m_partDone += count;
+            }
+
+            if (m_partDone == p.Length)
+            {
+                ++m_part;
+                m_partDone = 0;
+                m_headerDone = false;
+            }
+        }
+        return true;
+    }
+}
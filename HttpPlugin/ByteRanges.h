@@ -0,0 +1,76 @@
+#ifndef BYTE_RANGES_H__
+#define BYTE_RANGES_H__
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include <boost/filesystem/path.hpp>
+
+namespace NContext
+{
+    extern const char* const BYTERANGES_BOUNDARY;
+
+    // Inclusive byte range of a representation, as in "bytes=First-Last".
+    struct SByteRange
+    {
+        std::uint64_t First;
+        std::uint64_t Last;
+
+        std::uint64_t Length() const { return Last - First + 1; }
+    };
+
+    enum ERangeStatus
+    {
+        RANGE_ABSENT,               // No or malformed Range header: send the whole file.
+        RANGE_SATISFIABLE,
+        RANGE_NOT_SATISFIABLE
+    };
+
+    // Parses a Range header value against a representation of the given size.
+    // Overlapping and adjacent ranges are coalesced, so the result is sorted.
+    ERangeStatus ParseByteRanges(const std::string& header, std::uint64_t size, std::vector<SByteRange>& ranges);
+
+    std::string MakeContentRange(const SByteRange& range, std::uint64_t size);
+
+    // Produces the body of a full, single-range or multipart/byteranges
+    // response in bounded chunks, so the caller decides where disk reads run.
+    class CRangeReader
+    {
+        struct SPart
+        {
+            std::string     Header;
+            std::uint64_t   Offset;
+            std::uint64_t   Length;
+        };
+
+    public:
+        // Empty ranges mean the whole file.
+        CRangeReader(const boost::filesystem::path& filePath, std::uint64_t size,
+            const std::vector<SByteRange>& ranges, const std::string& contentType);
+
+        bool Open();
+
+        std::uint64_t ContentLength() const { return m_contentLength; }
+        bool Multipart() const { return m_multipart; }
+        bool Finished() const { return m_part == m_parts.size(); }
+
+        // Replaces the buffer content with up to maxSize next bytes of the body.
+        // Returns false if the file got shorter than expected.
+        bool ReadChunk(std::vector<char>& buffer, std::size_t maxSize);
+
+    private:
+        const boost::filesystem::path   m_filePath;
+        std::ifstream                   m_fs;
+        std::vector<SPart>              m_parts;
+        std::uint64_t                   m_contentLength;
+        bool                            m_multipart;
+
+        std::size_t                     m_part;
+        std::uint64_t                   m_partDone;
+        bool                            m_headerDone;
+    };
+}
+
+#endif // BYTE_RANGES_H__
@@ -483,7 +483,7 @@ namespace
             if (-1 == maxAge)
                 _wrn_ << "Camera list GRPC error";
 
-            NPluginUtility::SendText(req, resp, responseObject.toStyledString(), NHttp::IResponse::OK, maxAge);
+            NPluginUtility::SendText(req, resp, NPluginUtility::ToCompactString(responseObject), NHttp::IResponse::OK, maxAge);
         }
 
         const NWebGrpc::PGrpcManager m_grpcManager;
@@ -13,6 +13,8 @@
 #include <boost/format.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
+#include <stdexcept>
+
 #include <json/json.h>
 
 using namespace NHttp;
@@ -171,6 +173,92 @@ namespace NPluginUtility
         ctx->ScheduleWrite();
     }
 
+    // Deflates a body portion by portion into a single gzip member.
+    class CGzipStream
+    {
+    public:
+        CGzipStream()
+        {
+            m_strm.zalloc = Z_NULL;
+            m_strm.zfree = Z_NULL;
+            m_strm.opaque = Z_NULL;
+            m_ok = deflateInit2(&m_strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+
+        ~CGzipStream()
+        {
+            if (m_ok)
+                deflateEnd(&m_strm);
+        }
+
+        bool Ok() const
+        {
+            return m_ok;
+        }
+
+        bool Deflate(const std::string& data, bool finish, std::string& compressedData)
+        {
+            unsigned char out[CHUNK];
+            m_strm.next_in = (unsigned char*)data.data();
+            m_strm.avail_in = data.size();
+            do {
+                m_strm.avail_out = CHUNK;
+                m_strm.next_out = out;
+                if (deflate(&m_strm, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+                    return false;
+                compressedData.append((char*)out, CHUNK - m_strm.avail_out);
+            } while (m_strm.avail_out == 0);
+            return true;
+        }
+
+    private:
+        z_stream m_strm;
+        bool m_ok;
+    };
+
+    void SendJsonStream(const PRequest req, PResponse response, FJsonProducer producer, NHttp::IResponse::EStatus statusCode)
+    {
+        response->SetStatus(statusCode);
+        std::string contentType(NHttp::GetMIMETypeByExt("json"));
+        contentType.append("; charset=utf-8");
+        response << ContentType(contentType)
+                 << CacheControlNoCache()
+                 << NHttp::SHttpHeader("Transfer-Encoding", "chunked");
+
+        std::shared_ptr<CGzipStream> gzip;
+        if (supportCompression(req))
+        {
+            gzip = std::make_shared<CGzipStream>();
+            if (gzip->Ok())
+                response << NHttp::SHttpHeader("Content-Encoding", "gzip");
+            else
+                gzip.reset();
+        }
+
+        response->FlushHeaders();
+
+        auto writer = std::make_shared<CJsonStreamWriter>();
+        auto plain = std::make_shared<std::string>();
+        NContext::FChunkProducer chunks = [writer, producer, gzip, plain](std::string& out) -> bool
+        {
+            const bool more = producer(*writer);
+            if (!gzip)
+            {
+                writer->TakeOutput(out);
+                return more;
+            }
+
+            plain->clear();
+            writer->TakeOutput(*plain);
+            if (!gzip->Deflate(*plain, !more, out))
+                throw std::runtime_error("JSON stream compression failed");
+            return more;
+        };
+
+        NContext::PSendContext ctx(NContext::CreateChunkedContext(response, chunks));
+        ctx->ScheduleWrite();
+    }
+
     void ParseHostname(const std::string& epName, std::string& hostName)
     {
         size_t pos1 = epName.find_first_of('/');
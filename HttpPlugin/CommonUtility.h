@@ -3,6 +3,7 @@
 
 #include "GrpcReader.h"
 #include "GrpcHelpers.h"
+#include "JsonStream.h"
 
 #include <HttpServer/HttpServer.h>
 
@@ -44,6 +45,8 @@ namespace NPluginUtility
     void SendText(NHttp::PResponse&, const std::string&, bool resetResponse = false, bool headersOnly = false);
     void SendText(NHttp::PResponse&, NHttp::IResponse::EStatus statusCode, const std::string&, bool resetResponse = false, bool headersOnly = false);
     void SendText(const NHttp::PRequest, NHttp::PResponse, const std::string&, NHttp::IResponse::EStatus statusCode = NHttp::IResponse::OK, int maxAge = -1);
+    // Sends JSON as it is produced, in chunks, gzipped if the client accepts it.
+    void SendJsonStream(const NHttp::PRequest, NHttp::PResponse, FJsonProducer, NHttp::IResponse::EStatus statusCode = NHttp::IResponse::OK);
 
     void ParseHostname(const std::string& epName, std::string& hostName);
     std::string GetAudioEpFromVideoEp(const std::string &videoEp);
@@ -36,7 +36,7 @@ const char* const PARAM_TOKEN_VALID_HOURS = "valid_token_hours";
 const char* const PARAM_KEEP_ALIVE = "keep_alive";
 const char* const PARAM_HLS_TIME = "hls_time";
 const char* const PARAM_HLS_LIST_SIZE = "hls_list_size";
-const char* const PARAM_HLS_WRAP = "hls_wrap";
+const char* const PARAM_HLS_LOW_LATENCY = "hls_low_latency";
 
 const char* const RESULT_MASK = "result";
 
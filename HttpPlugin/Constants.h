@@ -38,7 +38,7 @@ extern const char* const PARAM_TOKEN_VALID_HOURS;
 extern const char* const PARAM_KEEP_ALIVE;
 extern const char* const PARAM_HLS_TIME;
 extern const char* const PARAM_HLS_LIST_SIZE;
-extern const char* const PARAM_HLS_WRAP;
+extern const char* const PARAM_HLS_LOW_LATENCY;
 
 extern const char* const RESULT_MASK;
 
@@ -106,11 +106,11 @@ namespace NHttp
 {
     PDataBuffer CreateDataBufferFromSample(NMMSS::ISample* s, bool urgent)
     {
-        return PDataBuffer(new SampleDataBuffer(s, urgent));
+        return CreatePooledDataBuffer<SampleDataBuffer>(s, urgent);
     }
 
     PDataBuffer CreateEoSBuffer(std::uint64_t ts)
     {
-        return PDataBuffer(new EoSDataBuffer(ts));
+        return CreatePooledDataBuffer<EoSDataBuffer>(ts);
     }
 }
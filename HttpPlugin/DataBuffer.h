@@ -5,6 +5,8 @@
 #include <cstdint>
 #include <functional>
 
+#include "SlabPool.h"
+
 namespace NMMSS
 {
     class ISample;
@@ -31,6 +33,14 @@ namespace NHttp
 
     PDataBuffer CreateDataBufferFromSample(NMMSS::ISample*, bool urgent = false);
     PDataBuffer CreateEoSBuffer(std::uint64_t);
+
+    // Buffers are created on every sample sent, so they are allocated together
+    // with their control block from the slab pool.
+    template <typename TBuffer, typename... TArgs>
+    PDataBuffer CreatePooledDataBuffer(TArgs&&... args)
+    {
+        return AllocatePooled<TBuffer>(std::forward<TArgs>(args)...);
+    }
 }
 
 #endif // !DATA_BUFFER_H__
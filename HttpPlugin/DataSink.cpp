@@ -5,7 +5,6 @@
 #include <ace/OS.h>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
-#include <boost/circular_buffer.hpp>
 #include <boost/asio.hpp>
 #include <boost/format.hpp>
 
@@ -412,10 +411,16 @@ private:
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-class CFlowControlSink : public NMMSS::CPullStyleSinkBase
+class CFlowControlSink : public virtual IMultipartSink
+    , public NMMSS::CPullStyleSinkBase
 {
 private:
-    static const size_t BUFFER_SIZE = 2;
+    // Whatever is queued while a write is in flight goes out in the next one, within these
+    // bounds; a client slower than the stream loses the oldest parts beyond them.
+    static const size_t MAX_WRITE_PARTS = 16;
+    static const size_t MAX_WRITE_BYTES = 4 * 1024 * 1024;
+
+    typedef std::vector<NMMSS::PSample> TSamples;
 
 private:
     struct SSharedCtx
@@ -423,18 +428,18 @@ private:
         NHttp::PResponse                       Response;
         NPluginHelpers::TOnDisconnected        OnDisconnected;
         NPluginHelpers::TOnSampleHandler       OnSample;
-        NCorbaHelpers::PReactor                Reactor;
-        boost::circular_buffer<NMMSS::PSample> Buffer;
+        std::deque<NMMSS::PSample>             Queue;
+        size_t                                 QueuedBytes;
         bool                                   Writing;
         boost::mutex                           Mutex;
+        NContext::PMultipartFrameCache         FrameCache;
 
         SSharedCtx(NHttp::PResponse r, const NPluginHelpers::TOnDisconnected &h,
             const NPluginHelpers::TOnSampleHandler &s)
             :   Response(r)
             ,   OnDisconnected(h)
             ,   OnSample(s)
-            ,   Reactor(NCorbaHelpers::GetReactorInstanceShared())
-            ,   Buffer(BUFFER_SIZE)
+            ,   QueuedBytes(0)
             ,   Writing(false)
         {}
     };
@@ -450,25 +455,38 @@ public:
     {
     }
 
+    void SetFrameCache(NContext::PMultipartFrameCache fc) override
+    {
+        boost::mutex::scoped_lock lock(m_ctx->Mutex);
+        m_ctx->FrameCache = fc;
+    }
+
 private:
     virtual void Receive(NMMSS::ISample *sample)
     {
         if(m_ctx->OnSample)
             m_ctx->OnSample(sample);
 
-        NMMSS::PSample s(sample, NCorbaHelpers::ShareOwnership());
+        bool send = false;
         {
             boost::mutex::scoped_lock lock(m_ctx->Mutex);
-            if(!m_ctx->Writing)
+            m_ctx->Queue.push_back(NMMSS::PSample(sample, NCorbaHelpers::ShareOwnership()));
+            m_ctx->QueuedBytes += sample->Header().nBodySize;
+            while (m_ctx->Queue.size() > 1
+                && (m_ctx->Queue.size() > MAX_WRITE_PARTS || m_ctx->QueuedBytes > MAX_WRITE_BYTES))
             {
-                m_ctx->Writing = true;
-                Send(m_ctx, s);
+                m_ctx->QueuedBytes -= m_ctx->Queue.front()->Header().nBodySize;
+                m_ctx->Queue.pop_front();
             }
-            else
+
+            if(!m_ctx->Writing)
             {
-                m_ctx->Buffer.push_back(s);
+                m_ctx->Writing = true;
+                send = true;
             }
         }
+        if (send)
+            Send(m_ctx);
         RequestNextSamples(1);
     }
 
@@ -482,10 +500,31 @@ private:
     }
 
 private:
-    static void Send(PSharedCtx shared, NMMSS::PSample sample)
+    // Writes everything queued at once; the completion of the write sends what was queued meanwhile.
+    static void Send(PSharedCtx shared)
     {
+        NContext::PMultipartFrameCache fc;
+        TSamples samples;
+        {
+            boost::mutex::scoped_lock lock(shared->Mutex);
+            if (shared->Queue.empty())
+            {
+                shared->Writing = false;
+                return;
+            }
+            fc = shared->FrameCache;
+            samples.assign(shared->Queue.begin(), shared->Queue.end());
+            shared->Queue.clear();
+            shared->QueuedBytes = 0;
+        }
+
+        std::vector<NMMSS::ISample*> parts;
+        parts.reserve(samples.size());
+        for (const NMMSS::PSample& s : samples)
+            parts.push_back(s.Get());
+
         NContext::PSendContext ctx(NContext::CreateMultipartContext(
-            shared->Response, sample.Get(), boost::bind(&CFlowControlSink::Done, shared, _1)));
+            shared->Response, parts, fc, boost::bind(&CFlowControlSink::Done, shared, _1)));
         ctx->ScheduleWrite();
     }
 
@@ -496,19 +535,7 @@ private:
             shared->OnDisconnected();
             return;
         }
-
-        NMMSS::PSample s;
-        {
-            boost::mutex::scoped_lock lock(shared->Mutex);
-            if(shared->Buffer.empty() || error)
-            {
-                shared->Writing = false;
-                return;
-            }
-            s = shared->Buffer.front();
-            shared->Buffer.pop_front();
-        }
-        shared->Reactor->GetIO().post(boost::bind(&CFlowControlSink::Send, shared, s));
+        Send(shared);
     }
 private:
     PSharedCtx m_ctx;
@@ -8,6 +8,7 @@
 #include <HttpServer/HttpResponse.h>
 #include "MMSS.h"
 #include "Sample.h"
+#include "SendContext.h"
 
 namespace NPluginHelpers
 {
@@ -31,6 +32,11 @@ namespace NPluginHelpers
         const boost::posix_time::ptime &end,
         size_t samplesCount);
 
+    struct IMultipartSink : public virtual NMMSS::IPullStyleSink
+    {
+        virtual void SetFrameCache(NContext::PMultipartFrameCache) = 0;
+    };
+
     NMMSS::IPullStyleSink* CreateFlowControlSink(NHttp::PResponse, const TOnDisconnected&, const TOnSampleHandler&);
 
     void SetSinkCounterHandler(boost::function1<void, int> handler);
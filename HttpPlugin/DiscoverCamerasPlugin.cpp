@@ -138,15 +138,18 @@ namespace
         {
             static const char CRLF[] = { '\r', '\n' };
 
+            // The serialised text must outlive the write.
+            auto data = std::make_shared<std::string>(NPluginUtility::ToCompactString(*ctx));
+
             std::vector<boost::asio::const_buffer> buffers;
-            buffers.push_back(boost::asio::buffer(ctx->toStyledString()));
+            buffers.push_back(boost::asio::buffer(*data));
             buffers.push_back(boost::asio::buffer(CRLF));
             buffers.push_back(boost::asio::buffer(CRLF));
 
             std::unique_lock<std::mutex> lock(m_mutex);
             try
             {
-                resp->AsyncWrite(buffers, [ctx](boost::system::error_code){});
+                resp->AsyncWrite(buffers, [data](boost::system::error_code){});
             }
             catch (...)
             {
@@ -709,8 +709,9 @@ namespace
 
             webExportSession->SetLastAccessTime();
 
+            boost::optional<const std::string&> range = req->GetHeader("Range");
             NContext::PSendContext ctx(NContext::CreateFileContext(GET_LOGGER_PTR, resp, presentationName.c_str(), decodedName,
-                [&](const boost::system::error_code&) {}));
+                range ? *range : std::string(), m_pool, [](const boost::system::error_code&) {}));
             ctx->ScheduleWrite();
             return true;
         }
@@ -65,7 +65,7 @@ namespace NPluginHelpers
     typedef NCorbaHelpers::CWeakPtr<IMuxerSource> WMuxerSource;
 
     IMuxerSource* CreateMP4Muxer(DECLARE_LOGGER_ARG, int speed, EStreamContainer,
-                                 bool hasSubtitles, const std::string& filePath);
+                                 bool hasSubtitles);
 
     class IGstManager
     {
@@ -87,6 +87,14 @@ namespace
         {
             return gst_sample_get_buffer(m_sample);
         }
+        bool isDeltaUnit()
+        {
+            return GST_BUFFER_FLAG_IS_SET(gst_sample_get_buffer(m_sample), GST_BUFFER_FLAG_DELTA_UNIT);
+        }
+        GstClockTime getPts()
+        {
+            return GST_BUFFER_PTS(gst_sample_get_buffer(m_sample));
+        }
         bool isAtomSample() const
         {
             GstMetaMarking * meta = GST_META_MARKING_GET(gst_sample_get_buffer(m_sample));
@@ -154,6 +162,36 @@ namespace
         std::uint64_t m_timestamp;
     };
 
+    // Transport stream produced by mpegtsmux carries no marking meta,
+    // key units are recognized by buffer flags instead.
+    class GstTsDataBuffer : public GstDataBuffer
+    {
+    public:
+        GstTsDataBuffer(WrappedGstSample s, std::uint64_t ts)
+            : GstDataBuffer(s, ts)
+            , m_keyData(!s->isDeltaUnit())
+        {
+        }
+
+        bool IsKeyData() const override
+        {
+            return m_keyData;
+        }
+
+        bool IsEoS() const override
+        {
+            return false;
+        }
+
+        bool IsUrgent() const override
+        {
+            return false;
+        }
+
+    private:
+        const bool m_keyData;
+    };
+
     class CMP4Muxer : public NPluginHelpers::IMuxerSource
         , public virtual NCorbaHelpers::CWeakReferableImpl
     {
@@ -161,7 +199,7 @@ namespace
         DECLARE_LOGGER_HOLDER;
 
     public:
-        CMP4Muxer(DECLARE_LOGGER_ARG, int speed, NPluginHelpers::EStreamContainer sc, bool hasSubtitles, const std::string& filePath)
+        CMP4Muxer(DECLARE_LOGGER_ARG, int speed, NPluginHelpers::EStreamContainer sc, bool hasSubtitles)
             : m_reactor(NCorbaHelpers::GetReactorInstanceShared())
             , m_finished(false)
             , m_initDataFlow(false)
@@ -173,7 +211,6 @@ namespace
             , m_audioConnection(nullptr)
 #endif
             , m_streamContainer(sc)
-            , m_filePath(filePath)
             , m_hasSubtitles(hasSubtitles)
             , m_textPts(0)
         {
@@ -327,7 +364,7 @@ namespace
             if (GST_STATE_CHANGE_FAILURE == gst_element_set_state(m_pipeline.get(), GST_STATE_PLAYING))
                 throw std::runtime_error("MP4 pipeline error: failed to set pipeline into PLAYING state");
 
-            m_lastSeenTime = vs->Header().dtTimeBegin;
+            m_lastSeenTime = m_startTime = vs->Header().dtTimeBegin;
 
             g_object_set(m_videoSource, "do-timestamp", TRUE, NULL);
 #ifdef ENV64
@@ -502,22 +539,24 @@ namespace
             makeGstElement("queue", "queue", m_queue);
             makeGstElement("h264parse", "streamParser", m_streamParser);
             makeGstElement("mpegtsmux", "mp4Muxer", m_mp4Muxer);
-            makeGstElement("hlssink", "mixerSink", m_appSink);
+            makeGstElement("appsink", "mixerSink", m_appSink);
 
 #undef MAKE_GST_ELEMENT
 
-            std::string pl_location = m_filePath + "/playlist.m3u8";
-            std::string location = m_filePath + "/segment%05d.ts";
-
+            // Segmentation is done by consumer on key units, so the stream goes out as is.
+            // A dropped transport stream buffer would break the segment it belongs to without
+            // any trace, so a slow consumer holds the pipeline back instead.
             gst_util_set_object_arg(G_OBJECT(m_videoSource), "format", "time");
-            g_object_set(m_appSink, "playlist-location", pl_location.c_str(), NULL);
-            g_object_set(m_appSink, "location", location.c_str(), NULL);
-            g_object_set(m_appSink, "target-duration", 3, NULL);
+            g_object_set(m_streamParser, "config-interval", -1, NULL);
+            g_object_set(m_appSink, "emit-signals", TRUE, NULL);
+            g_object_set(m_appSink, "max-buffers", 1000, "drop", FALSE, NULL);
 
             g_signal_connect(m_videoSource, "need-data", G_CALLBACK(needVideoData), this);
 
             configurePipeline();
 
+            g_signal_connect(m_appSink, "new-sample", G_CALLBACK(newSample), this);
+
             gst_element_link_many(m_videoSource, m_queue, m_streamParser, m_mp4Muxer, m_appSink, NULL);
         }
 
@@ -729,16 +768,34 @@ namespace
 
         void sendSample(WrappedGstSample sample)
         {
+            if (NPluginHelpers::EHLS_CONTAINER == m_streamContainer)
+            {
+                sendTsSample(sample);
+                return;
+            }
+
             std::uint64_t sTs = sample->getTimestamp();
             if (sTs != ATOM_TIMESTAMP)
                 m_lastSeenTime = sTs;
 
-            NHttp::PDataBuffer data = std::make_shared<GstDataBuffer>(sample, m_lastSeenTime);
+            NHttp::PDataBuffer data = NHttp::CreatePooledDataBuffer<GstDataBuffer>(sample, m_lastSeenTime);
             if (m_dp)
                 m_dp(data);
             return;
         }
 
+        void sendTsSample(WrappedGstSample sample)
+        {
+            // Pipeline running time is counted from the first pushed sample
+            const GstClockTime pts = sample->getPts();
+            if (GST_CLOCK_TIME_IS_VALID(pts))
+                m_lastSeenTime = NMMSS::PtimeToQword(NMMSS::PtimeFromQword(m_startTime) + boost::posix_time::microseconds(pts / GST_USECOND));
+
+            NHttp::PDataBuffer data = NHttp::CreatePooledDataBuffer<GstTsDataBuffer>(sample, m_lastSeenTime);
+            if (m_dp)
+                m_dp(data);
+        }
+
         void internalSendSample()
         {
             std::unique_lock<std::mutex> lock(m_cvMutex);
@@ -1021,6 +1078,7 @@ namespace
         std::uint16_t m_audioSampleRate;
         int m_speed;
         std::uint64_t m_lastSeenTime;
+        std::uint64_t m_startTime;
 
 #ifdef ENV64
         std::uint64_t m_audioSampleCount;
@@ -1029,7 +1087,6 @@ namespace
 #endif // ENV64
 
         NPluginHelpers::EStreamContainer m_streamContainer;
-        std::string m_filePath;
 
         std::once_flag m_needVideoFlag;
         std::once_flag m_needAudioFlag;
@@ -1045,8 +1102,8 @@ namespace
 
 namespace NPluginHelpers
 {
-    IMuxerSource* CreateMP4Muxer(DECLARE_LOGGER_ARG, int speed, EStreamContainer sc, bool hasSubtitles, const std::string& filePath)
+    IMuxerSource* CreateMP4Muxer(DECLARE_LOGGER_ARG, int speed, EStreamContainer sc, bool hasSubtitles)
     {
-        return new CMP4Muxer(GET_LOGGER_PTR, speed, sc, hasSubtitles, filePath);
+        return new CMP4Muxer(GET_LOGGER_PTR, speed, sc, hasSubtitles);
     }
 }
@@ -174,6 +174,24 @@ namespace
             return "";
     }
 
+    void releaseWrappedSample(gpointer data)
+    {
+        static_cast<NMMSS::ISample*>(data)->Release();
+    }
+
+    // Wraps the sample body into a read-only GstBuffer without copying.
+    // The buffer holds a reference to the sample until the last RTSP client drops it.
+    GstBuffer* wrapSample(NMMSS::ISample* sample)
+    {
+        const gsize size = sample->Header().nBodySize;
+        if (0 == size)
+            return gst_buffer_new();
+
+        sample->AddRef();
+        return gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, sample->GetBody(), size, 0, size,
+            sample, &releaseWrappedSample);
+    }
+
     void processCameras(std::vector<std::string> &ctxOut, const ::google::protobuf::RepeatedPtrField< ::axxonsoft::bl::domain::Camera >& cams)
     {
         int itemCount = cams.size();
@@ -418,14 +436,7 @@ namespace
 
         void sendVideoSampleAsIs(NMMSS::ISample* sample)
         {
-            GstBuffer* buf = gst_buffer_new_and_alloc(sample->Header().nBodySize);
-
-            GstMapInfo map;
-            gst_buffer_map(buf, &map, GST_MAP_WRITE);
-
-            memcpy(map.data, sample->GetBody(), sample->Header().nBodySize);
-
-            gst_buffer_unmap(buf, &map);
+            GstBuffer* buf = wrapSample(sample);
 
             GstFlowReturn ret;
             {
@@ -439,7 +450,7 @@ namespace
 
         void sendVideoSample(NMMSS::ISample* sample)
         {
-            GstBuffer* buf = gst_buffer_new_and_alloc(sample->Header().nBodySize);
+            GstBuffer* buf = wrapSample(sample);
 
             boost::posix_time::ptime currentTime = NMMSS::PtimeFromQword(sample->Header().dtTimeBegin);
 
@@ -478,13 +489,6 @@ namespace
             GST_BUFFER_DTS(buf) = GST_BUFFER_PTS(buf);
             GST_META_MARKING_ADD(buf, &(sample->Header()));
 
-            GstMapInfo map;
-            gst_buffer_map(buf, &map, GST_MAP_WRITE);
-
-            memcpy(map.data, sample->GetBody(), sample->Header().nBodySize);
-
-            gst_buffer_unmap(buf, &map);
-
             GstFlowReturn ret;
             g_signal_emit_by_name(m_videoSource, "push-buffer", buf, &ret);
             gst_buffer_unref(buf);
@@ -492,14 +496,7 @@ namespace
 
         void sendAudioSampleAsIs(NMMSS::ISample* sample)
         {
-            GstBuffer* buf = gst_buffer_new_and_alloc(sample->Header().nBodySize);
-
-            GstMapInfo map;
-            gst_buffer_map(buf, &map, GST_MAP_WRITE);
-
-            memcpy(map.data, sample->GetBody(), sample->Header().nBodySize);
-
-            gst_buffer_unmap(buf, &map);
+            GstBuffer* buf = wrapSample(sample);
 
             GstFlowReturn ret;
             {
@@ -513,7 +510,7 @@ namespace
 
         void sendAudioSample(NMMSS::ISample* sample)
         {
-            GstBuffer* buf = gst_buffer_new_and_alloc(sample->Header().nBodySize);
+            GstBuffer* buf = wrapSample(sample);
 
             const auto* subheader = NMMSS::NMediaType::GetSampleOfSubtype<NMMSS::NMediaType::Audio::PCM::SubtypeHeader>(sample);
 
@@ -525,13 +522,6 @@ namespace
 
             m_audioSampleCount += duration;
 
-            GstMapInfo map;
-            gst_buffer_map(buf, &map, GST_MAP_WRITE);
-
-            memcpy(map.data, sample->GetBody(), sample->Header().nBodySize);
-
-            gst_buffer_unmap(buf, &map);
-
             GstFlowReturn ret;
             {
                 std::unique_lock<std::mutex> lock(m_dataMutex);
@@ -1,172 +1,677 @@
 #include "Hls.h"
 
+#include <set>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+
 #include <boost/uuid/uuid.hpp>
-#include <boost/filesystem.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
 #include <json/json.h>
 
 #include <CorbaHelpers/Uuid.h>
+#include <CorbaHelpers/Reactor.h>
 
+#include "../PtimeFromQword.h"
 #include "Constants.h"
 #include "CommonUtility.h"
+#include "SendContext.h"
 
 using namespace NHttp;
 
 namespace
 {
-    const char* const PLAYLIST_NAME = "playlist.m3u8";
-    const char* const PLAYLIST_PATH_PREFIX = "/hls/";
+    const char* const HLS_PLAYLIST_COMMAND = "/hls/playlist.m3u8";
+    const char* const HLS_SEGMENT_COMMAND = "/hls/segment.ts";
+    const char* const HLS_PART_COMMAND = "/hls/part.ts";
+    const char* const HLS_KEEP_COMMAND = "/hls/keep";
+    const char* const HLS_STOP_COMMAND = "/hls/stop";
+
+    const char* const SEQUENCE_PARAM = "seq";
+    const char* const PART_PARAM = "part";
+    // LL-HLS blocking playlist reload
+    const char* const BLOCKING_SEQUENCE_PARAM = "_HLS_msn";
+    const char* const BLOCKING_PART_PARAM = "_HLS_part";
+
+    const char* const PLAYLIST_CONTENT_TYPE = "application/vnd.apple.mpegurl";
+    const char* const SEGMENT_CONTENT_TYPE = "video/mp2t";
 
     const int DEFAULT_KEEP_ALIVE = 10 * 60; // 10 minutes
     const int DEFAULT_HLS_TIME = 5;
     const int DEFAULT_HLS_LIST_SIZE = 4;
-    const int DEFAULT_HLS_WRAP = 10;
 
     const int MAX_HLS_LIST_SIZE = 20;
 
+    // Segments which already left the playlist but may be still downloaded by slow clients.
+    const std::size_t SPARE_SEGMENTS = 2;
+    // Partial segments are listed for the last complete segments only.
+    const std::size_t PARTS_SEGMENTS = 2;
+    const int PART_TARGET_MS = 500;
+
+    const int SWEEP_PERIOD_MS = 1000;
+
     const char* const SPEED_PARAM = "speed";
     const int DEFAULT_SPEED_VALUE = 1;
 
-    typedef boost::filesystem::path path_t;
-    path_t getRelativePath(const std::string& connectionId)
-    {
-        return  boost::filesystem::path(connectionId) / PLAYLIST_NAME;
-    }
-
     struct SHlsRequestParams
     {
         const std::string ep;
         int keep_alive;
         int hls_time;
         int hls_list_size;
-        int hls_wrap;
+        bool low_latency;
 
+        // Clients of the same endpoint with the same segmentation share one segmenter.
         bool operator <(const SHlsRequestParams& rhs) const
         {
-            if (ep < rhs.ep)
-                return true;
-
-            else if (ep == rhs.ep)
-            {
-                if (hls_time < rhs.hls_time)
-                    return true;
-                else if (hls_time == rhs.hls_time)
-                {
-                    if (hls_list_size < rhs.hls_list_size)
-                        return true;
-                    else if (hls_list_size == rhs.hls_list_size)
-                        return hls_wrap < rhs.hls_wrap;
-                }
-            }
-            return false;
+            return std::tie(ep, hls_time, hls_list_size, low_latency)
+                < std::tie(rhs.ep, rhs.hls_time, rhs.hls_list_size, rhs.low_latency);
         }
         SHlsRequestParams(const std::string& e)
             : ep(e)
             , keep_alive(DEFAULT_KEEP_ALIVE)
             , hls_time(DEFAULT_HLS_TIME)
             , hls_list_size(DEFAULT_HLS_LIST_SIZE)
-            , hls_wrap(DEFAULT_HLS_WRAP)
+            , low_latency(false)
         {}
     };
-    
-    const char* const HLS_KEEP_COMMAND = "/hls/keep";
-    const char* const HLS_STOP_COMMAND = "/hls/stop";
 
-    using StopFunction_t = boost::function<IResponse::EStatus()>;
+    std::int64_t elapsedMs(std::uint64_t from, std::uint64_t to)
+    {
+        if (to <= from)
+            return 0;
+        return (NMMSS::PtimeFromQword(to) - NMMSS::PtimeFromQword(from)).total_milliseconds();
+    }
+
+    void sendPlaylist(NHttp::PResponse resp, const std::string& playlist)
+    {
+        resp->SetStatus(IResponse::OK);
+        resp << ContentLength(playlist.size())
+             << ContentType(PLAYLIST_CONTENT_TYPE)
+             << CacheControlNoCache();
+        resp->FlushHeaders();
+
+        NContext::PSendContext ctx(NContext::CreateStringContext(resp, playlist));
+        ctx->ScheduleWrite();
+    }
+
+    typedef std::shared_ptr<const std::string> PChunk;
+
+    struct SHlsPart
+    {
+        PChunk data;
+        double duration;
+        bool independent;
+    };
+
+    struct SHlsSegment
+    {
+        std::uint64_t sequence;
+        double duration;
+        std::vector<SHlsPart> parts;
+    };
 
-    struct SHlsContext : public std::enable_shared_from_this<SHlsContext>
+    // Keeps a rolling window of transport stream segments of one stream in memory
+    // and serves playlist and media to all HLS clients of that stream.
+    class CHlsSegmenter : public std::enable_shared_from_this<CHlsSegmenter>
     {
         DECLARE_LOGGER_HOLDER;
 
-        SHlsContext(DECLARE_LOGGER_ARG)
-            : keepAlive(false)
-            , keepAliveTimer(NCorbaHelpers::GetReactorInstanceShared()->GetIO())
+        struct SPlaylistWaiter
+        {
+            std::string streamId;
+            NHttp::PResponse response;
+            std::uint64_t sequence;
+            int part;
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        struct SReply
+        {
+            NHttp::PResponse response;
+            std::string playlist;
+        };
+        typedef std::vector<SReply> TReplies;
+
+    public:
+        CHlsSegmenter(DECLARE_LOGGER_ARG, int targetDuration, int listSize, bool lowLatency)
+            : m_targetDuration(targetDuration)
+            , m_listSize(static_cast<std::size_t>(listSize))
+            , m_lowLatency(lowLatency)
+            , m_clients(0)
+            , m_finished(false)
+            , m_lastKeyData(false)
+            , m_segmentOpened(false)
+            , m_nextSequence(0)
+            , m_segmentStart(0)
+            , m_partStart(0)
+            , m_partIndependent(false)
+            , m_lastTimestamp(0)
         {
             INIT_LOGGER_HOLDER;
         }
 
-        ~SHlsContext()
+        ~CHlsSegmenter()
         {
             Stop();
         }
 
-        void Schedule(boost::posix_time::time_duration delay, StopFunction_t sf)
+        void Start(NHttp::PClientContext cc, NHttp::PCountedSynchronizer sync = NHttp::PCountedSynchronizer(), int speed = DEFAULT_SPEED_VALUE)
         {
-            keepAliveTimer.expires_from_now(delay);
-            keepAliveTimer.async_wait(std::bind(&SHlsContext::handle_timer, shared_from_this(), delay, sf, std::placeholders::_1));
+            m_cc = cc;
+            m_sync = sync;
+
+            m_cc->Init(NHttp::DataFunction(std::bind(&CHlsSegmenter::processData,
+                std::weak_ptr<CHlsSegmenter>(shared_from_this()), std::placeholders::_1)));
+
+            if (m_sync)
+                m_sync->Start(speed);
         }
 
         void Stop()
         {
-            keepAliveTimer.cancel();
+            TReplies replies;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_finished = true;
+                for (auto& w : m_waiters)
+                    replies.push_back({ w.response, std::string() });
+                m_waiters.clear();
+            }
+
+            for (auto& r : replies)
+                Error(r.response, IResponse::NotFound);
+
+            if (m_cc)
+            {
+                m_cc->Stop();
+                m_cc.reset();
+            }
+        }
+
+        static void SourceDisconnected(std::weak_ptr<CHlsSegmenter> weak)
+        {
+            if (auto segmenter = weak.lock())
+                segmenter->finish();
+        }
+
+        void AddClient()
+        {
+            ++m_clients;
+        }
+
+        int ReleaseClient()
+        {
+            return --m_clients;
+        }
+
+        bool IsFinished()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_finished;
+        }
+
+        void SendPlaylist(NHttp::PResponse resp, const std::string& streamId, const NPluginUtility::TParams& params)
+        {
+            const int sequence = NPluginUtility::GetParam(params, BLOCKING_SEQUENCE_PARAM, -1);
+            const int part = NPluginUtility::GetParam(params, BLOCKING_PART_PARAM, -1);
+
+            std::string playlist;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                // Blocking reload or the very first request before any segment is ready
+                boost::optional<std::uint64_t> waitFor;
+                if (sequence >= 0)
+                    waitFor = static_cast<std::uint64_t>(sequence);
+                else if (m_segments.empty())
+                    waitFor = m_nextSequence;
+
+                if (!m_finished && waitFor && !isAvailableLocked(*waitFor, m_lowLatency ? part : -1))
+                {
+                    const auto timeout = std::chrono::seconds(3 * m_targetDuration);
+                    m_waiters.push_back({ streamId, resp, *waitFor, m_lowLatency ? part : -1,
+                        std::chrono::steady_clock::now() + timeout });
+                    return;
+                }
+
+                playlist = renderPlaylistLocked(streamId);
+            }
+
+            sendPlaylist(resp, playlist);
+        }
+
+        void SendMedia(NHttp::PResponse resp, const NPluginUtility::TParams& params, bool partOnly)
+        {
+            const std::uint64_t sequence = NPluginUtility::GetParam<std::uint64_t>(params, SEQUENCE_PARAM);
+            const std::size_t partIndex = partOnly ? NPluginUtility::GetParam<std::size_t>(params, PART_PARAM) : 0;
+
+            auto chunks = std::make_shared<std::vector<PChunk>>();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                const SHlsSegment* segment = findSegmentLocked(sequence);
+                if (nullptr != segment)
+                {
+                    if (!partOnly)
+                    {
+                        for (const auto& p : segment->parts)
+                            chunks->push_back(p.data);
+                    }
+                    else if (partIndex < segment->parts.size())
+                        chunks->push_back(segment->parts[partIndex].data);
+                }
+            }
+
+            if (chunks->empty())
+            {
+                Error(resp, IResponse::NotFound);
+                return;
+            }
+
+            std::size_t size = 0;
+            IResponse::TConstBufferSeq buffs;
+            for (const auto& c : *chunks)
+            {
+                size += c->size();
+                buffs.push_back(boost::asio::buffer(c->data(), c->size()));
+            }
+
+            resp->SetStatus(IResponse::OK);
+            resp << ContentLength(size)
+                 << ContentType(SEGMENT_CONTENT_TYPE)
+                 << CacheControlNoCache();
+            resp->FlushHeaders();
+
+            try
+            {
+                resp->AsyncWrite(buffs, [chunks](boost::system::error_code) {});
+            }
+            catch (const boost::system::system_error& e)
+            {
+                _wrn_ << "HLS segment " << sequence << " is not sent: " << e.what();
+            }
+        }
+
+        // Answers blocking playlist requests which waited too long with what is there.
+        void ExpireWaiters(std::chrono::steady_clock::time_point now)
+        {
+            TReplies replies;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_waiters.begin();
+                while (it != m_waiters.end())
+                {
+                    if (it->deadline <= now)
+                    {
+                        replies.push_back({ it->response, renderPlaylistLocked(it->streamId) });
+                        it = m_waiters.erase(it);
+                    }
+                    else
+                        ++it;
+                }
+            }
+            sendReplies(replies);
         }
 
-        void handle_timer(boost::posix_time::time_duration delay, StopFunction_t sf, const boost::system::error_code& error)
+    private:
+        static void processData(std::weak_ptr<CHlsSegmenter> weak, NHttp::PDataBuffer db)
         {
-            if (error)
+            if (auto segmenter = weak.lock())
+                segmenter->onData(db);
+        }
+
+        void onData(NHttp::PDataBuffer db)
+        {
+            if (db->IsEoS())
+            {
+                finish();
                 return;
+            }
 
-            if (!keepAlive)
+            TReplies replies;
             {
-                _dbg_ << "No keep-alive message. Stop HLS stream";
-                sf();
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_finished)
+                    return;
+
+                const std::uint64_t ts = db->GetTimestamp();
+                m_lastTimestamp = ts;
+
+                // Key unit starts with the first non-delta buffer, tables go out in front of key frame
+                const bool keyUnit = db->IsKeyData() && !m_lastKeyData;
+                m_lastKeyData = db->IsKeyData();
+
+                if (m_segmentOpened)
+                {
+                    if (keyUnit && elapsedMs(m_segmentStart, ts) >= m_targetDuration * 1000)
+                        closeSegmentLocked(ts, replies);
+                    else if (m_lowLatency && !m_partData.empty() && elapsedMs(m_partStart, ts) >= PART_TARGET_MS)
+                        closePartLocked(ts, replies);
+                }
+
+                if (!m_segmentOpened)
+                {
+                    // Stream must start from key unit
+                    if (!keyUnit)
+                        return;
+                    openSegmentLocked(ts);
+                }
+
+                if (m_partData.empty())
+                    m_partIndependent = keyUnit;
+                m_partData.append(reinterpret_cast<const char*>(db->GetData()), static_cast<std::size_t>(db->GetSize()));
             }
-            else
+            sendReplies(replies);
+        }
+
+        void finish()
+        {
+            TReplies replies;
             {
-                _dbg_ << "We have keep-alive message. Prolongate HLS stream";
-                keepAlive = false;
-                Schedule(delay, sf);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_finished)
+                    return;
+
+                _log_ << "HLS source finished at segment " << m_nextSequence;
+                if (m_segmentOpened && !m_partData.empty())
+                    closeSegmentLocked(m_lastTimestamp, replies);
+                m_finished = true;
+
+                for (auto& w : m_waiters)
+                    replies.push_back({ w.response, renderPlaylistLocked(w.streamId) });
+                m_waiters.clear();
             }
+            sendReplies(replies);
         }
 
-        boost::uuids::uuid id;
-        NHttp::PClientContext cc;
-        NHttp::PCountedSynchronizer sync;
-        bool keepAlive;
+        void openSegmentLocked(std::uint64_t ts)
+        {
+            m_current = SHlsSegment{ m_nextSequence, 0.0, {} };
+            m_segmentStart = m_partStart = ts;
+            m_segmentOpened = true;
+        }
+
+        void closePartLocked(std::uint64_t ts, TReplies& replies)
+        {
+            m_current.parts.push_back({ std::make_shared<const std::string>(std::move(m_partData)),
+                elapsedMs(m_partStart, ts) / 1000.0, m_partIndependent });
+            m_partData.clear();
+            m_partStart = ts;
+
+            takeReadyWaitersLocked(replies);
+        }
+
+        void closeSegmentLocked(std::uint64_t ts, TReplies& replies)
+        {
+            if (!m_partData.empty())
+            {
+                m_current.parts.push_back({ std::make_shared<const std::string>(std::move(m_partData)),
+                    elapsedMs(m_partStart, ts) / 1000.0, m_partIndependent });
+                m_partData.clear();
+            }
+
+            m_current.duration = 0.0;
+            for (const auto& p : m_current.parts)
+                m_current.duration += p.duration;
+
+            m_segments.push_back(std::move(m_current));
+            while (m_segments.size() > m_listSize + SPARE_SEGMENTS)
+                m_segments.pop_front();
+
+            m_segmentOpened = false;
+            ++m_nextSequence;
+
+            takeReadyWaitersLocked(replies);
+        }
+
+        bool isAvailableLocked(std::uint64_t sequence, int part) const
+        {
+            if (sequence < m_nextSequence)
+                return true;
+
+            return part >= 0 && m_segmentOpened && m_current.sequence == sequence
+                && m_current.parts.size() > static_cast<std::size_t>(part);
+        }
+
+        void takeReadyWaitersLocked(TReplies& replies)
+        {
+            auto it = m_waiters.begin();
+            while (it != m_waiters.end())
+            {
+                if (isAvailableLocked(it->sequence, it->part))
+                {
+                    replies.push_back({ it->response, renderPlaylistLocked(it->streamId) });
+                    it = m_waiters.erase(it);
+                }
+                else
+                    ++it;
+            }
+        }
+
+        const SHlsSegment* findSegmentLocked(std::uint64_t sequence) const
+        {
+            if (m_segmentOpened && m_current.sequence == sequence)
+                return &m_current;
+
+            for (const auto& s : m_segments)
+            {
+                if (s.sequence == sequence)
+                    return &s;
+            }
+            return nullptr;
+        }
+
+        std::string renderPlaylistLocked(const std::string& streamId) const
+        {
+            const std::size_t first = m_segments.size() > m_listSize ? m_segments.size() - m_listSize : 0;
+
+            int targetDuration = m_targetDuration;
+            for (std::size_t i = first; i < m_segments.size(); ++i)
+                targetDuration = std::max(targetDuration, static_cast<int>(m_segments[i].duration + 0.5));
+
+            std::ostringstream playlist;
+            playlist << "#EXTM3U\n"
+                     << "#EXT-X-VERSION:" << (m_lowLatency ? 6 : 3) << "\n"
+                     << "#EXT-X-TARGETDURATION:" << targetDuration << "\n";
+            if (m_lowLatency)
+            {
+                playlist << boost::format("#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n") % (3 * PART_TARGET_MS / 1000.0)
+                         << boost::format("#EXT-X-PART-INF:PART-TARGET=%.3f\n") % (PART_TARGET_MS / 1000.0);
+            }
+            playlist << "#EXT-X-MEDIA-SEQUENCE:" << (first < m_segments.size() ? m_segments[first].sequence : m_nextSequence) << "\n";
+
+            for (std::size_t i = first; i < m_segments.size(); ++i)
+            {
+                const SHlsSegment& s = m_segments[i];
+                if (m_lowLatency && i + PARTS_SEGMENTS >= m_segments.size())
+                    renderPartsLocked(playlist, streamId, s);
+
+                playlist << boost::format("#EXTINF:%.3f,\n") % s.duration
+                         << "segment.ts?" << STREAM_ID_PARAMETER << "=" << streamId
+                         << "&" << SEQUENCE_PARAM << "=" << s.sequence << "\n";
+            }
+
+            if (m_lowLatency && m_segmentOpened)
+                renderPartsLocked(playlist, streamId, m_current);
 
-        boost::asio::deadline_timer keepAliveTimer;
+            if (m_finished)
+                playlist << "#EXT-X-ENDLIST\n";
+
+            return playlist.str();
+        }
+
+        void renderPartsLocked(std::ostringstream& playlist, const std::string& streamId, const SHlsSegment& s) const
+        {
+            for (std::size_t i = 0; i < s.parts.size(); ++i)
+            {
+                playlist << boost::format("#EXT-X-PART:DURATION=%.3f,URI=\"") % s.parts[i].duration
+                         << "part.ts?" << STREAM_ID_PARAMETER << "=" << streamId
+                         << "&" << SEQUENCE_PARAM << "=" << s.sequence
+                         << "&" << PART_PARAM << "=" << i << "\""
+                         << (s.parts[i].independent ? ",INDEPENDENT=YES\n" : "\n");
+            }
+        }
+
+        void sendReplies(TReplies& replies)
+        {
+            for (auto& r : replies)
+            {
+                try
+                {
+                    sendPlaylist(r.response, r.playlist);
+                }
+                catch (const std::exception& e)
+                {
+                    _wrn_ << "HLS playlist is not sent: " << e.what();
+                }
+            }
+        }
+
+        const int m_targetDuration;
+        const std::size_t m_listSize;
+        const bool m_lowLatency;
+
+        NHttp::PClientContext m_cc;
+        NHttp::PCountedSynchronizer m_sync;
+        std::atomic<int> m_clients;
+
+        std::mutex m_mutex;
+        bool m_finished;
+        bool m_lastKeyData;
+
+        std::deque<SHlsSegment> m_segments;
+        SHlsSegment m_current;
+        bool m_segmentOpened;
+        std::uint64_t m_nextSequence;
+        std::uint64_t m_segmentStart;
+
+        std::string m_partData;
+        std::uint64_t m_partStart;
+        bool m_partIndependent;
+        std::uint64_t m_lastTimestamp;
+
+        std::list<SPlaylistWaiter> m_waiters;
+    };
+    using PHlsSegmenter = std::shared_ptr<CHlsSegmenter>;
+
+    struct SHlsClient
+    {
+        PHlsSegmenter segmenter;
+        boost::optional<SHlsRequestParams> sharedKey;
+        std::chrono::seconds keepAlive;
+        std::chrono::steady_clock::time_point lastActivity;
     };
-    using PHlsContext = std::shared_ptr<SHlsContext>;
 }
 
 namespace NPluginHelpers
 {
 
-class HlsSourceManagerImpl :  boost::noncopyable
+class HlsSourceManagerImpl : public std::enable_shared_from_this<HlsSourceManagerImpl>, boost::noncopyable
 {
-    using CreateFunction_t = boost::function<NHttp::PClientContext(StopFunction_t)>;
+    typedef std::map<boost::uuids::uuid, SHlsClient> connectionsMap_t;
+    typedef std::map<SHlsRequestParams, PHlsSegmenter> segmentersMap_t;
+
 public:
-    HlsSourceManagerImpl(NCorbaHelpers::IContainer* c, const std::string& hlsContentPath, NHttp::PVideoSourceCache cache) 
+    HlsSourceManagerImpl(NCorbaHelpers::IContainer* c, NHttp::PVideoSourceCache cache) 
         : m_container(c, NCorbaHelpers::ShareOwnership())
-        , m_hlsContentPath(hlsContentPath)
         , m_videoSourceCache(cache)
+        , m_sweepTimer(NCorbaHelpers::GetReactorInstanceShared()->GetIO())
+        , m_sweepScheduled(false)
     {
         INIT_LOGGER_HOLDER_FROM_CONTAINER(c);
     }
 
     void ConnectToEnpoint(PRequest req, PResponse resp, const std::string& endpoint, const npu::TParams& params)
     {
-        PHlsContext hlsCtx = std::make_shared<SHlsContext>(GET_LOGGER_PTR);
-        CreateFunction_t cf = boost::bind(&NHttp::IVideoSourceCache::CreateHlsContext, m_videoSourceCache, resp, endpoint, getFilePath(hlsCtx), _1);
-        connectToEndpoint(req, resp, hlsCtx, endpoint, params, cf);
+        SHlsRequestParams p = parseRequest(endpoint.c_str(), params);
+
+        PHlsSegmenter segmenter;
+        boost::uuids::uuid id;
+        try
+        {
+            boost::mutex::scoped_lock lock(m_connectionGuard);
+
+            segmentersMap_t::iterator it = m_segmenters.find(p);
+            if (m_segmenters.end() != it && !it->second->IsFinished())
+            {
+                segmenter = it->second;
+            }
+            else
+            {
+                segmenter = std::make_shared<CHlsSegmenter>(GET_LOGGER_PTR, p.hls_time, p.hls_list_size, p.low_latency);
+                NHttp::PClientContext cc = m_videoSourceCache->CreateHlsContext(endpoint,
+                    boost::bind(&CHlsSegmenter::SourceDisconnected, std::weak_ptr<CHlsSegmenter>(segmenter)));
+                if (!cc)
+                {
+                    lock.unlock();
+                    Error(resp, IResponse::NotFound);
+                    return;
+                }
+
+                segmenter->Start(cc);
+                m_segmenters[p] = segmenter;
+                _log_ << "Started HLS segmenter for " << endpoint;
+            }
+
+            id = addClientLocked(segmenter, p, p.keep_alive);
+        }
+        catch (const std::exception& e)
+        {
+            _err_ << e.what();
+            Error(resp, IResponse::InternalServerError);
+            return;
+        }
+
+        sendResponse(req, resp, boost::lexical_cast<std::string>(id), boost::posix_time::seconds(p.keep_alive));
     }
 
     void ConnectToArchiveEnpoint(const NWebGrpc::PGrpcManager grpcManager, NGrpcHelpers::PCredentials credentials, 
         PRequest req, PResponse resp, const std::string& endpoint, const std::string& archiveName, const std::string& startTime, const npu::TParams& params)
     {
-        PHlsContext hlsCtx = std::make_shared<SHlsContext>(GET_LOGGER_PTR);
+        SHlsRequestParams p = parseRequest(endpoint.c_str(), params);
+
         NHttp::PCountedSynchronizer sync = boost::make_shared<NHttp::SCountedSynchronizer>(GET_LOGGER_PTR, m_container.Get());
-        hlsCtx->sync = sync;
 
-        NHttp::PArchiveContext aCtx = boost::make_shared<NHttp::SHlsArchiveContext>(GET_LOGGER_PTR, getFilePath(hlsCtx));
+        NHttp::PArchiveContext aCtx = boost::make_shared<NHttp::SHlsArchiveContext>(GET_LOGGER_PTR);
         aCtx->videoEndpoint = endpoint;
         aCtx->archiveName = archiveName;
         aCtx->startTime = startTime;
 
-        CreateFunction_t cf = boost::bind(&NHttp::IVideoSourceCache::CreateArchiveMp4Context, m_videoSourceCache,
-            grpcManager, credentials, resp, sync, aCtx, _1);
-        connectToEndpoint(req, resp, hlsCtx, endpoint, params, cf);
+        // Every archive client has its own position, so its segmenter is not shared
+        PHlsSegmenter segmenter = std::make_shared<CHlsSegmenter>(GET_LOGGER_PTR, p.hls_time, p.hls_list_size, p.low_latency);
+        boost::uuids::uuid id;
+        try
+        {
+            NHttp::PClientContext cc = m_videoSourceCache->CreateArchiveMp4Context(grpcManager, credentials, NHttp::PResponse(), sync, aCtx,
+                boost::bind(&CHlsSegmenter::SourceDisconnected, std::weak_ptr<CHlsSegmenter>(segmenter)));
+            if (!cc)
+            {
+                Error(resp, IResponse::NotFound);
+                return;
+            }
+
+            int speed = 1;
+            npu::GetParam(params, SPEED_PARAM, speed, DEFAULT_SPEED_VALUE);
+            segmenter->Start(cc, sync, speed);
+
+            boost::mutex::scoped_lock lock(m_connectionGuard);
+            id = addClientLocked(segmenter, boost::none, p.keep_alive);
+        }
+        catch (const std::exception& e)
+        {
+            _err_ << e.what();
+            Error(resp, IResponse::InternalServerError);
+            return;
+        }
+
+        sendResponse(req, resp, boost::lexical_cast<std::string>(id), boost::posix_time::seconds(p.keep_alive));
     }
 
     bool handleCommand(PRequest req, const npu::TParams& params, PResponse resp)
@@ -180,6 +685,19 @@ public:
             }
             const std::string path = req->GetPathInfo();
             const auto id = boost::lexical_cast<boost::uuids::uuid>(streamId);
+
+            if (path == HLS_PLAYLIST_COMMAND || path == HLS_SEGMENT_COMMAND || path == HLS_PART_COMMAND)
+            {
+                PHlsSegmenter segmenter = touch(id);
+                if (!segmenter)
+                    Error(resp, IResponse::NotFound);
+                else if (path == HLS_PLAYLIST_COMMAND)
+                    segmenter->SendPlaylist(resp, streamId, params);
+                else
+                    segmenter->SendMedia(resp, params, path == HLS_PART_COMMAND);
+                return true;
+            }
+
             boost::optional<IResponse::EStatus> returnCode;
             if (path == HLS_KEEP_COMMAND)
             {
@@ -216,57 +734,42 @@ public:
 
     void erase_all()
     {
-        boost::mutex::scoped_lock lock(m_connectionGuard);
-        connectionsMap_t::iterator it1 = m_connections.begin(), it2 = m_connections.end();
-        for (; it1 != it2; ++it1)
-            it1->second->cc->Stop();
-        m_connections.clear();
+        segmentersMap_t segmenters;
+        connectionsMap_t connections;
+        {
+            boost::mutex::scoped_lock lock(m_connectionGuard);
+            boost::system::error_code ignore;
+            m_sweepTimer.cancel(ignore);
+            segmenters.swap(m_segmenters);
+            connections.swap(m_connections);
+        }
+
+        for (auto& c : connections)
+            c.second.segmenter->Stop();
     }
 
 private:
-    void connectToEndpoint(PRequest req, PResponse resp, PHlsContext hlsCtx, const std::string& endpoint, const npu::TParams& params, CreateFunction_t cf)
+    boost::uuids::uuid addClientLocked(PHlsSegmenter segmenter, boost::optional<SHlsRequestParams> sharedKey, int keepAlive)
     {
-        SHlsRequestParams p = parseRequest(endpoint.c_str(), params);
-     
-        NHttp::PClientContext cc;
-
-        StopFunction_t sf = boost::bind(&HlsSourceManagerImpl::handleStopCommand, this, hlsCtx->id);
-        try {
-            
-            cc = cf(sf);
-            if (cc)
-            {
-                cc->Init();
-                hlsCtx->cc = cc;
+        const boost::uuids::uuid id = NCorbaHelpers::GenerateUUID();
 
-                if (hlsCtx->sync)
-                {
-                    int speed = 1;
-                    npu::GetParam(params, SPEED_PARAM, speed, DEFAULT_SPEED_VALUE);
-                    hlsCtx->sync->Start(speed);
-                }
-            }
-        }
-        catch (const std::exception& e) {
-            _err_ << e.what();
-            Error(resp, IResponse::InternalServerError);
-            return;
-        }
-
-        hlsCtx->Schedule(boost::posix_time::seconds(p.keep_alive), sf);
+        segmenter->AddClient();
+        m_connections.insert(std::make_pair(id,
+            SHlsClient{ segmenter, sharedKey, std::chrono::seconds(keepAlive), std::chrono::steady_clock::now() }));
 
+        if (!m_sweepScheduled)
         {
-            boost::mutex::scoped_lock lock(m_connectionGuard);
-            m_connections[hlsCtx->id] = hlsCtx;
+            m_sweepScheduled = true;
+            scheduleSweep();
         }
-
-        sendResponse(req, resp, boost::lexical_cast<std::string>(hlsCtx->id), boost::posix_time::seconds(p.keep_alive));
+        return id;
     }
+
     void sendResponse(NHttp::PRequest req, NHttp::PResponse resp, const std::string& connectionId, const boost::posix_time::seconds& keepAlive)
     {
         // Create response uri
         const std::string baseUrl = req->GetPrefix() + req->GetContextPath();
-        const std::string streamUrl = req->GetPrefix() + PLAYLIST_PATH_PREFIX + NLogging::ws2s(getRelativePath(connectionId).generic_string());
+        const std::string streamUrl = baseUrl + HLS_PLAYLIST_COMMAND + "?stream_id=" + connectionId;
         const std::string keepAliveUrl = baseUrl + HLS_KEEP_COMMAND + "?stream_id=" + connectionId;
         const std::string stopUrl = baseUrl + HLS_STOP_COMMAND + "?stream_id=" + connectionId;
         Json::Value json;
@@ -279,56 +782,124 @@ private:
         NPluginUtility::SendText(resp, Json::writeString(writer, json));
     }
 
+    PHlsSegmenter touch(const boost::uuids::uuid& id)
+    {
+        boost::mutex::scoped_lock lock(m_connectionGuard);
+        connectionsMap_t::iterator it = m_connections.find(id);
+        if (m_connections.end() == it)
+            return PHlsSegmenter();
+
+        it->second.lastActivity = std::chrono::steady_clock::now();
+        return it->second.segmenter;
+    }
+
     IResponse::EStatus handleKeepCommand(const boost::uuids::uuid& id)
     {
+        touch(id);
+        return IResponse::OK;
+    }
+
+    IResponse::EStatus handleStopCommand(const boost::uuids::uuid& id)
+    {
+        PHlsSegmenter released;
         {
             boost::mutex::scoped_lock lock(m_connectionGuard);
             connectionsMap_t::iterator it = m_connections.find(id);
-            if (m_connections.end() != it)
-                it->second->keepAlive = true;
+            if (m_connections.end() == it)
+                return NHttp::IResponse::NotFound;
+
+            released = removeClientLocked(it);
         }
+
+        if (released)
+            released->Stop();
+
         return IResponse::OK;
     }
 
-    IResponse::EStatus handleStopCommand(const boost::uuids::uuid& id)
+    // Returns segmenter which has lost its last client.
+    PHlsSegmenter removeClientLocked(connectionsMap_t::iterator it)
     {
-        PHlsContext hlsCtx;
-        boost::mutex::scoped_lock lock(m_connectionGuard);
-        connectionsMap_t::iterator it = m_connections.find(id);
-        if (m_connections.end() == it)
-            return NHttp::IResponse::NotFound;
-
-        hlsCtx = it->second;
+        const boost::uuids::uuid id = it->first;
+        SHlsClient client = it->second;
         m_connections.erase(it);
-        lock.unlock();
 
-        hlsCtx->cc->Stop();
-        hlsCtx->Stop();
+        if (0 != client.segmenter->ReleaseClient())
+            return PHlsSegmenter();
 
-        const std::string streamId = boost::lexical_cast<std::string>(id);
-        boost::filesystem::path streamPath = m_hlsContentPath / streamId;
-        boost::system::error_code ignore;
-        remove_all(streamPath.parent_path(), ignore);
+        if (client.sharedKey)
+        {
+            segmentersMap_t::iterator sit = m_segmenters.find(*client.sharedKey);
+            if (m_segmenters.end() != sit && sit->second == client.segmenter)
+                m_segmenters.erase(sit);
+        }
 
-        return IResponse::OK;
+        _dbg_ << "Last HLS client " << id << " gone. Stop segmenter";
+        return client.segmenter;
+    }
+
+    void scheduleSweep()
+    {
+        m_sweepTimer.expires_from_now(boost::posix_time::milliseconds(SWEEP_PERIOD_MS));
+        m_sweepTimer.async_wait(std::bind(&HlsSourceManagerImpl::handleSweep,
+            std::weak_ptr<HlsSourceManagerImpl>(shared_from_this()), std::placeholders::_1));
+    }
+
+    static void handleSweep(std::weak_ptr<HlsSourceManagerImpl> weak, const boost::system::error_code& error)
+    {
+        if (error)
+            return;
+
+        if (auto impl = weak.lock())
+            impl->sweep();
     }
 
-    std::string getFilePath(PHlsContext hlsCtx) 
+    // Drops clients which neither fetch media nor send keep-alive messages.
+    void sweep()
     {
-        boost::uuids::uuid reqId = NCorbaHelpers::GenerateUUID();
-        boost::filesystem::path streamPath = m_hlsContentPath / boost::lexical_cast<std::string>(reqId);
-        boost::filesystem::create_directories(streamPath);
-        hlsCtx->id = reqId;
-        return NLogging::ws2s(streamPath.string());
+        const auto now = std::chrono::steady_clock::now();
+
+        std::vector<PHlsSegmenter> released;
+        std::set<PHlsSegmenter> active;
+        {
+            boost::mutex::scoped_lock lock(m_connectionGuard);
+            connectionsMap_t::iterator it = m_connections.begin();
+            while (it != m_connections.end())
+            {
+                connectionsMap_t::iterator current = it++;
+                if (now - current->second.lastActivity > current->second.keepAlive)
+                {
+                    _dbg_ << "No keep-alive message from " << current->first << ". Stop HLS stream";
+                    PHlsSegmenter segmenter = removeClientLocked(current);
+                    if (segmenter)
+                        released.push_back(segmenter);
+                }
+                else
+                    active.insert(current->second.segmenter);
+            }
+
+            m_sweepScheduled = !m_connections.empty();
+            if (m_sweepScheduled)
+                scheduleSweep();
+        }
+
+        for (auto& s : released)
+            s->Stop();
+
+        for (auto& s : active)
+            s->ExpireWaiters(now);
     }
 
 private:
     NCorbaHelpers::PContainer m_container;
-    const path_t m_hlsContentPath;
     NHttp::PVideoSourceCache m_videoSourceCache;
-    typedef std::map<boost::uuids::uuid, PHlsContext> connectionsMap_t;
+
     boost::mutex m_connectionGuard;
     connectionsMap_t m_connections;
+    segmentersMap_t m_segmenters;
+
+    boost::asio::deadline_timer m_sweepTimer;
+    bool m_sweepScheduled;
     DECLARE_LOGGER_HOLDER;
 
     SHlsRequestParams parseRequest(const char* const ep, const npu::TParams& params)
@@ -339,7 +910,7 @@ private:
         npu::GetParam(params, PARAM_KEEP_ALIVE, p.keep_alive, DEFAULT_KEEP_ALIVE);
         npu::GetParam(params, PARAM_HLS_TIME, p.hls_time, DEFAULT_HLS_TIME);
         npu::GetParam(params, PARAM_HLS_LIST_SIZE, p.hls_list_size, DEFAULT_HLS_LIST_SIZE);
-        npu::GetParam(params, PARAM_HLS_WRAP, p.hls_wrap, DEFAULT_HLS_WRAP);
+        npu::GetParam(params, PARAM_HLS_LOW_LATENCY, p.low_latency, false);
 
         validateParams(p);
 
@@ -358,14 +929,11 @@ private:
 
         if (p.hls_time <= 0)
             p.hls_time = DEFAULT_HLS_TIME;
-
-        if (p.hls_wrap <= 0)
-            p.hls_wrap = DEFAULT_HLS_WRAP;
     }
 };
 
-HlsSourceManager::HlsSourceManager(NCorbaHelpers::IContainer* c, const std::string& hlsContentPath, NHttp::PVideoSourceCache cache) :
-    m_impl(new HlsSourceManagerImpl(c, hlsContentPath, cache))
+HlsSourceManager::HlsSourceManager(NCorbaHelpers::IContainer* c, NHttp::PVideoSourceCache cache) :
+    m_impl(std::make_shared<HlsSourceManagerImpl>(c, cache))
 {
 }
 
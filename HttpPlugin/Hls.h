@@ -22,7 +22,7 @@ typedef std::function<void()>                 OnDisconnected;
 class HlsSourceManager
 {
 public:
-    HlsSourceManager(NCorbaHelpers::IContainer* c, const std::string& hlsContentPath, NHttp::PVideoSourceCache cache);
+    HlsSourceManager(NCorbaHelpers::IContainer* c, NHttp::PVideoSourceCache cache);
     ~HlsSourceManager();
 
     void ConnectToEnpoint(NHttp::PRequest req, NHttp::PResponse resp, 
@@ -39,7 +39,7 @@ public:
     void Erase(const std::string& connectionId);
 
 private:
-    std::unique_ptr<HlsSourceManagerImpl> m_impl;
+    std::shared_ptr<HlsSourceManagerImpl> m_impl;
 };
 
 }
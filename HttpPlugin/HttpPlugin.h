@@ -25,16 +25,23 @@ namespace NHttp
     HTTPPLUGIN_DECLSPEC IServlet* CreateCommonServlet(NCorbaHelpers::IContainer*, const NWebGrpc::PGrpcManager grpcManager);
     HTTPPLUGIN_DECLSPEC IServlet* CreateHostServlet(NCorbaHelpers::IContainer*);
     HTTPPLUGIN_DECLSPEC IServlet* CreateArchiveServlet(NCorbaHelpers::IContainerNamed*, const NWebGrpc::PGrpcManager grpcManager, const NPluginUtility::PRigthsChecker rightsChecker,
-        const std::string& hlsContentPath, UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache);
+        UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache);
     HTTPPLUGIN_DECLSPEC IServlet* CreateVideoServlet(NCorbaHelpers::IContainer*, const NWebGrpc::PGrpcManager grpcManager, const NPluginUtility::PRigthsChecker,
-        const std::string& hlsContentPath, UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache);
+        UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache);
     HTTPPLUGIN_DECLSPEC IServlet* CreateLiveSnapshotServlet(NCorbaHelpers::IContainer*, const NPluginUtility::PRigthsChecker);
+
+    struct SSnapshotCacheStatistics
+    {
+        std::uint64_t Hits;
+        std::uint64_t Misses;
+    };
+    SSnapshotCacheStatistics GetSnapshotCacheStatistics();
     HTTPPLUGIN_DECLSPEC IServlet* CreateEventServlet(DECLARE_LOGGER_ARG, const NWebGrpc::PGrpcManager grpcManager, const NPluginUtility::PRigthsChecker);
     HTTPPLUGIN_DECLSPEC IServlet* CreateTelemetryServlet(NCorbaHelpers::IContainer*, const NWebGrpc::PGrpcManager grpcManager, const NPluginUtility::PRigthsChecker);
     HTTPPLUGIN_DECLSPEC IServlet* CreateExportServlet(NCorbaHelpers::IContainer*, const std::string& exportContentPath,
         const NWebGrpc::PGrpcManager grpcManager, const NPluginUtility::PRigthsChecker rightsChecker);
     HTTPPLUGIN_DECLSPEC IServlet* CreateAutoSearchServlet(NCorbaHelpers::IContainer* c, const NWebGrpc::PGrpcManager grpcManager);
-    HTTPPLUGIN_DECLSPEC IServlet* CreateFaceSearchServlet(NCorbaHelpers::IContainer* c);
+    HTTPPLUGIN_DECLSPEC IServlet* CreateFaceSearchServlet(NCorbaHelpers::IContainer* c, const NWebGrpc::PGrpcManager grpcManager);
     HTTPPLUGIN_DECLSPEC IServlet* CreateVmdaSearchServlet(NCorbaHelpers::IContainer*, const NWebGrpc::PGrpcManager grpcManager);
     HTTPPLUGIN_DECLSPEC IServlet* CreateStrangerSearchServlet(NCorbaHelpers::IContainerNamed*);
     HTTPPLUGIN_DECLSPEC IServlet* CreateFarStatusServlet(NCorbaHelpers::IContainer*);
@@ -0,0 +1,289 @@
+#include "JsonStream.h"
+
+#include <cstring>
+
+namespace
+{
+    const char HEX_DIGITS[] = "0123456789abcdef";
+}
+
+namespace NPluginUtility
+{
+    CJsonStreamWriter::CJsonStreamWriter()
+        : m_afterKey(false)
+    {
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::BeginObject()
+    {
+        beforeValue();
+        m_buffer.push_back('{');
+        m_empty.push_back(true);
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::EndObject()
+    {
+        m_buffer.push_back('}');
+        m_empty.pop_back();
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::BeginArray()
+    {
+        beforeValue();
+        m_buffer.push_back('[');
+        m_empty.push_back(true);
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::EndArray()
+    {
+        m_buffer.push_back(']');
+        m_empty.pop_back();
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Key(const char* key)
+    {
+        beforeValue();
+        writeString(key, key + std::strlen(key));
+        m_buffer.push_back(':');
+        m_afterKey = true;
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Key(const std::string& key)
+    {
+        beforeValue();
+        writeString(key.data(), key.data() + key.size());
+        m_buffer.push_back(':');
+        m_afterKey = true;
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(const char* v)
+    {
+        beforeValue();
+        writeString(v, v + std::strlen(v));
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(const std::string& v)
+    {
+        beforeValue();
+        writeString(v.data(), v.data() + v.size());
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(bool v)
+    {
+        beforeValue();
+        m_buffer.append(v ? "true" : "false");
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(int v)
+    {
+        return Value(static_cast<Json::Int64>(v));
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(unsigned int v)
+    {
+        return Value(static_cast<Json::UInt64>(v));
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(Json::Int64 v)
+    {
+        beforeValue();
+        writeInteger(v);
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(Json::UInt64 v)
+    {
+        beforeValue();
+        writeUnsigned(v);
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(double v)
+    {
+        beforeValue();
+        // Same formatting as the jsoncpp writers, including non-finite values.
+        m_buffer.append(Json::valueToString(v));
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Value(const Json::Value& v)
+    {
+        beforeValue();
+        writeValue(v);
+        return *this;
+    }
+
+    CJsonStreamWriter& CJsonStreamWriter::Null()
+    {
+        beforeValue();
+        m_buffer.append("null");
+        return *this;
+    }
+
+    std::size_t CJsonStreamWriter::Size() const
+    {
+        return m_buffer.size();
+    }
+
+    void CJsonStreamWriter::TakeOutput(std::string& out)
+    {
+        if (out.empty())
+            out.swap(m_buffer);
+        else
+            out.append(m_buffer);
+        m_buffer.clear();
+    }
+
+    void CJsonStreamWriter::beforeValue()
+    {
+        if (m_afterKey)
+        {
+            m_afterKey = false;
+            return;
+        }
+        if (m_empty.empty())
+            return;
+        if (m_empty.back())
+            m_empty.back() = false;
+        else
+            m_buffer.push_back(',');
+    }
+
+    void CJsonStreamWriter::writeString(const char* begin, const char* end)
+    {
+        m_buffer.push_back('"');
+        const char* plain = begin;
+        for (const char* p = begin; p != end; ++p)
+        {
+            const unsigned char c = static_cast<unsigned char>(*p);
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+
+            m_buffer.append(plain, p);
+            plain = p + 1;
+            switch (c)
+            {
+            case '"':  m_buffer.append("\\\""); break;
+            case '\\': m_buffer.append("\\\\"); break;
+            case '\b': m_buffer.append("\\b"); break;
+            case '\f': m_buffer.append("\\f"); break;
+            case '\n': m_buffer.append("\\n"); break;
+            case '\r': m_buffer.append("\\r"); break;
+            case '\t': m_buffer.append("\\t"); break;
+            default:
+            {
+                const char escaped[] = { '\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xF] };
+                m_buffer.append(escaped, sizeof(escaped));
+            }
+            }
+        }
+        m_buffer.append(plain, end);
+        m_buffer.push_back('"');
+    }
+
+    void CJsonStreamWriter::writeInteger(Json::Int64 v)
+    {
+        if (v < 0)
+        {
+            m_buffer.push_back('-');
+            // Negated in unsigned arithmetic, which also covers the minimum value.
+            writeUnsigned(Json::UInt64(0) - static_cast<Json::UInt64>(v));
+        }
+        else
+            writeUnsigned(static_cast<Json::UInt64>(v));
+    }
+
+    void CJsonStreamWriter::writeUnsigned(Json::UInt64 v)
+    {
+        char digits[20];
+        char* p = digits + sizeof(digits);
+        do
+        {
+            *--p = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v != 0);
+        m_buffer.append(p, digits + sizeof(digits));
+    }
+
+    void CJsonStreamWriter::writeValue(const Json::Value& v)
+    {
+        switch (v.type())
+        {
+        case Json::nullValue:
+            m_buffer.append("null");
+            break;
+        case Json::intValue:
+            writeInteger(v.asLargestInt());
+            break;
+        case Json::uintValue:
+            writeUnsigned(v.asLargestUInt());
+            break;
+        case Json::realValue:
+            m_buffer.append(Json::valueToString(v.asDouble()));
+            break;
+        case Json::stringValue:
+        {
+            const char* begin = nullptr;
+            const char* end = nullptr;
+            if (v.getString(&begin, &end))
+                writeString(begin, end);
+            else
+                m_buffer.append("\"\"");
+            break;
+        }
+        case Json::booleanValue:
+            m_buffer.append(v.asBool() ? "true" : "false");
+            break;
+        case Json::arrayValue:
+        {
+            m_buffer.push_back('[');
+            const Json::ArrayIndex size = v.size();
+            for (Json::ArrayIndex i = 0; i < size; ++i)
+            {
+                if (i)
+                    m_buffer.push_back(',');
+                writeValue(v[i]);
+            }
+            m_buffer.push_back(']');
+            break;
+        }
+        case Json::objectValue:
+        {
+            m_buffer.push_back('{');
+            bool first = true;
+            for (Json::Value::const_iterator it = v.begin(); it != v.end(); ++it)
+            {
+                if (!first)
+                    m_buffer.push_back(',');
+                first = false;
+
+                const char* end = nullptr;
+                const char* name = it.memberName(&end);
+                writeString(name, end);
+                m_buffer.push_back(':');
+                writeValue(*it);
+            }
+            m_buffer.push_back('}');
+            break;
+        }
+        }
+    }
+
+    std::string ToCompactString(const Json::Value& v)
+    {
+        CJsonStreamWriter writer;
+        writer.Value(v);
+        std::string result;
+        writer.TakeOutput(result);
+        return result;
+    }
+}
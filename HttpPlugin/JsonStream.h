@@ -0,0 +1,115 @@
+#ifndef JSON_STREAM_H__
+#define JSON_STREAM_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <json/json.h>
+
+namespace NPluginUtility
+{
+    // Writes compact JSON straight into a string buffer without building a
+    // Json::Value tree. Separators are placed by the writer; inside objects
+    // every value must be preceded by Key().
+    class CJsonStreamWriter
+    {
+    public:
+        CJsonStreamWriter();
+
+        CJsonStreamWriter& BeginObject();
+        CJsonStreamWriter& EndObject();
+        CJsonStreamWriter& BeginArray();
+        CJsonStreamWriter& EndArray();
+
+        CJsonStreamWriter& Key(const char*);
+        CJsonStreamWriter& Key(const std::string&);
+
+        CJsonStreamWriter& Value(const char*);
+        CJsonStreamWriter& Value(const std::string&);
+        CJsonStreamWriter& Value(bool);
+        CJsonStreamWriter& Value(int);
+        CJsonStreamWriter& Value(unsigned int);
+        CJsonStreamWriter& Value(Json::Int64);
+        CJsonStreamWriter& Value(Json::UInt64);
+        CJsonStreamWriter& Value(double);
+        // Subtrees that are already built are written compactly as well.
+        CJsonStreamWriter& Value(const Json::Value&);
+        CJsonStreamWriter& Null();
+
+        // Bytes written and not yet taken.
+        std::size_t Size() const;
+        // Moves the written bytes to the end of out.
+        void TakeOutput(std::string& out);
+
+    private:
+        void beforeValue();
+        void writeString(const char* begin, const char* end);
+        void writeInteger(Json::Int64);
+        void writeUnsigned(Json::UInt64);
+        void writeValue(const Json::Value&);
+
+        std::string m_buffer;
+        // One entry per open container: whether it has no elements yet.
+        std::vector<bool> m_empty;
+        bool m_afterKey;
+    };
+
+    // Called repeatedly to write the next portion of a document; returns false
+    // once the document is complete.
+    typedef std::function<bool(CJsonStreamWriter&)> FJsonProducer;
+    typedef std::function<void(CJsonStreamWriter&)> FJsonWrite;
+
+    const std::size_t JSON_ITEMS_PER_PORTION = 256;
+
+    // Produces the elements of [first, last) as a JSON array, JSON_ITEMS_PER_PORTION
+    // of them per call, holding mutex (if any) while a portion is walked. open and
+    // close write what surrounds the array, e.g. the other members of an object.
+    // The range must stay valid until the producer is done; captures of the
+    // functors are the place to keep its owner alive.
+    template <typename TIterator, typename FWriteItem>
+    FJsonProducer StreamArray(std::mutex* mutex, TIterator first, TIterator last, FWriteItem writeItem,
+        FJsonWrite open = FJsonWrite(), FJsonWrite close = FJsonWrite())
+    {
+        struct SState
+        {
+            TIterator It;
+            TIterator Last;
+            bool Started;
+        };
+        std::shared_ptr<SState> state(new SState{ first, last, false });
+
+        return [=](CJsonStreamWriter& writer) -> bool
+        {
+            if (!state->Started)
+            {
+                state->Started = true;
+                if (open)
+                    open(writer);
+                writer.BeginArray();
+            }
+
+            {
+                std::unique_lock<std::mutex> lock;
+                if (mutex)
+                    lock = std::unique_lock<std::mutex>(*mutex);
+                for (std::size_t n = 0; n < JSON_ITEMS_PER_PORTION && state->It != state->Last; ++n, ++state->It)
+                    writeItem(writer, *state->It);
+                if (state->It != state->Last)
+                    return true;
+            }
+
+            writer.EndArray();
+            if (close)
+                close(writer);
+            return false;
+        };
+    }
+
+    std::string ToCompactString(const Json::Value&);
+}
+
+#endif // JSON_STREAM_H__
@@ -37,12 +37,12 @@ namespace
 
     public:
         CVideoContentImpl(NCorbaHelpers::IContainer* c, const NWebGrpc::PGrpcManager grpcManager, const npu::PRigthsChecker rc,
-            const std::string& hlsContent, UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache)
+            UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache)
             : m_videoSourceCache(cache)
             , m_container(c, NCorbaHelpers::ShareOwnership())
             , m_grpcManager(grpcManager)
             , m_rightsChecker(rc)
-            , m_hlsManager(c, hlsContent, cache)
+            , m_hlsManager(c, cache)
             , m_rtspManager(rtspUrls)        
         {
             INIT_LOGGER_HOLDER_FROM_CONTAINER(c);
@@ -288,9 +288,9 @@ namespace
 namespace NHttp
 {
     IServlet* CreateVideoServlet(NCorbaHelpers::IContainer* c, const NWebGrpc::PGrpcManager grpcManager,
-        const npu::PRigthsChecker rc, const std::string& hlsContentPath,
+        const npu::PRigthsChecker rc,
         UrlBuilderSP rtspUrls, NHttp::PVideoSourceCache cache)
     {
-        return new CVideoContentImpl(c, grpcManager, rc, hlsContentPath, rtspUrls, cache);
+        return new CVideoContentImpl(c, grpcManager, rc, rtspUrls, cache);
     }
 }
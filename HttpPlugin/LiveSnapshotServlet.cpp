@@ -1,5 +1,8 @@
 #include <ace/OS.h>
 #include <map>
+#include <vector>
+#include <atomic>
+#include <tuple>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread/mutex.hpp>
@@ -34,35 +37,81 @@ namespace bpt = boost::posix_time;
 namespace
 {
     const uint32_t SAMPLE_TIMEOUT_MS = 15000;
+    const char* const VIDEO_COMPRESSION_PARAMETER = "vc";
+
+    std::atomic<std::uint64_t> g_snapshotHits(0);
+    std::atomic<std::uint64_t> g_snapshotMisses(0);
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+    typedef boost::function1<void, NMMSS::PSample> TOnSnapshotHandler;
+
+    typedef boost::shared_ptr<NMMSS::IConnectionBase>         PConnection;
+    typedef std::list<PConnection>                            TConnections;
+
+    void destroyConnection(NMMSS::IConnectionBase *conn)
+    {
+        try
+        {
+            NMMSS::GetConnectionBroker()->DestroyConnection(conn);
+        }
+        catch(const std::exception &) {}
+    }
+
+    // Requested snapshot rendition. Every rendition of one endpoint is produced from the same decoded frame.
+    struct SRenditionKey
+    {
+        uint32_t m_width;
+        uint32_t m_height;
+        float m_cropX;
+        float m_cropY;
+        float m_cropWidth;
+        float m_cropHeight;
+        int m_quality;
+
+        bool IsFullFrame() const
+        {
+            return 0.f == m_cropX && 0.f == m_cropY && 1.f == m_cropWidth && 1.f == m_cropHeight;
+        }
+
+        // A full frame plane scaled for this key can be downscaled further to serve the other key.
+        bool CanServe(const SRenditionKey& rhs) const
+        {
+            if (!IsFullFrame() || !rhs.IsFullFrame())
+                return false;
+            if ((0 == m_width) != (0 == rhs.m_width) || (0 == m_height) != (0 == rhs.m_height))
+                return false;
+            return rhs.m_width <= m_width && rhs.m_height <= m_height;
+        }
+
+        bool operator<(const SRenditionKey& rhs) const
+        {
+            return std::tie(m_width, m_height, m_cropX, m_cropY, m_cropWidth, m_cropHeight, m_quality)
+                < std::tie(rhs.m_width, rhs.m_height, rhs.m_cropX, rhs.m_cropY, rhs.m_cropWidth, rhs.m_cropHeight, rhs.m_quality);
+        }
+    };
+
     struct ISnapshotSink : public virtual NMMSS::CPullStyleSinkBasePureRefcounted
     {
-        virtual void Connect(const std::string &source, uint32_t width, uint32_t height, float, float, float, float) = 0;
+        virtual void Connect(const std::string &source) = 0;
         virtual void Disconnect() = 0;
     };
     typedef NCorbaHelpers::CAutoPtr<ISnapshotSink> PSnapshotSink;
 
     struct ISnapshotContext : public virtual NCorbaHelpers::IWeakReferable
     {
-        virtual void Execute(NHttp::PResponse, bool, uint32_t, uint32_t, float, float, float, float) = 0;
+        virtual void Execute(NHttp::PResponse, bool, const SRenditionKey&) = 0;
         virtual void ExecuteCb(std::function<void()> cb) = 0;
         virtual void Destroy() = 0;
     };
     typedef NCorbaHelpers::CAutoPtr<ISnapshotContext> PSnapshotContext;
     typedef NCorbaHelpers::CWeakPtr<ISnapshotContext> WPSnapshotContext;
 
-    typedef boost::function1<void, NMMSS::PSample> TOnSnapshotHandler;
-
+    // Pulls one frame of the endpoint and delivers it decoded.
     class CSnapshotSink : public virtual ISnapshotSink,
         public virtual NCorbaHelpers::CRefcountedImpl
     {
         DECLARE_LOGGER_HOLDER;
 
-        typedef std::list<NCorbaHelpers::PRefcounted>             TFilters;
-        typedef boost::shared_ptr<NMMSS::IConnectionBase>         PConnection;
-        typedef std::list<PConnection>                            TConnections;
-
         NCorbaHelpers::PReactor     m_reactor;
         NCorbaHelpers::WPContainer  m_container;
         boost::asio::deadline_timer m_timer;
@@ -113,7 +162,7 @@ namespace
                 m_decoder->GetSink()->Receive(s);
         }
 
-        virtual void Connect(const std::string &source, uint32_t width, uint32_t height, float crop_x, float crop_y, float crop_width, float crop_height)
+        virtual void Connect(const std::string &source)
         {
             NCorbaHelpers::PContainer cont = m_container;
             if(!cont) return;
@@ -122,21 +171,12 @@ namespace
             NLogging::ILogger *const logger = cont->GetLogger();
             PPullFilter decoder = CreateDecoder(logger);
 
-            PPullFilter scaler = PPullFilter(CreateSizeFilter(logger, width, height, true, crop_x, crop_y, crop_width, crop_height));
-            PPullFilter encoder = CreateEncoder(logger);
-
             PPullStyleSink sink(NPluginHelpers::CreateSink(
                 boost::bind(&CSnapshotSink::onSampleHandler, makeAutoPtr(), _1)));
 
             ConnectionBroker *const connBroker = GetConnectionBroker();
-            PConnection conn1(connBroker->SetConnection(sink.Get(), encoder->GetSource(), logger),
-                CSnapshotSink::destroyConnection);
-
-            PConnection conn2(connBroker->SetConnection(encoder->GetSink(), scaler->GetSource(), logger),
-                CSnapshotSink::destroyConnection);
-
-            PConnection conn3(connBroker->SetConnection(scaler->GetSink(), decoder->GetSource(), logger),
-                CSnapshotSink::destroyConnection);
+            PConnection conn(connBroker->SetConnection(sink.Get(), decoder->GetSource(), logger),
+                destroyConnection);
 
             try
             {
@@ -149,9 +189,7 @@ namespace
                         MMSS::EAUTO
                     ));
 
-                m_connections.push_back(conn1);
-                m_connections.push_back(conn2);
-                m_connections.push_back(conn3);
+                m_connections.push_back(conn);
             }
             catch(const std::exception &) {}
 
@@ -167,8 +205,11 @@ namespace
             m_destroyed = true;
 
             m_timer.cancel();
-            m_sink->Destroy();
-            m_sink.Reset();
+            if (m_sink)
+            {
+                m_sink->Destroy();
+                m_sink.Reset();
+            }
             m_connections.clear();
         }
 
@@ -185,21 +226,6 @@ namespace
             return res;
         }
 
-        static NMMSS::PPullFilter CreateEncoder(DECLARE_LOGGER_ARG)
-        {
-            using namespace NMMSS;
-            return PPullFilter(CreateMJPEGEncoderFilter(GET_LOGGER_PTR, static_cast<EVideoCodingPreset>(0)));
-        }
-
-        static void destroyConnection(NMMSS::IConnectionBase *conn)
-        {
-            try
-            {
-                NMMSS::GetConnectionBroker()->DestroyConnection(conn);
-            }
-            catch(const std::exception &) {}
-        }
-
         void noDataHandler(boost::system::error_code ec)
         {
             if (!ec && m_waiting)
@@ -231,17 +257,93 @@ namespace
             return NCorbaHelpers::CAutoPtr<CSnapshotSink>(this, NCorbaHelpers::ShareOwnership()); }
     };
 
+    // Scales a decoded frame and encodes it to JPEG. The scaled plane is reported before encoding,
+    // so that it can serve as a ladder step for smaller renditions.
+    class CSnapshotRenderer : public virtual NCorbaHelpers::CRefcountedImpl
+    {
+        NMMSS::PPullFilter  m_scaler;
+        NMMSS::PPullFilter  m_encoder;
+        TConnections        m_connections;
+        TOnSnapshotHandler  m_onPlane;
+        TOnSnapshotHandler  m_onJpeg;
+
+    public:
+        CSnapshotRenderer(DECLARE_LOGGER_ARG, const SRenditionKey& key, bool scale,
+            TOnSnapshotHandler onPlane, TOnSnapshotHandler onJpeg)
+            : m_encoder(NMMSS::CreateMJPEGEncoderFilter(GET_LOGGER_PTR, static_cast<NMMSS::EVideoCodingPreset>(key.m_quality)))
+            , m_onPlane(onPlane)
+            , m_onJpeg(onJpeg)
+        {
+            using namespace NMMSS;
+            ConnectionBroker *const connBroker = GetConnectionBroker();
+
+            NCorbaHelpers::CAutoPtr<CSnapshotRenderer> self(this, NCorbaHelpers::ShareOwnership());
+
+            PPullStyleSink jpegSink(NPluginHelpers::CreateSink(boost::bind(&CSnapshotRenderer::onJpeg, self, _1)));
+            m_connections.push_back(PConnection(connBroker->SetConnection(jpegSink.Get(), m_encoder->GetSource(), GET_LOGGER_PTR),
+                destroyConnection));
+
+            if (scale)
+            {
+                m_scaler = PPullFilter(CreateSizeFilter(GET_LOGGER_PTR, key.m_width, key.m_height, true,
+                    key.m_cropX, key.m_cropY, key.m_cropWidth, key.m_cropHeight));
+
+                PPullStyleSink planeSink(NPluginHelpers::CreateSink(boost::bind(&CSnapshotRenderer::onPlane, self, _1)));
+                m_connections.push_back(PConnection(connBroker->SetConnection(planeSink.Get(), m_scaler->GetSource(), GET_LOGGER_PTR),
+                    destroyConnection));
+            }
+        }
+
+        void Render(NMMSS::ISample* input)
+        {
+            if (m_scaler)
+                m_scaler->GetSink()->Receive(input);
+            else
+                m_encoder->GetSink()->Receive(input);
+        }
+
+        void Destroy()
+        {
+            m_connections.clear();
+        }
+
+    private:
+        void onPlane(NMMSS::ISample* sample)
+        {
+            m_onPlane(NMMSS::PSample(sample, NCorbaHelpers::ShareOwnership()));
+            m_encoder->GetSink()->Receive(sample);
+        }
+
+        void onJpeg(NMMSS::ISample* sample)
+        {
+            m_onJpeg(NMMSS::PSample(sample, NCorbaHelpers::ShareOwnership()));
+        }
+    };
+    typedef NCorbaHelpers::CAutoPtr<CSnapshotRenderer> PSnapshotRenderer;
+
+    // Per endpoint snapshot engine. The endpoint is decoded once per cache period,
+    // every requested size is scaled from the nearest larger ladder plane and encoded lazily.
     class CSnapshotContext : public virtual ISnapshotContext,
         public virtual NCorbaHelpers::CWeakReferableImpl
     {
         DECLARE_LOGGER_HOLDER;
 
+        typedef std::pair<NHttp::PResponse, bool> TWaiter;
+        typedef std::list<TWaiter> TWaiters;
+
+        struct SRendition
+        {
+            NMMSS::PSample m_jpeg;
+            PSnapshotRenderer m_renderer;
+            boost::shared_ptr<boost::asio::deadline_timer> m_renderTimer;
+            TWaiters m_waiters;
+        };
+        typedef std::map<SRenditionKey, SRendition> TRenditions;
+        typedef std::map<SRenditionKey, NMMSS::PSample> TPlanes;
+
         NCorbaHelpers::PReactor m_reactor;
         NCorbaHelpers::WPContainer m_container;
         const std::string m_ep;
-        typedef std::map<NHttp::PResponse, bool> TResponses;
-        TResponses m_responses;
-        bool m_headersOnly;
     public:
         CSnapshotContext(DECLARE_LOGGER_ARG, NCorbaHelpers::PReactor reactor
             , NCorbaHelpers::WPContainer c
@@ -249,34 +351,46 @@ namespace
             : m_reactor(reactor)
             , m_container(c)
             , m_ep(ep)
-            , m_processing(false)
             , m_stopping(false)
             , m_cacheTimer(m_reactor->GetIO())
         {
             INIT_LOGGER_HOLDER;
         }
 
-        void Execute(NHttp::PResponse r, bool headersOnly, uint32_t width, uint32_t height, float crop_x, float crop_y, float crop_width, float crop_height)
+        void Execute(NHttp::PResponse r, bool headersOnly, const SRenditionKey& key)
         {
             boost::mutex::scoped_lock lock(m_mutex);
-            while(m_processing)
-                m_condition.wait(lock);
+            if (m_stopping)
+            {
+                lock.unlock();
+                Error(r, IResponse::ServiceUnavailable);
+                return;
+            }
 
-            if (m_cachedSample)
+            SRendition& rendition = m_renditions[key];
+            if (rendition.m_jpeg)
             {
-                sendSample(r, headersOnly);
+                g_snapshotHits.fetch_add(1, std::memory_order_relaxed);
+                NMMSS::PSample s = rendition.m_jpeg;
+                lock.unlock();
+
+                sendSample(r, headersOnly, s);
                 return;
             }
 
-            if (!m_stopping)
+            g_snapshotMisses.fetch_add(1, std::memory_order_relaxed);
+            rendition.m_waiters.push_back(std::make_pair(r, headersOnly));
+
+            if (m_decoded)
             {
-                m_responses.insert(std::make_pair(r, headersOnly));
-                if (!m_sink)
-                {
-                    m_sink = PSnapshotSink(new CSnapshotSink(GET_LOGGER_PTR, m_reactor, m_container,
-                        boost::bind(&CSnapshotContext::OnSnapshot, makeSelfPtr(), _1)));
-                    m_sink->Connect(m_ep, width, height, crop_x, crop_y, crop_width, crop_height);
-                }
+                if (!rendition.m_renderer)
+                    render(lock, key);
+            }
+            else if (!m_sink)
+            {
+                m_sink = PSnapshotSink(new CSnapshotSink(GET_LOGGER_PTR, m_reactor, m_container,
+                    boost::bind(&CSnapshotContext::OnSnapshot, makeSelfPtr(), _1)));
+                m_sink->Connect(m_ep);
             }
         }
 
@@ -290,7 +404,7 @@ namespace
              }
             ));
 
-            m_sink->Connect(m_ep, 72, 0, 1,1,0,0);
+            m_sink->Connect(m_ep);
         }
 
         void Destroy()
@@ -306,49 +420,170 @@ namespace
                 m_sink.Reset();
             }
 
-            while(m_processing)
-                m_condition.wait(lock);
-
-            m_responses.clear();
+            for (auto& r : m_renditions)
+            {
+                if (r.second.m_renderer)
+                    r.second.m_renderer->Destroy();
+                if (r.second.m_renderTimer)
+                    r.second.m_renderTimer->cancel();
+            }
+            m_renditions.clear();
+            m_planes.clear();
+            m_decoded.Reset();
         }
 
     private:
         void OnSnapshot(NMMSS::PSample s)
         {
             boost::mutex::scoped_lock lock(m_mutex);
-            m_processing = true;
-            if (!m_stopping)
+            if (m_sink)
             {
                 m_sink->Disconnect();
                 m_sink.Reset();
             }
-            else
+
+            if (m_stopping)
             {
-                sendErrorToAll(IResponse::ServiceUnavailable);
+                sendErrorToAll(lock, IResponse::ServiceUnavailable);
                 return;
             }
 
             if(!s || NMMSS::NMediaType::CheckMediaType<NMMSS::NMediaType::Auxiliary::EndOfStream>(&s->Header()))
             {
-                sendErrorToAll(IResponse::NoContent);
+                sendErrorToAll(lock, IResponse::NoContent);
+                return;
             }
-            else
+
+            m_decoded = s;
+            m_planes.clear();
+
+            std::vector<SRenditionKey> pending;
+            for (auto& r : m_renditions)
             {
-                m_cachedSample = s;
-                TResponses responses = m_responses;
-                m_responses.clear();
-                onNotify();
-                lock.unlock();
+                if (!r.second.m_waiters.empty() && !r.second.m_renderer)
+                    pending.push_back(r.first);
+            }
+            lock.unlock();
+
+            // One at a time, so that every rendition can start from the planes of the previous ones.
+            for (const SRenditionKey& key : pending)
+            {
+                lock.lock();
+                TRenditions::iterator it = m_renditions.find(key);
+                if (m_stopping || m_renditions.end() == it || it->second.m_renderer)
+                    lock.unlock();
+                else
+                    render(lock, key);
+            }
 
-                m_cacheTimer.expires_from_now(boost::posix_time::milliseconds(NCorbaHelpers::CEnvar::SnapshotTimeout()));
-                m_cacheTimer.async_wait(boost::bind(&CSnapshotContext::invalidateCache, makeSelfPtr(), _1));
+            m_cacheTimer.expires_from_now(boost::posix_time::milliseconds(NCorbaHelpers::CEnvar::SnapshotTimeout()));
+            m_cacheTimer.async_wait(boost::bind(&CSnapshotContext::invalidateCache, makeSelfPtr(), _1));
+        }
+
+        // Picks the smallest already scaled plane that still covers the requested size.
+        NMMSS::PSample selectLadderStep(boost::mutex::scoped_lock&, const SRenditionKey& key, bool& scale)
+        {
+            scale = true;
 
-                TResponses::iterator it1 = responses.begin(), it2 = responses.end();
-                for (; it1 != it2; ++it1)
+            NMMSS::PSample input = m_decoded;
+            const SRenditionKey* best = nullptr;
+            for (const auto& p : m_planes)
+            {
+                if (!p.first.CanServe(key))
+                    continue;
+                if (nullptr == best || best->CanServe(p.first))
                 {
-                    sendSample(it1->first, it1->second);
+                    best = &p.first;
+                    input = p.second;
                 }
             }
+
+            if (nullptr != best && best->m_width == key.m_width && best->m_height == key.m_height)
+                scale = false;
+            return input;
+        }
+
+        // Releases the lock before rendering: the scaler and the encoder call back
+        // into onPlane and onJpeg, which take it themselves.
+        void render(boost::mutex::scoped_lock& lock, const SRenditionKey& key)
+        {
+            bool scale = true;
+            NMMSS::PSample input = selectLadderStep(lock, key, scale);
+
+            PSnapshotRenderer renderer(new CSnapshotRenderer(GET_LOGGER_PTR, key, scale,
+                boost::bind(&CSnapshotContext::onPlane, makeSelfPtr(), key, _1),
+                boost::bind(&CSnapshotContext::onJpeg, makeSelfPtr(), key, _1)));
+
+            // The renderer marks the rendition as in progress until the picture comes or the timer fires.
+            SRendition& rendition = m_renditions[key];
+            rendition.m_renderer = renderer;
+            rendition.m_renderTimer.reset(new boost::asio::deadline_timer(m_reactor->GetIO()));
+            rendition.m_renderTimer->expires_from_now(boost::posix_time::milliseconds(SAMPLE_TIMEOUT_MS));
+            rendition.m_renderTimer->async_wait(boost::bind(&CSnapshotContext::onRenderTimeout, makeSelfPtr(), key, renderer, _1));
+            lock.unlock();
+
+            renderer->Render(input.Get());
+        }
+
+        void onRenderTimeout(SRenditionKey key, PSnapshotRenderer renderer, boost::system::error_code ec)
+        {
+            if (ec)
+                return;
+
+            boost::mutex::scoped_lock lock(m_mutex);
+            TRenditions::iterator it = m_renditions.find(key);
+            if (m_renditions.end() == it || it->second.m_renderer.Get() != renderer.Get())
+                return;
+
+            _wrn_ << "Snapshot of " << m_ep << " has not been rendered in " << SAMPLE_TIMEOUT_MS << " ms";
+
+            SRendition& rendition = it->second;
+            rendition.m_renderer->Destroy();
+            rendition.m_renderer.Reset();
+
+            TWaiters waiters;
+            waiters.swap(rendition.m_waiters);
+            lock.unlock();
+
+            for (const TWaiter& w : waiters)
+            {
+                NHttp::PResponse response = w.first;
+                Error(response, IResponse::InternalServerError);
+            }
+        }
+
+        void onPlane(SRenditionKey key, NMMSS::PSample s)
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (!m_stopping && m_decoded && key.IsFullFrame())
+                m_planes[key] = s;
+        }
+
+        void onJpeg(SRenditionKey key, NMMSS::PSample s)
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            TRenditions::iterator it = m_renditions.find(key);
+            if (m_renditions.end() == it)
+                return;
+
+            SRendition& rendition = it->second;
+            if (rendition.m_renderer)
+            {
+                rendition.m_renderer->Destroy();
+                rendition.m_renderer.Reset();
+            }
+            if (rendition.m_renderTimer)
+                rendition.m_renderTimer->cancel();
+
+            TWaiters waiters;
+            waiters.swap(rendition.m_waiters);
+
+            if (m_decoded)
+                rendition.m_jpeg = s;
+            lock.unlock();
+
+            for (const TWaiter& w : waiters)
+                sendSample(w.first, w.second, s);
         }
 
         void RequestFilled(NHttp::PResponse r, boost::system::error_code error)
@@ -357,22 +592,18 @@ namespace
                 Error(r, IResponse::InternalServerError);
         }
 
-        void onNotify()
+        void sendErrorToAll(boost::mutex::scoped_lock& lock, NHttp::IResponse::EStatus status)
         {
-            m_processing = false;
-            m_condition.notify_one();
-        }
+            TWaiters waiters;
+            for (auto& r : m_renditions)
+                waiters.splice(waiters.end(), r.second.m_waiters);
+            lock.unlock();
 
-        void sendErrorToAll(NHttp::IResponse::EStatus status)
-        {
-            TResponses::iterator it1 = m_responses.begin(), it2 = m_responses.end();
-            for (; it1 != it2; ++it1)
+            for (const TWaiter& w : waiters)
             {
-                NHttp::PResponse response = it1->first;
+                NHttp::PResponse response = w.first;
                 Error(response, status);
             }
-            m_responses.clear();
-            onNotify();
         }
 
         void invalidateCache(boost::system::error_code ec)
@@ -380,13 +611,22 @@ namespace
             if (!ec)
             {
                 boost::mutex::scoped_lock lock(m_mutex);
-                m_cachedSample.Reset();
+                m_decoded.Reset();
+                m_planes.clear();
+
+                TRenditions::iterator it = m_renditions.begin();
+                while (m_renditions.end() != it)
+                {
+                    if (it->second.m_renderer)
+                        ++it;
+                    else
+                        it = m_renditions.erase(it);
+                }
             }
         }
 
-        void sendSample(NHttp::PResponse response, bool headersOnly)
+        void sendSample(NHttp::PResponse response, bool headersOnly, NMMSS::PSample s)
         {
-            NMMSS::PSample s = m_cachedSample;
             response->SetStatus(IResponse::OK);
             response << ContentLength(s->Header().nBodySize)
                        << ContentType(GetMIMETypeByExt("jpeg"))
@@ -408,10 +648,10 @@ namespace
 
         boost::mutex m_mutex;
         PSnapshotSink m_sink;
-        bool m_processing;
         bool m_stopping;
-        boost::condition m_condition;
-        NMMSS::PSample m_cachedSample;
+        NMMSS::PSample m_decoded;
+        TPlanes m_planes;
+        TRenditions m_renditions;
         boost::asio::deadline_timer m_cacheTimer;
     };
 
@@ -492,13 +732,21 @@ namespace
                 return;
             }
 
-            uint32_t width = npu::GetParam<int>(params, WIDTH_PARAMETER, 0);
-            uint32_t height = npu::GetParam<int>(params, HEIGHT_PARAMETER, 0);
+            SRenditionKey key;
+            key.m_width = npu::GetParam<int>(params, WIDTH_PARAMETER, 0);
+            key.m_height = npu::GetParam<int>(params, HEIGHT_PARAMETER, 0);
+
+            key.m_cropX = npu::GetParam<float>(params, "crop_x", 0.f);
+            key.m_cropY = npu::GetParam<float>(params, "crop_y", 0.f);
+            key.m_cropWidth = npu::GetParam<float>(params, "crop_width", 1.f);
+            key.m_cropHeight = npu::GetParam<float>(params, "crop_height", 1.f);
 
-            float crop_x = npu::GetParam<float>(params, "crop_x", 0.f);
-            float crop_y = npu::GetParam<float>(params, "crop_y", 0.f);
-            float crop_width = npu::GetParam<float>(params, "crop_width", 1.f);
-            float crop_height = npu::GetParam<float>(params, "crop_height", 1.f);
+            key.m_quality = npu::GetParam<int>(params, VIDEO_COMPRESSION_PARAMETER, NMMSS::VCP_BestQuality);
+            if (NMMSS::VCP_BestQuality > key.m_quality || key.m_quality > NMMSS::VCP_BestSize)
+            {
+                _wrn_ << "Wrong snapshot compression level " << key.m_quality << ". Adjust to default (0).";
+                key.m_quality = NMMSS::VCP_BestQuality;
+            }
 
             boost::mutex::scoped_lock lock(m_mutex);
             if (m_destroying)
@@ -506,19 +754,18 @@ namespace
             else
             {
                 PSnapshotContext ctx;
-                SSnapshotContextKey sck(endpoint, width, height);
-                TContextMap::iterator it = m_contexts.find(sck);
+                TContextMap::iterator it = m_contexts.find(endpoint);
                 if (m_contexts.end() == it)
                 {
                     ctx = PSnapshotContext(new CSnapshotContext(GET_LOGGER_PTR, m_reactor,
                         m_container, endpoint));
-                    m_contexts.insert(std::make_pair(sck, ctx));
+                    m_contexts.insert(std::make_pair(endpoint, ctx));
                 }
                 else
-                    ctx = m_contexts[sck];
+                    ctx = it->second;
 
                 m_reactor->GetIO().post(boost::bind(&ISnapshotContext::Execute,
-                    ctx, resp, headersOnly, width, height, crop_x, crop_y, crop_width, crop_height));
+                    ctx, resp, headersOnly, key));
             }
         }
 
@@ -540,31 +787,8 @@ namespace
         DECLARE_LOGGER_HOLDER;
         std::auto_ptr<NMMSS::CMMCodingInitialization> m_mmcoding;
 
-        struct SSnapshotContextKey
-        {
-            std::string m_ep;
-            uint32_t m_width;
-            uint32_t m_height;
-
-            SSnapshotContextKey(const std::string& ep, uint32_t width, uint32_t height)
-                : m_ep(ep)
-                , m_width(width)
-                , m_height(height)
-            {}
-
-            bool operator<(const SSnapshotContextKey& rhs) const
-            {
-                int res = strcmp(m_ep.c_str(), rhs.m_ep.c_str());
-                if (0 != res)
-                    return res < 0 ? true : false;
-                if (m_width != rhs.m_width)
-                    return m_width <= rhs.m_width;
-                if (m_height != rhs.m_height)
-                    return m_height <= rhs.m_height;
-                return false;
-            }
-        };
-        typedef std::map<SSnapshotContextKey, PSnapshotContext> TContextMap;
+        // One snapshot engine per endpoint, all requested renditions share its decoded frame.
+        typedef std::map<std::string, PSnapshotContext> TContextMap;
         TContextMap m_contexts;
 
         boost::mutex m_mutex;
@@ -581,4 +805,12 @@ namespace NHttp
     {
         return new CLiveSnapshotServlet(c, rc);
     }
+
+    SSnapshotCacheStatistics GetSnapshotCacheStatistics()
+    {
+        SSnapshotCacheStatistics res;
+        res.Hits = g_snapshotHits.load(std::memory_order_relaxed);
+        res.Misses = g_snapshotMisses.load(std::memory_order_relaxed);
+        return res;
+    }
 }
@@ -2,8 +2,16 @@
 #include "Constants.h"
 #include "BLQueryHelper.h"
 #include "CommonUtility.h"
+#include "GrpcReader.h"
+
+#include <mutex>
+#include <chrono>
+
+#include <CorbaHelpers/Uuid.h>
+#include <SecurityManager/SecurityManager.h>
 
 #include <axxonsoft/bl/security/SecurityService.grpc.pb.h>
+#include <axxonsoft/bl/events/Notification.grpc.pb.h>
 
 namespace bl = axxonsoft::bl;
 
@@ -22,6 +30,18 @@ namespace
     using PPermissionsReader_t = std::shared_ptr < PermissionsReader_t > ;
     using PermissionCallback_t = std::function < void(const bl::security::ListUserGlobalPermissionsResponse&, grpc::Status) > ;
 
+    using EventReader_t = NWebGrpc::AsyncStreamReader < bl::events::DomainNotifier, bl::events::PullEventsRequest,
+        bl::events::Events >;
+    using PEventReader_t = std::shared_ptr < EventReader_t >;
+    using EventCallback_t = std::function<void(const bl::events::Events&, NWebGrpc::STREAM_ANSWER, grpc::Status)>;
+
+    using DisconnectChannelReader_t = NWebGrpc::AsyncResultReader < bl::events::DomainNotifier, bl::events::DisconnectEventChannelRequest,
+        bl::events::DisconnectEventChannelResponse >;
+    using PDisconnectChannelReader_t = std::shared_ptr < DisconnectChannelReader_t >;
+
+    // Permissions of a session are reused for this long unless a configuration change arrives earlier.
+    const std::chrono::seconds RIGHTS_CACHE_TTL(30);
+
     class CRightsChecker : public NPluginUtility::IRigthsChecker
     {
         DECLARE_LOGGER_HOLDER;
@@ -34,13 +54,60 @@ namespace
             int m_cameraAccessLevel;
         };
         typedef std::shared_ptr<SCameraContext> PCameraContext;
+
+        typedef std::chrono::steady_clock TClock;
+
+        // Cached answer or an RPC in flight. Concurrent lookups of the same key wait for one RPC.
+        struct SPermissionsEntry
+        {
+            SPermissionsEntry()
+                : m_ready(false)
+            {}
+            bool m_ready;
+            TClock::time_point m_expires;
+            bl::security::ListUserGlobalPermissionsResponse m_response;
+            std::vector<PermissionCallback_t> m_waiters;
+        };
+        typedef std::map<std::string, SPermissionsEntry> TPermissionsCache;
+
+        struct SCameraAccessEntry
+        {
+            SCameraAccessEntry()
+                : m_ready(false)
+                , m_cameraAccessLevel(axxonsoft::bl::security::CAMERA_ACCESS_UNSPECIFIED)
+            {}
+            bool m_ready;
+            TClock::time_point m_expires;
+            int m_cameraAccessLevel;
+            std::vector<NPluginUtility::IsAllowCallbackInt_t> m_waiters;
+        };
+        typedef std::pair<std::string, std::string> TCameraAccessKey;
+        typedef std::map<TCameraAccessKey, SCameraAccessEntry> TCameraAccessCache;
     public:
         CRightsChecker(DECLARE_LOGGER_ARG, const NWebGrpc::PGrpcManager grpcManager)
             : m_grpcManager(grpcManager)
+            , m_generation(0)
+            , m_subscribed(false)
+            , m_eventSubscriptionId(NCorbaHelpers::GenerateUUIDString())
         {
             INIT_LOGGER_HOLDER;
         }
 
+        ~CRightsChecker()
+        {
+            if (!m_reader)
+                return;
+            m_reader->asyncStop();
+
+            // The server keeps the event channel until it is disconnected.
+            PDisconnectChannelReader_t reader(new DisconnectChannelReader_t
+                (GET_LOGGER_PTR, m_grpcManager, m_systemCred, &bl::events::DomainNotifier::Stub::AsyncDisconnectEventChannel));
+
+            bl::events::DisconnectEventChannelRequest req;
+            req.set_subscription_id(m_eventSubscriptionId);
+            reader->asyncRequest(req, [](const bl::events::DisconnectEventChannelResponse&, grpc::Status) {});
+        }
+
         void IsCameraAllowed(const std::string& cam, const AuthSession& session, NPluginUtility::IsAllowCallbackInt_t acb) override
         {
             if (TOKEN_AUTH_SESSION_ID == session.id)
@@ -49,12 +116,38 @@ namespace
                 return;
             }
 
-            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials( session.data.first?*(session.data.first):"");
+            const std::string token(session.data.first ? *(session.data.first) : "");
+            const TCameraAccessKey key(token, cam);
+            subscribeEvents();
+
+            std::uint64_t generation = 0;
+            {
+                std::unique_lock<std::mutex> lock(m_cacheMutex);
+                SCameraAccessEntry& entry = m_cameraAccess[key];
+                if (entry.m_ready && TClock::now() < entry.m_expires)
+                {
+                    const int level = entry.m_cameraAccessLevel;
+                    lock.unlock();
+
+                    acb(level);
+                    return;
+                }
+
+                entry.m_ready = false;
+                entry.m_waiters.push_back(acb);
+                if (entry.m_waiters.size() > 1)
+                    return;
+
+                generation = m_generation;
+                pruneExpired(lock);
+            }
+
+            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials(token);
 
             PCameraContext ctxOut = std::make_shared<SCameraContext>();
             NWebBL::TEndpoints eps{ cam };
             NWebBL::FAction action = boost::bind(&CRightsChecker::onCameraInfo, shared_from_base<CRightsChecker>(),
-                ctxOut, acb, _1, _2, _3);
+                key, generation, ctxOut, _1, _2, _3);
             NWebBL::QueryBLComponent(GET_LOGGER_PTR, m_grpcManager, metaCredentials, eps, action);
         }
 
@@ -63,15 +156,10 @@ namespace
             if (TOKEN_AUTH_SESSION_ID == session.id)
             {
                 acb(true);
+                return;
             }
 
-            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials( session.data.first ? *(session.data.first) : "");
-
-            PPermissionsReader_t reader(new PermissionsReader_t
-                (GET_LOGGER_PTR, m_grpcManager,
-                metaCredentials, &bl::security::SecurityService::Stub::AsyncListUserGlobalPermissions));
-
-            reader->asyncRequest(::google::protobuf::Empty(),
+            getGlobalPermissions(session,
                 [acb](const bl::security::ListUserGlobalPermissionsResponse& resp, grpc::Status valid)
             {
                 if (!valid.ok() || (0 == resp.permissions_size()))
@@ -99,15 +187,10 @@ namespace
             {
                 //TODO: BOOKMARK_ACCESS_CREATE_PROTECT_EDIT_DELETE here
                 acb(true);
+                return;
             }
 
-            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials( session.data.first ? *(session.data.first) : "");
-
-            PPermissionsReader_t reader(new PermissionsReader_t
-                (GET_LOGGER_PTR, m_grpcManager,
-                metaCredentials, &bl::security::SecurityService::Stub::AsyncListUserGlobalPermissions));
-
-             reader->asyncRequest(::google::protobuf::Empty(),
+            getGlobalPermissions(session,
                 [acb](const bl::security::ListUserGlobalPermissionsResponse& resp, grpc::Status valid)
             {
                 if (!valid.ok() || (0 == resp.permissions_size()))
@@ -134,15 +217,10 @@ namespace
             if (TOKEN_AUTH_SESSION_ID == session.id)
             {
                 acb(bl::security::ALERT_ACCESS_FULL);
+                return;
             }
 
-            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials( session.data.first ? *(session.data.first) : "");
-
-            PPermissionsReader_t reader(new PermissionsReader_t
-            (GET_LOGGER_PTR, m_grpcManager,
-                metaCredentials, &bl::security::SecurityService::Stub::AsyncListUserGlobalPermissions));
-
-            reader->asyncRequest(::google::protobuf::Empty(),
+            getGlobalPermissions(session,
                 [acb](const bl::security::ListUserGlobalPermissionsResponse& resp, grpc::Status valid)
             {
                 if (!valid.ok() || (0 == resp.permissions_size()))
@@ -169,30 +247,88 @@ namespace
             if (TOKEN_AUTH_SESSION_ID == session.id)
             {
                 acb(true);
+                return;
+            }
+
+            PermissionCallback_t cb = std::bind(&CRightsChecker::onHasPermissions,
+                shared_from_base<CRightsChecker>(), permissions, acb,
+                std::placeholders::_1, std::placeholders::_2);
+
+            getGlobalPermissions(session, cb);
+        }
+    private:
+        void getGlobalPermissions(const AuthSession& session, PermissionCallback_t cb)
+        {
+            const std::string token(session.data.first ? *(session.data.first) : "");
+            subscribeEvents();
+
+            std::uint64_t generation = 0;
+            {
+                std::unique_lock<std::mutex> lock(m_cacheMutex);
+                SPermissionsEntry& entry = m_permissions[token];
+                if (entry.m_ready && TClock::now() < entry.m_expires)
+                {
+                    const bl::security::ListUserGlobalPermissionsResponse resp(entry.m_response);
+                    lock.unlock();
+
+                    cb(resp, grpc::Status::OK);
+                    return;
+                }
+
+                entry.m_ready = false;
+                entry.m_waiters.push_back(cb);
+                if (entry.m_waiters.size() > 1)
+                    return;
+
+                generation = m_generation;
+                pruneExpired(lock);
             }
 
-            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials( session.data.first ? *(session.data.first) : "");
+            NGrpcHelpers::PCredentials metaCredentials = NGrpcHelpers::NGPAuthTokenCallCredentials(token);
 
             PPermissionsReader_t reader(new PermissionsReader_t
                 (GET_LOGGER_PTR, m_grpcManager,
                 metaCredentials, &bl::security::SecurityService::Stub::AsyncListUserGlobalPermissions));
 
-            ::google::protobuf::Empty req;
-
-            PermissionCallback_t cb = std::bind(&CRightsChecker::onHasPermissions,
-                shared_from_base<CRightsChecker>(), permissions, acb,
+            PermissionCallback_t done = std::bind(&CRightsChecker::onGlobalPermissions,
+                shared_from_base<CRightsChecker>(), token, generation,
                 std::placeholders::_1, std::placeholders::_2);
 
-            reader->asyncRequest(req, cb);
+            reader->asyncRequest(::google::protobuf::Empty(), done);
         }
-    private:
-        void onCameraInfo(PCameraContext ctxOut, NPluginUtility::IsAllowCallbackInt_t acb,
+
+        void onGlobalPermissions(const std::string& token, std::uint64_t generation,
+            const bl::security::ListUserGlobalPermissionsResponse& resp, grpc::Status valid)
+        {
+            std::vector<PermissionCallback_t> waiters;
+            {
+                std::unique_lock<std::mutex> lock(m_cacheMutex);
+                TPermissionsCache::iterator it = m_permissions.find(token);
+                if (m_permissions.end() != it)
+                {
+                    waiters.swap(it->second.m_waiters);
+                    if (valid.ok() && generation == m_generation)
+                    {
+                        it->second.m_ready = true;
+                        it->second.m_expires = TClock::now() + RIGHTS_CACHE_TTL;
+                        it->second.m_response = resp;
+                    }
+                    else
+                        m_permissions.erase(it);
+                }
+            }
+
+            for (const PermissionCallback_t& cb : waiters)
+                cb(resp, valid);
+        }
+
+        void onCameraInfo(const TCameraAccessKey& key, std::uint64_t generation, PCameraContext ctxOut,
             const ::google::protobuf::RepeatedPtrField< ::axxonsoft::bl::domain::Camera >& cams, NWebGrpc::STREAM_ANSWER valid, grpc::Status status)
         {
             if (!status.ok())
             {
                 _err_ << "RightsChecker: GetCamerasByComponents method failed";
-                acb(axxonsoft::bl::security::CAMERA_ACCESS_UNSPECIFIED);
+                completeCameraAccess(key, generation, axxonsoft::bl::security::CAMERA_ACCESS_UNSPECIFIED, false);
                 return;
             }
 
@@ -200,7 +336,128 @@ namespace
 
             if (valid == NWebGrpc::_FINISH)
             {
-                acb(ctxOut->m_cameraAccessLevel);
+                completeCameraAccess(key, generation, ctxOut->m_cameraAccessLevel, true);
+            }
+        }
+
+        void completeCameraAccess(const TCameraAccessKey& key, std::uint64_t generation, int level, bool cacheable)
+        {
+            std::vector<NPluginUtility::IsAllowCallbackInt_t> waiters;
+            {
+                std::unique_lock<std::mutex> lock(m_cacheMutex);
+                TCameraAccessCache::iterator it = m_cameraAccess.find(key);
+                if (m_cameraAccess.end() != it)
+                {
+                    waiters.swap(it->second.m_waiters);
+                    if (cacheable && generation == m_generation)
+                    {
+                        it->second.m_ready = true;
+                        it->second.m_expires = TClock::now() + RIGHTS_CACHE_TTL;
+                        it->second.m_cameraAccessLevel = level;
+                    }
+                    else
+                        m_cameraAccess.erase(it);
+                }
+            }
+
+            for (const NPluginUtility::IsAllowCallbackInt_t& acb : waiters)
+                acb(level);
+        }
+
+        // Drops answers nobody asked for during their lifetime, lookups in flight are kept.
+        void pruneExpired(std::unique_lock<std::mutex>&)
+        {
+            const TClock::time_point now = TClock::now();
+            for (TPermissionsCache::iterator it = m_permissions.begin(); m_permissions.end() != it;)
+            {
+                if (it->second.m_waiters.empty() && it->second.m_expires <= now)
+                    it = m_permissions.erase(it);
+                else
+                    ++it;
+            }
+            for (TCameraAccessCache::iterator it = m_cameraAccess.begin(); m_cameraAccess.end() != it;)
+            {
+                if (it->second.m_waiters.empty() && it->second.m_expires <= now)
+                    it = m_cameraAccess.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        void invalidateCache()
+        {
+            std::unique_lock<std::mutex> lock(m_cacheMutex);
+            ++m_generation;
+            for (TPermissionsCache::iterator it = m_permissions.begin(); m_permissions.end() != it;)
+            {
+                if (it->second.m_waiters.empty())
+                    it = m_permissions.erase(it);
+                else
+                    ++it;
+            }
+            for (TCameraAccessCache::iterator it = m_cameraAccess.begin(); m_cameraAccess.end() != it;)
+            {
+                if (it->second.m_waiters.empty())
+                    it = m_cameraAccess.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        // Security settings are a part of the domain configuration, any config or camera change drops the cache.
+        void subscribeEvents()
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_cacheMutex);
+                if (m_subscribed)
+                    return;
+                m_subscribed = true;
+            }
+
+            if (!m_systemCred)
+                m_systemCred = NGrpcHelpers::NGPAuthTokenCallCredentials(
+                    NSecurityManager::CreateSystemSession(GET_LOGGER_PTR, "HttpPlugin/RightsChecker"));
+
+            // A finished stream may still be winding down its coroutine.
+            if (m_reader)
+                m_reader->asyncStop();
+            m_reader.reset(new EventReader_t
+                (GET_LOGGER_PTR, m_grpcManager, m_systemCred, &bl::events::DomainNotifier::Stub::AsyncPullEvents));
+
+            bl::events::PullEventsRequest req;
+            req.set_subscription_id(m_eventSubscriptionId);
+
+            bl::events::EventFilters* filter = req.mutable_filters();
+            filter->add_include()->set_event_type(bl::events::ET_ConfigChangedEvent);
+            filter->add_include()->set_event_type(bl::events::ET_CameraChangedEvent);
+
+            // A weak reference, or the stream would keep the checker alive for good.
+            EventCallback_t cb = std::bind(&CRightsChecker::onEvents,
+                boost::weak_ptr<CRightsChecker>(shared_from_base<CRightsChecker>()),
+                std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+
+            m_reader->asyncRequest(req, cb);
+        }
+
+        static void onEvents(boost::weak_ptr<CRightsChecker> obj, const bl::events::Events& res, NWebGrpc::STREAM_ANSWER valid, grpc::Status status)
+        {
+            boost::shared_ptr<CRightsChecker> owner = obj.lock();
+            if (owner)
+                owner->processEvents(res, valid, status);
+        }
+
+        void processEvents(const bl::events::Events& res, NWebGrpc::STREAM_ANSWER valid, grpc::Status status)
+        {
+            if (res.items_size() > 0)
+                invalidateCache();
+
+            if (!status.ok() || NWebGrpc::_FINISH == valid)
+            {
+                _wrn_ << "RightsChecker: event subscription closed, cached permissions are dropped";
+                invalidateCache();
+
+                std::unique_lock<std::mutex> lock(m_cacheMutex);
+                m_subscribed = false;
             }
         }
 
@@ -289,6 +546,16 @@ namespace
         }
 
         const NWebGrpc::PGrpcManager m_grpcManager;
+
+        std::mutex m_cacheMutex;
+        std::uint64_t m_generation;
+        TPermissionsCache m_permissions;
+        TCameraAccessCache m_cameraAccess;
+
+        bool m_subscribed;
+        const std::string m_eventSubscriptionId;
+        NGrpcHelpers::PCredentials m_systemCred;
+        PEventReader_t m_reader;
     };
 }
 
@@ -36,7 +36,7 @@ CSearchPlugin<TDatabase>::~CSearchPlugin()
     std::lock_guard<std::mutex> lock(m_searchMutex);
     TSearches::const_iterator it1 = m_searches.begin(), it2 = m_searches.end();
     for (; it1 != it2; ++it1)
-        it1->second->StopSearch();
+        CancelSearch(it1->first, it1->second.Context);
 }
 
 template <typename TDatabase>
@@ -69,23 +69,23 @@ void CSearchPlugin<TDatabase>::Get(const NHttp::PRequest req, NHttp::PResponse r
     PSearchContext searchCtx;
     {
         std::lock_guard<std::mutex> lock(m_searchMutex);
-        TSearches::const_iterator it = m_searches.find(searchId);
+        DropAbandonedSearches();
+
+        typename TSearches::iterator it = m_searches.find(searchId);
         if (m_searches.end() == it)
         {
-            TDefferredIds::const_iterator it2 = m_defferredIds.find(searchId);
-            if (m_defferredIds.end() == it2)
-            {
-                _err_ << "Requested search session (" << searchId << ") not found";
-                Error(resp, IResponse::NotFound);
-                return;
-            }
-            else
-            {
-                Error(resp, IResponse::PartialContent);
-                return;
-            }
+            _err_ << "Requested search session (" << searchId << ") not found";
+            Error(resp, IResponse::NotFound);
+            return;
+        }
+
+        it->second.LastAccess = std::chrono::steady_clock::now();
+        if (GetSearchScheduler().IsPending(searchId))
+        {
+            Error(resp, IResponse::PartialContent);
+            return;
         }
-        searchCtx = it->second;
+        searchCtx = it->second.Context;
     }
 
     if (searchCtx)
@@ -106,7 +106,9 @@ void CSearchPlugin<TDatabase>::Delete(const NHttp::PRequest req, NHttp::PRespons
     }
 
     std::lock_guard<std::mutex> lock(m_searchMutex);
-    TSearches::const_iterator it = m_searches.find(searchId);
+    DropAbandonedSearches();
+
+    typename TSearches::iterator it = m_searches.find(searchId);
     if (m_searches.end() == it)
     {
         _err_ << "Requested search session (" << searchId << ") not found.";
@@ -114,7 +116,7 @@ void CSearchPlugin<TDatabase>::Delete(const NHttp::PRequest req, NHttp::PRespons
         return;
     }
 
-    it->second->StopSearch();
+    CancelSearch(it->first, it->second.Context);
     m_searches.erase(it);
 
     Error(resp, IResponse::NoContent);
@@ -271,13 +273,6 @@ void CSearchPlugin<TDatabase>::DoSearch(const NHttp::PRequest req, NHttp::PRespo
     const std::string& hostName, const std::vector<std::string>& origins, Json::Value& data,
     boost::posix_time::ptime beginTime, boost::posix_time::ptime endTime, bool descending)
 {
-    if (m_defferredSearchCount >= m_maxDefferredCount)
-    {
-        _wrn_ << "Search query rejected. Too many requests";
-        Error(resp, IResponse::InternalServerError);
-        return;
-    }
-
     std::string exportId(NCorbaHelpers::GenerateUUIDString());
 
     PSearchContext searchCtx(CreateSearchContext(req, db, hostName, origins, data, beginTime, endTime, descending));
@@ -287,26 +282,26 @@ void CSearchPlugin<TDatabase>::DoSearch(const NHttp::PRequest req, NHttp::PRespo
         return;
     }
 
-    if (m_searchCount >= m_maxActiveCount)
     {
-        ++m_defferredSearchCount;
-
         std::unique_lock<std::mutex> lock(m_searchMutex);
-        m_defferredSearches.push_back(std::make_pair(exportId, searchCtx));
-        m_defferredIds.insert(exportId);
+        DropAbandonedSearches();
+
+        SSearch search = { searchCtx, std::chrono::steady_clock::now() };
+        m_searches.insert(std::make_pair(exportId, search));
     }
-    else
+
+    // Searches of one servlet form a type, the authenticated user is the unit of fairness within it.
+    if (!GetSearchScheduler().Submit(exportId, req->GetContextPath(), m_searchWeight, m_maxActiveCount,
+        req->GetAuthSession().user, boost::bind(&TThis::StartScheduledSearch, exportId, searchCtx)))
     {
-        ++m_searchCount;
         {
             std::unique_lock<std::mutex> lock(m_searchMutex);
-            m_searches.insert(std::make_pair(exportId, searchCtx));
+            m_searches.erase(exportId);
         }
-            
-        searchCtx->Init(boost::bind(&TThis::SearchDone,
-            boost::weak_ptr<TThis>(shared_from_base<TThis>())));
-        searchCtx->StartSearch();
 
+        _wrn_ << "Search query rejected. Too many requests";
+        Error(resp, IResponse::InternalServerError);
+        return;
     }
 
     NHttp::SHttpHeader contentDispositionHeader("Location", req->GetPrefix() + req->GetContextPath() + "/" + exportId);
@@ -394,42 +389,44 @@ TDatabase* CSearchPlugin<TDatabase>::GetDatabaseReference(NCorbaHelpers::IContai
 }
 
 template <typename TDatabase>
-void CSearchPlugin<TDatabase>::SearchDone(boost::weak_ptr<TThis> sp)
+void CSearchPlugin<TDatabase>::StartScheduledSearch(const std::string& id, PSearchContext ctx)
 {
-    if (auto plugin = sp.lock())
-    {
-        plugin->DoNextSearch();
-    }
+    // The slot is returned when the search reports completion, or at the latest
+    // when the context goes away.
+    std::shared_ptr<CSearchSlot> slot(std::make_shared<CSearchSlot>(GetSearchScheduler(), id));
+    ctx->Init([slot]() { slot->Release(); });
+    ctx->StartSearch();
+}
+
+template <typename TDatabase>
+void CSearchPlugin<TDatabase>::CancelSearch(const std::string& id, const PSearchContext& ctx)
+{
+    if (!GetSearchScheduler().Cancel(id))
+        ctx->StopSearch();
 }
 
 template <typename TDatabase>
-void CSearchPlugin<TDatabase>::DoNextSearch()
+void CSearchPlugin<TDatabase>::DropAbandonedSearches()
 {
-    PSearchContext ctx;
+    // The search API is polled, so a client that went away shows up as a search
+    // nobody asks about any more. Only running and waiting ones cost a slot or a database,
+    // finished results are kept for the clients that fetch them late.
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    typename TSearches::iterator it = m_searches.begin();
+    while (m_searches.end() != it)
     {
-        std::lock_guard<std::mutex> lock(m_searchMutex);
-        if (m_defferredSearches.empty())
+        const bool finished = it->second.Context->IsFinished();
+        if (it->second.LastAccess + (finished ? std::chrono::steady_clock::duration(FINISHED_SEARCH_TTL) : SEARCH_IDLE_TIMEOUT) < now)
         {
-            --m_searchCount;
-            _log_ << "No pending searches";
-            return;
+            if (finished)
+                _log_ << "Results of search session (" << it->first << ") expired. Dropping them";
+            else
+                _wrn_ << "Search session (" << it->first << ") is not polled by its client. Dropping it";
+            CancelSearch(it->first, it->second.Context);
+            it = m_searches.erase(it);
         }
-
-        TSearchInfo si = m_defferredSearches.front();
-        m_defferredSearches.pop_front();
-
-        ctx = si.second;
-        m_defferredIds.erase(si.first);
-        m_searches.insert(std::make_pair(si.first, ctx));
-    }
-
-    --m_defferredSearchCount;
-
-    if (ctx)
-    {
-        ctx->Init(boost::bind(&TThis::SearchDone,
-            boost::weak_ptr<TThis>(shared_from_base<TThis>())));
-        ctx->StartSearch();
+        else
+            ++it;
     }
 }
 
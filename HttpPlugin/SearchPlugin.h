@@ -1,11 +1,16 @@
 #include <mutex>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include <Logging/log2.h>
 #include <CorbaHelpers/Container.h>
 
 #include "CommonUtility.h"
 #include "Tokens.h"
+#include "SearchScheduler.h"
 
 #include <HttpServer/HttpServer.h>
 #include <HttpServer/BasicServletImpl.h>
@@ -18,8 +23,16 @@
 
 namespace
 {
+    // Per search type; the slots shared by all types are counted by the search scheduler.
     const std::uint32_t MAX_ACTIVE_SEARCH_COUNT = 8;
-    const std::uint32_t MAX_DEFFERRED_SEARCH_COUNT = 200;
+    // Share of the scheduler slots when search types compete for them.
+    const std::uint32_t DEFAULT_SEARCH_WEIGHT = 2;
+    // A running or waiting search whose results nobody has asked for this long
+    // is considered abandoned by its client: it is stopped and dropped.
+    const std::chrono::minutes SEARCH_IDLE_TIMEOUT(2);
+    // The results of a finished search are kept until the client deletes them
+    // or leaves them alone this long.
+    const std::chrono::hours FINISHED_SEARCH_TTL(1);
 }
 
 template <typename TResultContainer>
@@ -58,7 +71,17 @@ struct ISearchContext : public std::enable_shared_from_this<ISearchContext>
     
     void Init(FSearchDone done)
     {
-        m_done = done;
+        m_done = [this, done]()
+        {
+            m_finished = true;
+            if (done)
+                done();
+        };
+    }
+
+    bool IsFinished() const
+    {
+        return m_finished;
     }
 
     virtual void StartSearch() = 0;
@@ -72,13 +95,52 @@ struct ISearchContext : public std::enable_shared_from_this<ISearchContext>
         return std::dynamic_pointer_cast<Derived>(shared_from_this());
     }
 
-    void SendResponse(const NHttp::PRequest req, NHttp::PResponse resp, const Json::Value& responseObject, bool searchFinished) const
+    // Streams { <members of fields>, "<arrayName>": [...] }, so that large results are neither
+    // built as one Json::Value nor serialised in one go on a reactor thread. [first, last) is
+    // the page selected under lock, which is released here. The results of a finished search
+    // do not change any more and are walked in place, a portion at a time under the mutex;
+    // the page of a running one is copied before, otherwise the results the search inserts
+    // meanwhile would leak into it or shift its bounds. The context stays alive until the
+    // response is written.
+    template <typename TIterator, typename FWriteItem>
+    void SendResponse(const NHttp::PRequest req, NHttp::PResponse resp, std::unique_lock<std::mutex>& lock, bool searchFinished,
+        const Json::Value& fields, const char* arrayName, TIterator first, TIterator last, FWriteItem writeItem) const
     {
-        NPluginUtility::SendText(req, resp, responseObject.toStyledString(),
-            searchFinished ? NHttp::IResponse::OK : NHttp::IResponse::PartialContent);
+        std::shared_ptr<const ISearchContext> self(shared_from_this());
+        auto open = [self, fields, arrayName](NPluginUtility::CJsonStreamWriter& writer)
+        {
+            writer.BeginObject();
+            for (Json::Value::const_iterator it = fields.begin(); it != fields.end(); ++it)
+                writer.Key(it.name()).Value(*it);
+            writer.Key(arrayName);
+        };
+        auto close = [](NPluginUtility::CJsonStreamWriter& writer) { writer.EndObject(); };
+
+        if (searchFinished)
+        {
+            std::mutex* mutex = lock.mutex();
+            lock.unlock();
+            NPluginUtility::SendJsonStream(req, resp, NPluginUtility::StreamArray(mutex, first, last, writeItem, open, close),
+                NHttp::IResponse::OK);
+            return;
+        }
+
+        typedef typename std::decay<decltype(*first)>::type TItem;
+        std::shared_ptr<std::vector<TItem>> page(new std::vector<TItem>());
+        for (; first != last; ++first)
+            page->push_back(*first);
+        lock.unlock();
+
+        NPluginUtility::SendJsonStream(req, resp,
+            NPluginUtility::StreamArray(nullptr, page->cbegin(), page->cend(), writeItem,
+                [page, open](NPluginUtility::CJsonStreamWriter& writer) { open(writer); }, close),
+            NHttp::IResponse::PartialContent);
     }
 
     FSearchDone m_done;
+
+private:
+    std::atomic<bool> m_finished{ false };
 };
 typedef std::shared_ptr<ISearchContext> PSearchContext;
 
@@ -92,10 +154,8 @@ protected:
 public:
     CSearchPlugin(NCorbaHelpers::IContainer *c)
         : m_container(c)
-        , m_searchCount(0)
-        , m_defferredSearchCount(0)
         , m_maxActiveCount(MAX_ACTIVE_SEARCH_COUNT)
-        , m_maxDefferredCount(MAX_DEFFERRED_SEARCH_COUNT)
+        , m_searchWeight(DEFAULT_SEARCH_WEIGHT)
     {
         INIT_LOGGER_HOLDER_FROM_CONTAINER(c);
     }
@@ -122,26 +182,26 @@ protected:
     const char* const GetDatabaseReferenceName();
     TDatabase* GetDatabaseReference(NCorbaHelpers::IContainer* cont, const std::string& hostName);
 
-    static void SearchDone(boost::weak_ptr<TThis> sp);
-    void DoNextSearch();
+    static void StartScheduledSearch(const std::string& id, PSearchContext ctx);
+    // Both expect m_searchMutex to be held.
+    void CancelSearch(const std::string& id, const PSearchContext& ctx);
+    void DropAbandonedSearches();
 
     NCorbaHelpers::WPContainer m_container;
 
-    typedef std::map<std::string, PSearchContext> TSearches;
-    typedef std::pair<std::string, PSearchContext> TSearchInfo;
-    typedef std::deque<TSearchInfo> TDefferredSearches;
-    typedef std::set<std::string> TDefferredIds;
+    struct SSearch
+    {
+        PSearchContext Context;
+        std::chrono::steady_clock::time_point LastAccess;
+    };
+    typedef std::map<std::string, SSearch> TSearches;
 
+    // Running, waiting for a slot and finished searches.
     std::mutex m_searchMutex;
     TSearches m_searches;
-    TDefferredSearches m_defferredSearches;
-    TDefferredIds m_defferredIds;
-
-    std::atomic<std::uint32_t> m_searchCount;
-    std::atomic<std::uint32_t> m_defferredSearchCount;
 
     std::uint32_t m_maxActiveCount;
-    std::uint32_t m_maxDefferredCount;
+    std::uint32_t m_searchWeight;
 
     std::mutex m_dbMutex;
     typedef std::map<std::string, DB_var> TDatabases;
@@ -216,31 +216,24 @@ namespace
                 return;
             }
 
-            Json::Value events(Json::arrayValue);
+            std::pair<Json::Value::const_iterator, Json::Value::const_iterator> its;
+            Json::Value fields(Json::objectValue);
+            std::unique_lock<std::mutex> lock(m_mutex);
             try
             {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                std::pair<Json::Value::const_iterator, Json::Value::const_iterator> its = SelectIteratorRange(m_events, offset, limit);
-                if (its.first == m_events.begin() && its.second == m_events.end())
-                    events = m_events;
-                else
-                {
-                    for (; its.first != its.second; ++(its.first))
-                        events.append(*(its.first));
-                }
+                its = SelectIteratorRange(m_events, offset, limit);
+                fields["more"] = offset + limit < m_events.size();
             }
             catch (const std::exception& e)
             {
+                lock.unlock();
                 _err_ << e.what();
                 Error(resp, IResponse::NotFound);
                 return;
             }
 
-            Json::Value responseObject(Json::objectValue);
-            responseObject["events"] = events;
-            responseObject["more"] = offset + limit < m_events.size();
-
-            SendResponse(req, resp, responseObject, m_searchFinished);
+            SendResponse(req, resp, lock, m_searchFinished, fields, "events", its.first, its.second,
+                [](NPluginUtility::CJsonStreamWriter& writer, const Json::Value& ev) { writer.Value(ev); });
         }
     private:
         // TODO: use NativeBL EventHistory interface instead of CORBA ReadLprEvents
@@ -2,21 +2,18 @@
 #include "HttpPlugin.h"
 #include "SearchPlugin.h"
 #include "RegexUtility.h"
+#include "GrpcReader.h"
 
-#include <CorbaHelpers/Reactor.h>
 #include <CorbaHelpers/Unicode.h>
 #include <Crypto/Crypto.h>
 
 #include <boost/asio.hpp>
 
-#include <NativeBLClient/NativeBLClient.h>
-#include <GrpcHelpers/GrpcSpawnClient2.h>
-#include <GrpcHelpers/GrpcClient.h>
-#include <GrpcHelpers/GrpcClientBasicResponseHandler.h>
 #include <axxonsoft/bl/events/EventHistory.grpc.pb.h>
 
 using namespace NHttp;
 using namespace NPluginUtility;
+namespace abe = axxonsoft::bl::events;
 
 namespace
 {
@@ -24,8 +21,16 @@ namespace
 
     const uint32_t DEFAULT_PORTION_SIZE = 1000;
 
+    // Face searches are the heaviest ones, they get the smallest share of the search slots.
+    const std::uint32_t FACE_SEARCH_WEIGHT = 1;
+
     std::chrono::milliseconds DEQUEUE_TIMEOUT = std::chrono::milliseconds(15 * 1000);
 
+    using FindSimilarObjectsReader_t = NWebGrpc::AsyncStreamReader<abe::EventHistoryService, abe::FindSimilarObjectsRequest,
+        abe::FindSimilarObjectsResponse>;
+    using ReadEventsReader_t = NWebGrpc::AsyncStreamReader<abe::EventHistoryService, abe::ReadEventsRequest,
+        abe::ReadEventsResponse>;
+
     struct SFaceEvent
     {
         struct Position
@@ -57,9 +62,10 @@ namespace
     struct FaceSearchContext : public ISearchContext
     {
         DECLARE_LOGGER_HOLDER;
-        FaceSearchContext(DECLARE_LOGGER_ARG, size_t bufSize, CORBA::Octet* buf, ORM::AsipDatabase_var orm, NGrpcHelpers::PBoundGrpcClient nativeBLClient,
-            ORM::StringSeq& origins, ORM::TimeRange& range, float accuracy)
-            : m_reactor(NCorbaHelpers::GetReactorInstanceShared())
+        FaceSearchContext(DECLARE_LOGGER_ARG, size_t bufSize, CORBA::Octet* buf, const NWebGrpc::PGrpcManager grpcManager,
+            NGrpcHelpers::PCredentials metaCredentials, ORM::StringSeq& origins, ORM::TimeRange& range, float accuracy)
+            : m_grpcManager(grpcManager)
+            , m_metaCredentials(metaCredentials)
             , m_image(bufSize, bufSize, buf, 1)
             , m_origins(origins)
             , m_range(range)
@@ -68,7 +74,6 @@ namespace
             , m_errorOccurred(false)
             , m_searchStopped(false)
             , m_searchFinished(false)
-            , m_nativeBLClient(nativeBLClient)
         {
             INIT_LOGGER_HOLDER;
         }
@@ -81,16 +86,35 @@ namespace
         void StartSearch()
         {
             _dbg_ << "Starting face search...";
-            if (m_reactor)
+            if (!m_searchStopped)
             {
-                m_reactor->GetIO().post(std::bind(&FaceSearchContext::SearchTask, shared_from_base<FaceSearchContext>(), DEFAULT_PORTION_SIZE, 0U));
+                try
+                {
+                    if (m_haveImage)
+                        startReader<FindSimilarObjectsReader_t>(&abe::EventHistoryService::Stub::AsyncFindSimilarObjects,
+                            createFindSimilarObjectsRequest(DEFAULT_PORTION_SIZE, 0U));
+                    else
+                        startReader<ReadEventsReader_t>(&abe::EventHistoryService::Stub::AsyncReadEvents,
+                            createReadEventsRequest(DEFAULT_PORTION_SIZE, 0U));
+                    return;
+                }
+                catch (const std::exception& e)
+                {
+                    m_errorOccurred = true;
+                    _err_ << "Face search error: " << e.what();
+                }
             }
+            finishSearch();
         }
 
         void StopSearch()
         {
             _dbg_ << "Stopping face search...";
             m_searchStopped = true;
+
+            std::lock_guard<std::mutex> lock(m_readerMutex);
+            if (m_stopReader)
+                m_stopReader();
         }
 
         void GetResult(const PRequest req, PResponse resp, size_t offset, size_t limit) const
@@ -102,157 +126,128 @@ namespace
             }
 
             typename TFaceEventCont::const_iterator it1, it2;
+            Json::Value fields(Json::objectValue);
+            std::unique_lock<std::mutex> lock(m_mutex);
             try
             {
-                std::unique_lock<std::mutex> lock(m_mutex);
                 std::pair<typename TFaceEventCont::const_iterator, typename TFaceEventCont::const_iterator> its = SelectIteratorRange(m_events, offset, limit);
                 it1 = its.first, it2 = its.second;
+                fields["more"] = offset + limit < m_events.size();
             }
             catch (const std::exception& e)
             {
+                lock.unlock();
                 _err_ << e.what();
                 Error(resp, IResponse::NotFound);
                 return;
             }
 
-            Json::Value responseObject(Json::objectValue);
-            responseObject["events"] = Json::Value(Json::arrayValue);
-            responseObject["more"] = offset + limit < m_events.size();
+            SendResponse(req, resp, lock, m_searchFinished, fields, "events", it1, it2,
+                [this](NPluginUtility::CJsonStreamWriter& writer, const auto& value)
+                {
+                    Json::Value ev(Json::objectValue);
+                    getResultEvent(value, ev);
+                    writer.Value(ev);
+                });
+        }
+    private:
+        // The stream is read by a coroutine on the reactor, its answers are handled
+        // as they arrive; no thread waits for the search to complete.
+        template <typename TReader, typename TRequest>
+        void startReader(typename TReader::AsyncRpcMethod_t method, const TRequest& request)
+        {
+            auto reader = std::make_shared<TReader>(GET_LOGGER_PTR, m_grpcManager, m_metaCredentials, method, DEQUEUE_TIMEOUT);
+            {
+                std::lock_guard<std::mutex> lock(m_readerMutex);
+                std::weak_ptr<TReader> weakReader(reader);
+                m_stopReader = [weakReader]()
+                {
+                    if (auto r = weakReader.lock())
+                        r->asyncStop();
+                };
+                // StopSearch() may have come in before the reader existed.
+                if (m_searchStopped)
+                    reader->asyncStop();
+            }
 
-            for (; it1 != it2; ++it1)
+            // The context is kept until the stream ends, so that completion is always reported.
+            auto owner = shared_from_base<FaceSearchContext>();
+            reader->asyncRequest(request, [owner](const auto& res, NWebGrpc::STREAM_ANSWER status, grpc::Status grpcStatus)
             {
-                Json::Value ev(Json::objectValue);
+                owner->processResult(res, status, grpcStatus);
+            });
+        }
 
-                getResultEvent(*it1, ev);
-                responseObject["events"].append(ev);
+        template <typename TResponse>
+        void processResult(const TResponse& res, NWebGrpc::STREAM_ANSWER status, grpc::Status grpcStatus)
+        {
+            if (NWebGrpc::_PROGRESS == status)
+            {
+                TFaceEventCont events;
+                ConvertFaceEvents(res.items(), events);
+                appendEvents(events);
+                return;
             }
 
-            SendResponse(req, resp, responseObject, m_searchFinished);
+            if (!grpcStatus.ok())
+            {
+                m_errorOccurred = true;
+                _err_ << "Face search error: " << grpcStatus.error_message();
+            }
+            finishSearch();
         }
-    private:
-        void SearchTask(CORBA::ULong limit, CORBA::ULong offset)
+
+        void finishSearch()
         {
-            if (!m_searchStopped)
+            m_searchFinished = true;
+
+            if (this->m_done)
+                this->m_done();
+        }
+
+        abe::FindSimilarObjectsRequest createFindSimilarObjectsRequest(CORBA::ULong limit, CORBA::ULong offset) const
+        {
+            abe::FindSimilarObjectsRequest request;
+            auto range = request.mutable_range();
+            range->set_begin_time(m_range.Begin.value.in());
+            range->set_end_time(m_range.End.value.in());
+
+            request.set_session(0U);
+            request.set_is_face(true);
+            request.set_minimal_score(m_accuracy);
+
+            const CORBA::ULong length = m_origins.length();
+            for (CORBA::ULong i = 0; i < length; ++i)
             {
-                _dbg_ << "Search continues from position " << offset;
+                *request.add_origin_ids() = m_origins[i];
+            }
 
-                try
-                {
-                    namespace abe = axxonsoft::bl::events;
+            request.set_jpeg_image(std::string(reinterpret_cast<const char*>(m_image.get_buffer()), m_image.length()));
+            request.set_limit(limit);
+            request.set_offset(offset);
+            return request;
+        }
 
-                    grpc::Status status;
+        abe::ReadEventsRequest createReadEventsRequest(CORBA::ULong limit, CORBA::ULong offset) const
+        {
+            abe::ReadEventsRequest request;
 
-                    if (m_haveImage)
-                    {
-                        abe::FindSimilarObjectsRequest request;
-                        auto range = request.mutable_range();
-                        range->set_begin_time(m_range.Begin.value.in());
-                        range->set_end_time(m_range.End.value.in());
-
-                        request.set_session(0U);
-                        request.set_is_face(true);
-                        request.set_minimal_score(m_accuracy);
-
-                        const CORBA::ULong length = m_origins.length();
-                        for (CORBA::ULong i = 0; i < length; ++i)
-                        {
-                            *request.add_origin_ids() = m_origins[i];
-                        }
-
-                        request.set_jpeg_image(std::string(reinterpret_cast<const char*>(m_image.get_buffer()), m_image.length()));
-                        request.set_limit(limit);
-                        request.set_offset(offset);
-
-                        NGrpcHelpers::SimpleLambdaResponseHandler<abe::FindSimilarObjectsResponse> handler(
-                            [this, &offset](std::shared_ptr<abe::FindSimilarObjectsResponse> const& response)
-                            {
-                                TFaceEventCont events;
-                                this->ConvertFaceEvents(response->items(), events);
-                                this->appendEvents(events);
-                                offset += response->offset();
-                                return true;
-                            });
-
-                        auto future = handler.getStatusFuture();
-
-                        NGrpcHelpers::AsyncServerStreamingGrpcCall<abe::EventHistoryService>(
-                            GET_THIS_LOGGER_PTR,
-                            m_nativeBLClient,
-                            &axxonsoft::bl::events::EventHistoryService::Stub::AsyncFindSimilarObjects,
-                            &handler,
-                            request,
-                            DEQUEUE_TIMEOUT
-                            );
-
-                        status = future.get();
-                    }
-                    else
-                    {
-                        abe::ReadEventsRequest request;
-
-                        auto range = request.mutable_range();
-                        range->set_begin_time(m_range.Begin.value.in());
-                        range->set_end_time(m_range.End.value.in());
-
-                        abe::SearchFilterArray* filters = request.mutable_filters();
-                        for (CORBA::ULong i = 0; i < m_origins.length(); ++i)
-                        {
-                            abe::SearchFilter* f = filters->add_filters();
-                            f->set_type(abe::ET_DetectorEvent);
-                            *f->add_subjects() = m_origins[i].in();
-                            *f->add_texts() = "faceAppeared";
-                        }
-
-                        request.set_limit(limit);
-                        request.set_offset(offset);
-
-                        NGrpcHelpers::SimpleLambdaResponseHandler<abe::ReadEventsResponse> handler(
-                            [this, &offset](std::shared_ptr<abe::ReadEventsResponse> const& response)
-                            {
-                                TFaceEventCont events;
-                                this->ConvertFaceEvents(response->items(), events);
-                                this->appendEvents(events);
-                                offset += response->items_size();
-                                return true;
-                            });
-
-                        auto future = handler.getStatusFuture();
-
-                        NGrpcHelpers::AsyncServerStreamingGrpcCall<abe::EventHistoryService>(
-                            GET_THIS_LOGGER_PTR,
-                            m_nativeBLClient,
-                            &axxonsoft::bl::events::EventHistoryService::Stub::AsyncReadEvents,
-                            &handler,
-                            request,
-                            DEQUEUE_TIMEOUT
-                            );
-
-                        status = future.get();
-                    }
-
-                    if (!status.ok())
-                        m_errorOccurred = true;
-                }
-                catch (const ORM::JsonEventInvalidJson& e)
-                {
-                    m_errorOccurred = true;
-                    _err_ << "Face search error, invalid json: " << e.Message.in();
-                }
-                catch (const CORBA::Exception& e)
-                {
-                    m_errorOccurred = true;
-                    _err_ << "Face search error: " << e._info();
-                }
-                catch (const std::exception& e)
-                {
-                    m_errorOccurred = true;
-                    _err_ << "Face search error: " << e.what();
-                }
+            auto range = request.mutable_range();
+            range->set_begin_time(m_range.Begin.value.in());
+            range->set_end_time(m_range.End.value.in());
+
+            abe::SearchFilterArray* filters = request.mutable_filters();
+            for (CORBA::ULong i = 0; i < m_origins.length(); ++i)
+            {
+                abe::SearchFilter* f = filters->add_filters();
+                f->set_type(abe::ET_DetectorEvent);
+                *f->add_subjects() = m_origins[i].in();
+                *f->add_texts() = "faceAppeared";
             }
-            m_searchFinished = true;
 
-            if (this->m_done)
-                this->m_done();
+            request.set_limit(limit);
+            request.set_offset(offset);
+            return request;
         }
 
         void appendEvents(const TFaceEvents& events)
@@ -402,7 +397,8 @@ namespace
             }
         }
 
-        NCorbaHelpers::PReactor m_reactor;
+        const NWebGrpc::PGrpcManager m_grpcManager;
+        NGrpcHelpers::PCredentials m_metaCredentials;
 
         ORM::OctetSeq m_image;
         ORM::StringSeq m_origins;
@@ -417,7 +413,8 @@ namespace
         std::atomic<bool> m_searchStopped;
         std::atomic<bool> m_searchFinished;
 
-        NGrpcHelpers::PBoundGrpcClient m_nativeBLClient;
+        std::mutex m_readerMutex;
+        std::function<void()> m_stopReader;
     };
 
     typedef FaceSearchContext<TFaceEvents> SortedFaceSearchContext;
@@ -426,28 +423,15 @@ namespace
     class CFaceSearchContentImpl : public CSearchPlugin<ORM::AsipDatabase>
     {
     public:
-        CFaceSearchContentImpl(NCorbaHelpers::IContainer *c)
+        CFaceSearchContentImpl(NCorbaHelpers::IContainer *c, const NWebGrpc::PGrpcManager grpcManager)
             : CSearchPlugin(c)
+            , m_grpcManager(grpcManager)
         {
-            m_grpcClientBase = NGrpcHelpers::CreateGrpcClientBase(GET_LOGGER_PTR, NCorbaHelpers::GetReactorInstanceShared()->GetIO());
-            m_nativeBLClient = NNativeBL::Client::GetLocalBL(GET_LOGGER_PTR, m_grpcClientBase, "HttpPlugin/FaceSearch");
-            m_grpcClientBase->Start();
-        }
-
-        ~CFaceSearchContentImpl()
-        {
-            if (m_nativeBLClient)
-                m_nativeBLClient->Cancel();
-
-            if (m_grpcClientBase)
-            {
-                m_grpcClientBase->Shutdown();
-                m_grpcClientBase.reset();
-            }
+            this->m_searchWeight = FACE_SEARCH_WEIGHT;
         }
 
     private:
-        PSearchContext CreateSearchContext(const NHttp::PRequest req, DB_var orm, const std::string&, const std::vector<std::string>& orgs,
+        PSearchContext CreateSearchContext(const NHttp::PRequest req, DB_var, const std::string&, const std::vector<std::string>& orgs,
             Json::Value& data, boost::posix_time::ptime beginTime, boost::posix_time::ptime endTime, bool descending)
         {
             TParams params;
@@ -507,20 +491,22 @@ namespace
             ORM::StringSeq origins;
             PrepareAsipRequest(orgs, beginTime, endTime, origins, range);
 
+            const IRequest::AuthSession& as = req->GetAuthSession();
+            NGrpcHelpers::PCredentials metaCredentials = NPluginUtility::GetCommonCredentials(GET_LOGGER_PTR, as);
+
             return RESULT_TYPE_FULL == result_type ? 
-                PSearchContext(new ReplicationFaceSearchContext(GET_LOGGER_PTR, sz, buf, orm, m_nativeBLClient, origins, range, accuracy)) :
-                PSearchContext(new SortedFaceSearchContext(GET_LOGGER_PTR, sz, buf, orm, m_nativeBLClient, origins, range, accuracy));
+                PSearchContext(new ReplicationFaceSearchContext(GET_LOGGER_PTR, sz, buf, m_grpcManager, metaCredentials, origins, range, accuracy)) :
+                PSearchContext(new SortedFaceSearchContext(GET_LOGGER_PTR, sz, buf, m_grpcManager, metaCredentials, origins, range, accuracy));
         }
     private:
-        NGrpcHelpers::PGrpcClientBase m_grpcClientBase;
-        NGrpcHelpers::PBoundGrpcClient m_nativeBLClient;
+        const NWebGrpc::PGrpcManager m_grpcManager;
     };
 }
 
 namespace NHttp
 {
-    IServlet* CreateFaceSearchServlet(NCorbaHelpers::IContainer* c)
+    IServlet* CreateFaceSearchServlet(NCorbaHelpers::IContainer* c, const NWebGrpc::PGrpcManager grpcManager)
     {
-        return new CFaceSearchContentImpl(c);
+        return new CFaceSearchContentImpl(c, grpcManager);
     }
 }
@@ -24,6 +24,9 @@ namespace
 
     const uint32_t DEFAULT_PORTION_SIZE = 1000;
 
+    // Compares faces like the face search does, so it gets the same share of the search slots.
+    const std::uint32_t STRANGER_SEARCH_WEIGHT = 1;
+
     const char* const THRESHOLD_PARAM = "threshold";
     const char* const OP_PARAM = "op";
 
@@ -106,41 +109,35 @@ namespace
             }
 
             TFaceEvents::const_iterator it1, it2;
+            std::unique_lock<std::mutex> lock(m_mutex);
             try
             {
-                std::unique_lock<std::mutex> lock(m_mutex);
                 std::pair<TFaceEvents::const_iterator, TFaceEvents::const_iterator> its = SelectIteratorRange(m_events, offset, limit);
                 it1 = its.first, it2 = its.second;
             }
             catch (const std::exception& e)
             {
+                lock.unlock();
                 _err_ << e.what();
                 Error(resp, IResponse::NotFound);
                 return;
             }
 
-            Json::Value responseObject(Json::objectValue);
-            responseObject["events"] = Json::Value(Json::arrayValue);
-
-            for (; it1 != it2; ++it1)
-            {
-                Json::Value ev(Json::objectValue);
-                ev["timestamp"] = it1->timestamp;
-                ev["origin"] = it1->origin;
-                ev["rate"] = it1->score;
-
-                Json::Value rect(Json::objectValue);
-                rect["left"] = it1->position.left;
-                rect["top"] = it1->position.top;
-                rect["right"] = it1->position.right;
-                rect["bottom"] = it1->position.bottom;
-
-                ev["position"] = rect;
-
-                responseObject["events"].append(ev);
-            }
-
-            SendResponse(req, resp, responseObject, m_searchFinished);
+            SendResponse(req, resp, lock, m_searchFinished, Json::Value(Json::objectValue), "events", it1, it2,
+                [](NPluginUtility::CJsonStreamWriter& writer, const SFaceEvent& e)
+                {
+                    writer.BeginObject()
+                        .Key("timestamp").Value(e.timestamp)
+                        .Key("origin").Value(e.origin)
+                        .Key("rate").Value(e.score)
+                        .Key("position").BeginObject()
+                            .Key("left").Value(e.position.left)
+                            .Key("top").Value(e.position.top)
+                            .Key("right").Value(e.position.right)
+                            .Key("bottom").Value(e.position.bottom)
+                        .EndObject()
+                    .EndObject();
+                });
         }
     private:
         void SearchTask(CORBA::ULong limit, CORBA::ULong offset)
@@ -262,7 +259,9 @@ namespace
         CStrangerSearchContentImpl(NCorbaHelpers::IContainerNamed*c)
             : CSearchPlugin(c)
             , m_cont(c, NCorbaHelpers::ShareOwnership())
-        {}
+        {
+            this->m_searchWeight = STRANGER_SEARCH_WEIGHT;
+        }
 
     private:
         PSearchContext CreateSearchContext(const NHttp::PRequest req, DB_var orm, const std::string&, const std::vector<std::string>& orgs,
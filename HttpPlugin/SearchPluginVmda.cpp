@@ -163,30 +163,22 @@ namespace
                 return;
             }
 
-            Json::Value intervals(Json::arrayValue);
+            std::pair<Json::Value::const_iterator, Json::Value::const_iterator> its;
+            std::unique_lock<std::mutex> lock(m_intervalMutex);
             try
             {
-                std::unique_lock<std::mutex> lock(m_intervalMutex);
-                std::pair<Json::Value::const_iterator, Json::Value::const_iterator> its = SelectIteratorRange(m_intervals, offset, limit);
-                if (its.first == m_intervals.begin() && its.second == m_intervals.end())
-                    intervals = m_intervals;
-                else
-                {
-                    for (; its.first != its.second; ++(its.first))
-                        intervals.append(*(its.first));
-                }
+                its = SelectIteratorRange(m_intervals, offset, limit);
             }
             catch (const std::exception& e)
             {
+                lock.unlock();
                 _err_ << e.what();
                 Error(resp, IResponse::NotFound);
                 return;
             }
 
-            Json::Value responseObject(Json::objectValue);
-            responseObject["intervals"] = intervals;
-
-            SendResponse(req, resp, responseObject, m_searchFinished);
+            SendResponse(req, resp, lock, m_searchFinished, Json::Value(Json::objectValue), "intervals", its.first, its.second,
+                [](NPluginUtility::CJsonStreamWriter& writer, const Json::Value& interval) { writer.Value(interval); });
         }
     private:
         void SearchTask(const std::string& detectorId)
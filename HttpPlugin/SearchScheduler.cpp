@@ -0,0 +1,238 @@
+#include "SearchScheduler.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    // Searches running at once over all search servlets.
+    const std::size_t SEARCH_SLOT_COUNT = 32;
+    const std::size_t MAX_PENDING_SEARCH_COUNT = 200;
+    // Keeps a single client from filling the whole queue.
+    const std::size_t MAX_PENDING_SEARCH_COUNT_PER_USER = 50;
+}
+
+namespace NHttp
+{
+    CSearchScheduler::CSearchScheduler(std::size_t slots, std::size_t maxPending, std::size_t maxPendingPerUser)
+        : m_slots(std::max<std::size_t>(1, slots))
+        , m_maxPending(maxPending)
+        , m_maxPendingPerUser(maxPendingPerUser)
+        , m_active(0)
+        , m_pending(0)
+        , m_sequence(0)
+        , m_started(0)
+        , m_rejected(0)
+        , m_cancelled(0)
+    {
+    }
+
+    bool CSearchScheduler::Submit(const std::string& id, const std::string& type, std::uint32_t weight, std::uint32_t maxActive,
+        const std::string& user, FStart start)
+    {
+        std::vector<FStart> starts;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_searches.count(id))
+            {
+                ++m_rejected;
+                return false;
+            }
+
+            SType& t = m_types[type];
+            t.Weight = std::max<std::uint32_t>(1, weight);
+            t.MaxActive = std::max<std::uint32_t>(1, maxActive);
+            SUser& u = m_users[user];
+
+            // The queue limits only matter for searches that have to wait.
+            const bool startable = m_active < m_slots && canStart(t);
+            if (!startable && (m_pending >= m_maxPending || u.Pending >= m_maxPendingPerUser))
+            {
+                ++m_rejected;
+                releaseUser(user);
+                return false;
+            }
+
+            SPending p = { m_sequence++, id, std::move(start) };
+            t.Users[user].push_back(std::move(p));
+            ++u.Pending;
+            ++m_pending;
+            SSearch s = { type, user, false };
+            m_searches.insert(std::make_pair(id, s));
+
+            startPending(starts);
+        }
+
+        for (const FStart& s : starts)
+            s();
+        return true;
+    }
+
+    bool CSearchScheduler::Cancel(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_searches.find(id);
+        if (m_searches.end() == it || it->second.Started)
+            return false;
+
+        SType& t = m_types[it->second.Type];
+        auto q = t.Users.find(it->second.User);
+        if (t.Users.end() != q)
+        {
+            TQueue& queue = q->second;
+            queue.erase(std::remove_if(queue.begin(), queue.end(),
+                [&id](const SPending& p) { return p.Id == id; }), queue.end());
+            if (queue.empty())
+                t.Users.erase(q);
+        }
+
+        --m_users[it->second.User].Pending;
+        --m_pending;
+        ++m_cancelled;
+        releaseUser(it->second.User);
+        m_searches.erase(it);
+        return true;
+    }
+
+    void CSearchScheduler::Finished(const std::string& id)
+    {
+        std::vector<FStart> starts;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_searches.find(id);
+            if (m_searches.end() == it || !it->second.Started)
+                return;
+
+            --m_types[it->second.Type].Active;
+            --m_users[it->second.User].Active;
+            --m_active;
+            releaseUser(it->second.User);
+            m_searches.erase(it);
+
+            startPending(starts);
+        }
+
+        for (const FStart& start : starts)
+            start();
+    }
+
+    bool CSearchScheduler::IsPending(const std::string& id) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_searches.find(id);
+        return m_searches.end() != it && !it->second.Started;
+    }
+
+    SSearchSchedulerStatistics CSearchScheduler::GetStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        SSearchSchedulerStatistics st;
+        st.Active = m_active;
+        st.Pending = m_pending;
+        st.Started = m_started;
+        st.Rejected = m_rejected;
+        st.Cancelled = m_cancelled;
+        return st;
+    }
+
+    bool CSearchScheduler::canStart(const SType& t) const
+    {
+        return t.Active < t.MaxActive;
+    }
+
+    void CSearchScheduler::startPending(std::vector<FStart>& starts)
+    {
+        SPending next;
+        while (takeNext(next))
+            starts.push_back(std::move(next.Start));
+    }
+
+    bool CSearchScheduler::takeNext(SPending& next)
+    {
+        if (m_active >= m_slots)
+            return false;
+
+        SType* bestType = nullptr;
+        std::map<std::string, TQueue>::iterator bestUser;
+        for (auto& type : m_types)
+        {
+            SType& t = type.second;
+            if (t.Users.empty() || !canStart(t))
+                continue;
+
+            // The user of this type with the fewest running searches, then the longest waiting one.
+            auto user = t.Users.begin();
+            for (auto u = std::next(user); u != t.Users.end(); ++u)
+            {
+                const std::size_t active = m_users[u->first].Active;
+                const std::size_t bestActive = m_users[user->first].Active;
+                if (active < bestActive || (active == bestActive && u->second.front().Sequence < user->second.front().Sequence))
+                    user = u;
+            }
+
+            if (bestType)
+            {
+                // Compares Active / Weight of the two types.
+                const std::uint64_t share = std::uint64_t(t.Active) * bestType->Weight;
+                const std::uint64_t bestShare = std::uint64_t(bestType->Active) * t.Weight;
+                if (share > bestShare || (share == bestShare && user->second.front().Sequence > bestUser->second.front().Sequence))
+                    continue;
+            }
+            bestType = &t;
+            bestUser = user;
+        }
+
+        if (!bestType)
+            return false;
+
+        next = std::move(bestUser->second.front());
+        bestUser->second.pop_front();
+        const std::string user = bestUser->first;
+        if (bestUser->second.empty())
+            bestType->Users.erase(bestUser);
+
+        --m_users[user].Pending;
+        --m_pending;
+        startLocked(m_searches[next.Id]);
+        return true;
+    }
+
+    void CSearchScheduler::startLocked(SSearch& search)
+    {
+        search.Started = true;
+        ++m_types[search.Type].Active;
+        ++m_users[search.User].Active;
+        ++m_active;
+        ++m_started;
+    }
+
+    void CSearchScheduler::releaseUser(const std::string& user)
+    {
+        auto it = m_users.find(user);
+        if (m_users.end() != it && 0 == it->second.Active && 0 == it->second.Pending)
+            m_users.erase(it);
+    }
+
+    CSearchSlot::CSearchSlot(CSearchScheduler& scheduler, const std::string& id)
+        : m_scheduler(scheduler)
+        , m_id(id)
+    {
+    }
+
+    CSearchSlot::~CSearchSlot()
+    {
+        Release();
+    }
+
+    void CSearchSlot::Release()
+    {
+        // Finished() ignores the ids it no longer knows.
+        m_scheduler.Finished(m_id);
+    }
+
+    CSearchScheduler& GetSearchScheduler()
+    {
+        static CSearchScheduler scheduler(SEARCH_SLOT_COUNT, MAX_PENDING_SEARCH_COUNT, MAX_PENDING_SEARCH_COUNT_PER_USER);
+        return scheduler;
+    }
+}
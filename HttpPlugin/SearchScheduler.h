@@ -0,0 +1,126 @@
+#ifndef SEARCH_SCHEDULER_H__
+#define SEARCH_SCHEDULER_H__
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace NHttp
+{
+    struct SSearchSchedulerStatistics
+    {
+        std::uint64_t Active;
+        std::uint64_t Pending;
+        std::uint64_t Started;
+        std::uint64_t Rejected;
+        std::uint64_t Cancelled;
+    };
+
+    // Hands out a fixed number of search slots shared by all search types.
+    // When a slot frees up, the pending search to start is chosen in weighted
+    // fair order: first the type with the fewest running searches per unit of
+    // weight (below its own cap), then within that type the user with the fewest
+    // running searches of any type, then the earliest submitted.
+    class CSearchScheduler
+    {
+    public:
+        typedef std::function<void()> FStart;
+
+        CSearchScheduler(std::size_t slots, std::size_t maxPending, std::size_t maxPendingPerUser);
+
+        // Queues the search and starts whatever the fair order allows, usually
+        // this search itself when a slot is free. start is called without internal
+        // locks held, possibly from the thread that calls Submit() or Finished()
+        // for another search. Returns false if the search would have to wait and
+        // the queue (as a whole or of this user) is full.
+        bool Submit(const std::string& id, const std::string& type, std::uint32_t weight, std::uint32_t maxActive,
+            const std::string& user, FStart start);
+        // Drops a search that has not been started yet; returns false otherwise.
+        bool Cancel(const std::string& id);
+        // Frees the slot of a started search. Unknown and repeated ids are ignored.
+        void Finished(const std::string& id);
+
+        bool IsPending(const std::string& id) const;
+        SSearchSchedulerStatistics GetStatistics() const;
+
+    private:
+        struct SPending
+        {
+            std::uint64_t Sequence;
+            std::string Id;
+            FStart Start;
+        };
+        typedef std::deque<SPending> TQueue;
+
+        struct SType
+        {
+            std::uint32_t Weight;
+            std::uint32_t MaxActive;
+            std::size_t Active;
+            std::map<std::string, TQueue> Users;
+        };
+
+        struct SUser
+        {
+            std::size_t Active;
+            std::size_t Pending;
+        };
+
+        struct SSearch
+        {
+            std::string Type;
+            std::string User;
+            bool Started;
+        };
+
+        bool canStart(const SType& t) const;
+        void startPending(std::vector<FStart>& starts);
+        bool takeNext(SPending& next);
+        void startLocked(SSearch& search);
+        void releaseUser(const std::string& user);
+
+        const std::size_t m_slots;
+        const std::size_t m_maxPending;
+        const std::size_t m_maxPendingPerUser;
+
+        mutable std::mutex m_mutex;
+        std::map<std::string, SType> m_types;
+        std::map<std::string, SUser> m_users;
+        std::map<std::string, SSearch> m_searches;
+        std::size_t m_active;
+        std::size_t m_pending;
+        std::uint64_t m_sequence;
+
+        std::uint64_t m_started;
+        std::uint64_t m_rejected;
+        std::uint64_t m_cancelled;
+    };
+
+    // Frees the slot of a started search when released or destroyed, whichever
+    // comes first: a search context that is dropped without reporting its
+    // completion does not keep the slot forever.
+    class CSearchSlot
+    {
+    public:
+        CSearchSlot(CSearchScheduler& scheduler, const std::string& id);
+        ~CSearchSlot();
+
+        CSearchSlot(const CSearchSlot&) = delete;
+        CSearchSlot& operator=(const CSearchSlot&) = delete;
+
+        void Release();
+
+    private:
+        CSearchScheduler& m_scheduler;
+        const std::string m_id;
+    };
+
+    // The scheduler shared by the search servlets of the process.
+    CSearchScheduler& GetSearchScheduler();
+}
+
+#endif // SEARCH_SCHEDULER_H__
@@ -1,6 +1,10 @@
-#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdio>
 
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/date_time/posix_time/ptime.hpp>
@@ -8,6 +12,7 @@
 #include <HttpServer/HttpServer.h>
 #include <ConnectionBroker.h>
 #include "SendContext.h"
+#include "ByteRanges.h"
 #include "Constants.h"
 #include "../PtimeFromQword.h"
 
@@ -18,9 +23,64 @@ using namespace NContext;
 
 namespace
 {
-    const char* const CONTENT_TYPE = "Content-Type: image/jpeg";
+    const char* const JPEG_CONTENT_TYPE = "Content-Type: image/jpeg";
     const char *const SAMPLE_TIMESTAMP = "X-Video-Original-Time: ";
 
+    const size_t FRAMED_CHUNK_HISTORY = 4;
+
+    // IResponse has no named status for "416 Range Not Satisfiable".
+    const IResponse::EStatus RANGE_NOT_SATISFIABLE_STATUS = static_cast<IResponse::EStatus>(416);
+
+    std::atomic<std::uint64_t> g_framedChunks(0);
+    std::atomic<std::uint64_t> g_framedChunkReuses(0);
+
+    class CMultipartFrameCache : public IMultipartFrameCache
+    {
+        struct SFramedChunk
+        {
+            NMMSS::PSample  Sample;
+            PFramedHeader   Header;
+        };
+
+    public:
+        CMultipartFrameCache()
+            : m_next(0)
+        {
+            m_chunks.resize(FRAMED_CHUNK_HISTORY);
+        }
+
+        PFramedHeader GetHeader(NMMSS::ISample* s) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // Clients of one distributor may lag each other by a few samples,
+            // so keep a short history instead of the last chunk only.
+            for (SFramedChunk& c : m_chunks)
+            {
+                if (c.Sample.Get() == s)
+                {
+                    g_framedChunkReuses.fetch_add(1, std::memory_order_relaxed);
+                    return c.Header;
+                }
+            }
+
+            SFramedChunk& c = m_chunks[m_next];
+            m_next = (m_next + 1) % m_chunks.size();
+
+            c.Sample = NMMSS::PSample(s, NCorbaHelpers::ShareOwnership());
+            c.Header = boost::make_shared<const std::string>(
+                MakeMultipartHeader(s->Header().nBodySize, s->Header().dtTimeBegin));
+            g_framedChunks.fetch_add(1, std::memory_order_relaxed);
+
+            return c.Header;
+        }
+
+    private:
+        std::mutex                  m_mutex;
+        std::vector<SFramedChunk>   m_chunks;
+        size_t                      m_next;
+    };
+
     class CStringContext : public ISendContext
     {
         NHttp::PResponse            m_response;
@@ -100,34 +160,36 @@ namespace
     class CMultipartContext: public ISendContext
     {
         PResponse                   m_response;
-        NMMSS::PSample              m_sample;
+        std::vector<NMMSS::PSample> m_samples;
+        PMultipartFrameCache        m_frameCache;
         FDoneCallback               m_cb;
 
     public:
-        CMultipartContext(PResponse resp, NMMSS::ISample* s, FDoneCallback cb)
+        CMultipartContext(PResponse resp, const std::vector<NMMSS::ISample*>& samples, PMultipartFrameCache fc, FDoneCallback cb)
             : m_response(resp)
-            , m_sample(s, NCorbaHelpers::ShareOwnership())
+            , m_frameCache(fc)
             , m_cb(cb)
-        { }
+        {
+            m_samples.reserve(samples.size());
+            for (NMMSS::ISample* s : samples)
+                m_samples.push_back(NMMSS::PSample(s, NCorbaHelpers::ShareOwnership()));
+        }
 
         void ScheduleWrite()
         {
-            size_t bodylen = m_sample->Header().nBodySize;
-            const std::string ts = boost::posix_time::to_iso_string(
-                NMMSS::PtimeFromQword(m_sample->Header().dtTimeBegin));
+            IResponse::TConstBufferSeq buffs;
+            m_headers.reserve(m_samples.size());
+            for (const NMMSS::PSample& s : m_samples)
+            {
+                size_t bodylen = s->Header().nBodySize;
 
-            std::stringstream s;
-            s                                << CR << LF 
-                << BOUNDARY                  << CR << LF 
-                << CONTENT_TYPE              << CR << LF 
-                << CONTENT_LENGTH << bodylen << CR << LF
-                << SAMPLE_TIMESTAMP << ts    << CR << LF 
-                                             << CR << LF;
+                PFramedHeader header = m_frameCache ? m_frameCache->GetHeader(s.Get())
+                    : boost::make_shared<const std::string>(MakeMultipartHeader(bodylen, s->Header().dtTimeBegin));
+                m_headers.push_back(header);
 
-            IResponse::TConstBufferSeq buffs;
-            m_headerBuffer.assign(s.str());
-            buffs.push_back(boost::asio::buffer(m_headerBuffer.c_str(), m_headerBuffer.size()));
-            buffs.push_back(boost::asio::buffer(m_sample->GetBody(), bodylen));
+                buffs.push_back(boost::asio::buffer(header->c_str(), header->size()));
+                buffs.push_back(boost::asio::buffer(s->GetBody(), bodylen));
+            }
 
             try
             {
@@ -149,9 +211,11 @@ namespace
             m_cb(ec);
         }
 
-        std::string m_headerBuffer;
+        std::vector<PFramedHeader> m_headers;
     };
 
+    // Disk reads run on the executor, one chunk ahead of the socket at most,
+    // so a slow disk or a large export never blocks the reactor thread.
     class CFileContext : public ISendContext
     {
         DECLARE_LOGGER_HOLDER;
@@ -160,26 +224,68 @@ namespace
         PResponse                   m_response;
         const std::string           m_presentationName;
         const boost::filesystem::path m_filePath;
+        const std::string           m_range;
+        NExecutors::PDynamicThreadPool m_executor;
         FDoneCallback               m_cb;
-        std::vector < char >        m_buffer;
-        std::ifstream               m_fs;
+        std::unique_ptr<CRangeReader> m_reader;
+
+        std::mutex                  m_mutex;
+        std::vector<char>           m_readBuffer;
+        std::vector<char>           m_writeBuffer;
+        bool                        m_reading;
+        bool                        m_writing;
+        bool                        m_ready;
+        bool                        m_done;
+        boost::system::error_code   m_error;
 
     public:
         CFileContext(DECLARE_LOGGER_ARG, PResponse resp, const char* const presentationName,
-            const boost::filesystem::path& filePath, FDoneCallback cb)
+            const boost::filesystem::path& filePath, const std::string& range,
+            NExecutors::PDynamicThreadPool executor, FDoneCallback cb)
             : m_response(resp)
             , m_presentationName(presentationName)
             , m_filePath(filePath)
+            , m_range(range)
+            , m_executor(executor)
             , m_cb(cb)
+            , m_reading(false)
+            , m_writing(false)
+            , m_ready(false)
+            , m_done(false)
         {
             INIT_LOGGER_HOLDER;
-            m_buffer.reserve(CHUNK_SIZE);
+            m_readBuffer.reserve(CHUNK_SIZE);
+            m_writeBuffer.reserve(CHUNK_SIZE);
         }
 
         void ScheduleWrite()
         {
-            m_fs.open(m_filePath.c_str(), std::ios::binary | std::ios::in);
-            if (!m_fs.good())
+            boost::system::error_code ec;
+            const std::uint64_t fileSize = boost::filesystem::file_size(m_filePath, ec);
+            if (ec)
+            {
+                Error(m_response, IResponse::NotFound);
+                return;
+            }
+
+            std::string extension(m_presentationName.substr(m_presentationName.find_last_of('.') + 1));
+            const std::string contentType(NHttp::GetMIMETypeByExt(extension.c_str()));
+
+            std::vector<SByteRange> ranges;
+            const ERangeStatus rangeStatus = ParseByteRanges(m_range, fileSize, ranges);
+            if (RANGE_NOT_SATISFIABLE == rangeStatus)
+            {
+                _wrn_ << "Range " << m_range << " is not satisfiable for " << m_filePath << " of size " << fileSize;
+                m_response->SetStatus(RANGE_NOT_SATISFIABLE_STATUS);
+                m_response << ContentLength(0)
+                    << NHttp::SHttpHeader("Content-Range", "bytes */" + std::to_string(fileSize));
+                m_response->FlushHeaders();
+                m_cb(boost::system::error_code());
+                return;
+            }
+
+            m_reader.reset(new CRangeReader(m_filePath, fileSize, ranges, contentType));
+            if (!m_reader->Open())
             {
                 Error(m_response, IResponse::NotFound);
                 return;
@@ -188,46 +294,253 @@ namespace
             std::string contentDisposition("attachment; filename=");
             contentDisposition.append(m_presentationName);
             NHttp::SHttpHeader contentDispositionHeader("Content-Disposition", contentDisposition);
-            NHttp::SHttpHeader acceptRangeHeader("Accept-Range", "bytes");
+            NHttp::SHttpHeader acceptRangesHeader("Accept-Ranges", "bytes");
 
-            std::string extension(m_presentationName.substr(m_presentationName.find_last_of('.') + 1));
-            
-            m_response->SetStatus(IResponse::OK);
-            m_response << ContentLength(static_cast<std::size_t>(boost::filesystem::file_size(m_filePath)))
-                << ContentType(NHttp::GetMIMETypeByExt(extension.c_str()))
+            m_response->SetStatus(ranges.empty() ? IResponse::OK : IResponse::PartialContent);
+            m_response << ContentLength(static_cast<std::size_t>(m_reader->ContentLength()))
                 << CacheControlNoCache()
                 << contentDispositionHeader
-                << acceptRangeHeader;
+                << acceptRangesHeader;
+
+            if (m_reader->Multipart())
+                m_response << ContentType(std::string("multipart/byteranges; boundary=") + BYTERANGES_BOUNDARY);
+            else
+                m_response << ContentType(contentType);
+
+            if (1 == ranges.size())
+                m_response << NHttp::SHttpHeader("Content-Range", MakeContentRange(ranges.front(), fileSize));
 
             m_response->FlushHeaders();
 
-            ReadChunk();
+            if (m_reader->Finished())
+            {
+                m_cb(boost::system::error_code());
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_reading = true;
+            }
+            ScheduleRead();
         }
 
     private:
+        void ScheduleRead()
+        {
+            PSendContext self(shared_from_this());
+            if (!m_executor || !m_executor->Post([self, this]() { ReadChunk(); }))
+            {
+                _wrn_ << "Reading " << m_filePath << " on the caller thread: executor is not available";
+                ReadChunk();
+            }
+        }
+
         void ReadChunk()
         {
-            m_fs.read(&m_buffer[0], CHUNK_SIZE);
-            size_t count = static_cast<std::size_t>(m_fs.gcount());
+            const bool ok = m_reader->ReadChunk(m_readBuffer, CHUNK_SIZE);
+            if (!ok)
+                _err_ << "Can't read " << m_filePath << ": file is shorter than expected";
+
+            bool write = false;
+            boost::system::error_code ec;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_reading = false;
+                if (!ok && !m_error)
+                    m_error = boost::system::errc::make_error_code(boost::system::errc::io_error);
+
+                if (m_error)
+                    ec = m_error;
+                else if (!m_writing)
+                    write = true;
+                else
+                    m_ready = true;
+            }
+
+            if (write)
+                WriteChunk();
+            else if (ec)
+                Finish(ec);
+        }
+
+        // Called with the read buffer filled and no write in progress.
+        void WriteChunk()
+        {
+            bool read = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_readBuffer.swap(m_writeBuffer);
+                m_ready = false;
+                m_writing = true;
+                if (!m_reader->Finished())
+                    read = m_reading = true;
+            }
+
             m_response->AsyncWrite(
-                &m_buffer[0], count,
+                &m_writeBuffer[0], m_writeBuffer.size(),
                 boost::bind(
                 &ISendContext::WriteHandler, shared_from_this(), _1)
             );
+
+            if (read)
+                ScheduleRead();
         }
+
         void WriteHandler(boost::system::error_code ec)
         {
-            if (!m_fs)
-                m_cb(ec);
-            else
-                ReadChunk();
+            bool write = false;
+            bool done = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_writing = false;
+                if (ec && !m_error)
+                    m_error = ec;
+
+                if (m_error)
+                {
+                    ec = m_error;
+                    done = !m_reading;
+                }
+                else if (m_ready)
+                    write = true;
+                else
+                    done = !m_reading && m_reader->Finished();
+            }
+
+            if (write)
+                WriteChunk();
+            else if (done)
+                Finish(ec);
+        }
+
+        void Finish(boost::system::error_code ec)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_done)
+                    return;
+                m_done = true;
+            }
+            m_cb(ec);
         }
     };
     std::uint32_t CFileContext::CHUNK_SIZE = 65536;
+
+    // Chunked transfer coding of a body produced while it is sent: the next
+    // chunk is asked for only after the previous one has been written, so
+    // at most one chunk of the body is held in memory.
+    class CChunkedContext : public ISendContext
+    {
+        static const std::size_t CHUNK_SIZE = 65536;
+
+        NHttp::PResponse            m_response;
+        FChunkProducer              m_producer;
+        FDoneCallback               m_cb;
+        std::string                 m_sizeLine;
+        std::string                 m_chunk;
+        bool                        m_finished;
+
+    public:
+        CChunkedContext(NHttp::PResponse resp, FChunkProducer producer, FDoneCallback cb)
+            : m_response(resp)
+            , m_producer(producer)
+            , m_cb(cb)
+            , m_finished(false)
+        {
+            m_chunk.reserve(CHUNK_SIZE);
+        }
+
+        void ScheduleWrite()
+        {
+            m_chunk.clear();
+            try
+            {
+                // A portion may be empty, e.g. when compressed output is held back,
+                // and an empty chunk would end the body.
+                while (!m_finished && m_chunk.size() < CHUNK_SIZE)
+                    m_finished = !m_producer(m_chunk);
+            }
+            catch (const std::exception&)
+            {
+                // Headers are gone already, the client sees the body cut short.
+                WriteHandler(boost::system::errc::make_error_code(boost::system::errc::io_error));
+                return;
+            }
+
+            static const char CRLF[] = { static_cast<char>(CR), static_cast<char>(LF) };
+            static const char LAST_CHUNK[] = { '0', static_cast<char>(CR), static_cast<char>(LF), static_cast<char>(CR), static_cast<char>(LF) };
+
+            IResponse::TConstBufferSeq buffers;
+            if (!m_chunk.empty())
+            {
+                char size[2 * sizeof(std::size_t) + 1];
+                const int len = std::snprintf(size, sizeof(size), "%zx", m_chunk.size());
+                m_sizeLine.assign(size, len).append(CRLF, sizeof(CRLF));
+
+                buffers.push_back(boost::asio::buffer(m_sizeLine));
+                buffers.push_back(boost::asio::buffer(m_chunk));
+                buffers.push_back(boost::asio::buffer(CRLF));
+            }
+            if (m_finished)
+                buffers.push_back(boost::asio::buffer(LAST_CHUNK));
+
+            try
+            {
+                m_response->AsyncWrite(buffers,
+                    boost::bind(&ISendContext::WriteHandler, shared_from_this(), _1));
+            }
+            catch (const boost::system::system_error& e)
+            {
+                WriteHandler(e.code());
+            }
+        }
+
+    private:
+        void WriteHandler(boost::system::error_code ec)
+        {
+            if (ec || m_finished)
+            {
+                m_cb(ec);
+                return;
+            }
+            ScheduleWrite();
+        }
+    };
 }
 
 namespace NContext
 {
+    std::string MakeMultipartHeader(std::uint64_t bodySize, std::uint64_t timestamp)
+    {
+        const std::string ts = boost::posix_time::to_iso_string(NMMSS::PtimeFromQword(timestamp));
+        const std::string len = std::to_string(bodySize);
+        const char crlf[] = { static_cast<char>(CR), static_cast<char>(LF) };
+
+        std::string h;
+        h.reserve(128 + len.size() + ts.size());
+        h.append(crlf, 2)
+            .append(BOUNDARY).append(crlf, 2)
+            .append(JPEG_CONTENT_TYPE).append(crlf, 2)
+            .append(CONTENT_LENGTH).append(len).append(crlf, 2)
+            .append(SAMPLE_TIMESTAMP).append(ts).append(crlf, 2)
+            .append(crlf, 2);
+        return h;
+    }
+
+    PMultipartFrameCache CreateMultipartFrameCache()
+    {
+        return PMultipartFrameCache(new CMultipartFrameCache());
+    }
+
+    SFramingStatistics GetFramingStatistics()
+    {
+        SFramingStatistics st;
+        st.FramedChunks = g_framedChunks.load(std::memory_order_relaxed);
+        st.FramedChunkReuses = g_framedChunkReuses.load(std::memory_order_relaxed);
+        return st;
+    }
+
     ISendContext* CreateStringContext(NHttp::PResponse response, const std::string& data, FDoneCallback cb)
     {
         return new CStringContext(response, data, cb);
@@ -240,12 +553,28 @@ namespace NContext
 
     ISendContext* CreateMultipartContext(NHttp::PResponse response, NMMSS::ISample* sample, FDoneCallback cb)
     {
-        return new CMultipartContext(response, sample, cb);
+        return new CMultipartContext(response, { sample }, PMultipartFrameCache(), cb);
+    }
+
+    ISendContext* CreateMultipartContext(NHttp::PResponse response, NMMSS::ISample* sample, PMultipartFrameCache fc, FDoneCallback cb)
+    {
+        return new CMultipartContext(response, { sample }, fc, cb);
+    }
+
+    ISendContext* CreateMultipartContext(NHttp::PResponse response, const std::vector<NMMSS::ISample*>& samples,
+        PMultipartFrameCache fc, FDoneCallback cb)
+    {
+        return new CMultipartContext(response, samples, fc, cb);
     }
 
     ISendContext* CreateFileContext(DECLARE_LOGGER_ARG, NHttp::PResponse response, const char* const presentationName,
-        const boost::filesystem::path& filePath, FDoneCallback cb)
+        const boost::filesystem::path& filePath, const std::string& range, NExecutors::PDynamicThreadPool executor, FDoneCallback cb)
+    {
+        return new CFileContext(GET_LOGGER_PTR, response, presentationName, filePath, range, executor, cb);
+    }
+
+    ISendContext* CreateChunkedContext(NHttp::PResponse response, FChunkProducer producer, FDoneCallback cb)
     {
-        return new CFileContext(GET_LOGGER_PTR, response, presentationName, filePath, cb);
+        return new CChunkedContext(response, producer, cb);
     }
 }
@@ -1,11 +1,16 @@
 #ifndef STRING_CONTEXT_H__
 #define STRING_CONTEXT_H__
 
+#include <string>
+#include <vector>
+#include <cstdint>
+
 #include <boost/shared_ptr.hpp>
 #include <boost/optional/optional.hpp>
 #include <boost/smart_ptr/enable_shared_from_this.hpp>
 
 #include <HttpServer/HttpResponse.h>
+#include <Executors/DynamicThreadPool.h>
 
 namespace boost { namespace filesystem { class path; } }
 
@@ -29,11 +34,47 @@ namespace NContext
 
     typedef boost::function1<void, boost::system::error_code> FDoneCallback;
 
+    // Appends the next portion of a body and returns false once the body is complete.
+    typedef boost::function1<bool, std::string&> FChunkProducer;
+
+    typedef boost::shared_ptr<const std::string> PFramedHeader;
+
+    // Builds multipart part headers once per sample and shares them between
+    // all clients fed by the same distributor.
+    class IMultipartFrameCache
+    {
+    public:
+        virtual ~IMultipartFrameCache() {}
+
+        virtual PFramedHeader GetHeader(NMMSS::ISample*) = 0;
+    };
+
+    typedef boost::shared_ptr<IMultipartFrameCache> PMultipartFrameCache;
+
+    struct SFramingStatistics
+    {
+        std::uint64_t FramedChunks = 0;
+        std::uint64_t FramedChunkReuses = 0;
+    };
+
+    std::string MakeMultipartHeader(std::uint64_t bodySize, std::uint64_t timestamp);
+    PMultipartFrameCache CreateMultipartFrameCache();
+    SFramingStatistics GetFramingStatistics();
+
     ISendContext* CreateStringContext(NHttp::PResponse, const std::string&, FDoneCallback = [](boost::system::error_code) {});
     ISendContext* CreateSampleContext(NHttp::PResponse, NMMSS::ISample*, FDoneCallback);
     ISendContext* CreateMultipartContext(NHttp::PResponse, NMMSS::ISample*, FDoneCallback);
+    ISendContext* CreateMultipartContext(NHttp::PResponse, NMMSS::ISample*, PMultipartFrameCache, FDoneCallback);
+    // Sends several samples as consecutive multipart parts in one gather write.
+    ISendContext* CreateMultipartContext(NHttp::PResponse, const std::vector<NMMSS::ISample*>&, PMultipartFrameCache, FDoneCallback);
+    // Serves a file honouring the Range header value, if any. Disk reads are
+    // posted to the executor.
     ISendContext* CreateFileContext(DECLARE_LOGGER_ARG, NHttp::PResponse, const char* const /*presentationName*/,
-        const boost::filesystem::path& /*filePath*/, FDoneCallback);
+        const boost::filesystem::path& /*filePath*/, const std::string& /*range*/,
+        NExecutors::PDynamicThreadPool, FDoneCallback);
+    // Sends a body of unknown length with chunked transfer coding; the caller sets
+    // the headers. The producer runs on the completion of the previous write.
+    ISendContext* CreateChunkedContext(NHttp::PResponse, FChunkProducer, FDoneCallback = [](boost::system::error_code) {});
 }
 
 #endif // STRING_CONTEXT_H__
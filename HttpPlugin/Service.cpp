@@ -41,7 +41,6 @@ namespace
 
 const char *HOST = "0.0.0.0";
 const char *VAR_STATIC_CONTENT = "WEB_STATIC_CONTENT_PATH";
-const char *VAR_HLS_CONTENT = "WEB_HLS_CONTENT_PATH";
 const char *VAR_EXPORT_CONTENT = "WEB_EXPORT_CONTENT_PATH";
 
 const uint8_t ALLOWED_LOGIN_TRY_COUNT = 5;
@@ -177,14 +176,6 @@ inline bool operator<(const SUserWithIp& lhs, const SUserWithIp& rhs)
             {
                 m_staticContent = GetPath(objId, VAR_STATIC_CONTENT);
 
-                m_hlsContent = GetPath(objId, VAR_HLS_CONTENT);
-                if (m_hlsContent.empty())
-                {
-                    boost::filesystem::path content(m_staticContent);
-                    content /= "hls";
-                    m_hlsContent = content.string();
-                }
-
                 std::string rootPath;
                 if (!NCorbaHelpers::CEnvar::Lookup(VAR_EXPORT_CONTENT, rootPath))
                     throw std::runtime_error(std::string("Couldn't find the environment variable: ") + VAR_EXPORT_CONTENT);
@@ -251,14 +242,13 @@ inline bool operator<(const SUserWithIp& lhs, const SUserWithIp& rhs)
 
             m_server->Install("",                      CreateRedirectionServlet("/"));
             m_server->Install("/",                     CreateStaticContentServlet(m_staticContent, SM_Read, indeces));
-            m_server->Install("/hls",                  CreateStaticContentServlet(m_hlsContent, SM_Read, indeces));
             m_server->Install("/product",              CreateCommonServlet(cont, m_grpcManager));
             m_server->Install("/hosts",                CreateHostServlet(cont));
-            m_server->Install("/live/media",           CreateVideoServlet(cont, m_grpcManager, m_rightsChecker, m_hlsContent, rtspUrlBuilder, m_videoCache));
+            m_server->Install("/live/media",           CreateVideoServlet(cont, m_grpcManager, m_rightsChecker, rtspUrlBuilder, m_videoCache));
             m_server->Install("/live/media/snapshot",  CreateLiveSnapshotServlet(cont, m_rightsChecker));
             m_server->Install("/video-origins",        CreateVideoAccessPointServlet(GET_LOGGER_PTR, m_grpcManager));
             m_server->Install("/video-sources",        CreateVideoAccessPointServlet(GET_LOGGER_PTR, m_grpcManager));
-            m_server->Install("/archive",              CreateArchiveServlet(cont, m_grpcManager, m_rightsChecker, m_hlsContent, rtspUrlBuilder, m_videoCache));
+            m_server->Install("/archive",              CreateArchiveServlet(cont, m_grpcManager, m_rightsChecker, rtspUrlBuilder, m_videoCache));
             m_server->Install("/uuid",                 CreateCommonServlet(cont, m_grpcManager));
             m_server->Install("/languages",            CreateCommonServlet(cont, m_grpcManager));
             m_server->Install("/logout",               CreateCommonServlet(cont, m_grpcManager));
@@ -266,7 +256,7 @@ inline bool operator<(const SUserWithIp& lhs, const SUserWithIp& rhs)
             m_server->Install("/archive/events",       CreateEventServlet(GET_LOGGER_PTR, m_grpcManager, m_rightsChecker));
             m_server->Install("/export",               CreateExportServlet(cont, m_exportContent, m_grpcManager, m_rightsChecker));
             m_server->Install("/search/auto",          CreateAutoSearchServlet(cont, m_grpcManager));
-            m_server->Install("/search/face",          CreateFaceSearchServlet(cont));
+            m_server->Install("/search/face",          CreateFaceSearchServlet(cont, m_grpcManager));
             m_server->Install("/search/vmda",          CreateVmdaSearchServlet(cont, m_grpcManager));
             m_server->Install("/search/stranger",      CreateStrangerSearchServlet(cont));
             m_server->Install("/faceAppearanceRate",   CreateFarStatusServlet(cont));
@@ -604,7 +594,6 @@ inline bool operator<(const SUserWithIp& lhs, const SUserWithIp& rhs)
         NPluginUtility::PRigthsChecker m_rightsChecker;
 
         std::string m_staticContent;
-        std::string m_hlsContent;
         std::string m_exportContent;
         std::auto_ptr<NHttp::IHttpServer> m_server;
         NPluginHelpers::PGstManager m_gstManager;
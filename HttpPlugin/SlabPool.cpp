@@ -0,0 +1,46 @@
+#include "SlabPool.h"
+
+#include <atomic>
+
+namespace
+{
+    std::atomic<std::uint64_t> g_allocations(0);
+    std::atomic<std::uint64_t> g_deallocations(0);
+    std::atomic<std::uint64_t> g_depotRefills(0);
+    std::atomic<std::uint64_t> g_slabs(0);
+}
+
+namespace NHttp
+{
+    namespace NSlabPool
+    {
+        void NoteOperations(std::uint64_t allocations, std::uint64_t deallocations)
+        {
+            if (allocations)
+                g_allocations.fetch_add(allocations, std::memory_order_relaxed);
+            if (deallocations)
+                g_deallocations.fetch_add(deallocations, std::memory_order_relaxed);
+        }
+
+        void NoteDepotRefill()
+        {
+            g_depotRefills.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void NoteSlab()
+        {
+            g_slabs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SSlabPoolStatistics GetSlabPoolStatistics()
+    {
+        SSlabPoolStatistics st;
+        const std::uint64_t deallocations = g_deallocations.load(std::memory_order_relaxed);
+        st.Allocations = g_allocations.load(std::memory_order_relaxed);
+        st.DepotRefills = g_depotRefills.load(std::memory_order_relaxed);
+        st.Slabs = g_slabs.load(std::memory_order_relaxed);
+        st.BlocksInUse = st.Allocations > deallocations ? st.Allocations - deallocations : 0;
+        return st;
+    }
+}
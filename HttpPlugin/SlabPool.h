@@ -0,0 +1,292 @@
+#ifndef SLAB_POOL_H__
+#define SLAB_POOL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace NHttp
+{
+    struct SSlabPoolStatistics
+    {
+        std::uint64_t Allocations = 0;
+        // Thread caches refilled from the shared depot, the only locked path of allocation.
+        std::uint64_t DepotRefills = 0;
+        std::uint64_t Slabs = 0;
+        // Counted per thread and published in batches, so it lags slightly behind.
+        std::uint64_t BlocksInUse = 0;
+    };
+
+    SSlabPoolStatistics GetSlabPoolStatistics();
+
+    namespace NSlabPool
+    {
+        const std::size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+        const std::size_t BLOCKS_PER_BATCH = 64;
+        const std::size_t BATCHES_PER_SLAB = 8;
+        const std::size_t THREAD_CACHE_LIMIT = 2 * BLOCKS_PER_BATCH;
+        // Threads count operations locally and publish them this often, so that
+        // the counters do not bounce a shared cache line on every allocation.
+        const std::size_t PUBLISH_INTERVAL = 256;
+
+        void NoteOperations(std::uint64_t allocations, std::uint64_t deallocations);
+        void NoteDepotRefill();
+        void NoteSlab();
+
+        constexpr std::size_t BlockSizeFor(std::size_t size)
+        {
+            return (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+        }
+    }
+
+    // Fixed size blocks carved from slabs that are never returned to the heap.
+    // Each thread allocates from and frees to its own cache; blocks move between
+    // the caches and the shared depot in batches, so the depot lock is taken
+    // once per BLOCKS_PER_BATCH operations at most. A block may be freed on
+    // a thread other than the one that allocated it.
+    template <std::size_t BlockSize>
+    class CSlabPool
+    {
+        static_assert(BlockSize >= sizeof(void*) && BlockSize % NSlabPool::BLOCK_ALIGNMENT == 0,
+            "Block size must be a non-zero multiple of the block alignment");
+
+        struct SBlock
+        {
+            SBlock* Next;
+        };
+
+        struct SBatch
+        {
+            SBlock* Head;
+            std::size_t Count;
+        };
+
+        struct SDepot
+        {
+            std::mutex Mutex;
+            std::vector<SBatch> Batches;
+        };
+
+        struct SThreadCache
+        {
+            SBlock* Head = nullptr;
+            std::size_t Count = 0;
+            std::uint64_t Allocations = 0;
+            std::uint64_t Deallocations = 0;
+
+            void Note(bool allocation)
+            {
+                ++(allocation ? Allocations : Deallocations);
+                if (Allocations + Deallocations >= NSlabPool::PUBLISH_INTERVAL)
+                    Publish();
+            }
+
+            void Publish()
+            {
+                NSlabPool::NoteOperations(Allocations, Deallocations);
+                Allocations = Deallocations = 0;
+            }
+
+            ~SThreadCache()
+            {
+                Publish();
+                cacheDestroyed() = true;
+                if (Head)
+                    pushToDepot(SBatch{ Head, Count });
+            }
+        };
+
+    public:
+        static void* Allocate()
+        {
+            SBlock* block = nullptr;
+            if (cacheDestroyed())
+            {
+                SBatch batch = popFromDepot();
+                block = batch.Head;
+                if (batch.Count > 1)
+                    pushToDepot(SBatch{ block->Next, batch.Count - 1 });
+                NSlabPool::NoteOperations(1, 0);
+            }
+            else
+            {
+                SThreadCache& cache = threadCache();
+                if (!cache.Head)
+                {
+                    SBatch batch = popFromDepot();
+                    cache.Head = batch.Head;
+                    cache.Count = batch.Count;
+                }
+                block = cache.Head;
+                cache.Head = block->Next;
+                --cache.Count;
+                cache.Note(true);
+            }
+            return block;
+        }
+
+        static void Deallocate(void* p)
+        {
+            SBlock* block = static_cast<SBlock*>(p);
+            if (cacheDestroyed())
+            {
+                // Freed during thread teardown, after the cache of this thread has gone.
+                block->Next = nullptr;
+                pushToDepot(SBatch{ block, 1 });
+                NSlabPool::NoteOperations(0, 1);
+                return;
+            }
+
+            SThreadCache& cache = threadCache();
+            block->Next = cache.Head;
+            cache.Head = block;
+            cache.Note(false);
+            if (++cache.Count > NSlabPool::THREAD_CACHE_LIMIT)
+            {
+                SBlock* last = cache.Head;
+                for (std::size_t i = 1; i < NSlabPool::BLOCKS_PER_BATCH; ++i)
+                    last = last->Next;
+                SBatch batch{ cache.Head, NSlabPool::BLOCKS_PER_BATCH };
+                cache.Head = last->Next;
+                cache.Count -= NSlabPool::BLOCKS_PER_BATCH;
+                last->Next = nullptr;
+                pushToDepot(batch);
+            }
+        }
+
+    private:
+        static SThreadCache& threadCache()
+        {
+            static thread_local SThreadCache cache;
+            return cache;
+        }
+
+        // Trivially destructible, so it stays readable while other thread_local objects are destroyed.
+        static bool& cacheDestroyed()
+        {
+            static thread_local bool destroyed = false;
+            return destroyed;
+        }
+
+        // Deliberately leaked: thread caches and blocks freed from static destructors outlive any static object.
+        static SDepot& depot()
+        {
+            static SDepot* d = new SDepot();
+            return *d;
+        }
+
+        static void pushToDepot(SBatch batch)
+        {
+            SDepot& d = depot();
+            std::lock_guard<std::mutex> lock(d.Mutex);
+            d.Batches.push_back(batch);
+        }
+
+        static SBatch popFromDepot()
+        {
+            NSlabPool::NoteDepotRefill();
+            SDepot& d = depot();
+            {
+                std::lock_guard<std::mutex> lock(d.Mutex);
+                if (!d.Batches.empty())
+                {
+                    SBatch batch = d.Batches.back();
+                    d.Batches.pop_back();
+                    return batch;
+                }
+            }
+            return allocateSlab();
+        }
+
+        // Carves a new slab into batches, keeps the first one and shares the rest.
+        static SBatch allocateSlab()
+        {
+            const std::size_t blocks = NSlabPool::BLOCKS_PER_BATCH * NSlabPool::BATCHES_PER_SLAB;
+            char* slab = static_cast<char*>(::operator new(blocks * BlockSize));
+            NSlabPool::NoteSlab();
+
+            std::vector<SBatch> batches;
+            batches.reserve(NSlabPool::BATCHES_PER_SLAB);
+            for (std::size_t b = 0; b < NSlabPool::BATCHES_PER_SLAB; ++b)
+            {
+                char* first = slab + b * NSlabPool::BLOCKS_PER_BATCH * BlockSize;
+                for (std::size_t i = 0; i < NSlabPool::BLOCKS_PER_BATCH; ++i)
+                {
+                    SBlock* block = reinterpret_cast<SBlock*>(first + i * BlockSize);
+                    block->Next = (i + 1 < NSlabPool::BLOCKS_PER_BATCH)
+                        ? reinterpret_cast<SBlock*>(first + (i + 1) * BlockSize)
+                        : nullptr;
+                }
+                batches.push_back(SBatch{ reinterpret_cast<SBlock*>(first), NSlabPool::BLOCKS_PER_BATCH });
+            }
+
+            SDepot& d = depot();
+            std::lock_guard<std::mutex> lock(d.Mutex);
+            d.Batches.insert(d.Batches.end(), batches.begin() + 1, batches.end());
+            return batches.front();
+        }
+    };
+
+    // Standard allocator over the slab pool of the matching size class. Meant for
+    // std::allocate_shared, which allocates the object together with its control
+    // block in a single block.
+    template <typename T>
+    class CSlabAllocator
+    {
+        using pool_type = CSlabPool<NSlabPool::BlockSizeFor(sizeof(T))>;
+
+        static bool pooled(std::size_t n)
+        {
+            return n == 1 && alignof(T) <= NSlabPool::BLOCK_ALIGNMENT;
+        }
+
+    public:
+        using value_type = T;
+
+        CSlabAllocator() = default;
+
+        template <typename U>
+        CSlabAllocator(const CSlabAllocator<U>&)
+        {
+        }
+
+        T* allocate(std::size_t n)
+        {
+            if (pooled(n))
+                return static_cast<T*>(pool_type::Allocate());
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, std::size_t n)
+        {
+            if (pooled(n))
+                pool_type::Deallocate(p);
+            else
+                ::operator delete(p);
+        }
+
+        template <typename U>
+        bool operator==(const CSlabAllocator<U>&) const
+        {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(const CSlabAllocator<U>&) const
+        {
+            return false;
+        }
+    };
+
+    template <typename T, typename... TArgs>
+    std::shared_ptr<T> AllocatePooled(TArgs&&... args)
+    {
+        return std::allocate_shared<T>(CSlabAllocator<T>(), std::forward<TArgs>(args)...);
+    }
+}
+
+#endif // !SLAB_POOL_H__
@@ -10,6 +10,9 @@
 #include "CommonUtility.h"
 #include "DataSink.h"
 #include "SendContext.h"
+#include "SlabPool.h"
+#include "SearchScheduler.h"
+#include "VideoSourceCache.h"
 #include "BLQueryHelper.h"
 #include "Constants.h"
 #include "RegexUtility.h"
@@ -18,6 +21,7 @@
 #include <CorbaHelpers/ResolveServant.h>
 #include <InfraServer_IDL/HostAgentC.h>
 #include <MMTransport/MMTransport.h>
+#include "../MMCoding/ThreadBudget.h"
 
 #include <axxonsoft/bl/statistics/Statistics.grpc.pb.h>
 
@@ -108,6 +112,11 @@ struct WebserverStatistics: boost::enable_shared_from_this<WebserverStatistics>
         boost::mutex::scoped_lock lock(m_mutex);
         //update(lock);
         const auto& strNow = boost::posix_time::to_iso_string(now);
+        const NContext::SFramingStatistics framing = NContext::GetFramingStatistics();
+        const NHttp::SSnapshotCacheStatistics snapshots = NHttp::GetSnapshotCacheStatistics();
+        const NHttp::SSlabPoolStatistics dataBuffers = NHttp::GetSlabPoolStatistics();
+        const NHttp::SSearchSchedulerStatistics searches = NHttp::GetSearchScheduler().GetStatistics();
+        const NHttp::SSendQueueStatistics sendQueues = NHttp::GetSendQueueStatistics();
         arch 
             & boost::serialization::make_nvp("now", strNow)
             & boost::serialization::make_nvp("requests", requests)
@@ -116,6 +125,22 @@ struct WebserverStatistics: boost::enable_shared_from_this<WebserverStatistics>
             & boost::serialization::make_nvp("bytesOutPerSecond", bytesOutPerSecond)
             & boost::serialization::make_nvp("streams", streams)
             & boost::serialization::make_nvp("uptime", uptime)
+            & boost::serialization::make_nvp("framedChunks", framing.FramedChunks)
+            & boost::serialization::make_nvp("framedChunkReuses", framing.FramedChunkReuses)
+            & boost::serialization::make_nvp("snapshotCacheHits", snapshots.Hits)
+            & boost::serialization::make_nvp("snapshotCacheMisses", snapshots.Misses)
+            & boost::serialization::make_nvp("dataBufferAllocations", dataBuffers.Allocations)
+            & boost::serialization::make_nvp("dataBufferDepotRefills", dataBuffers.DepotRefills)
+            & boost::serialization::make_nvp("dataBufferSlabs", dataBuffers.Slabs)
+            & boost::serialization::make_nvp("dataBuffersInUse", dataBuffers.BlocksInUse)
+            & boost::serialization::make_nvp("searchesActive", searches.Active)
+            & boost::serialization::make_nvp("searchesPending", searches.Pending)
+            & boost::serialization::make_nvp("searchesStarted", searches.Started)
+            & boost::serialization::make_nvp("searchesRejected", searches.Rejected)
+            & boost::serialization::make_nvp("searchesCancelled", searches.Cancelled)
+            & boost::serialization::make_nvp("sendQueueOverflows", sendQueues.Overflows)
+            & boost::serialization::make_nvp("sendQueueDroppedFrames", sendQueues.DroppedFrames)
+            & boost::serialization::make_nvp("sendQueueDroppedBytes", sendQueues.DroppedBytes)
             ;
     }
 
@@ -156,6 +181,19 @@ struct WebserverStatistics: boost::enable_shared_from_this<WebserverStatistics>
     }
 };
 
+namespace
+{
+    const char* threadingModeName(NMMSS::EThreadingMode mode)
+    {
+        switch (mode)
+        {
+        case NMMSS::ETM_FRAME: return "frame";
+        case NMMSS::ETM_SLICE: return "slice";
+        default: return "single";
+        }
+    }
+}
+
 class EndpointStatisticsSerializer
 {
 public:
@@ -398,6 +436,37 @@ private:
             }
             NPluginUtility::SendText(resp, stream.str(), true, headersOnly);
         }
+        else if ("/webserver/codecs" == pathInfo)
+        {
+            const NMMSS::SThreadBudgetStatistics budget = NMMSS::GetThreadBudgetStatistics();
+            Json::Value contexts(Json::arrayValue);
+            for (const auto& c : budget.Contexts)
+            {
+                Json::Value context(Json::objectValue);
+                context["id"] = static_cast<Json::UInt64>(c.Id);
+                context["kind"] = NMMSS::ECK_ENCODER == c.Kind ? "encoder" : "decoder";
+                context["width"] = c.Width;
+                context["height"] = c.Height;
+                context["fixed"] = c.Fixed;
+                context["threads"] = c.Allocation.Threads;
+                context["mode"] = threadingModeName(c.Allocation.Mode);
+                contexts.append(context);
+            }
+
+            Json::Value codecs(Json::objectValue);
+            codecs["cores"] = budget.Cores;
+            codecs["generation"] = static_cast<Json::UInt64>(budget.Generation);
+            codecs["contexts"] = contexts;
+            NPluginUtility::SendText(req, resp, codecs.toStyledString());
+        }
+        else if ("/webserver/reconnects" == pathInfo)
+        {
+            const NMMSS::SSinkReconnectStatistics st = NMMSS::GetSinkReconnectStatistics();
+            Json::Value reconnects(Json::objectValue);
+            reconnects["waiting"] = static_cast<Json::UInt64>(st.Waiting);
+            reconnects["connecting"] = static_cast<Json::UInt64>(st.Connecting);
+            NPluginUtility::SendText(req, resp, reconnects.toStyledString());
+        }
         else if (0 == pathInfo.find("/hardware"))
         {
             NCorbaHelpers::PContainer cont(m_container);
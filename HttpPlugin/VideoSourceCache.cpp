@@ -2,6 +2,7 @@
 #include <atomic>
 
 #include <boost/asio.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 
 #include "Platform.h"
 #include "Gstreamer.h"
@@ -25,8 +26,20 @@
 
 namespace
 {
-    const size_t BUFFER_THRESHOLD = 1000;
-    const char* const SAMPLE_TIMESTAMP = "X-Video-Original-Time: ";
+    // Send queue limits of a single MP4/JPEG client. The item capacity only sizes the ring,
+    // the actual backpressure is driven by queued bytes and by queued media duration.
+    const size_t SEND_QUEUE_CAPACITY = 1024;
+    const std::uint64_t SEND_QUEUE_MAX_BYTES = 32 * 1024 * 1024;
+    const std::int64_t SEND_QUEUE_MAX_MEDIA_MS = 10000;
+
+    // Budget of a single gather write when the client lags and several buffers are queued.
+    const std::uint64_t SEND_BATCH_MAX_BYTES = 1024 * 1024;
+    const size_t SEND_BATCH_MAX_BUFFERS = 64;
+
+    // Totals of all clients, the per-client counters only reach the log.
+    std::atomic<std::uint64_t> g_droppedFrames(0);
+    std::atomic<std::uint64_t> g_droppedBytes(0);
+    std::atomic<std::uint64_t> g_sendQueueOverflows(0);
 
     struct SOrigin : public boost::noncopyable
     {
@@ -72,12 +85,14 @@ namespace
         NMMSS::PPullFilter encoder;
         NMMSS::CConnectionResource encoder2distributor;
         NMMSS::PDistributor distributor;
+        NContext::PMultipartFrameCache frameCache;
 
         SAdapted(DECLARE_LOGGER_ARG, POrigin o, int width, int height, int compression)
             :origin(o)
             , scaler(NMMSS::CreateSizeFilter(GET_LOGGER_PTR, width, height))
             , encoder(NMMSS::CreateMJPEGEncoderFilter(GET_LOGGER_PTR, static_cast<NMMSS::EVideoCodingPreset>(compression)))
             , distributor(NMMSS::CreateDistributor(GET_LOGGER_PTR, NMMSS::NAugment::UnbufferedDistributor{}))
+            , frameCache(NContext::CreateMultipartFrameCache())
         {
             encoder2distributor = NMMSS::CConnectionResource(encoder->GetSource(), distributor->GetSink(), GET_LOGGER_PTR);
             scaler2encoder = NMMSS::CConnectionResource(scaler->GetSource(), encoder->GetSink(), GET_LOGGER_PTR);
@@ -145,6 +160,10 @@ namespace
             :adapted(a)
             , sink(s)
         {
+            NPluginHelpers::IMultipartSink* ms = dynamic_cast<NPluginHelpers::IMultipartSink*>(sink.Get());
+            if (nullptr != ms)
+                ms->SetFrameCache(adapted->frameCache);
+
             auto src = NMMSS::PPullStyleSource(adapted->distributor->CreateSource());
             connection = NMMSS::GetConnectionBroker()->SetConnection(src.Get(), sink.Get(), GET_LOGGER_PTR);
         }
@@ -228,8 +247,7 @@ namespace
                           NHttp::IVideoSourceCache::TOnDisconnected f1,
                           DECLARE_LOGGER_ARG,
                           bool keyFrames,
-                          NPluginHelpers::EStreamContainer sc,
-                          const std::string& filePath)
+                          NPluginHelpers::EStreamContainer sc)
             : m_response(resp)
             , m_videoOrigin(videoSource)
             , m_audioOrigin(audioSource)
@@ -240,8 +258,13 @@ namespace
             , m_disconnected(false)
             , m_dataTimer(NCorbaHelpers::GetReactorInstanceShared()->GetIO())
             , m_dataWaitTimeout(keyFrames ? boost::posix_time::milliseconds(KEY_SAMPLE_TIMEOUT) : boost::posix_time::milliseconds(SAMPLE_TIMEOUT))
+            , m_dataToSend(SEND_QUEUE_CAPACITY)
+            , m_queuedBytes(0)
+            , m_oldestQueuedTs(0)
             , m_drop(false)
             , m_processing(false)
+            , m_droppedFrames(0)
+            , m_droppedBytes(0)
             , m_currentTs(0)
         {
             INIT_LOGGER_HOLDER;
@@ -249,8 +272,7 @@ namespace
             m_mp4Muxer = NPluginHelpers::PMuxerSource((NPluginHelpers::CreateMP4Muxer(GET_LOGGER_PTR,
                                                                                       1,
                                                                                       sc,
-                                                                                      textSource ? true : false,
-                                                                                      filePath)));
+                                                                                      textSource ? true : false)));
 
             m_videoConnection = NMMSS::CConnectionResource(videoSource->GetSource(), m_mp4Muxer->GetVideoSink(), GET_LOGGER_PTR);
 
@@ -284,22 +306,25 @@ namespace
             , m_dataTimer(NCorbaHelpers::GetReactorInstanceShared()->GetIO())
             , m_dataWaitTimeout(ctx->keyFrames ? boost::posix_time::milliseconds(KEY_SAMPLE_TIMEOUT)
                                                : boost::posix_time::milliseconds(SAMPLE_TIMEOUT))
+            , m_dataToSend(SEND_QUEUE_CAPACITY)
+            , m_queuedBytes(0)
+            , m_oldestQueuedTs(0)
             , m_drop(false)
             , m_processing(false)
+            , m_droppedFrames(0)
+            , m_droppedBytes(0)
             , m_currentTs(0)
         {
             INIT_LOGGER_HOLDER;
 
             NHttp::SJpegArchiveContext* jpegCtx = nullptr;
-            NHttp::SHlsArchiveContext* hlsCtx = nullptr;
 
-            NPluginHelpers::EStreamContainer sc = getStreamContainer(ctx, jpegCtx, hlsCtx);
+            NPluginHelpers::EStreamContainer sc = getStreamContainer(ctx, jpegCtx);
 
             m_mp4Muxer = NPluginHelpers::PMuxerSource((NPluginHelpers::CreateMP4Muxer(GET_LOGGER_PTR,
                                                                                       ctx->speed,
                                                                                       sc,
-                                                                                      false,
-                                                                                      (nullptr == hlsCtx) ? "" : hlsCtx->m_filePath)));
+                                                                                      false)));
 
             const long playFlags = (ctx->speed < 0) ? NMMSS::PMF_REVERSE | NMMSS::PMF_KEYFRAMES
                                     : (ctx->keyFrames) ? NMMSS::PMF_KEYFRAMES
@@ -358,7 +383,8 @@ namespace
 
         ~SMp4ClientContext()
         {
-            _log_ << "SMp4ClientContext dtor";
+            _log_ << "SMp4ClientContext dtor. Dropped " << m_droppedFrames.load()
+                  << " frames (" << m_droppedBytes.load() << " bytes)";
             Stop();
         }
 
@@ -480,43 +506,75 @@ namespace
                 cc->onSample(s);
         }
 
+        // Producer side of the send queue. Called from the muxer callback only.
         void onSample(NHttp::PDataBuffer db) override
         {
-            m_hasData.test_and_set();
+            if (m_drop && !db->IsKeyData())
             {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                if (m_dataToSend.size() == BUFFER_THRESHOLD)
-                {
-                    m_drop = true;
-                    return;
-                }
+                dropSample(db);
+                return;
+            }
+            m_drop = false;
 
-                if (m_drop && !db->IsKeyData())
-                {
-                    _wrn_ << "Drop delta frame";
-                    return;
-                }
-                else if (m_drop)
+            bool overflowed = isQueueOverflowed(db);
+            if (!overflowed)
+            {
+                // Account before publishing, otherwise the consumer may subtract first.
+                // The first buffer put into an empty queue is the oldest one there.
+                std::uint64_t none = 0;
+                m_oldestQueuedTs.compare_exchange_strong(none, db->GetTimestamp(), std::memory_order_relaxed);
+                m_queuedBytes.fetch_add(db->GetSize(), std::memory_order_relaxed);
+                if (!m_dataToSend.push(db))
                 {
-                    m_drop = false;
+                    m_queuedBytes.fetch_sub(db->GetSize(), std::memory_order_relaxed);
+                    overflowed = true;
                 }
+            }
 
-                m_dataToSend.push_back(db);
+            if (overflowed)
+            {
+                _wrn_ << "Client send queue overflow: " << m_queuedBytes.load(std::memory_order_relaxed)
+                      << " bytes queued. Drop frames until next key frame";
+                g_sendQueueOverflows.fetch_add(1, std::memory_order_relaxed);
+                m_drop = true;
+                dropSample(db);
+                return;
+            }
 
-                if (!m_processing)
-                {
-                    m_processing = true;
-                    lock.unlock();
+            // Only samples going out keep the connection alive, a client dropping everything times out.
+            m_hasData.test_and_set();
 
-                    std::call_once(m_timerFlag, [this]() {
-                        setDataTimer();
-                    });
+            if (!m_processing.exchange(true, std::memory_order_acq_rel))
+            {
+                std::call_once(m_timerFlag, [this]() {
+                    setDataTimer();
+                });
 
-                    sendDataBuffer();
-                }
+                sendDataBuffer();
             }
         }
 
+        bool isQueueOverflowed(NHttp::PDataBuffer db) const
+        {
+            if (m_queuedBytes.load(std::memory_order_relaxed) + db->GetSize() > SEND_QUEUE_MAX_BYTES)
+                return true;
+
+            std::uint64_t oldestTs = m_oldestQueuedTs.load(std::memory_order_relaxed);
+            if (0 == oldestTs || db->GetTimestamp() <= oldestTs)
+                return false;
+
+            return (NMMSS::PtimeFromQword(db->GetTimestamp()) - NMMSS::PtimeFromQword(oldestTs)).total_milliseconds()
+                > SEND_QUEUE_MAX_MEDIA_MS;
+        }
+
+        void dropSample(NHttp::PDataBuffer db)
+        {
+            m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            m_droppedBytes.fetch_add(db->GetSize(), std::memory_order_relaxed);
+            g_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            g_droppedBytes.fetch_add(db->GetSize(), std::memory_order_relaxed);
+        }
+
         static void sourceFinishProcessing(NHttp::WClientContext ctx)
         {
             NHttp::PClientContext cc = ctx.lock();
@@ -545,39 +603,67 @@ namespace
 
             std::uint64_t bodySize = db->GetSize();
 
-            std::stringstream s;
-            s << CR << LF
-                << BOUNDARY << CR << LF
-                << CONTENT_TYPE << "image/jpeg" << CR << LF
-                << CONTENT_LENGTH << bodySize << CR << LF
-                << SAMPLE_TIMESTAMP << boost::posix_time::to_iso_string(NMMSS::PtimeFromQword(db->GetTimestamp())) << CR << LF
-                << CR << LF;
-
-            m_headerBuffer.assign(s.str());
-            buffs.push_back(boost::asio::buffer(m_headerBuffer.c_str(), m_headerBuffer.size()));
+            m_headerBuffers.push_back(NContext::MakeMultipartHeader(bodySize, db->GetTimestamp()));
+            const std::string& header = m_headerBuffers.back();
+            buffs.push_back(boost::asio::buffer(header.c_str(), header.size()));
             buffs.push_back(boost::asio::buffer(db->GetData(), static_cast<size_t>(bodySize)));
         }
 
+        bool popDataBuffer(NHttp::PDataBuffer& db)
+        {
+            if (!m_dataToSend.pop(db))
+                return false;
+
+            m_queuedBytes.fetch_sub(db->GetSize(), std::memory_order_relaxed);
+            updateOldestQueuedTs();
+            return true;
+        }
+
+        // The queued media is measured from the new head of the ring. A drained queue holds none,
+        // then the next buffer queued starts the measure anew, unless it has been pushed already.
+        void updateOldestQueuedTs()
+        {
+            if (m_dataToSend.read_available() > 0)
+            {
+                m_oldestQueuedTs.store(m_dataToSend.front()->GetTimestamp(), std::memory_order_relaxed);
+                return;
+            }
+
+            m_oldestQueuedTs.store(0, std::memory_order_relaxed);
+            if (m_dataToSend.read_available() > 0)
+            {
+                std::uint64_t none = 0;
+                m_oldestQueuedTs.compare_exchange_strong(none, m_dataToSend.front()->GetTimestamp(), std::memory_order_relaxed);
+            }
+        }
+
+        // Consumer side of the send queue. Only the owner of m_processing may pop.
         void sendDataBuffer()
         {
             NHttp::PDataBuffer db;
+            while (!popDataBuffer(db))
             {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                if (!m_dataToSend.empty())
-                {
-                    db = m_dataToSend.front();
-                    m_dataToSend.pop_front();
-                }
+                m_processing.store(false, std::memory_order_release);
 
-                if (!db)
-                {
-                    m_processing = false;
+                // The producer may have pushed after the failed pop but before the flag was released.
+                if (m_dataToSend.empty() || m_processing.exchange(true, std::memory_order_acq_rel))
                     return;
-                }
             }
 
+            // Everything already queued goes out in one gather write, within the batch budget.
+            m_sending.clear();
+            m_headerBuffers.clear();
+
             NHttp::IResponse::TConstBufferSeq buffs;
-            m_onData(buffs, db);
+            std::uint64_t batchBytes = 0;
+            do
+            {
+                m_onData(buffs, db);
+                m_sending.push_back(db);
+                batchBytes += db->GetSize();
+            } while (batchBytes < SEND_BATCH_MAX_BYTES
+                && buffs.size() + 2 <= SEND_BATCH_MAX_BUFFERS
+                && popDataBuffer(db));
 
             try
             {
@@ -585,7 +671,7 @@ namespace
                     m_response->AsyncWrite(
                         buffs,
                         std::bind(&SMp4ClientContext::onSentData, shared_from_base<SMp4ClientContext>(),
-                            db, std::placeholders::_1)
+                            std::placeholders::_1)
                     );
             }
             catch (...)
@@ -595,7 +681,7 @@ namespace
             }
         }
 
-        void onSentData(NHttp::PDataBuffer db, const boost::system::error_code ec)
+        void onSentData(const boost::system::error_code ec)
         {
             if (ec)
             {
@@ -612,7 +698,7 @@ namespace
             if (es)
             {
                 Json::Value v(Json::stringValue);
-                v = boost::posix_time::to_iso_string(NMMSS::PtimeFromQword(db->GetTimestamp()));
+                v = boost::posix_time::to_iso_string(NMMSS::PtimeFromQword(m_sending.back()->GetTimestamp()));
                 es->SendEvent("timestamp", v);
             }
 
@@ -661,14 +747,13 @@ namespace
             return NMMSS::PPullStyleSink(NPluginHelpers::CreateJPEGSink(GET_LOGGER_PTR, ctx->m_width, ctx->m_height, gSink));
         }
 
-        NPluginHelpers::EStreamContainer getStreamContainer(NHttp::PArchiveContext ctx, NHttp::SJpegArchiveContext*& jpegCtx, NHttp::SHlsArchiveContext*& hlsCtx)
+        NPluginHelpers::EStreamContainer getStreamContainer(NHttp::PArchiveContext ctx, NHttp::SJpegArchiveContext*& jpegCtx)
         {
             jpegCtx = dynamic_cast<NHttp::SJpegArchiveContext*>(ctx.get());
             if (nullptr != jpegCtx)
                 return NPluginHelpers::ENO_CONTAINER;
 
-            hlsCtx = dynamic_cast<NHttp::SHlsArchiveContext*>(ctx.get());
-            if (nullptr != hlsCtx)
+            if (nullptr != dynamic_cast<NHttp::SHlsArchiveContext*>(ctx.get()))
                 return NPluginHelpers::EHLS_CONTAINER;
 
             return NPluginHelpers::EMP4_CONTAINER;
@@ -683,9 +768,6 @@ namespace
         NHttp::PMMOrigin m_textOrigin;
         NMMSS::CConnectionResource m_textConnection;
 
-        std::mutex m_mutex;
-        std::deque<NHttp::PDataBuffer> m_dataToSend;
-
         NHttp::IVideoSourceCache::TOnDisconnected m_onDisconnected;
 
         std::mutex m_esMutex;
@@ -709,12 +791,19 @@ namespace
         boost::posix_time::time_duration m_dataWaitTimeout;
         std::atomic_flag m_hasData = ATOMIC_FLAG_INIT;
 
+        boost::lockfree::spsc_queue<NHttp::PDataBuffer> m_dataToSend;
+        std::atomic<std::uint64_t> m_queuedBytes;
+        std::atomic<std::uint64_t> m_oldestQueuedTs;
+
         bool m_drop;
-        bool m_processing;
+        std::atomic<bool> m_processing;
+        std::atomic<std::uint64_t> m_droppedFrames;
+        std::atomic<std::uint64_t> m_droppedBytes;
 
         bool m_detachAudio = false;
 
-        std::string m_headerBuffer;
+        std::vector<NHttp::PDataBuffer> m_sending;
+        std::deque<std::string> m_headerBuffers;
 
         std::function<void(NHttp::IResponse::TConstBufferSeq& buffs, NHttp::PDataBuffer db)> m_onData;
 
@@ -776,8 +865,7 @@ namespace
                                                                    f1,
                                                                    GET_LOGGER_PTR,
                                                                    keyFrames,
-                                                                   NPluginHelpers::EMP4_CONTAINER,
-                                                                   "" ));
+                                                                   NPluginHelpers::EMP4_CONTAINER));
             else
                 return NHttp::PClientContext();
         }
@@ -806,9 +894,7 @@ namespace
                                                                ctx));
         }
 
-        NHttp::PClientContext CreateHlsContext(NHttp::PResponse r,
-                                               const std::string& videoSource,
-                                               const std::string& rootPath,
+        NHttp::PClientContext CreateHlsContext(const std::string& videoSource,
                                                NHttp::IVideoSourceCache::TOnDisconnected f1) override
         {
             NCorbaHelpers::PContainer cont = m_container;
@@ -823,15 +909,14 @@ namespace
             lock.unlock();
 
             if (videoOrigin)
-                return NHttp::PClientContext(new SMp4ClientContext(cont.Get(), r,
+                return NHttp::PClientContext(new SMp4ClientContext(cont.Get(), NHttp::PResponse(),
                                                                    videoOrigin,
                                                                    {},
                                                                    {},
                                                                    f1,
                                                                    GET_LOGGER_PTR,
                                                                    false,
-                                                                   NPluginHelpers::EHLS_CONTAINER,
-                                                                   rootPath));
+                                                                   NPluginHelpers::EHLS_CONTAINER));
             else
                 return NHttp::PClientContext();
         }
@@ -911,4 +996,13 @@ namespace NHttp
     {
         return PVideoSourceCache(new CVideoSourceCache(c, cache));
     }
+
+    SSendQueueStatistics GetSendQueueStatistics()
+    {
+        SSendQueueStatistics st;
+        st.Overflows = g_sendQueueOverflows.load(std::memory_order_relaxed);
+        st.DroppedFrames = g_droppedFrames.load(std::memory_order_relaxed);
+        st.DroppedBytes = g_droppedBytes.load(std::memory_order_relaxed);
+        return st;
+    }
 }
@@ -140,17 +140,14 @@ namespace NHttp
 
     struct SHlsArchiveContext : public SArchiveContext
     {
-        SHlsArchiveContext(DECLARE_LOGGER_ARG, const std::string& filePath) 
+        SHlsArchiveContext(DECLARE_LOGGER_ARG) 
             : SArchiveContext(GET_LOGGER_PTR)
-            , m_filePath(filePath)
         {}
 
         ~SHlsArchiveContext()
         {
             _this_log_ << "SHlsArchiveContext dtor";
         }
-
-        std::string m_filePath;
     };
 
     struct IVideoSourceCache
@@ -169,13 +166,23 @@ namespace NHttp
             NGrpcHelpers::PCredentials credentials, NHttp::PResponse r, NHttp::PCountedSynchronizer sync,
             PArchiveContext ctx, TOnDisconnected) = 0;
 
-        virtual PClientContext CreateHlsContext(NHttp::PResponse r, const std::string& videoSource, const std::string& rootPath, TOnDisconnected) = 0;
+        // Transport stream of videoSource goes to the data function passed to IClientContext::Init.
+        virtual PClientContext CreateHlsContext(const std::string& videoSource, TOnDisconnected) = 0;
 
         virtual PClientContext CreateRawContext(const NWebGrpc::PGrpcManager grpcManager, NGrpcHelpers::PCredentials credentials, NHttp::PResponse r, PArchiveContext ctx) = 0;
     };
     typedef boost::shared_ptr<IVideoSourceCache> PVideoSourceCache;
 
     PVideoSourceCache GetVideoSourceCache(NCorbaHelpers::IContainer* c, PMMCache);
+
+    // Send queues of the MP4 and JPEG clients: how often they overflowed and what was dropped then.
+    struct SSendQueueStatistics
+    {
+        std::uint64_t Overflows = 0;
+        std::uint64_t DroppedFrames = 0;
+        std::uint64_t DroppedBytes = 0;
+    };
+    SSendQueueStatistics GetSendQueueStatistics();
 }
 
 #endif // VIDEO_SOURCE_CACHE_H__
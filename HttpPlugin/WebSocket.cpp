@@ -69,6 +69,7 @@ namespace
     const char* const JSON_QUERY_ENTITIES_FIELD = "entities";
     const char* const JSON_QUERY_ENTITYID_FIELD = "id";
     const char* const JSON_QUERY_FORWARD_FIELD = "forward";
+    const char* const JSON_QUERY_CONCURRENCY_FIELD = "concurrency";
 
     const char* const METHOD_FIELD_PLAY_STATE = "play";
     const char* const METHOD_FIELD_STOP_STATE = "stop";
@@ -82,6 +83,9 @@ namespace
 
     const std::uint16_t DATA_WAIT_TIMEOUT = 30;
 
+    const int DEFAULT_BATCH_CONCURRENCY = 4;
+    const int MAX_BATCH_CONCURRENCY = 16;
+
     using ArchiveCommand_t = std::function<void(const std::string&)>;
 
     using ArchiveEndpointInfoCollection_t = std::map<std::string, PEndpointQueryContext>;
@@ -194,75 +198,158 @@ namespace
                 Stop();
             }
 
-            void Start(MMSS::StorageEndpoint_var ep, int width, int height, float crop_x, float crop_y, float crop_width, float crop_height, NPluginHelpers::TOnTimedSampleHandler sh)
+            size_t GetTimestampCount() const
             {
-                m_dataEndpoint = ep;
+                return m_timestamps.size();
+            }
 
-                m_snapshotSink = NPluginHelpers::PBatchSink(NPluginHelpers::CreateBatchSink(GET_LOGGER_PTR, this->GetStreamId(), width, height, true, crop_x, crop_y, crop_width, crop_height, sh,
-                    boost::bind(&SBatchContext::querySnapshot, std::weak_ptr<SBatchContext>(shared_from_base<SBatchContext>()), _1)));
+            // Creates an archive reader, nil when the archive refuses.
+            typedef std::function<MMSS::StorageEndpoint_var()> FCreateReader;
 
-                readSnapshot();
+            // Every lane is an independent archive reader, timestamps are spread over them
+            // and each result is sent as soon as its reader has it.
+            void Start(size_t readers, FCreateReader createReader, int width, int height, float crop_x, float crop_y, float crop_width, float crop_height, NPluginHelpers::TOnTimedSampleHandler sh)
+            {
+                m_createReader = createReader;
+                std::weak_ptr<SBatchContext> self(shared_from_base<SBatchContext>());
+                for (size_t i = 0; i < readers; ++i)
+                {
+                    PLane lane = std::make_shared<SLane>();
+                    lane->m_snapshotSink = NPluginHelpers::PBatchSink(NPluginHelpers::CreateBatchSink(GET_LOGGER_PTR, this->GetStreamId(), width, height, true, crop_x, crop_y, crop_width, crop_height, sh,
+                        boost::bind(&SBatchContext::querySnapshot, self, i, _1)));
+                    m_lanes.push_back(lane);
+                }
+
+                _this_log_ << "Batch stream " << this->GetStreamId() << " runs " << m_lanes.size() << " readers";
+
+                // Each lane creates its reader on the first query, so the archive requests go out at once.
+                for (size_t i = 0; i < m_lanes.size(); ++i)
+                    NCorbaHelpers::GetReactorInstanceShared()->GetIO().post(boost::bind(&SBatchContext::querySnapshot, self, i, true));
             }
 
         private:
+            struct SLane
+            {
+                MMSS::StorageEndpoint_var m_dataEndpoint;
+                NPluginHelpers::PBatchSink m_snapshotSink;
+                NMMSS::PSinkEndpoint m_sinkEndpoint;
+            };
+            typedef std::shared_ptr<SLane> PLane;
+
             void Stop()
             {
                 std::unique_lock<std::mutex> lock(m_stopMutex);
-                if (m_sinkEndpoint)
+                for (PLane lane : m_lanes)
+                    stopLane(lane);
+            }
+
+            static void stopLane(PLane lane)
+            {
+                if (lane->m_sinkEndpoint)
                 {
-                    m_sinkEndpoint->Destroy();
-                    m_sinkEndpoint.Reset();
+                    lane->m_sinkEndpoint->Destroy();
+                    lane->m_sinkEndpoint.Reset();
                 }
-                if (m_snapshotSink)
-                    m_snapshotSink.Reset();
+                if (lane->m_snapshotSink)
+                    lane->m_snapshotSink.Reset();
             }
 
-            static void querySnapshot(std::weak_ptr<SBatchContext> obj, bool)
+            static void querySnapshot(std::weak_ptr<SBatchContext> obj, size_t lane, bool)
             {
                 std::shared_ptr<SBatchContext> owner = obj.lock();
                 if (owner)
-                    owner->readSnapshot();          
+                    owner->readSnapshot(lane);
             }
 
-            void readSnapshot()
+            // The reader of a lane is created by its first query, false when the lane has none.
+            bool createLaneReader(size_t laneIndex)
             {
-                if (!m_timestamps.empty())
+                PLane lane;
                 {
-                    boost::posix_time::ptime seekTime = m_timestamps.front();
-                    m_timestamps.pop_front();
+                    std::unique_lock<std::mutex> lock(m_stopMutex);
+                    lane = m_lanes[laneIndex];
+                    if (!lane->m_snapshotSink)
+                        return false;
+                    // Nothing left to query, the lane is cleaned up without a reader.
+                    if (m_timestamps.empty())
+                        return true;
+                }
+                if (!CORBA::is_nil(lane->m_dataEndpoint.in()))
+                    return true;
 
-                    std::uint32_t sessionId = ++m_sessionId;
-                    m_snapshotSink->SetFragmentId(sessionId, seekTime);
+                MMSS::StorageEndpoint_var endpoint = m_createReader();
+                if (CORBA::is_nil(endpoint.in()))
+                {
+                    _this_err_ << "Batch stream " << this->GetStreamId() << " reader " << laneIndex << " can not be created";
+                    std::unique_lock<std::mutex> lock(m_stopMutex);
+                    stopLane(lane);
+                    return false;
+                }
+                lane->m_dataEndpoint = endpoint;
+                return true;
+            }
 
-                    _this_dbg_ << "Batch stream " << this->GetStreamId() << ": query time " <<
-                        boost::posix_time::to_iso_string(seekTime) << " for fragment " << sessionId;
+            void readSnapshot(size_t laneIndex)
+            {
+                if (!createLaneReader(laneIndex))
+                    return;
 
-                    m_dataEndpoint->Seek(boost::posix_time::to_iso_string(seekTime).c_str(), NPluginUtility::ToCORBAPosition(m_startPosition), NMMSS::PMF_NONE, sessionId);
+                // Stop may reset the lane at any time, so it is only used under the lock.
+                PLane lane;
+                NPluginHelpers::PBatchSink sink;
+                bool connect = false;
+                boost::posix_time::ptime seekTime;
+                {
+                    std::unique_lock<std::mutex> lock(m_stopMutex);
+                    lane = m_lanes[laneIndex];
+                    sink = lane->m_snapshotSink;
+                    if (!sink)
+                        return;
 
-                    if (!m_sinkEndpoint)
+                    if (m_timestamps.empty())
                     {
-                        auto qos = NMMSS::MakeQualityOfService();
-                        if (axxonsoft::bl::archive::START_POSITION_NEAREST_KEY_FRAME == m_startPosition)
-                            NMMSS::SetRequest(qos, MMSS::QoSRequest::OnlyKeyFrames{ true });
-
-                        m_sinkEndpoint = CreatePullConnectionByObjref(GET_LOGGER_PTR,
-                            m_dataEndpoint, m_snapshotSink.Get(), MMSS::EAUTO, &qos);
+                        _this_log_ << "Batch stream " << this->GetStreamId() << " reader " << laneIndex << " cleanup";
+                        stopLane(lane);
+                        return;
                     }
+
+                    seekTime = m_timestamps.front();
+                    m_timestamps.pop_front();
+                    if (!lane->m_sinkEndpoint)
+                        connect = true;
                 }
-                else
+
+                std::uint32_t sessionId = ++m_sessionId;
+                sink->SetFragmentId(sessionId, seekTime);
+
+                _this_dbg_ << "Batch stream " << this->GetStreamId() << ": query time " <<
+                    boost::posix_time::to_iso_string(seekTime) << " for fragment " << sessionId << " on reader " << laneIndex;
+
+                lane->m_dataEndpoint->Seek(boost::posix_time::to_iso_string(seekTime).c_str(), NPluginUtility::ToCORBAPosition(m_startPosition), NMMSS::PMF_NONE, sessionId);
+
+                if (connect)
                 {
-                    _this_log_ << "Batch stream " << this->GetStreamId() << " cleanup";
-                    Stop();
+                    auto qos = NMMSS::MakeQualityOfService();
+                    if (axxonsoft::bl::archive::START_POSITION_NEAREST_KEY_FRAME == m_startPosition)
+                        NMMSS::SetRequest(qos, MMSS::QoSRequest::OnlyKeyFrames{ true });
+
+                    NMMSS::PSinkEndpoint endpoint(CreatePullConnectionByObjref(GET_LOGGER_PTR,
+                        lane->m_dataEndpoint, sink.Get(), MMSS::EAUTO, &qos));
+
+                    // The lane may have been stopped while connecting.
+                    std::unique_lock<std::mutex> lock(m_stopMutex);
+                    if (lane->m_snapshotSink && !lane->m_sinkEndpoint)
+                        lane->m_sinkEndpoint = endpoint;
+                    else if (endpoint)
+                        endpoint->Destroy();
                 }
             }
 
             std::deque<boost::posix_time::ptime> m_timestamps;
+            std::vector<PLane> m_lanes;
+            FCreateReader m_createReader;
 
-            MMSS::StorageEndpoint_var m_dataEndpoint;
-            NPluginHelpers::PBatchSink m_snapshotSink;
-            NMMSS::PSinkEndpoint m_sinkEndpoint;
-
-            static std::uint32_t m_sessionId;
+            static std::atomic<std::uint32_t> m_sessionId;
             axxonsoft::bl::archive::EStartPosition m_startPosition;
 
             std::mutex m_stopMutex;
@@ -701,7 +788,7 @@ namespace
                                           m_metaCredentialsStorage->GetMetaCredentials(), eqc, ssc);
         }
 
-        void execBatchCommand(NCorbaHelpers::IContainer* cont, PBatchContext sc,
+        void execBatchCommand(PBatchContext sc,
                               const Json::Value& data,
                               axxonsoft::bl::archive::EStartPosition startPosition,
                               const std::string& arc_accessPoint)
@@ -710,15 +797,26 @@ namespace
             float crop_x = 0.f, crop_y = 0.f, crop_width = 1.f, crop_height = 1.f;
             parseJpegParameters(data, width, height, crop_x, crop_y, crop_width, crop_height, vc);
 
-            MMSS::StorageEndpoint_var endpoint =
-                NPluginUtility::ResolveEndoint(m_grpcManager, m_metaCredentialsStorage->GetMetaCredentials(),
-                                               cont, arc_accessPoint, "", startPosition, 0);
-            if (!CORBA::is_nil(endpoint))
-            {
-                sc->Start(endpoint, width, height, crop_x, crop_y, crop_width, crop_height,
-                    boost::bind(&CWSContext::onSampleHandler, boost::weak_ptr<CWSContext>(shared_from_base<CWSContext>()),
-                        WMediaContext(sc), _1, _2));
-            }
+            int concurrency = DEFAULT_BATCH_CONCURRENCY;
+            if (data.isMember(JSON_QUERY_CONCURRENCY_FIELD))
+                concurrency = std::min(std::max(data[JSON_QUERY_CONCURRENCY_FIELD].asInt(), 1), MAX_BATCH_CONCURRENCY);
+            concurrency = std::max(1, std::min<int>(concurrency, sc->GetTimestampCount()));
+
+            // Readers are created by the lanes themselves, in parallel, rather than one after another here.
+            NCorbaHelpers::WPContainer container = m_container;
+            NWebGrpc::PGrpcManager grpcManager = m_grpcManager;
+            NGrpcHelpers::PCredentials credentials = m_metaCredentialsStorage->GetMetaCredentials();
+            SBatchContext::FCreateReader createReader = [container, grpcManager, credentials, arc_accessPoint, startPosition]()
+            {
+                NCorbaHelpers::PContainer cont = container;
+                if (!cont)
+                    return MMSS::StorageEndpoint_var();
+                return NPluginUtility::ResolveEndoint(grpcManager, credentials, cont.Get(), arc_accessPoint, "", startPosition, 0);
+            };
+
+            sc->Start(concurrency, createReader, width, height, crop_x, crop_y, crop_width, crop_height,
+                boost::bind(&CWSContext::onSampleHandler, boost::weak_ptr<CWSContext>(shared_from_base<CWSContext>()),
+                    WMediaContext(sc), _1, _2));
         }
 
         void ProcessBatchCommand(const std::string& streamId, const Json::Value& data)
@@ -762,7 +860,7 @@ namespace
             PBatchContext sc = std::make_shared<SBatchContext>(GET_LOGGER_PTR, streamId, data[JSON_QUERY_TIMESTAMP_LIST_FIELD], startPosition);
             addContext(streamId, sc);
 
-            ArchiveCommand_t ac = std::bind(&CWSContext::execBatchCommand, shared_from_base<CWSContext>(), cont.Get(), sc, data, startPosition, std::placeholders::_1);
+            ArchiveCommand_t ac = std::bind(&CWSContext::execBatchCommand, shared_from_base<CWSContext>(), sc, data, startPosition, std::placeholders::_1);
             execArchiveCommand(data[JSON_QUERY_ARCHIVE_FILED].asString(), "hosts/" + ep, ac);
         }
 
@@ -1758,7 +1856,7 @@ namespace
         NHttp::SConfig& m_webCfg;
     };
 
-    std::uint32_t CWSContext::SBatchContext::m_sessionId = 0;
+    std::atomic<std::uint32_t> CWSContext::SBatchContext::m_sessionId(0);
 }
 
 namespace NHttp
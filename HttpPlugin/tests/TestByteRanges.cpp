@@ -0,0 +1,173 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "../ByteRanges.h"
+
+using namespace NContext;
+
+namespace
+{
+    class CTempFile
+    {
+    public:
+        explicit CTempFile(std::size_t size)
+            : m_path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("byteranges-%%%%-%%%%.bin"))
+        {
+            m_data.resize(size);
+            for (std::size_t i = 0; i < size; ++i)
+                m_data[i] = static_cast<char>(i * 7 + i / 251);
+
+            std::ofstream fs(m_path.c_str(), std::ios::binary);
+            fs.write(m_data.data(), m_data.size());
+        }
+
+        ~CTempFile()
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove(m_path, ec);
+        }
+
+        const boost::filesystem::path& Path() const { return m_path; }
+        const std::vector<char>& Data() const { return m_data; }
+
+    private:
+        boost::filesystem::path m_path;
+        std::vector<char> m_data;
+    };
+
+    std::string ReadAll(CRangeReader& reader, std::size_t chunkSize)
+    {
+        std::string body;
+        std::vector<char> buffer;
+        BOOST_REQUIRE(reader.Open());
+        while (!reader.Finished())
+        {
+            BOOST_REQUIRE(reader.ReadChunk(buffer, chunkSize));
+            BOOST_REQUIRE(!buffer.empty());
+            body.append(buffer.begin(), buffer.end());
+        }
+        return body;
+    }
+
+    std::string Slice(const std::vector<char>& data, std::uint64_t first, std::uint64_t last)
+    {
+        return std::string(data.begin() + first, data.begin() + last + 1);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(TestByteRanges)
+
+BOOST_AUTO_TEST_CASE(ParseSingleRanges)
+{
+    std::vector<SByteRange> r;
+
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=0-99", 1000, r));
+    BOOST_REQUIRE_EQUAL(1u, r.size());
+    BOOST_CHECK_EQUAL(0u, r[0].First);
+    BOOST_CHECK_EQUAL(99u, r[0].Last);
+
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=900-", 1000, r));
+    BOOST_CHECK_EQUAL(900u, r[0].First);
+    BOOST_CHECK_EQUAL(999u, r[0].Last);
+
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=-100", 1000, r));
+    BOOST_CHECK_EQUAL(900u, r[0].First);
+    BOOST_CHECK_EQUAL(999u, r[0].Last);
+
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=-5000", 1000, r));
+    BOOST_CHECK_EQUAL(0u, r[0].First);
+
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=500-5000", 1000, r));
+    BOOST_CHECK_EQUAL(999u, r[0].Last);
+}
+
+BOOST_AUTO_TEST_CASE(ParseMultipleRanges)
+{
+    std::vector<SByteRange> r;
+
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=500-599, 0-9,-10", 1000, r));
+    BOOST_REQUIRE_EQUAL(3u, r.size());
+    BOOST_CHECK_EQUAL(0u, r[0].First);
+    BOOST_CHECK_EQUAL(500u, r[1].First);
+    BOOST_CHECK_EQUAL(990u, r[2].First);
+
+    // Overlapping and adjacent ranges are coalesced.
+    BOOST_CHECK_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=0-9,10-19,15-30", 1000, r));
+    BOOST_REQUIRE_EQUAL(1u, r.size());
+    BOOST_CHECK_EQUAL(30u, r[0].Last);
+}
+
+BOOST_AUTO_TEST_CASE(ParseInvalidRanges)
+{
+    std::vector<SByteRange> r;
+
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("items=0-1", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("bytes=", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("bytes=10-5", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("bytes=a-5", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("bytes=5", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_ABSENT, ParseByteRanges("bytes=99999999999999999999-", 1000, r));
+    BOOST_CHECK(r.empty());
+
+    BOOST_CHECK_EQUAL(RANGE_NOT_SATISFIABLE, ParseByteRanges("bytes=1000-", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_NOT_SATISFIABLE, ParseByteRanges("bytes=-0", 1000, r));
+    BOOST_CHECK_EQUAL(RANGE_NOT_SATISFIABLE, ParseByteRanges("bytes=0-", 0, r));
+}
+
+BOOST_AUTO_TEST_CASE(ReadWholeFile)
+{
+    CTempFile file(200000);
+    CRangeReader reader(file.Path(), file.Data().size(), std::vector<SByteRange>(), "video/mp4");
+
+    BOOST_CHECK(!reader.Multipart());
+    BOOST_CHECK_EQUAL(file.Data().size(), reader.ContentLength());
+    BOOST_CHECK(ReadAll(reader, 65536) == std::string(file.Data().begin(), file.Data().end()));
+}
+
+BOOST_AUTO_TEST_CASE(ReadSingleRange)
+{
+    CTempFile file(100000);
+    std::vector<SByteRange> r;
+    BOOST_REQUIRE_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=12345-76543", file.Data().size(), r));
+
+    CRangeReader reader(file.Path(), file.Data().size(), r, "video/mp4");
+    BOOST_CHECK_EQUAL(76543u - 12345u + 1, reader.ContentLength());
+    BOOST_CHECK(ReadAll(reader, 4096) == Slice(file.Data(), 12345, 76543));
+    BOOST_CHECK_EQUAL("bytes 12345-76543/100000", MakeContentRange(r[0], file.Data().size()));
+}
+
+BOOST_AUTO_TEST_CASE(ReadMultipleRanges)
+{
+    CTempFile file(10000);
+    std::vector<SByteRange> r;
+    BOOST_REQUIRE_EQUAL(RANGE_SATISFIABLE, ParseByteRanges("bytes=0-99,5000-5999,-10", file.Data().size(), r));
+
+    CRangeReader reader(file.Path(), file.Data().size(), r, "video/mp4");
+    BOOST_CHECK(reader.Multipart());
+
+    const std::string boundary = std::string("--") + BYTERANGES_BOUNDARY;
+    std::string expected;
+    for (const SByteRange& range : r)
+    {
+        expected += "\r\n" + boundary + "\r\nContent-Type: video/mp4\r\nContent-Range: "
+            + MakeContentRange(range, file.Data().size()) + "\r\n\r\n" + Slice(file.Data(), range.First, range.Last);
+    }
+    expected += "\r\n" + boundary + "--\r\n";
+
+    BOOST_CHECK_EQUAL(expected.size(), reader.ContentLength());
+    BOOST_CHECK(ReadAll(reader, 333) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(ReadTruncatedFile)
+{
+    CTempFile file(1000);
+    std::vector<SByteRange> r(1, SByteRange{ 500, 1999 });
+
+    CRangeReader reader(file.Path(), 2000, r, "video/mp4");
+    std::vector<char> buffer;
+    BOOST_REQUIRE(reader.Open());
+    BOOST_CHECK(!reader.ReadChunk(buffer, 65536));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,243 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../JsonStream.h"
+
+#include <chrono>
+#include <limits>
+#include <random>
+
+using namespace NPluginUtility;
+
+namespace
+{
+    Json::Value parse(const std::string& text)
+    {
+        Json::CharReaderBuilder builder;
+        std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        Json::Value result;
+        std::string errors;
+        BOOST_REQUIRE_MESSAGE(reader->parse(text.data(), text.data() + text.size(), &result, &errors), errors << ": " << text);
+        return result;
+    }
+
+    // Runs a producer the way the chunked send context does, collecting the output.
+    std::string drain(const FJsonProducer& producer, std::size_t* calls = nullptr, std::size_t* largestPortion = nullptr)
+    {
+        CJsonStreamWriter writer;
+        std::string out;
+        std::size_t n = 0;
+        std::size_t largest = 0;
+        bool more = true;
+        while (more)
+        {
+            more = producer(writer);
+            largest = std::max(largest, writer.Size());
+            writer.TakeOutput(out);
+            ++n;
+        }
+        if (calls)
+            *calls = n;
+        if (largestPortion)
+            *largestPortion = largest;
+        return out;
+    }
+
+    struct SEvent
+    {
+        std::string Timestamp;
+        std::string Origin;
+        double Score;
+        double Left, Top, Right, Bottom;
+    };
+
+    std::vector<SEvent> makeEvents(std::size_t count)
+    {
+        std::mt19937 random(42);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::vector<SEvent> events(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            SEvent& e = events[i];
+            e.Timestamp = "20161016T1200" + std::to_string(10 + i % 50) + ".123456";
+            e.Origin = "hosts/Server" + std::to_string(i % 7) + "/DeviceIpint." + std::to_string(i % 300) + "/SourceEndpoint.video:0:0";
+            e.Score = unit(random);
+            e.Left = unit(random);
+            e.Top = unit(random);
+            e.Right = unit(random);
+            e.Bottom = unit(random);
+        }
+        return events;
+    }
+
+    void writeEvent(CJsonStreamWriter& writer, const SEvent& e)
+    {
+        writer.BeginObject()
+            .Key("timestamp").Value(e.Timestamp)
+            .Key("origin").Value(e.Origin)
+            .Key("rate").Value(e.Score)
+            .Key("position").BeginObject()
+                .Key("left").Value(e.Left)
+                .Key("top").Value(e.Top)
+                .Key("right").Value(e.Right)
+                .Key("bottom").Value(e.Bottom)
+            .EndObject()
+        .EndObject();
+    }
+
+    Json::Value eventTree(const SEvent& e)
+    {
+        Json::Value ev(Json::objectValue);
+        ev["timestamp"] = e.Timestamp;
+        ev["origin"] = e.Origin;
+        ev["rate"] = e.Score;
+        Json::Value rect(Json::objectValue);
+        rect["left"] = e.Left;
+        rect["top"] = e.Top;
+        rect["right"] = e.Right;
+        rect["bottom"] = e.Bottom;
+        ev["position"] = rect;
+        return ev;
+    }
+
+    FJsonProducer eventsProducer(const std::vector<SEvent>& events, std::mutex* mutex = nullptr)
+    {
+        Json::Value fields(Json::objectValue);
+        fields["more"] = false;
+        return StreamArray(mutex, events.begin(), events.end(), writeEvent,
+            [fields](CJsonStreamWriter& writer)
+            {
+                writer.BeginObject();
+                for (Json::Value::const_iterator it = fields.begin(); it != fields.end(); ++it)
+                    writer.Key(it.name()).Value(*it);
+                writer.Key("events");
+            },
+            [](CJsonStreamWriter& writer) { writer.EndObject(); });
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(JsonStream)
+
+BOOST_AUTO_TEST_CASE(WritesCompactSeparators)
+{
+    CJsonStreamWriter writer;
+    writer.BeginObject()
+        .Key("a").Value(1)
+        .Key("b").BeginArray().Value(true).Value(false).Null().BeginArray().EndArray().BeginObject().EndObject().EndArray()
+        .Key("c").Value("x")
+    .EndObject();
+
+    std::string out;
+    writer.TakeOutput(out);
+    BOOST_CHECK_EQUAL(out, "{\"a\":1,\"b\":[true,false,null,[],{}],\"c\":\"x\"}");
+    BOOST_CHECK_EQUAL(writer.Size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(WritesIntegerLimits)
+{
+    CJsonStreamWriter writer;
+    writer.BeginArray()
+        .Value(0)
+        .Value(-1)
+        .Value(std::numeric_limits<Json::Int64>::min())
+        .Value(std::numeric_limits<Json::Int64>::max())
+        .Value(std::numeric_limits<Json::UInt64>::max())
+        .Value(std::numeric_limits<unsigned int>::max())
+    .EndArray();
+
+    std::string out;
+    writer.TakeOutput(out);
+    BOOST_CHECK_EQUAL(out, "[0,-1,-9223372036854775808,9223372036854775807,18446744073709551615,4294967295]");
+}
+
+BOOST_AUTO_TEST_CASE(EscapesStrings)
+{
+    const char text[] = "quote\" backslash\\ slash/ \b\f\n\r\t \x01\x1f utf8 \xd0\xbf\xd1\x80\xd0\xb8";
+    const std::string raw(text, sizeof(text) - 1);
+    CJsonStreamWriter writer;
+    writer.BeginObject().Key(raw).Value(raw).EndObject();
+
+    std::string out;
+    writer.TakeOutput(out);
+    BOOST_CHECK(out.find("\\u0001\\u001f") != std::string::npos);
+
+    const Json::Value parsed = parse(out);
+    BOOST_REQUIRE(parsed.isMember(raw));
+    BOOST_CHECK_EQUAL(parsed[raw].asString(), raw);
+
+    std::string embeddedZero("a\0b", 3);
+    BOOST_CHECK_EQUAL(ToCompactString(Json::Value(embeddedZero)), "\"a\\u0000b\"");
+}
+
+BOOST_AUTO_TEST_CASE(SerialisesTreesLikeJsoncpp)
+{
+    Json::Value tree(Json::objectValue);
+    tree["null"] = Json::Value();
+    tree["int"] = -42;
+    tree["uint"] = Json::UInt64(1) << 63;
+    tree["real"] = 0.1;
+    tree["string"] = "text with \"quotes\"";
+    tree["bool"] = true;
+    tree["array"] = Json::Value(Json::arrayValue);
+    tree["array"].append(1);
+    tree["array"].append(Json::Value(Json::objectValue));
+    tree["array"].append("two");
+    tree["object"]["nested"]["deeper"] = 3.5;
+    tree["emptyArray"] = Json::Value(Json::arrayValue);
+
+    const std::string compact = ToCompactString(tree);
+    BOOST_CHECK(compact.find('\n') == std::string::npos);
+    BOOST_CHECK(compact.find(' ') == compact.find("with") - 1);
+    BOOST_CHECK(parse(compact) == tree);
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    BOOST_CHECK_EQUAL(compact, Json::writeString(builder, tree));
+}
+
+BOOST_AUTO_TEST_CASE(StreamsArrayInPortions)
+{
+    for (std::size_t count : { std::size_t(0), std::size_t(1), JSON_ITEMS_PER_PORTION, JSON_ITEMS_PER_PORTION + 1, 5 * JSON_ITEMS_PER_PORTION + 3 })
+    {
+        const std::vector<SEvent> events = makeEvents(count);
+        std::mutex mutex;
+        std::size_t calls = 0;
+        const std::string out = drain(eventsProducer(events, &mutex), &calls);
+
+        BOOST_CHECK_EQUAL(calls, std::max<std::size_t>(1, (count + JSON_ITEMS_PER_PORTION - 1) / JSON_ITEMS_PER_PORTION));
+
+        const Json::Value parsed = parse(out);
+        BOOST_CHECK_EQUAL(parsed["more"].asBool(), false);
+        BOOST_REQUIRE_EQUAL(parsed["events"].size(), count);
+        for (std::size_t i = 0; i < count; ++i)
+            BOOST_REQUIRE(parsed["events"][Json::ArrayIndex(i)] == eventTree(events[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(JsonStreamBenchmark)
+{
+    // A large face search result: the tree and styled string against the streaming writer.
+    const std::size_t COUNT = 100000;
+    const std::vector<SEvent> events = makeEvents(COUNT);
+
+    const auto treeStart = std::chrono::steady_clock::now();
+    Json::Value responseObject(Json::objectValue);
+    responseObject["events"] = Json::Value(Json::arrayValue);
+    responseObject["more"] = false;
+    for (const auto& e : events)
+        responseObject["events"].append(eventTree(e));
+    const std::string styled = responseObject.toStyledString();
+    const std::chrono::duration<double, std::milli> treeTime = std::chrono::steady_clock::now() - treeStart;
+
+    const auto streamStart = std::chrono::steady_clock::now();
+    std::size_t calls = 0;
+    std::size_t largestPortion = 0;
+    const std::string streamed = drain(eventsProducer(events), &calls, &largestPortion);
+    const std::chrono::duration<double, std::milli> streamTime = std::chrono::steady_clock::now() - streamStart;
+
+    BOOST_CHECK(parse(streamed) == responseObject);
+    BOOST_TEST_MESSAGE("JSON of " << COUNT << " events: tree + toStyledString " << treeTime.count() << " ms, "
+        << styled.size() << " bytes; streaming writer " << streamTime.count() << " ms, " << streamed.size()
+        << " bytes in " << calls << " portions of at most " << largestPortion << " bytes");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,227 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../SearchScheduler.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace NHttp;
+
+namespace
+{
+    // Records the order in which the scheduler starts searches.
+    struct SStarts
+    {
+        CSearchScheduler::FStart operator()(const std::string& id)
+        {
+            return [this, id]() { Ids.push_back(id); };
+        }
+
+        std::vector<std::string> Ids;
+    };
+
+    const std::uint32_t NO_CAP = 100;
+}
+
+BOOST_AUTO_TEST_SUITE(SearchScheduler)
+
+BOOST_AUTO_TEST_CASE(QueuesBeyondSlots)
+{
+    CSearchScheduler scheduler(2, 10, 10);
+    SStarts starts;
+    BOOST_CHECK(scheduler.Submit("1", "face", 1, NO_CAP, "user", starts("1")));
+    BOOST_CHECK(scheduler.Submit("2", "face", 1, NO_CAP, "user", starts("2")));
+    BOOST_CHECK(scheduler.Submit("3", "face", 1, NO_CAP, "user", starts("3")));
+    BOOST_CHECK_EQUAL(starts.Ids.size(), 2u);
+    BOOST_CHECK(scheduler.IsPending("3"));
+
+    scheduler.Finished("1");
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 3u);
+    BOOST_CHECK_EQUAL(starts.Ids[2], "3");
+    BOOST_CHECK(!scheduler.IsPending("3"));
+
+    // Repeated and unknown completions do not free slots.
+    scheduler.Finished("1");
+    scheduler.Finished("unknown");
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().Active, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(TypeCapLeavesSlotsToOthers)
+{
+    CSearchScheduler scheduler(4, 10, 10);
+    SStarts starts;
+    for (const char* id : { "f1", "f2", "f3" })
+        scheduler.Submit(id, "face", 1, 2, "user", starts(id));
+    scheduler.Submit("v1", "vmda", 1, NO_CAP, "user", starts("v1"));
+
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 3u);
+    BOOST_CHECK_EQUAL(starts.Ids[2], "v1");
+    BOOST_CHECK(scheduler.IsPending("f3"));
+}
+
+BOOST_AUTO_TEST_CASE(SlotsAreSharedByWeight)
+{
+    CSearchScheduler scheduler(4, 20, 20);
+    SStarts starts;
+    for (const char* id : { "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8" })
+        scheduler.Submit(id, "face", 1, NO_CAP, "user", starts(id));
+    for (const char* id : { "v1", "v2", "v3", "v4" })
+        scheduler.Submit(id, "vmda", 3, NO_CAP, "user", starts(id));
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 4u);
+
+    // Slots freed by face searches go to VMDA until it holds three of the four.
+    for (const char* id : { "f1", "f2", "f3", "f4" })
+        scheduler.Finished(id);
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 8u);
+    BOOST_CHECK_EQUAL(starts.Ids[4], "v1");
+    BOOST_CHECK_EQUAL(starts.Ids[5], "v2");
+    BOOST_CHECK_EQUAL(starts.Ids[6], "v3");
+    BOOST_CHECK_EQUAL(starts.Ids[7], "f5");
+}
+
+BOOST_AUTO_TEST_CASE(UsersWithFewerSearchesGoFirst)
+{
+    CSearchScheduler scheduler(2, 10, 10);
+    SStarts starts;
+    for (const char* id : { "a1", "a2", "a3", "a4" })
+        scheduler.Submit(id, "face", 1, NO_CAP, "alice", starts(id));
+    scheduler.Submit("b1", "auto", 1, NO_CAP, "bob", starts("b1"));
+    scheduler.Submit("b2", "face", 1, NO_CAP, "bob", starts("b2"));
+
+    // The idle type goes first; within a type the user with fewer running
+    // searches: alice while bob's auto search runs, bob after it.
+    scheduler.Finished("a1");
+    scheduler.Finished("a2");
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 4u);
+    BOOST_CHECK_EQUAL(starts.Ids[2], "b1");
+    BOOST_CHECK_EQUAL(starts.Ids[3], "a3");
+
+    scheduler.Finished("b1");
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 5u);
+    BOOST_CHECK_EQUAL(starts.Ids[4], "b2");
+}
+
+BOOST_AUTO_TEST_CASE(CancelsAndRejects)
+{
+    CSearchScheduler scheduler(1, 2, 1);
+    SStarts starts;
+    BOOST_CHECK(scheduler.Submit("a1", "face", 1, NO_CAP, "alice", starts("a1")));
+    BOOST_CHECK(scheduler.Submit("a2", "face", 1, NO_CAP, "alice", starts("a2")));
+    BOOST_CHECK(!scheduler.Submit("a3", "face", 1, NO_CAP, "alice", starts("a3")));
+    BOOST_CHECK(scheduler.Submit("b1", "face", 1, NO_CAP, "bob", starts("b1")));
+    BOOST_CHECK(!scheduler.Submit("c1", "face", 1, NO_CAP, "carol", starts("c1")));
+    BOOST_CHECK(!scheduler.Submit("a1", "face", 1, NO_CAP, "alice", starts("a1")));
+
+    BOOST_CHECK(!scheduler.Cancel("a1"));
+    BOOST_CHECK(scheduler.Cancel("a2"));
+    BOOST_CHECK(!scheduler.Cancel("a2"));
+
+    scheduler.Finished("a1");
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 2u);
+    BOOST_CHECK_EQUAL(starts.Ids[1], "b1");
+
+    const SSearchSchedulerStatistics st = scheduler.GetStatistics();
+    BOOST_CHECK_EQUAL(st.Active, 1u);
+    BOOST_CHECK_EQUAL(st.Pending, 0u);
+    BOOST_CHECK_EQUAL(st.Started, 2u);
+    BOOST_CHECK_EQUAL(st.Rejected, 3u);
+    BOOST_CHECK_EQUAL(st.Cancelled, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(SlotIsFreedByDroppedSearch)
+{
+    CSearchScheduler scheduler(1, 10, 10);
+    SStarts starts;
+    scheduler.Submit("1", "face", 1, NO_CAP, "user", starts("1"));
+    scheduler.Submit("2", "face", 1, NO_CAP, "user", starts("2"));
+    scheduler.Submit("3", "face", 1, NO_CAP, "user", starts("3"));
+
+    {
+        // A context that never reports completion.
+        CSearchSlot slot(scheduler, "1");
+    }
+    BOOST_REQUIRE_EQUAL(starts.Ids.size(), 2u);
+
+    {
+        CSearchSlot slot(scheduler, "2");
+        slot.Release();
+        BOOST_CHECK_EQUAL(starts.Ids.size(), 3u);
+    }
+    BOOST_CHECK_EQUAL(starts.Ids.size(), 3u);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().Active, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentSubmitAndFinish)
+{
+    const std::size_t SLOTS = 4;
+    const int THREADS = 4;
+    const int SEARCHES = 2000;
+    CSearchScheduler scheduler(SLOTS, THREADS * SEARCHES, THREADS * SEARCHES);
+
+    std::atomic<int> running(0);
+    std::atomic<int> maxRunning(0);
+    std::atomic<int> started(0);
+    std::mutex mutex;
+    std::vector<std::string> toFinish;
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < THREADS; ++t)
+    {
+        workers.emplace_back([&, t]()
+        {
+            for (int i = 0; i < SEARCHES; ++i)
+            {
+                const std::string id = std::to_string(t) + "/" + std::to_string(i);
+                scheduler.Submit(id, i % 3 ? "face" : "vmda", 1 + i % 2, NO_CAP, "user" + std::to_string(t), [&, id]()
+                {
+                    const int now = ++running;
+                    int seen = maxRunning;
+                    while (now > seen && !maxRunning.compare_exchange_weak(seen, now));
+                    ++started;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    toFinish.push_back(id);
+                });
+
+                std::string finished;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!toFinish.empty())
+                    {
+                        finished = toFinish.back();
+                        toFinish.pop_back();
+                    }
+                }
+                if (!finished.empty())
+                {
+                    --running;
+                    scheduler.Finished(finished);
+                }
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+
+    while (true)
+    {
+        std::string finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (toFinish.empty())
+                break;
+            finished = toFinish.back();
+            toFinish.pop_back();
+        }
+        --running;
+        scheduler.Finished(finished);
+    }
+
+    BOOST_CHECK_EQUAL(started.load(), THREADS * SEARCHES);
+    BOOST_CHECK_LE(maxRunning.load(), int(SLOTS));
+    const SSearchSchedulerStatistics st = scheduler.GetStatistics();
+    BOOST_CHECK_EQUAL(st.Active, 0u);
+    BOOST_CHECK_EQUAL(st.Pending, 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../SlabPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace NHttp;
+
+namespace
+{
+    // Roughly the size of the data buffers the pool is used for.
+    struct SPayload
+    {
+        explicit SPayload(std::uint64_t v, std::atomic<int>* alive = nullptr)
+            : Value(v)
+            , Alive(alive)
+        {
+            if (Alive)
+                ++*Alive;
+        }
+
+        ~SPayload()
+        {
+            if (Alive)
+                --*Alive;
+        }
+
+        std::uint64_t Value;
+        std::atomic<int>* Alive;
+        char Padding[24];
+    };
+
+    using TPool = CSlabPool<NSlabPool::BlockSizeFor(sizeof(SPayload))>;
+
+    // Allocates and frees in the order a streaming connection does:
+    // a few buffers queued, released in FIFO order.
+    template <typename FMake>
+    double measure(FMake make, int threads, int iterations)
+    {
+        const int QUEUE = 16;
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&]()
+            {
+                std::vector<std::shared_ptr<SPayload>> queue(QUEUE);
+                for (int i = 0; i < iterations; ++i)
+                    queue[i % QUEUE] = make(i);
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / (double(threads) * iterations);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(SlabPool)
+
+BOOST_AUTO_TEST_CASE(BlockSizeRounding)
+{
+    BOOST_CHECK_EQUAL(NSlabPool::BlockSizeFor(1), NSlabPool::BLOCK_ALIGNMENT);
+    BOOST_CHECK_EQUAL(NSlabPool::BlockSizeFor(NSlabPool::BLOCK_ALIGNMENT), NSlabPool::BLOCK_ALIGNMENT);
+    BOOST_CHECK_EQUAL(NSlabPool::BlockSizeFor(NSlabPool::BLOCK_ALIGNMENT + 1), 2 * NSlabPool::BLOCK_ALIGNMENT);
+}
+
+BOOST_AUTO_TEST_CASE(BlocksAreDistinctAlignedAndReused)
+{
+    const std::size_t COUNT = 3 * NSlabPool::BLOCKS_PER_BATCH * NSlabPool::BATCHES_PER_SLAB;
+    std::vector<void*> blocks;
+    std::set<void*> unique;
+    for (std::size_t i = 0; i < COUNT; ++i)
+    {
+        void* p = TPool::Allocate();
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<std::uintptr_t>(p) % NSlabPool::BLOCK_ALIGNMENT, 0u);
+        std::memset(p, 0xA5, NSlabPool::BlockSizeFor(sizeof(SPayload)));
+        blocks.push_back(p);
+        unique.insert(p);
+    }
+    BOOST_CHECK_EQUAL(unique.size(), COUNT);
+
+    for (void* p : blocks)
+        TPool::Deallocate(p);
+
+    // The thread cache hands the last freed block out first.
+    void* p = TPool::Allocate();
+    BOOST_CHECK(unique.count(p) == 1);
+    TPool::Deallocate(p);
+}
+
+BOOST_AUTO_TEST_CASE(SharedObjectsAreDestroyed)
+{
+    // Counters of a thread are published in batches and when it exits.
+    const int COUNT = 10 * int(NSlabPool::PUBLISH_INTERVAL);
+    std::atomic<int> alive(0);
+    const SSlabPoolStatistics before = GetSlabPoolStatistics();
+    std::vector<std::shared_ptr<SPayload>> objects;
+    std::thread([&]()
+    {
+        for (int i = 0; i < COUNT; ++i)
+            objects.push_back(AllocatePooled<SPayload>(i, &alive));
+    }).join();
+
+    BOOST_CHECK_EQUAL(alive.load(), COUNT);
+    for (int i = 0; i < COUNT; ++i)
+        BOOST_REQUIRE_EQUAL(objects[i]->Value, std::uint64_t(i));
+    const SSlabPoolStatistics during = GetSlabPoolStatistics();
+    BOOST_CHECK_EQUAL(during.Allocations - before.Allocations, std::uint64_t(COUNT));
+    BOOST_CHECK_EQUAL(during.BlocksInUse - before.BlocksInUse, std::uint64_t(COUNT));
+
+    std::thread([&]() { objects.clear(); }).join();
+    BOOST_CHECK_EQUAL(alive.load(), 0);
+    BOOST_CHECK_EQUAL(GetSlabPoolStatistics().BlocksInUse, before.BlocksInUse);
+}
+
+BOOST_AUTO_TEST_CASE(FreedOnOtherThreads)
+{
+    // Buffers are produced on a source thread and released on reactor threads.
+    const int PRODUCED = 20000;
+    const int CONSUMERS = 4;
+    std::atomic<int> alive(0);
+    const SSlabPoolStatistics before = GetSlabPoolStatistics();
+
+    std::vector<std::vector<std::shared_ptr<SPayload>>> perConsumer(CONSUMERS);
+    std::thread producer([&]()
+    {
+        for (int i = 0; i < PRODUCED; ++i)
+            perConsumer[i % CONSUMERS].push_back(AllocatePooled<SPayload>(i, &alive));
+    });
+    producer.join();
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < CONSUMERS; ++c)
+    {
+        consumers.emplace_back([&, c]()
+        {
+            perConsumer[c].clear();
+            // Churn on this thread reuses the blocks it has just freed.
+            for (int i = 0; i < PRODUCED; ++i)
+                AllocatePooled<SPayload>(i, &alive);
+        });
+    }
+    for (auto& c : consumers)
+        c.join();
+
+    BOOST_CHECK_EQUAL(alive.load(), 0);
+    BOOST_CHECK_EQUAL(GetSlabPoolStatistics().BlocksInUse, before.BlocksInUse);
+
+    // Blocks returned by exited threads are available to new ones without new slabs.
+    const std::uint64_t slabs = GetSlabPoolStatistics().Slabs;
+    std::thread([&]()
+    {
+        std::vector<std::shared_ptr<SPayload>> objects;
+        for (int i = 0; i < PRODUCED / 2; ++i)
+            objects.push_back(AllocatePooled<SPayload>(i));
+    }).join();
+    BOOST_CHECK_EQUAL(GetSlabPoolStatistics().Slabs, slabs);
+}
+
+BOOST_AUTO_TEST_CASE(SlabPoolBenchmark)
+{
+    const int ITERATIONS = 1000000;
+    for (int threads : { 1, 4 })
+    {
+        const double heap = measure([](int i) { return std::make_shared<SPayload>(i); }, threads, ITERATIONS);
+        const double pooled = measure([](int i) { return AllocatePooled<SPayload>(i); }, threads, ITERATIONS);
+        BOOST_TEST_MESSAGE("Data buffer allocation, " << threads << " thread(s): make_shared "
+            << heap << " ns, slab pool " << pooled << " ns");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
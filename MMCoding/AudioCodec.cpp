@@ -11,6 +11,11 @@ extern "C"
 #include "Transforms.h"
 #include "FFmpegMutex.h"
 #include "FFMPEGCodec.h"
+#include "G711.h"
+
+#include <cstring>
+#include <map>
+#include <tuple>
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -20,6 +25,86 @@ extern "C"
 namespace
 {
 
+// Large enough for a packet of any of the audio encoders; they code straight
+// into the output sample when given a buffer of their own.
+const int MAX_AUDIO_PACKET_SIZE = AV_INPUT_BUFFER_MIN_SIZE;
+
+struct SResampleFormat
+{
+    unsigned int InSampleRate;
+    NMMSS::NMediaType::Audio::ESampleType InType;
+    unsigned int InChannelsCount;
+    unsigned int OutSampleRate;
+    NMMSS::NMediaType::Audio::ESampleType OutType;
+    unsigned int OutChannelsCount;
+
+    bool operator<(const SResampleFormat& other) const
+    {
+        return std::tie(InSampleRate, InType, InChannelsCount, OutSampleRate, OutType, OutChannelsCount)
+            < std::tie(other.InSampleRate, other.InType, other.InChannelsCount, other.OutSampleRate, other.OutType, other.OutChannelsCount);
+    }
+};
+
+/// Resample contexts of the process by their formats. Streams hand theirs back
+/// when the format changes or they go away; reinitialising a context for the
+/// same formats keeps its filter bank and only drops the buffered samples.
+class CResampleContextPool
+{
+public:
+    static CResampleContextPool& Instance()
+    {
+        static CResampleContextPool pool;
+        return pool;
+    }
+
+    NMMSS::SwrContextPtr Acquire(const SResampleFormat& format)
+    {
+        NMMSS::SwrContextPtr context;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            auto it = m_free.find(format);
+            if (it != m_free.end() && !it->second.empty())
+            {
+                context = std::move(it->second.back());
+                it->second.pop_back();
+            }
+        }
+
+        if (!context)
+            context = create(format);
+
+        if (context && swr_init(context.get()) < 0)
+            context.reset();
+        return context;
+    }
+
+    void Release(const SResampleFormat& format, NMMSS::SwrContextPtr context)
+    {
+        if (!context)
+            return;
+        boost::mutex::scoped_lock lock(m_mutex);
+        std::vector<NMMSS::SwrContextPtr>& contexts = m_free[format];
+        if (contexts.size() < MAX_FREE_PER_FORMAT)
+            contexts.push_back(std::move(context));
+    }
+
+private:
+    static const size_t MAX_FREE_PER_FORMAT = 8;
+
+    static int64_t channelLayout(unsigned int channelsCount)
+    {
+        if (channelsCount == 1)
+            return AV_CH_LAYOUT_MONO;
+        if (channelsCount == 2)
+            return AV_CH_LAYOUT_STEREO;
+        return AV_CH_LAYOUT_NATIVE;
+    }
+
+    static NMMSS::SwrContextPtr create(const SResampleFormat& format);
+
+    boost::mutex m_mutex;
+    std::map<SResampleFormat, std::vector<NMMSS::SwrContextPtr> > m_free;
+};
 
 class CAudioResampler
 {
@@ -40,7 +125,7 @@ public:
 
     ~CAudioResampler()
     {
-        m_pSwrCtx.reset();
+        CResampleContextPool::Instance().Release(format(), std::move(m_pSwrCtx));
     }
 
     NMMSS::ETransformResult operator()(NMMSS::ISample* in, NMMSS::CDeferredAllocSampleHolder& holder)
@@ -169,54 +254,28 @@ protected:
             (pHeader->nSampleType != m_inType) ||
             (pHeader->nChannelsCount != m_inChannelsCount))
         {
+            CResampleContextPool& pool = CResampleContextPool::Instance();
+            pool.Release(format(), std::move(m_pSwrCtx));
 
             m_inSampleRate = pHeader->nSampleRate;
             m_inType = pHeader->nSampleType;
             m_inChannelsCount = pHeader->nChannelsCount;
 
-            m_pSwrCtx.reset(swr_alloc());
+            m_pSwrCtx = pool.Acquire(format());
             if (!m_pSwrCtx)
             {
                 return false;
             }
-
-            int64_t in_ch_layout = AV_CH_LAYOUT_NATIVE;
-            if (m_inChannelsCount == 1)
-            {
-                in_ch_layout = AV_CH_LAYOUT_MONO;
-            }
-            else if (m_inChannelsCount == 2)
-            {
-                in_ch_layout = AV_CH_LAYOUT_STEREO;
-            }
-
-            int64_t out_ch_layout = AV_CH_LAYOUT_NATIVE;
-            if (m_outChannelsCount == 1)
-            {
-                out_ch_layout = AV_CH_LAYOUT_MONO;
-            }
-            else if (m_outChannelsCount == 2)
-            {
-                out_ch_layout = AV_CH_LAYOUT_STEREO;
-            }
-
-            av_opt_set_int(m_pSwrCtx.get(), "in_channel_layout", in_ch_layout, 0);
-            av_opt_set_int(m_pSwrCtx.get(), "in_sample_fmt", getFFmpegType(m_inType), 0);
-            av_opt_set_int(m_pSwrCtx.get(), "in_sample_rate", m_inSampleRate, 0);
-            av_opt_set_int(m_pSwrCtx.get(), "out_channel_layout", out_ch_layout, 0);
-            av_opt_set_int(m_pSwrCtx.get(), "out_sample_fmt", getFFmpegType(m_outType), 0);
-            av_opt_set_int(m_pSwrCtx.get(), "out_sample_rate", m_outSampleRate, 0);
-
-
-            if (swr_init(m_pSwrCtx.get()) < 0)
-            {
-                m_pSwrCtx.reset();
-                return false;
-            }
         }
         return true;
     }
 
+    SResampleFormat format() const
+    {
+        const SResampleFormat f = { m_inSampleRate, m_inType, m_inChannelsCount, m_outSampleRate, m_outType, m_outChannelsCount };
+        return f;
+    }
+
 private:
     DECLARE_LOGGER_HOLDER;
     NMMSS::ETransformResult m_result;
@@ -228,6 +287,23 @@ private:
     NMMSS::CDeferredAllocSampleHolder* m_holder;
 };
 
+NMMSS::SwrContextPtr CResampleContextPool::create(const SResampleFormat& format)
+{
+    NMMSS::SwrContextPtr context(swr_alloc());
+    if (!context)
+    {
+        return context;
+    }
+
+    av_opt_set_int(context.get(), "in_channel_layout", channelLayout(format.InChannelsCount), 0);
+    av_opt_set_int(context.get(), "in_sample_fmt", CAudioResampler::getFFmpegType(format.InType), 0);
+    av_opt_set_int(context.get(), "in_sample_rate", format.InSampleRate, 0);
+    av_opt_set_int(context.get(), "out_channel_layout", channelLayout(format.OutChannelsCount), 0);
+    av_opt_set_int(context.get(), "out_sample_fmt", CAudioResampler::getFFmpegType(format.OutType), 0);
+    av_opt_set_int(context.get(), "out_sample_rate", format.OutSampleRate, 0);
+    return context;
+}
+
 /// Used for holding sample extra data and checking if it is new.
 class ExtraDataChecker
 {
@@ -329,25 +405,20 @@ public:
                     uint8_t* dataPtr)
     {
         const ::uint32_t type = NMMSS::NMediaType::Audio::G711::ID;
-        if(!m_codecFFMPEG.get() || (m_lastType != type))
+        if (m_lastType != type)
         {
-            initialize(type);
+            m_codecFFMPEG.reset();
+            m_lastType = type;
         }
 
         switch(subtypeHeader->eCodingLaw)
         {
         case NMMSS::NMediaType::Audio::G711::U_LAW:
-            DecodeWithFFMPEG(AV_CODEC_ID_PCM_MULAW,
-                             subtypeHeader->nChannelsCount,
-                             subtypeHeader->nSampleRate,
-                             0, dataPtr);
+            DecodeG711(NMMSS::NG711::DecodeULaw, subtypeHeader, dataPtr);
             break;
 
         case NMMSS::NMediaType::Audio::G711::A_LAW:
-            DecodeWithFFMPEG(AV_CODEC_ID_PCM_ALAW,
-                             subtypeHeader->nChannelsCount,
-                             subtypeHeader->nSampleRate,
-                             0, dataPtr);
+            DecodeG711(NMMSS::NG711::DecodeALaw, subtypeHeader, dataPtr);
             break;
 
         default: m_result = NMMSS::ETHROUGH;
@@ -450,6 +521,68 @@ private:
         m_lastType = type;
     }
 
+    void DecodeG711(void (*decode)(const uint8_t*, int16_t*, size_t),
+                    const NMMSS::NMediaType::Audio::G711::SubtypeHeader* subtypeHeader,
+                    const uint8_t* dataPtr)
+    {
+        const int channels = std::max<int>(subtypeHeader->nChannelsCount, 1);
+        const int sampleRate = subtypeHeader->nSampleRate ? subtypeHeader->nSampleRate : 8000;
+        const uint32_t count = m_sampleHeader->nBodySize / channels * channels;
+        if (!count)
+        {
+            m_result = NMMSS::ETRANSFORMED;
+            return;
+        }
+
+        NMMSS::PSample sample(m_holder->GetAllocator()->Alloc(count * sizeof(int16_t)));
+        if (!sample)
+        {
+            _err_ << "Audio processing memory allocation failed" << std::endl;
+            m_result = NMMSS::EFAILED;
+            return;
+        }
+        decode(dataPtr, reinterpret_cast<int16_t*>(sample->GetBody()), count);
+
+        addPcmSample(sample, NMMSS::NMediaType::Audio::ST_INT16, channels, sampleRate, count / channels);
+        m_result = NMMSS::ETRANSFORMED;
+    }
+
+    void addPcmSample(NMMSS::PSample sample,
+                      NMMSS::NMediaType::Audio::ESampleType sType,
+                      int channels,
+                      int sampleRate,
+                      int samplesCount)
+    {
+        sample->Header().nBodySize = NMMSS::NMediaType::Audio::GetTypeSize(sType) * samplesCount * channels;
+
+        NMMSS::NMediaType::Audio::PCM::SubtypeHeader *subheader = 0;
+        NMMSS::NMediaType::MakeMediaTypeStruct<NMMSS::NMediaType::Audio::PCM>(sample->GetHeader(), &subheader);
+
+        subheader->nChannelsCount = channels;
+        subheader->nSampleType = sType;
+        subheader->nSampleRate = sampleRate;
+
+        uint64_t dtTimeBegin = m_sampleHeader->dtTimeBegin;
+        uint64_t dtTimeEnd = m_sampleHeader->dtTimeEnd;
+
+        if (samplesCount)
+        {
+            boost::posix_time::time_duration duration = boost::posix_time::milliseconds(
+                static_cast<int64_t>((samplesCount * 1000.0) / sampleRate));
+
+            boost::posix_time::ptime posixTimeBegin = NMMSS::PtimeFromQword(dtTimeBegin);
+            boost::posix_time::ptime posixTimeEnd = NMMSS::PtimeFromQword(dtTimeEnd) + duration;
+
+            dtTimeBegin = NMMSS::PtimeToQword(posixTimeBegin);
+            dtTimeEnd = NMMSS::PtimeToQword(posixTimeEnd);
+        }
+
+        sample->Header().dtTimeBegin = dtTimeBegin;
+        sample->Header().dtTimeEnd   = dtTimeEnd;
+
+        m_holder->AddSample(sample);
+    }
+
     void DecodeWithFFMPEG(
         AVCodecID codecID,
         int channels,
@@ -484,35 +617,9 @@ private:
                         static_cast<NMMSS::NMediaType::Audio::ESampleType>(NMMSS::getSampleTypeFromAVFormat((AVSampleFormat)frame->format));
                     int bodySize = NMMSS::NMediaType::Audio::GetTypeSize(sType) * frame->nb_samples * frame->channels;
                     NMMSS::PSample sample(m_holder->GetAllocator()->Alloc(bodySize));
-                    sample->Header().nBodySize = bodySize;
                     memcpy(sample->GetBody(), frame->extended_data[0], bodySize);
 
-                    NMMSS::NMediaType::Audio::PCM::SubtypeHeader *subheader = 0;
-                    NMMSS::NMediaType::MakeMediaTypeStruct<NMMSS::NMediaType::Audio::PCM>(sample->GetHeader(), &subheader);
-
-                    subheader->nChannelsCount = frame->channels;
-                    subheader->nSampleType = sType;
-                    subheader->nSampleRate = frame->sample_rate;
-
-                    uint64_t dtTimeBegin = m_sampleHeader->dtTimeBegin;
-                    uint64_t dtTimeEnd = m_sampleHeader->dtTimeEnd;
-
-                    if (frame->nb_samples)
-                    {
-                        boost::posix_time::time_duration duration = boost::posix_time::milliseconds(
-                            static_cast<int64_t>((frame->nb_samples * 1000.0) / frame->sample_rate));
-
-                        boost::posix_time::ptime posixTimeBegin = NMMSS::PtimeFromQword(dtTimeBegin);
-                        boost::posix_time::ptime posixTimeEnd = NMMSS::PtimeFromQword(dtTimeEnd) + duration;
-
-                        dtTimeBegin = NMMSS::PtimeToQword(posixTimeBegin);
-                        dtTimeEnd = NMMSS::PtimeToQword(posixTimeEnd);
-                    }
-
-                    sample->Header().dtTimeBegin = dtTimeBegin;
-                    sample->Header().dtTimeEnd   = dtTimeEnd;
-
-                    m_holder->AddSample(sample);
+                    addPcmSample(sample, sType, frame->channels, frame->sample_rate, frame->nb_samples);
                 }
             }
 
@@ -541,41 +648,10 @@ template<const char encoderName[]>
 class CAudioEncoder_G7XX
 {
 public:
-    CAudioEncoder_G7XX(DECLARE_LOGGER_ARG, int bitrate = 64000) :
+    CAudioEncoder_G7XX(DECLARE_LOGGER_ARG) :
         m_audioResampler(GET_LOGGER_PTR, 8000, NMMSS::NMediaType::Audio::ST_INT16, 1)
     {
         INIT_LOGGER_HOLDER;
-
-        boost::mutex::scoped_lock lock(NMMSS::CFFmpegMutex::Get());
-        AVCodec* pCodec = avcodec_find_encoder_by_name(encoderName);
-
-        if(!pCodec)
-        {
-            _err_ << __FUNCTION__ << ". Couldn't find " << encoderName << " audio encoder" << std::endl;
-            throw std::runtime_error("Couldn't find audio encoder");
-        }
-
-        m_pFFmpegContext = NMMSS::CFFMPEGBase::AllocContext(pCodec);
-
-        if (!m_pFFmpegContext)
-        {
-            _err_ << __FUNCTION__ << ". Could not allocate audio codec context";
-            throw std::runtime_error("Could not allocate audio codec context");
-        }
-
-        //инициируем контекст кодера
-        m_pFFmpegContext->channels    = 1;
-        m_pFFmpegContext->sample_rate = 8000;
-        m_pFFmpegContext->time_base   = {1,m_pFFmpegContext->sample_rate};
-        m_pFFmpegContext->sample_fmt  = AV_SAMPLE_FMT_S16;
-        m_pFFmpegContext->bit_rate    = bitrate;
-        m_pFFmpegContext->channel_layout = av_get_default_channel_layout(m_pFFmpegContext->channels);
-
-        if(avcodec_open2(m_pFFmpegContext.get(), pCodec, 0) < 0)
-        {
-            _err_ << __FUNCTION__ << ". Couldn't open encoding context" << std::endl;
-            throw std::runtime_error("Couldn't open audio encoding context");
-        }
     }
 
 
@@ -606,84 +682,24 @@ public:
             return NMMSS::ETHROUGH;
         }
 
-        //выделяем место для кодированного фрейма
-        if (!holder.Alloc(rawSample->Header().nBodySize))
+        // G.711 codes every sample into a byte of its own.
+        const uint32_t count = rawSample->Header().nBodySize / sizeof(int16_t);
+        if (!count)
         {
-            _log_ << "Audio processing memory allocation failed" << std::endl;
-            return NMMSS::EFAILED;
-        }
-
-        AVPacket pkt = {0};
-        NMMSS::AVFramePtr frame;
-
-        av_init_packet(&pkt);
-        pkt.data = holder->GetBody();
-        pkt.size = rawSample->Header().nBodySize / sizeof(int16_t);
-        AVCodecContext* avctx = m_pFFmpegContext.get();
-
-        const int16_t * samples = (int16_t*)rawSample->GetBody();
-        if (samples)
-        {
-            frame.reset(av_frame_alloc());
-            if (!frame)
-            {
-                _err_ << "Error in audio encoding. Insufficient memory." << std::endl;
-                return NMMSS::EIGNORED;
-            }
-
-            if (avctx->frame_size)
-            {
-                frame->nb_samples = avctx->frame_size;
-            }
-            else
-            {
-                // Calculate number of samples from buffer size.
-                int64_t nb_samples;
-                if (!av_get_bits_per_sample(avctx->codec_id))
-                {
-                    _err_ << "Error in audio encoding. Unsupported codec " << avctx->codec_id << std::endl;
-                    return NMMSS::EIGNORED;
-                }
-                nb_samples = (int64_t)pkt.size * 8 / (av_get_bits_per_sample(avctx->codec_id) * avctx->channels);
-                if (nb_samples >= INT_MAX)
-                {
-                    _err_ << "Error in audio encoding. Incorrect samples size." << std::endl;
-                    return NMMSS::EIGNORED;
-                }
-                frame->nb_samples = (int)nb_samples;
-            }
-
-            int samples_size = av_samples_get_buffer_size(NULL, avctx->channels, frame->nb_samples, avctx->sample_fmt, 1);
-            if (avcodec_fill_audio_frame(frame.get(), avctx->channels, avctx->sample_fmt, (const uint8_t*)samples, samples_size, 1) < 0)
-            {
-                _err_ << "Error in audio encoding. Frame fill failed." << std::endl;
-                return NMMSS::EIGNORED;
-            }
-        }
-
-        int got_packet = 0;
-        int ret = avcodec_encode_audio2(avctx, &pkt, frame.get(), &got_packet);
-        if (!ret && got_packet && avctx->coded_frame)
-        {
-            avctx->coded_frame->pts = pkt.pts;
-            avctx->coded_frame->key_frame = !!(pkt.flags & AV_PKT_FLAG_KEY);
+            return NMMSS::EIGNORED;
         }
 
-        av_packet_free_side_data(&pkt);
-        if (frame && frame->extended_data != frame->data)
+        if (!holder.Alloc(count))
         {
-            av_freep(&frame->extended_data);
+            _log_ << "Audio processing memory allocation failed" << std::endl;
+            return NMMSS::EFAILED;
         }
 
-        if (pkt.size <= 0)
-        {
-            _err_ << "Error in audio encoding" << std::endl;
-            return NMMSS::EIGNORED;
-        }
+        this->Encode(reinterpret_cast<const int16_t*>(rawSample->GetBody()), holder->GetBody(), count);
 
         this->CreateHeader(holder.operator->());
 
-        holder->Header().nBodySize = pkt.size;
+        holder->Header().nBodySize = count;
         holder->Header().eFlags    = 0;
 
         holder->Header().dtTimeBegin = in->Header().dtTimeBegin;
@@ -694,10 +710,10 @@ public:
 
 protected:
     void CreateHeader(NMMSS::ISample* pSample);
+    void Encode(const int16_t* samples, uint8_t* codes, size_t count);
 
 private:
     DECLARE_LOGGER_HOLDER;
-    boost::shared_ptr<AVCodecContext> m_pFFmpegContext;
     CAudioResampler m_audioResampler;
 };
 
@@ -717,6 +733,13 @@ void CAudioEncoder_G7XX<ENCODER_NAME_G711_A>::CreateHeader(
     pOutHeader->nSampleRate    = 8000;
 }
 
+template<>
+void CAudioEncoder_G7XX<ENCODER_NAME_G711_A>::Encode(
+    const int16_t* samples, uint8_t* codes, size_t count)
+{
+    NMMSS::NG711::EncodeALaw(samples, codes, count);
+}
+
 extern const char ENCODER_NAME_G711_U[]      = "pcm_mulaw";
 template<>
 void CAudioEncoder_G7XX<ENCODER_NAME_G711_U>::CreateHeader(
@@ -731,6 +754,13 @@ void CAudioEncoder_G7XX<ENCODER_NAME_G711_U>::CreateHeader(
     pOutHeader->nSampleRate    = 8000;
 }
 
+template<>
+void CAudioEncoder_G7XX<ENCODER_NAME_G711_U>::Encode(
+    const int16_t* samples, uint8_t* codes, size_t count)
+{
+    NMMSS::NG711::EncodeULaw(samples, codes, count);
+}
+
 template<const char encoderName[]>
 class CAudioEncoder : public NMMSS::CPullFilterImpl<CAudioEncoder<encoderName> >
 {
@@ -741,6 +771,7 @@ public:
             NMMSS::SAllocatorRequirements(8, AV_INPUT_BUFFER_MIN_SIZE, 16),
             NMMSS::SAllocatorRequirements(0, 0, 16),
             this)
+        , m_packetBuffer(MAX_AUDIO_PACKET_SIZE)
         , m_compression(0)
         , m_bitrate(0)
     {
@@ -870,17 +901,17 @@ public:
         AVPacket pkt;
         int got_output, ret;
 
-        while (m_cacheBuffer.size() >= m_frameBufferSize)
+        // Small camera packets gather in the cache until they fill a codec
+        // frame; the frames coded are dropped from it at once afterwards.
+        NMMSS::ETransformResult result = NMMSS::ETRANSFORMED;
+        size_t consumed = 0;
+        while (m_cacheBuffer.size() - consumed >= m_frameBufferSize)
         {
-            av_init_packet(&pkt);
-            pkt.data = NULL;
-            pkt.size = 0;
-            
             ret = avcodec_fill_audio_frame(
                 m_frame,
                 m_pFFmpegContext->channels,
                 m_pFFmpegContext->sample_fmt,
-                (const uint8_t*)&m_cacheBuffer[0],
+                (const uint8_t*)&m_cacheBuffer[consumed],
                 m_frameBufferSize,
                 0
                 );
@@ -889,29 +920,40 @@ public:
             {
                 char errbuf[256];
                 _err_ << __FUNCTION__  << ". Couldn't encode audio sample: " << av_strerror(ret, errbuf, 256) << std::endl;
-                return NMMSS::EFAILED;
+                result = NMMSS::EFAILED;
+                break;
             }
 
+            // Packets are far smaller than the buffer they may need, so they are
+            // coded into one kept for all of them and copied out at their size.
+            av_init_packet(&pkt);
+            pkt.data = m_packetBuffer.data();
+            pkt.size = MAX_AUDIO_PACKET_SIZE;
+
             ret = avcodec_encode_audio2(m_pFFmpegContext.get(), &pkt, m_frame, &got_output);
+            av_packet_free_side_data(&pkt);
             if (ret < 0 || !got_output)
             {
                 _err_ << __FUNCTION__ << ". Couldn't encode audio sample" << std::endl;
-                return NMMSS::EFAILED;
+                result = NMMSS::EFAILED;
+                break;
             }
 
             NMMSS::PSample sample(holder.GetAllocator()->Alloc(pkt.size));
+            std::memcpy(sample->GetBody(), pkt.data, pkt.size);
             this->CreateHeader(sample.Get());
             sample->Header().nBodySize = pkt.size;
             sample->Header().dtTimeBegin = timestamp;
             sample->Header().dtTimeEnd = NMMSS::PtimeToQword(NMMSS::PtimeFromQword(timestamp) + boost::posix_time::millisec(10));
             timestamp = sample->Header().dtTimeEnd;
 
-            memcpy(sample->GetBody(), pkt.data, pkt.size);
-            m_cacheBuffer.erase(m_cacheBuffer.begin(), m_cacheBuffer.begin() + m_frameBufferSize);
-
+            consumed += m_frameBufferSize;
             holder.AddSample(sample);
-            av_free_packet(&pkt);
         }
+        m_cacheBuffer.erase(m_cacheBuffer.begin(), m_cacheBuffer.begin() + consumed);
+
+        if (NMMSS::EFAILED == result)
+            return result;
 
         if (holder.GetSamples().empty())
             return NMMSS::EIGNORED;
@@ -963,6 +1005,7 @@ private:
     AVCodec*                            m_pCodec;
     AVFrame*                            m_frame;
     std::vector<uint8_t>                m_cacheBuffer;
+    std::vector<uint8_t>                m_packetBuffer;
     uint32_t                            m_frameBufferSize;
     int                                 m_compression;
     int                                 m_bitrate;
@@ -1,4 +1,6 @@
 #include <deque>
+#include <map>
+#include <cmath>
 #include <boost/make_shared.hpp>
 #include <boost/thread/reverse_lock.hpp>
 #include <CorbaHelpers/Envar.h>
@@ -37,6 +39,40 @@ namespace
         bpt::time_period         m_textScope;
         PSampleReader            m_source;
 
+        // Rendered text line, kept in YUV with a per pixel coverage so that it can be blended
+        // straight into the frame planes.
+        struct STextBitmap
+        {
+            int width;
+            int height;
+            std::vector<uint8_t> alpha;
+            std::vector<uint8_t> y;
+            std::vector<uint8_t> u;
+            std::vector<uint8_t> v;
+
+            STextBitmap(int w, int h)
+                : width(w)
+                , height(h)
+                , alpha(w * h, 0)
+                , y(w * h, 0)
+                , u(w * h, 0)
+                , v(w * h, 0)
+            {
+            }
+
+            void SetPixel(int i, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+            {
+                alpha[i] = a;
+                y[i] = uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                u[i] = uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                v[i] = uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        };
+        typedef boost::shared_ptr<STextBitmap> PTextBitmap;
+        typedef std::map<std::string, PTextBitmap> TTextBitmaps;
+
+        TTextBitmaps             m_bitmaps;
+
     public:
 
         CBurnTextTransformerBase(DECLARE_LOGGER_ARG,
@@ -111,6 +147,96 @@ namespace
             return false;
         }
 
+    protected:
+
+        virtual PTextBitmap RenderLine(const std::string& line) = 0;
+
+        PTextBitmap GetLineBitmap(const std::string& line)
+        {
+            TTextBitmaps::iterator it = m_bitmaps.find(line);
+            if (m_bitmaps.end() != it)
+                return it->second;
+
+            PTextBitmap bitmap = RenderLine(line);
+            m_bitmaps.insert(std::make_pair(line, bitmap));
+            return bitmap;
+        }
+
+        // Copies the source frame into the output sample, the text is burned there afterwards.
+        void PrepareOutput(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height)
+        {
+            AVPicture output;
+            avpicture_fill(&output, m_sample->GetBody(), format, width, height);
+            av_picture_copy(&output, &picture, format, width, height);
+            picture = output;
+        }
+
+        // Blends the bitmap into the frame within the (x, y, w, h) box only.
+        void BlendText(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height,
+                       const STextBitmap& bitmap, int x, int y, int w, int h)
+        {
+            const int x0 = std::max(x, 0);
+            const int y0 = std::max(y, 0);
+            const int x1 = std::min<int64_t>(x + std::min(w, bitmap.width), width);
+            const int y1 = std::min<int64_t>(y + std::min(h, bitmap.height), height);
+            if (x0 >= x1 || y0 >= y1)
+                return;
+
+            for (int py = y0; py < y1; ++py)
+            {
+                uint8_t* row = picture.data[0] + py * picture.linesize[0];
+                const int offset = (py - y) * bitmap.width - x;
+                for (int px = x0; px < x1; ++px)
+                {
+                    const int a = bitmap.alpha[offset + px];
+                    if (a)
+                        row[px] = uint8_t((bitmap.y[offset + px] * a + row[px] * (255 - a) + 127) / 255);
+                }
+            }
+
+            if (AV_PIX_FMT_GRAY8 == format)
+                return;
+
+            // Chroma planes are horizontally subsampled for both I420 and Y42B, vertically for I420 only.
+            // The base transformer puts the V plane first.
+            const int shiftY = AV_PIX_FMT_YUV420P == format ? 1 : 0;
+            const int blockSize = 2 << shiftY;
+            for (int cy = y0 >> shiftY; cy <= ((y1 - 1) >> shiftY); ++cy)
+            {
+                uint8_t* rowV = picture.data[1] + cy * picture.linesize[1];
+                uint8_t* rowU = picture.data[2] + cy * picture.linesize[2];
+                const int top = std::max(cy << shiftY, y0);
+                const int bottom = std::min((cy + 1) << shiftY, y1);
+                for (int cx = x0 >> 1; cx <= ((x1 - 1) >> 1); ++cx)
+                {
+                    const int left = std::max(cx << 1, x0);
+                    const int right = std::min((cx + 1) << 1, x1);
+
+                    int sumA = 0, sumU = 0, sumV = 0;
+                    for (int py = top; py < bottom; ++py)
+                    {
+                        const int offset = (py - y) * bitmap.width - x;
+                        for (int px = left; px < right; ++px)
+                        {
+                            const int a = bitmap.alpha[offset + px];
+                            sumA += a;
+                            sumU += bitmap.u[offset + px] * a;
+                            sumV += bitmap.v[offset + px] * a;
+                        }
+                    }
+
+                    if (sumA)
+                    {
+                        const int full = blockSize * 255;
+                        rowU[cx] = uint8_t((sumU + rowU[cx] * (full - sumA) + full / 2) / full);
+                        rowV[cx] = uint8_t((sumV + rowV[cx] * (full - sumA) + full / 2) / full);
+                    }
+                }
+            }
+        }
+
+    private:
+
         bool WaitMatchedText(const bpt::time_period& period)
         {
             if (m_source && m_textScope.end() <= period.begin())
@@ -228,6 +354,15 @@ namespace
                 std::copy((char*)data, (char*)data + contentSize, std::back_inserter(text));
                 boost::replace_all(text, "\\n", "\n");
                 boost::split(m_lines, text, boost::is_any_of("\n"));
+
+                TTextBitmaps::iterator it = m_bitmaps.begin();
+                while (m_bitmaps.end() != it)
+                {
+                    if (m_lines.end() == std::find(m_lines.begin(), m_lines.end(), it->first))
+                        it = m_bitmaps.erase(it);
+                    else
+                        ++it;
+                }
             }
         }
     };
@@ -286,21 +421,44 @@ namespace
 
     private:
 
-        void Transform(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height) override
+        PTextBitmap RenderLine(const std::string& line) override
         {
-            static const float EPSILON = 0.00001F;
+            boost::mutex::scoped_lock lock = NMMSS::CSDLttfLib::Lock();
+            SDL_Surface* lineSurface = TTF_RenderUTF8_Blended(m_font, line.c_str(), m_color);
+            lock.unlock();
+
+            if (!lineSurface)
+                return PTextBitmap();
+
+            PTextBitmap bitmap = boost::make_shared<STextBitmap>(lineSurface->w, lineSurface->h);
+
+            SDL_LockSurface(lineSurface);
+            const uint8_t* pixels = static_cast<const uint8_t*>(lineSurface->pixels);
+            for (int y = 0; y < lineSurface->h; ++y)
+            {
+                for (int x = 0; x < lineSurface->w; ++x)
+                {
+                    Uint32 pixel = 0;
+                    memcpy(&pixel, pixels + y * lineSurface->pitch + x * lineSurface->format->BytesPerPixel, lineSurface->format->BytesPerPixel);
 
-            // make source picture
-            AVPicture rgbPicture1, rgbPicture2;
-            avpicture_alloc(&rgbPicture1, AV_PIX_FMT_RGB24, width, height);
+                    Uint8 r, g, b, a;
+                    SDL_GetRGBA(pixel, lineSurface->format, &r, &g, &b, &a);
+                    bitmap->SetPixel(y * lineSurface->w + x, r, g, b, a);
+                }
+            }
+            SDL_UnlockSurface(lineSurface);
+            SDL_FreeSurface(lineSurface);
+
+            return bitmap;
+        }
 
-            SwsContext* rgbContext = sws_getContext(width, height, format, width, height, AV_PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
-            sws_scale(rgbContext, picture.data, picture.linesize, 0, height, rgbPicture1.data, rgbPicture1.linesize);
+        void Transform(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height) override
+        {
+            static const float EPSILON = 0.00001F;
 
-            // create main surface
-            SDL_Surface *frameSurface = SDL_CreateRGBSurfaceFrom(rgbPicture1.data[0], width, height, 24, rgbPicture1.linesize[0], 0, 0, 0, 0);
+            PrepareOutput(picture, format, width, height);
 
-            // create text lines
+            // layout text lines
             uint32_t lh = TTF_FontHeight(m_font);
             uint32_t lw = m_sw > EPSILON ? uint32_t(m_sw * width) : (width > lh * 2 ? width - lh * 2 : width);
 
@@ -318,40 +476,13 @@ namespace
             {
                 if (!m_lines[i].empty())
                 {
-                    boost::mutex::scoped_lock lock = NMMSS::CSDLttfLib::Lock();
-                    SDL_Surface* lineSurface = TTF_RenderUTF8_Blended(m_font, m_lines[i].c_str(), m_color);
-                    lock.unlock();
-
-                    SDL_Rect place = {
-                        static_cast<int>(lx),
-                        static_cast<int>(ly),
-                        static_cast<int>(lw),
-                        static_cast<int>(lh)
-                    };
-                    SDL_Rect area = {
-                        0, 0,
-                        static_cast<int>(lw),
-                        static_cast<int>(lh)
-                    };
-
-                    SDL_BlitSurface(lineSurface, &area, frameSurface, &place);
-                    SDL_FreeSurface(lineSurface);
+                    PTextBitmap bitmap = GetLineBitmap(m_lines[i]);
+                    if (bitmap)
+                        BlendText(picture, format, width, height, *bitmap, lx, ly, lw, lh);
                 }
 
                 ly += lh;
             }
-
-            // make result picture
-            avpicture_fill(&rgbPicture2, (uint8_t*)frameSurface->pixels, AV_PIX_FMT_RGB24, width, height);
-            avpicture_fill(&picture, m_sample->GetBody(), format, width, height);
-
-            SwsContext* fmtContext = sws_getContext(width, height, AV_PIX_FMT_RGB24, width, height, format, SWS_BICUBIC, NULL, NULL, NULL);
-            sws_scale(fmtContext, rgbPicture2.data, rgbPicture2.linesize, 0, height, picture.data, picture.linesize);
-
-            SDL_FreeSurface(frameSurface);
-            sws_freeContext(rgbContext);
-            sws_freeContext(fmtContext);
-            avpicture_free(&rgbPicture1);
         }
     };
 
@@ -372,6 +503,9 @@ namespace
         int    m_fontStyle;
         double m_fontColor[4];
 
+        bool                 m_measured;
+        cairo_font_extents_t m_fontExtents;
+
     public:
 
         CBurnTextTransformer(DECLARE_LOGGER_ARG,
@@ -387,6 +521,7 @@ namespace
             : CBurnTextTransformerBase(GET_LOGGER_PTR, textSource, x1, y1, x2, y2, mode, beginTime, endTime)
             , m_fontSize(fontSize > 0 ? fontSize : 20)
             , m_fontStyle(fontStyle)
+            , m_measured(false)
         {
             m_fontColor[0] = double(fontColor[0]) / 255.0;
             m_fontColor[1] = double(fontColor[1]) / 255.0;
@@ -430,36 +565,114 @@ namespace
 
     private:
 
-        void Transform(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height) override
+        cairo_t* CreateContext(cairo_surface_t* surface)
         {
-            static const float EPSILON = 0.00001F;
-
-            AVPicture rgba;
-			avpicture_alloc(&rgba, AV_PIX_FMT_RGBA, width, height);
-
-			SwsContext* toRGBA = sws_getContext(width, height, format, width, height, AV_PIX_FMT_RGBA, SWS_BICUBIC, NULL, NULL, NULL);
-            sws_scale(toRGBA, picture.data, picture.linesize, 0, height, rgba.data, rgba.linesize);
-
-            cairo_surface_t* surface = cairo_image_surface_create_for_data(rgba.data[0], CAIRO_FORMAT_ARGB32, width, height, rgba.linesize[0]);
             cairo_t* cairo = cairo_create(surface);
             cairo_set_font_face(cairo, m_font.get());
             cairo_set_font_size(cairo, m_fontSize);
+            return cairo;
+        }
+
+        const cairo_font_extents_t& FontExtents()
+        {
+            if (!m_measured)
+            {
+                cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+                cairo_t* cairo = CreateContext(surface);
+                cairo_font_extents(cairo, &m_fontExtents);
+                cairo_destroy(cairo);
+                cairo_surface_destroy(surface);
+                m_measured = true;
+            }
+            return m_fontExtents;
+        }
+
+        PTextBitmap RenderLine(const std::string& line) override
+        {
+            const cairo_font_extents_t& fe = FontExtents();
+
+            cairo_text_extents_t te;
+            {
+                cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+                cairo_t* cairo = CreateContext(surface);
+                cairo_text_extents(cairo, line.c_str(), &te);
+                cairo_destroy(cairo);
+                cairo_surface_destroy(surface);
+            }
+
+            // the line baseline is put at the font ascent
+            const int w = int(std::ceil(std::max(te.x_advance, te.x_bearing + te.width))) + 1;
+            const int h = int(std::ceil(fe.ascent + fe.descent)) + 1;
+            if (w <= 1 || h <= 1)
+                return PTextBitmap();
+
+            cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+            cairo_t* cairo = CreateContext(surface);
             cairo_set_source_rgba(cairo, m_fontColor[0], m_fontColor[1], m_fontColor[2], m_fontColor[3]);
 
-            cairo_font_extents_t fe;
-            cairo_font_extents(cairo, &fe);
+            cairo_move_to(cairo, 0, fe.ascent);
+            cairo_show_text(cairo, line.c_str());
+
+            if (m_fontStyle & FS_Underline)
+            {
+                cairo_move_to(cairo, 0, fe.ascent);
+                cairo_line_to(cairo, te.width, fe.ascent);
+                cairo_stroke(cairo);
+            }
+            if (m_fontStyle & FS_Strikeout)
+            {
+                cairo_move_to(cairo, 0, fe.ascent - te.height / 2);
+                cairo_line_to(cairo, te.width, fe.ascent - te.height / 2);
+                cairo_stroke(cairo);
+            }
+
+            cairo_destroy(cairo);
+            cairo_surface_flush(surface);
+
+            PTextBitmap bitmap = boost::make_shared<STextBitmap>(w, h);
+
+            const uint8_t* data = cairo_image_surface_get_data(surface);
+            const int stride = cairo_image_surface_get_stride(surface);
+            for (int y = 0; y < h; ++y)
+            {
+                for (int x = 0; x < w; ++x)
+                {
+                    uint32_t pixel = 0;
+                    memcpy(&pixel, data + y * stride + x * sizeof(uint32_t), sizeof(uint32_t));
 
-            // create text lines
+                    // cairo keeps colors premultiplied
+                    const uint32_t a = pixel >> 24;
+                    if (a)
+                    {
+                        bitmap->SetPixel(y * w + x,
+                            uint8_t(((pixel >> 16) & 0xFF) * 255 / a),
+                            uint8_t(((pixel >> 8) & 0xFF) * 255 / a),
+                            uint8_t((pixel & 0xFF) * 255 / a),
+                            uint8_t(a));
+                    }
+                }
+            }
+
+            cairo_surface_destroy(surface);
+            return bitmap;
+        }
+
+        void Transform(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height) override
+        {
+            static const float EPSILON = 0.00001F;
+
+            PrepareOutput(picture, format, width, height);
+
+            const cairo_font_extents_t& fe = FontExtents();
+
+            // layout text lines
             double lx = m_sw > EPSILON ? double(m_sx * width) : fe.height;
             double ly = m_sh > EPSILON ? double(m_sy * height) + fe.height : fe.height * 2;
 
-            double tw = m_sw > EPSILON ? double(m_sw * width) : (width > fe.height * 2 ? width - fe.height * 2 : width);
             double th = m_sh > EPSILON ? double(m_sh * height) : (height > fe.height * 5 ? height - fe.height * 5 : height);
             if (ly + th > height - fe.height * 4)
                 th = height - ly - fe.height * 4;
 
-            cairo_rectangle(cairo, lx, ly, tw, th);
-
             size_t lc = th / fe.height;
             size_t i = m_lines.size() > lc ? m_lines.size() - lc : 0;
 
@@ -467,40 +680,16 @@ namespace
             {
                 if (!m_lines[i].empty())
                 {
-                    cairo_move_to(cairo, lx, ly);
-                    cairo_show_text(cairo, m_lines[i].c_str());
-
-                    cairo_text_extents_t te;
-                    cairo_text_extents(cairo, m_lines[i].c_str(), &te);
-
-                    if (m_fontStyle & FS_Underline)
-                    {
-                        cairo_move_to(cairo, lx, ly);
-                        cairo_line_to(cairo, lx + te.width, ly);
-                        cairo_stroke(cairo);
-                    }
-                    if (m_fontStyle & FS_Strikeout)
+                    PTextBitmap bitmap = GetLineBitmap(m_lines[i]);
+                    if (bitmap)
                     {
-                        cairo_move_to(cairo, lx, ly - te.height / 2);
-                        cairo_line_to(cairo, lx + te.width, ly - te.height / 2);
-                        cairo_stroke(cairo);
+                        BlendText(picture, format, width, height, *bitmap,
+                            int(lx), int(ly - fe.ascent), bitmap->width, bitmap->height);
                     }
                 }
 
                 ly += fe.height;
             }
-
-            avpicture_fill(&picture, m_sample->GetBody(), format, width, height);
-
-			SwsContext* fromRGBA = sws_getContext(width, height, AV_PIX_FMT_RGBA, width, height, format, SWS_BICUBIC, NULL, NULL, NULL);
-            sws_scale(fromRGBA, rgba.data, rgba.linesize, 0, height, picture.data, picture.linesize);
-
-            cairo_destroy(cairo);
-            cairo_surface_destroy(surface);
-
-            sws_freeContext(toRGBA);
-            sws_freeContext(fromRGBA);
-            avpicture_free(&rgba);
         }
     };
 
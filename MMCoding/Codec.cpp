@@ -362,21 +362,6 @@ public:
         , m_setDiscontinuity(false)
     {
         INIT_LOGGER_HOLDER;
-
-        if (m_multithreaded)
-        {
-            boost::mutex::scoped_lock lock(m_concurrentMutex);
-            ++m_concurrentCount;
-        }
-    }
-
-    ~CDecoder()
-    {
-        if (m_multithreaded)
-        {
-            boost::mutex::scoped_lock lock(m_concurrentMutex);
-            --m_concurrentCount;
-        }
     }
 
     NMMSS::ETransformResult operator()(
@@ -612,24 +597,28 @@ private:
         if (!m_decoderFlushed && m_codecFFMPEG)
         {
             if (m_lastType || !m_sessionWatcher.SessionChanged())
-            {
-                uint8_t* dataPtr = nullptr;
-                uint32_t dataSize = 0;
-                while (decodeFrameWithFFMPEG(false, m_lastCodecId, 0, 0, 0, dataPtr, dataSize, 0, true, false));
-            }
+                drainFFMPEGDecoder();
             m_decoderFlushed = true;
             return true;
         }
         return false;
     }
 
+    // Sends the pictures still held by the decoder threads and resets the decoder.
+    void drainFFMPEGDecoder()
+    {
+        uint8_t* dataPtr = nullptr;
+        uint32_t dataSize = 0;
+        while (decodeFrameWithFFMPEG(false, m_lastCodecId, 0, 0, 0, dataPtr, dataSize, 0, true, false));
+    }
+
     void checkFFMPEGDecoder(::uint32_t type, AVCodecID codecId)
     {
         if(!m_codecFFMPEG.get() || (m_lastType != type))
         {
             flushFFMPEGDecoder();
 
-            m_codecFFMPEG.reset(new NMMSS::CFFMPEGVideoDecoder(GET_LOGGER_PTR, m_allocator, m_multithreaded ? m_concurrentCount : 0));
+            m_codecFFMPEG.reset(new NMMSS::CFFMPEGVideoDecoder(GET_LOGGER_PTR, m_allocator, m_multithreaded));
             m_lastType = type;
             m_lastCodecId = codecId;
             m_setDiscontinuity = true;
@@ -678,6 +667,10 @@ private:
                 NMMSS::SMediaSampleHeader::EFNeedKeyFrame |
                 NMMSS::SMediaSampleHeader::EFNeedPreviousFrame));
 
+        // The key frame reopens the decoder with its new threads, the pictures of the old ones go out first.
+        if (isKeyFrame && m_codecFFMPEG->IsThreadAllocationChanged())
+            drainFFMPEGDecoder();
+
         int lowres = calcLowres ? GetMPEGlowres(subtypeHeader->nCodedWidth, subtypeHeader->nCodedHeight) : 0;
         uint64_t dts = m_sampleHeader->dtTimeBegin;
         for(int frame_num = 0; dataSize > 0; ++frame_num)
@@ -853,15 +846,8 @@ private:
     std::unique_ptr<NMMSS::CWXWLDecoder> m_codecWXWL;
     std::unique_ptr<NMMSS::CBIMWDecoder> m_codecBIMW;
 #endif //_WIN32
-
-private:
-    static boost::mutex m_concurrentMutex;
-    static int m_concurrentCount;
 };
 
-boost::mutex CDecoder::m_concurrentMutex;
-int CDecoder::m_concurrentCount = 0;
-
 } // anonymous namespace
 
 namespace NMMSS
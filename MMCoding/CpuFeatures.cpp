@@ -0,0 +1,42 @@
+#include "CpuFeatures.h"
+
+namespace NMMSS
+{
+#ifdef MMCODING_X86
+    bool IsSSE2Supported()
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        return true;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+#endif
+    }
+
+    bool IsAVX2Supported()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        const int OSXSAVE_AVX = (1 << 27) | (1 << 28);
+        if ((info[2] & OSXSAVE_AVX) != OSXSAVE_AVX)
+            return false;
+        // The OS must save both XMM and YMM state.
+        if ((_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif // MMCODING_X86
+}
@@ -0,0 +1,28 @@
+#ifndef CPU_FEATURES_HEADER
+#define CPU_FEATURES_HEADER
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MMCODING_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Compiles a function for a given instruction set without enabling it for the
+// whole translation unit; callers check support at run time.
+#if defined(MMCODING_X86) && (defined(__GNUC__) || defined(__clang__))
+#define MMCODING_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MMCODING_TARGET(isa)
+#endif
+
+namespace NMMSS
+{
+#ifdef MMCODING_X86
+    bool IsSSE2Supported();
+    bool IsAVX2Supported();
+#endif
+}
+
+#endif //CPU_FEATURES_HEADER
@@ -4,20 +4,47 @@
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <Executors/DynamicThreadPool.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "Transforms.h"
+#include "DewarpRemap.h"
 #include "../FilterImpl.h"
 
 namespace
 {
     // http://www.paulbourke.net/dome/dualfish2sphere/
-    
+
+    // Frames are split into horizontal stripes remapped in parallel.
+    const uint32_t MAX_DEWARP_THREADS = 4;
+    // Fewer rows per stripe do not pay for the hand-off to another thread.
+    const uint32_t MIN_DEWARP_STRIPE_ROWS = 32;
+
+    uint32_t dewarpStripes()
+    {
+        return std::max(1u, std::min(std::thread::hardware_concurrency(), MAX_DEWARP_THREADS));
+    }
+
+    // Shared by all transformers, so that many dewarped views do not keep a
+    // set of idle threads each. Stripes which do not fit the queue are remapped
+    // by the calling thread.
+    NExecutors::PDynamicThreadPool getDewarpPool(DECLARE_LOGGER_ARG)
+    {
+        static const uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+        static const NExecutors::PDynamicThreadPool pool =
+            NExecutors::CreateDynamicThreadPool(GET_LOGGER_PTR, "Dewarp", threads * MAX_DEWARP_THREADS, 0, threads);
+        return pool;
+    }
+
     class CFisheyeDewarpTransformer
     {
         DECLARE_LOGGER_HOLDER;
 
     public:
 
-        CFisheyeDewarpTransformer(DECLARE_LOGGER_ARG, float fisheyeLeft, float fisheyeRight, float fisheyeTop, float fisheyeBottom, float fov, float pan, float tilt, float zoom, uint32_t destWidth, uint32_t destHeight, NMMSS::ECameraPlace place)
+        CFisheyeDewarpTransformer(DECLARE_LOGGER_ARG, float fisheyeLeft, float fisheyeRight, float fisheyeTop, float fisheyeBottom, float fov, float pan, float tilt, float zoom, uint32_t destWidth, uint32_t destHeight, NMMSS::ECameraPlace place, NMMSS::EDewarpMode mode)
             : m_fisheyeLeft(fisheyeLeft)
             , m_fisheyeRight(fisheyeRight)
             , m_fisheyeTop(fisheyeTop)
@@ -27,11 +54,14 @@ namespace
             , m_tilt(tilt)
             , m_zoom(zoom)
             , m_place(place)
+            , m_mode(mode)
             , m_destWidth((destWidth + 7) & -8)
             , m_destHeight((destHeight + 7) & -8)
             , m_srcWidth(0)
             , m_srcHeight(0)
-            , m_initialized(false)
+            , m_uvXFactor(0)
+            , m_uvYFactor(0)
+            , m_stripes(dewarpStripes())
         {
             INIT_LOGGER_HOLDER;
 
@@ -40,6 +70,10 @@ namespace
 
             if(m_destWidth == 0 || m_destHeight == 0)
                 throw std::runtime_error("bad 'destWidth' or 'destHeight' parameter");
+
+            // The calling thread remaps a stripe itself.
+            if (m_stripes > 1)
+                m_pool = getDewarpPool(GET_LOGGER_PTR);
         }
 
         NMMSS::ETransformResult operator()(NMMSS::ISample* sample, NMMSS::CDeferredAllocSampleHolder& holder)
@@ -73,7 +107,7 @@ namespace
 
         void operator()(NMMSS::NMediaType::Video::fccGREY::SubtypeHeader* header, uint8_t* body)
         {
-            Init(header->nWidth, header->nHeight);
+            Init(header->nWidth, header->nHeight, 0, 0);
 
             uint32_t dstPitch = (m_destWidth + 15) & -16;
             uint32_t bodySize = dstPitch * m_destHeight;
@@ -92,7 +126,7 @@ namespace
 
             memset(dewarpBody, 0, dstPitch * m_destHeight);
 
-            MakeDewarp(body, 0, 0, header->nPitch, 0, 0, dewarpBody, 0, 0, subheader->nPitch, 0, 0, 0, 0);
+            MakeDewarp(body, 0, 0, header->nPitch, 0, 0, dewarpBody, 0, 0, subheader->nPitch, 0, 0);
 
             m_result = NMMSS::ETRANSFORMED;
         }
@@ -112,7 +146,7 @@ namespace
         template <typename THeader>
         void DoTransform(typename THeader::SubtypeHeader* header, uint8_t* body, uint8_t uvXFactor, uint8_t uvYFactor)
         {
-            Init(header->nWidth, header->nHeight);
+            Init(header->nWidth, header->nHeight, uvXFactor, uvYFactor);
 
             uint32_t dstYPitch = (m_destWidth + 15) & -16;
             uint32_t dstUVPitch = dstYPitch / uvXFactor;
@@ -151,97 +185,100 @@ namespace
                        dewarpBody + subheader->nOffsetV,
                        subheader->nPitch,
                        subheader->nPitchU,
-                       subheader->nPitchV,
-                       uvXFactor,
-                       uvYFactor);
+                       subheader->nPitchV);
 
             m_result = NMMSS::ETRANSFORMED;
         }
 
         void MakeDewarp(uint8_t* pSrcY, uint8_t* pSrcU, uint8_t* pSrcV, uint32_t srcYPitch, uint32_t srcUPitch, uint32_t srcVPitch,
-                        uint8_t* pDstY, uint8_t* pDstU, uint8_t* pDstV, uint32_t dstYPitch, uint32_t dstUPitch, uint32_t dstVPitch,
-                        uint8_t wUVFactor, uint8_t hUVFactor)
+                        uint8_t* pDstY, uint8_t* pDstU, uint8_t* pDstV, uint32_t dstYPitch, uint32_t dstUPitch, uint32_t dstVPitch)
         {
-            for (uint32_t y = 0; y < m_destHeight; ++y)
-            {
-                for (uint32_t x = 0; x < m_destWidth; ++x)
-                {
-                    uint32_t dstPos = y * dstYPitch + x;
-
-                    uint32_t hook = y * m_destWidth + x;
-                    uint32_t srcX = m_hooks[hook].first;
-                    uint32_t srcY = m_hooks[hook].second;
+            const NMMSS::NDewarp::SPlane luma = { pSrcY, srcYPitch, pDstY, dstYPitch };
+            const NMMSS::NDewarp::SPlane u = { pSrcU, srcUPitch, pDstU, dstUPitch };
+            const NMMSS::NDewarp::SPlane v = { pSrcV, srcVPitch, pDstV, dstVPitch };
+            const bool chroma = pSrcU && pSrcV && pDstU && pDstV && m_table->Chroma.Height > 0;
 
-                    if (srcX < m_srcWidth && srcY < m_srcHeight)
-                    {
-                        uint32_t srcPos = srcY * srcYPitch + srcX;
-                        pDstY[dstPos] = pSrcY[srcPos];
+            const NMMSS::NDewarp::SPlaneMap& lumaMap = m_table->Luma;
+            const NMMSS::NDewarp::SPlaneMap& chromaMap = m_table->Chroma;
+            const uint32_t stripes = std::max(1u, std::min(m_stripes, m_destHeight / MIN_DEWARP_STRIPE_ROWS));
 
-                        if (pSrcU && pSrcV && pDstU && pDstV)
-                        {
-                            uint32_t dstPosU = (y / hUVFactor) * dstUPitch + x / wUVFactor;
-                            uint32_t dstPosV = (y / hUVFactor) * dstVPitch + x / wUVFactor;
+            auto remapStripe = [&](uint32_t i)
+            {
+                NMMSS::NDewarp::RemapRows(lumaMap, luma, lumaMap.Height * i / stripes, lumaMap.Height * (i + 1) / stripes);
+                if (chroma)
+                {
+                    const uint32_t begin = chromaMap.Height * i / stripes;
+                    const uint32_t end = chromaMap.Height * (i + 1) / stripes;
+                    NMMSS::NDewarp::RemapRows(chromaMap, u, begin, end);
+                    NMMSS::NDewarp::RemapRows(chromaMap, v, begin, end);
+                }
+            };
 
-                            uint32_t srcUVx = srcX / wUVFactor;
-                            uint32_t srcUVy = srcY / hUVFactor;
+            struct SJoin
+            {
+                std::mutex Mutex;
+                std::condition_variable Done;
+                uint32_t Pending;
+            };
+            SJoin join;
+            join.Pending = stripes - 1;
+
+            for (uint32_t i = 1; i < stripes; ++i)
+            {
+                auto task = [&join, &remapStripe, i]()
+                {
+                    remapStripe(i);
+                    std::lock_guard<std::mutex> lock(join.Mutex);
+                    if (0 == --join.Pending)
+                        join.Done.notify_one();
+                };
+
+                if (!m_pool->Post(task))
+                    task();
+            }
 
-                            uint32_t srcPosU = srcUVy * srcUPitch + srcUVx;
-                            uint32_t srcPosV = srcUVy * srcVPitch + srcUVx;
+            remapStripe(0);
 
-                            pDstU[dstPosU] = pSrcU[srcPosU];
-                            pDstV[dstPosV] = pSrcV[srcPosV];
-                        }
-                    }
-                }
-            }
+            std::unique_lock<std::mutex> lock(join.Mutex);
+            join.Done.wait(lock, [&join] { return 0 == join.Pending; });
         }
 
         virtual glm::vec2 MapViewPortPointToFisheyeCoord(int x, int y) const = 0;
 
-        void Init(uint32_t srcWidth, uint32_t srcHeight)
+        void Init(uint32_t srcWidth, uint32_t srcHeight, uint32_t uvXFactor, uint32_t uvYFactor)
         {
-            if(m_initialized)
+            if (m_table && srcWidth == m_srcWidth && srcHeight == m_srcHeight && uvXFactor == m_uvXFactor && uvYFactor == m_uvYFactor)
                 return;
 
             m_srcWidth = srcWidth;
             m_srcHeight = srcHeight;
+            m_uvXFactor = uvXFactor;
+            m_uvYFactor = uvYFactor;
 
-            int xRadius = int((m_fisheyeRight - m_fisheyeLeft) / 2.0f * m_srcWidth);
-            int yRadius = int((m_fisheyeBottom - m_fisheyeTop) / 2.0f * m_srcHeight);
+            const float xRadius = float(int((m_fisheyeRight - m_fisheyeLeft) / 2.0f * m_srcWidth));
+            const float yRadius = float(int((m_fisheyeBottom - m_fisheyeTop) / 2.0f * m_srcHeight));
 
-            int cx = int(m_fisheyeLeft * m_srcWidth + xRadius);
-            int cy = int(m_fisheyeTop * m_srcHeight + yRadius);
+            const float cx = float(int(m_fisheyeLeft * m_srcWidth + xRadius));
+            const float cy = float(int(m_fisheyeTop * m_srcHeight + yRadius));
 
-            m_hooks.resize(m_destWidth * m_destHeight);
+            NMMSS::NDewarp::SRemapKey key;
+            key.View = { float(m_mode), float(m_place), m_fisheyeLeft, m_fisheyeRight, m_fisheyeTop, m_fisheyeBottom, m_fov, m_pan, m_tilt, m_zoom };
+            key.DestWidth = m_destWidth;
+            key.DestHeight = m_destHeight;
+            key.SrcWidth = m_srcWidth;
+            key.SrcHeight = m_srcHeight;
+            key.UVXFactor = m_uvXFactor;
+            key.UVYFactor = m_uvYFactor;
 
-            for (int y = 0; y < int(m_destHeight); ++y)
+            m_table = NMMSS::NDewarp::GetRemapTable(key, [&](uint32_t x, uint32_t y, float& srcX, float& srcY)
             {
-                for (int x = 0; x < int(m_destWidth); ++x)
-                {
-                    glm::vec2 fisheyePoint = MapViewPortPointToFisheyeCoord(x, y);
-
-                    int srcX = int(fisheyePoint.x * xRadius + cx);
-                    int srcY = int(fisheyePoint.y * yRadius + cy);
-
-                    float len = std::sqrt(fisheyePoint.x * fisheyePoint.x + fisheyePoint.y * fisheyePoint.y);
-                    if (len > 1.0f)
-                    {
-                        srcX = -1;
-                        srcY = -1;
-                    }
-
-                    if (srcX >= 0 && srcX < int(m_srcWidth) && srcY >= 0 && srcY < int(m_srcHeight))
-                    {
-                        m_hooks[y * m_destWidth + x] = std::make_pair(uint32_t(srcX), uint32_t(srcY));
-                    }
-                    else
-                    {
-                        m_hooks[y * m_destWidth + x] = std::make_pair(std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max());
-                    }
-                }
-            }
+                glm::vec2 fisheyePoint = MapViewPortPointToFisheyeCoord(int(x), int(y));
+
+                srcX = fisheyePoint.x * xRadius + cx;
+                srcY = fisheyePoint.y * yRadius + cy;
 
-            m_initialized = true;
+                return std::sqrt(fisheyePoint.x * fisheyePoint.x + fisheyePoint.y * fisheyePoint.y) <= 1.0f;
+            });
         }
 
     protected:
@@ -255,16 +292,20 @@ namespace
         float m_tilt;
         float m_zoom;
         NMMSS::ECameraPlace m_place;
+        NMMSS::EDewarpMode m_mode;
         uint32_t m_destWidth;
         uint32_t m_destHeight;
         uint32_t m_srcWidth;
         uint32_t m_srcHeight;
+        uint32_t m_uvXFactor;
+        uint32_t m_uvYFactor;
 
-        std::vector<std::pair<uint32_t, uint32_t>> m_hooks;
+        NMMSS::NDewarp::PRemapTable m_table;
+        const uint32_t m_stripes;
+        NExecutors::PDynamicThreadPool m_pool;
         NMMSS::PAllocator m_allocator;
         NMMSS::PSample m_dewarpSample;
         NMMSS::ETransformResult m_result;
-        bool m_initialized;
     };
 
     class CFisheyePtzDewarpTransformer : public CFisheyeDewarpTransformer
@@ -275,7 +316,7 @@ namespace
     public:
 
         CFisheyePtzDewarpTransformer(DECLARE_LOGGER_ARG, float fisheyeLeft, float fisheyeRight, float fisheyeTop, float fisheyeBottom, float fov, float pan, float tilt, float zoom, uint32_t destWidth, uint32_t destHeight, NMMSS::ECameraPlace place)
-            : CFisheyeDewarpTransformer(GET_LOGGER_PTR, fisheyeLeft, fisheyeRight, fisheyeTop, fisheyeBottom, fov, pan, tilt, zoom, destWidth, destHeight, place)
+            : CFisheyeDewarpTransformer(GET_LOGGER_PTR, fisheyeLeft, fisheyeRight, fisheyeTop, fisheyeBottom, fov, pan, tilt, zoom, destWidth, destHeight, place, NMMSS::EDewarpMode::PTZ)
         {
             // check if zoom is extremal
             static const float ZOOM_LIMIT = 1.6f;
@@ -332,7 +373,7 @@ namespace
     public:
 
         CFisheyePerimeterDewarpTransformer(DECLARE_LOGGER_ARG, float fisheyeLeft, float fisheyeRight, float fisheyeTop, float fisheyeBottom, float fov, float pan, float tilt, float zoom, uint32_t destWidth, uint32_t destHeight, NMMSS::ECameraPlace place)
-            : CFisheyeDewarpTransformer(GET_LOGGER_PTR, fisheyeLeft, fisheyeRight, fisheyeTop, fisheyeBottom, fov, pan, tilt, zoom, destWidth, destHeight, place)
+            : CFisheyeDewarpTransformer(GET_LOGGER_PTR, fisheyeLeft, fisheyeRight, fisheyeTop, fisheyeBottom, fov, pan, tilt, zoom, destWidth, destHeight, place, NMMSS::EDewarpMode::PERIMETER)
         {
             static const float ZOOM_LIMIT = 2.356f;  // to cut distortions of poles
 
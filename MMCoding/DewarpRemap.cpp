@@ -0,0 +1,350 @@
+#include "DewarpRemap.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+
+using namespace NMMSS::NDewarp;
+
+namespace
+{
+    // Taps and pitches are handled as signed 16 bit values by the vector kernel.
+    const uint32_t MAX_SOURCE_SIZE = 32767;
+
+    const uint32_t ROUNDING = 1 << (2 * WEIGHT_BITS - 1);
+
+    std::mutex g_cacheMutex;
+    std::map<SRemapKey, std::weak_ptr<const SRemapTable>> g_cache;
+    std::atomic<uint64_t> g_cacheHits(0);
+    std::atomic<uint64_t> g_cacheBuilds(0);
+
+    struct SPoint
+    {
+        float X;
+        float Y;
+        bool Valid;
+    };
+
+    // Splits a position into the first of the two pixels it lies between and the
+    // weight of the second one. Positions beyond the outer pixel centres are clamped.
+    void splitPosition(float position, uint32_t size, uint32_t& pixel, uint32_t& weight)
+    {
+        const float u = position - 0.5f;
+        if (size < 2 || u <= 0.0f)
+        {
+            pixel = 0;
+            weight = 0;
+        }
+        else if (u >= float(size - 1))
+        {
+            pixel = size - 2;
+            weight = WEIGHT_ONE;
+        }
+        else
+        {
+            const float whole = std::floor(u);
+            pixel = uint32_t(whole);
+            weight = uint32_t(std::lround((u - whole) * WEIGHT_ONE));
+        }
+    }
+
+    // Same bounds as truncating the position to a pixel index.
+    bool isInside(float position, uint32_t size)
+    {
+        return position > -1.0f && position < float(size);
+    }
+
+    template <typename FPoint>
+    void buildPlane(SPlaneMap& plane, uint32_t width, uint32_t height, uint32_t srcWidth, uint32_t srcHeight, FPoint point)
+    {
+        plane.Width = width;
+        plane.Height = height;
+        plane.SrcWidth = srcWidth;
+        plane.SrcHeight = srcHeight;
+        plane.GroupsPerRow = (width + GROUP_PIXELS - 1) / GROUP_PIXELS;
+        plane.Taps.assign(size_t(width) * height, INVALID_TAP);
+        plane.Weights.assign(size_t(width) * height, 0);
+        plane.Groups.assign(size_t(plane.GroupsPerRow) * height, EG_EMPTY);
+
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            for (uint32_t g = 0; g < plane.GroupsPerRow; ++g)
+            {
+                const uint32_t begin = g * GROUP_PIXELS;
+                const uint32_t end = std::min(begin + GROUP_PIXELS, width);
+                uint32_t valid = 0;
+                bool vectorSafe = end - begin == GROUP_PIXELS && srcWidth >= 4 && srcHeight >= 2;
+
+                for (uint32_t x = begin; x < end; ++x)
+                {
+                    const SPoint p = point(x, y);
+                    if (!p.Valid || !isInside(p.X, srcWidth) || !isInside(p.Y, srcHeight))
+                        continue;
+
+                    uint32_t tapX, tapY, fx, fy;
+                    splitPosition(p.X, srcWidth, tapX, fx);
+                    splitPosition(p.Y, srcHeight, tapY, fy);
+
+                    const size_t i = size_t(y) * width + x;
+                    plane.Taps[i] = (tapY << 16) | tapX;
+                    plane.Weights[i] = uint16_t((fy << 8) | fx);
+                    ++valid;
+                    vectorSafe = vectorSafe && tapX + 3 < srcWidth;
+                }
+
+                plane.Groups[size_t(y) * plane.GroupsPerRow + g] = uint8_t(
+                    0 == valid ? EG_EMPTY : (valid == end - begin && vectorSafe) ? EG_VECTOR : EG_MIXED);
+            }
+        }
+    }
+
+    // Neighbours with zero weight are not read, so any valid tap is safe here.
+    inline uint8_t interpolate(const uint8_t* src, uint32_t pitch, uint32_t tap, uint32_t weights)
+    {
+        const uint32_t fx = weights & 0xFF;
+        const uint32_t fy = weights >> 8;
+        const uint8_t* p = src + (tap >> 16) * pitch + (tap & 0xFFFF);
+
+        uint32_t top = p[0] * (WEIGHT_ONE - fx);
+        if (fx)
+            top += p[1] * fx;
+        uint32_t value = top * (WEIGHT_ONE - fy);
+        if (fy)
+        {
+            const uint8_t* q = p + pitch;
+            uint32_t bottom = q[0] * (WEIGHT_ONE - fx);
+            if (fx)
+                bottom += q[1] * fx;
+            value += bottom * fy;
+        }
+        return uint8_t((value + ROUNDING) >> (2 * WEIGHT_BITS));
+    }
+
+    void remapPixels(const SPlaneMap& map, const SPlane& plane, uint32_t row, uint32_t begin, uint32_t end)
+    {
+        const uint32_t* taps = &map.Taps[size_t(row) * map.Width];
+        const uint16_t* weights = &map.Weights[size_t(row) * map.Width];
+        uint8_t* dst = plane.Dst + size_t(row) * plane.DstPitch;
+        for (uint32_t x = begin; x < end; ++x)
+        {
+            if (INVALID_TAP != taps[x])
+                dst[x] = interpolate(plane.Src, plane.SrcPitch, taps[x], weights[x]);
+        }
+    }
+
+    // Hands whole EG_VECTOR groups to vectorGroup(taps, weights, dst), the rest pixel by pixel.
+    template <typename FVectorGroup>
+    void remapGroups(const SPlaneMap& map, const SPlane& plane, uint32_t rowBegin, uint32_t rowEnd, FVectorGroup vectorGroup)
+    {
+        for (uint32_t row = rowBegin; row < rowEnd; ++row)
+        {
+            const uint8_t* groups = &map.Groups[size_t(row) * map.GroupsPerRow];
+            const size_t rowStart = size_t(row) * map.Width;
+            uint8_t* dst = plane.Dst + size_t(row) * plane.DstPitch;
+            for (uint32_t g = 0; g < map.GroupsPerRow; ++g)
+            {
+                const uint32_t begin = g * GROUP_PIXELS;
+                switch (groups[g])
+                {
+                case EG_EMPTY:
+                    break;
+                case EG_VECTOR:
+                    vectorGroup(&map.Taps[rowStart + begin], &map.Weights[rowStart + begin], dst + begin);
+                    break;
+                default:
+                    remapPixels(map, plane, row, begin, std::min(begin + GROUP_PIXELS, map.Width));
+                }
+            }
+        }
+    }
+
+    void remapRowsScalar(const SPlaneMap& map, const SPlane& plane, uint32_t rowBegin, uint32_t rowEnd)
+    {
+        for (uint32_t row = rowBegin; row < rowEnd; ++row)
+            remapPixels(map, plane, row, 0, map.Width);
+    }
+
+#ifdef MMCODING_X86
+    // The vector kernel interpolates in 16 bit lanes holding pixel pairs:
+    // madd of (left, right) with (1 - fx, fx) gives each source row, madd of
+    // (top, bottom) with (1 - fy, fy) the result, both with the same rounding
+    // as interpolate().
+
+    MMCODING_TARGET("avx2")
+    void remapGroupAVX2(const uint32_t* taps, const uint16_t* weights, const uint8_t* src, uint32_t pitch, uint8_t* dst)
+    {
+        // (x, y) lanes of the taps times (1, pitch) are the offsets of the top left pixels;
+        // a four byte gather there and one row below fetches both pairs of a pixel.
+        const __m256i offsets = _mm256_madd_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(taps)),
+            _mm256_set1_epi32(int32_t((pitch << 16) | 1)));
+        const __m256i top = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), offsets, 1);
+        const __m256i bottom = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src + pitch), offsets, 1);
+
+        const __m256i lowByte = _mm256_set1_epi32(0xFF);
+        const __m256i secondByte = _mm256_set1_epi32(0xFF00);
+        const __m256i topPair = _mm256_or_si256(_mm256_and_si256(top, lowByte), _mm256_slli_epi32(_mm256_and_si256(top, secondByte), 8));
+        const __m256i bottomPair = _mm256_or_si256(_mm256_and_si256(bottom, lowByte), _mm256_slli_epi32(_mm256_and_si256(bottom, secondByte), 8));
+
+        const __m256i one = _mm256_set1_epi32(WEIGHT_ONE);
+        const __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(weights)));
+        const __m256i fx = _mm256_and_si256(w, lowByte);
+        const __m256i fy = _mm256_srli_epi32(w, 8);
+        const __m256i wx = _mm256_or_si256(_mm256_sub_epi32(one, fx), _mm256_slli_epi32(fx, 16));
+        const __m256i wy = _mm256_or_si256(_mm256_sub_epi32(one, fy), _mm256_slli_epi32(fy, 16));
+
+        const __m256i rows = _mm256_or_si256(_mm256_madd_epi16(topPair, wx), _mm256_slli_epi32(_mm256_madd_epi16(bottomPair, wx), 16));
+        const __m256i value = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(rows, wy), _mm256_set1_epi32(ROUNDING)), 2 * WEIGHT_BITS);
+
+        const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(words, words));
+    }
+
+    void remapRowsAVX2(const SPlaneMap& map, const SPlane& plane, uint32_t rowBegin, uint32_t rowEnd)
+    {
+        if (plane.SrcPitch > MAX_SOURCE_SIZE)
+        {
+            remapRowsScalar(map, plane, rowBegin, rowEnd);
+            return;
+        }
+
+        const uint8_t* src = plane.Src;
+        const uint32_t pitch = plane.SrcPitch;
+        remapGroups(map, plane, rowBegin, rowEnd, [src, pitch](const uint32_t* taps, const uint16_t* weights, uint8_t* dst)
+        {
+            remapGroupAVX2(taps, weights, src, pitch, dst);
+        });
+    }
+#endif // MMCODING_X86
+
+    FRemapRows selectRemapKernel()
+    {
+        if (auto kernel = NMMSS::NDewarp::GetRemapKernel(ERK_AVX2))
+            return kernel;
+        return remapRowsScalar;
+    }
+}
+
+namespace NMMSS
+{
+    namespace NDewarp
+    {
+        bool SRemapKey::operator<(const SRemapKey& other) const
+        {
+            return std::tie(View, DestWidth, DestHeight, SrcWidth, SrcHeight, UVXFactor, UVYFactor)
+                < std::tie(other.View, other.DestWidth, other.DestHeight, other.SrcWidth, other.SrcHeight, other.UVXFactor, other.UVYFactor);
+        }
+
+        PRemapTable BuildRemapTable(const SRemapKey& key, const FMapPoint& map)
+        {
+            if (key.SrcWidth > MAX_SOURCE_SIZE || key.SrcHeight > MAX_SOURCE_SIZE)
+                throw std::runtime_error("source frame is too large for dewarping");
+
+            std::vector<SPoint> points(size_t(key.DestWidth) * key.DestHeight);
+            for (uint32_t y = 0; y < key.DestHeight; ++y)
+            {
+                for (uint32_t x = 0; x < key.DestWidth; ++x)
+                {
+                    SPoint& p = points[size_t(y) * key.DestWidth + x];
+                    p.Valid = map(x, y, p.X, p.Y);
+                }
+            }
+
+            std::shared_ptr<SRemapTable> table(std::make_shared<SRemapTable>());
+            buildPlane(table->Luma, key.DestWidth, key.DestHeight, key.SrcWidth, key.SrcHeight,
+                [&](uint32_t x, uint32_t y) { return points[size_t(y) * key.DestWidth + x]; });
+
+            if (key.UVXFactor && key.UVYFactor)
+            {
+                // A chroma pixel shows what the luma pixel at its top left corner does.
+                buildPlane(table->Chroma, key.DestWidth / key.UVXFactor, key.DestHeight / key.UVYFactor,
+                    key.SrcWidth / key.UVXFactor, key.SrcHeight / key.UVYFactor,
+                    [&](uint32_t x, uint32_t y)
+                    {
+                        SPoint p = points[size_t(y * key.UVYFactor) * key.DestWidth + x * key.UVXFactor];
+                        p.X /= key.UVXFactor;
+                        p.Y /= key.UVYFactor;
+                        return p;
+                    });
+            }
+            else
+            {
+                buildPlane(table->Chroma, 0, 0, 0, 0, [](uint32_t, uint32_t) { return SPoint(); });
+            }
+            return table;
+        }
+
+        PRemapTable GetRemapTable(const SRemapKey& key, const FMapPoint& map)
+        {
+            {
+                std::lock_guard<std::mutex> lock(g_cacheMutex);
+                auto it = g_cache.find(key);
+                if (g_cache.end() != it)
+                {
+                    if (PRemapTable table = it->second.lock())
+                    {
+                        g_cacheHits.fetch_add(1, std::memory_order_relaxed);
+                        return table;
+                    }
+                }
+            }
+
+            // Built without the lock: it takes a while and other views must not wait for it.
+            PRemapTable table = BuildRemapTable(key, map);
+            g_cacheBuilds.fetch_add(1, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            for (auto it = g_cache.begin(); it != g_cache.end();)
+            {
+                if (it->second.expired())
+                    it = g_cache.erase(it);
+                else
+                    ++it;
+            }
+
+            // Another transformer may have built the same table meanwhile. Its last user may
+            // also have dropped it since the sweep, then the table just built takes its place.
+            auto inserted = g_cache.insert(std::make_pair(key, std::weak_ptr<const SRemapTable>(table)));
+            if (!inserted.second)
+            {
+                if (PRemapTable existing = inserted.first->second.lock())
+                    return existing;
+                inserted.first->second = table;
+            }
+            return table;
+        }
+
+        SRemapCacheStatistics GetRemapCacheStatistics()
+        {
+            SRemapCacheStatistics st;
+            st.Hits = g_cacheHits.load(std::memory_order_relaxed);
+            st.Builds = g_cacheBuilds.load(std::memory_order_relaxed);
+            return st;
+        }
+
+        FRemapRows GetRemapKernel(ERemapKernel kernel)
+        {
+            switch (kernel)
+            {
+            case ERK_SCALAR:
+                return remapRowsScalar;
+#ifdef MMCODING_X86
+            case ERK_AVX2:
+                return IsAVX2Supported() ? remapRowsAVX2 : nullptr;
+#endif
+            default:
+                return nullptr;
+            }
+        }
+
+        void RemapRows(const SPlaneMap& map, const SPlane& plane, uint32_t rowBegin, uint32_t rowEnd)
+        {
+            static const FRemapRows kernel = selectRemapKernel();
+            kernel(map, plane, rowBegin, rowEnd);
+        }
+    }
+}
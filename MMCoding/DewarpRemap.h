@@ -0,0 +1,119 @@
+#ifndef DEWARP_REMAP_HEADER
+#define DEWARP_REMAP_HEADER
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "MMCodingExports.h"
+
+namespace NMMSS
+{
+    namespace NDewarp
+    {
+        // Bilinear weights are fixed point with this many fractional bits.
+        const uint32_t WEIGHT_BITS = 7;
+        const uint32_t WEIGHT_ONE = 1 << WEIGHT_BITS;
+
+        // Destination pixels are classified in groups of this many per row, so that
+        // the vector kernel knows which groups they may process whole.
+        const uint32_t GROUP_PIXELS = 8;
+
+        // Tap of a destination pixel outside the fisheye image; it is left untouched.
+        const uint32_t INVALID_TAP = 0xFFFFFFFF;
+
+        enum EGroup
+        {
+            // Every pixel maps into the image, far enough from its right edge
+            // for four byte loads from both source rows.
+            EG_VECTOR,
+            EG_MIXED,
+            EG_EMPTY
+        };
+
+        // Lookup table of one plane: for every destination pixel the top left
+        // of the four source pixels it is interpolated from and the weights of
+        // the right and lower ones.
+        struct SPlaneMap
+        {
+            uint32_t Width;
+            uint32_t Height;
+            uint32_t SrcWidth;
+            uint32_t SrcHeight;
+            uint32_t GroupsPerRow;
+            // (y << 16) | x, or INVALID_TAP.
+            std::vector<uint32_t> Taps;
+            // (fy << 8) | fx, both within [0, WEIGHT_ONE].
+            std::vector<uint16_t> Weights;
+            // EGroup of every GROUP_PIXELS pixels of a row.
+            std::vector<uint8_t> Groups;
+        };
+
+        struct SRemapTable
+        {
+            SPlaneMap Luma;
+            // Shared by both chroma planes; empty for single plane formats.
+            SPlaneMap Chroma;
+        };
+        typedef std::shared_ptr<const SRemapTable> PRemapTable;
+
+        // Position in the source luma plane that destination pixel (x, y) shows,
+        // pixel i covering [i, i + 1). Returns false outside the fisheye image.
+        typedef std::function<bool(uint32_t x, uint32_t y, float& srcX, float& srcY)> FMapPoint;
+
+        // Every parameter the mapping depends on; tables are shared by equal keys.
+        struct SRemapKey
+        {
+            std::vector<float> View;
+            uint32_t DestWidth;
+            uint32_t DestHeight;
+            uint32_t SrcWidth;
+            uint32_t SrcHeight;
+            // Chroma subsampling, 0 for single plane formats.
+            uint32_t UVXFactor;
+            uint32_t UVYFactor;
+
+            bool operator<(const SRemapKey& other) const;
+        };
+
+        // The mapping is evaluated once per destination luma pixel; chroma taps
+        // are derived from the same positions.
+        MMCODING_CLASS_DECLSPEC PRemapTable BuildRemapTable(const SRemapKey& key, const FMapPoint& map);
+
+        // Process-wide cache: transformers dewarping the same camera with the same
+        // view share one table, which lives as long as any of them uses it.
+        MMCODING_CLASS_DECLSPEC PRemapTable GetRemapTable(const SRemapKey& key, const FMapPoint& map);
+
+        struct SRemapCacheStatistics
+        {
+            uint64_t Hits;
+            uint64_t Builds;
+        };
+        MMCODING_CLASS_DECLSPEC SRemapCacheStatistics GetRemapCacheStatistics();
+
+        struct SPlane
+        {
+            const uint8_t* Src;
+            uint32_t SrcPitch;
+            uint8_t* Dst;
+            uint32_t DstPitch;
+        };
+
+        // Interpolates destination rows [rowBegin, rowEnd) of a plane. Rows are
+        // independent, so parts of a plane may be remapped on different threads.
+        typedef void (*FRemapRows)(const SPlaneMap& map, const SPlane& plane, uint32_t rowBegin, uint32_t rowEnd);
+
+        enum ERemapKernel
+        {
+            ERK_SCALAR,
+            ERK_AVX2
+        };
+
+        // Particular implementation, nullptr if it is not supported by this CPU or build.
+        // All of them give the same result. RemapRows dispatches to the best supported one.
+        MMCODING_CLASS_DECLSPEC FRemapRows GetRemapKernel(ERemapKernel kernel);
+        MMCODING_CLASS_DECLSPEC void RemapRows(const SPlaneMap& map, const SPlane& plane, uint32_t rowBegin, uint32_t rowEnd);
+    }
+}
+
+#endif //DEWARP_REMAP_HEADER
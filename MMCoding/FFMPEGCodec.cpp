@@ -3,18 +3,51 @@
 
 using namespace NMMSS;
 
-
-void CFFMPEGVideoDecoder::setupMultithreaded(AVCodecContext* const codecCtx)
+namespace
 {
-    const int MAGIC_FFMPEG_THREAD_COUNT = 9;
-    if (m_concurrentCount > 0)
+    void applyThreadAllocation(AVCodecContext* const codecCtx, const SThreadAllocation& threads)
     {
-        int threadCount = (MAGIC_FFMPEG_THREAD_COUNT + m_concurrentCount - 1) / m_concurrentCount;
-        codecCtx->thread_count = threadCount;
-        codecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        codecCtx->thread_count = threads.Threads;
+        switch (threads.Mode)
+        {
+        case ETM_FRAME: codecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE; break;
+        case ETM_SLICE: codecCtx->thread_type = FF_THREAD_SLICE; break;
+        case ETM_SINGLE: break;
+        }
     }
 }
 
+void CFFMPEGVideoDecoder::setupThreading(AVCodecContext* const codecCtx, int codedWidth, int codedHeight)
+{
+    // Single threaded decoders stay single threaded, but take their core out of the budget.
+    if (!m_threadLease)
+        m_threadLease = GetThreadBudget().Register(ECK_DECODER, codedWidth, codedHeight, !m_multithreaded);
+    else if (codedWidth > 0 && codedHeight > 0)
+        m_threadLease->SetResolution(codedWidth, codedHeight);
+
+    m_threadGeneration = GetThreadBudget().Generation();
+    m_threads = m_threadLease->Allocation();
+    m_threadsChanged = false;
+    applyThreadAllocation(codecCtx, m_threads);
+}
+
+bool CFFMPEGVideoDecoder::IsThreadAllocationChanged()
+{
+    if (!m_multithreaded || !m_threadLease)
+        return false;
+    if (m_threadsChanged)
+        return true;
+
+    // Most key frames find the budget as it was and skip its lock.
+    const uint64_t generation = GetThreadBudget().Generation();
+    if (generation == m_threadGeneration)
+        return false;
+    m_threadGeneration = generation;
+
+    m_threadsChanged = m_threadLease->Allocation() != m_threads;
+    return m_threadsChanged;
+}
+
 
 
 AVCodecContext* CFFMPEGVideoEncoder::GetMPEG4Context(int codedWidth, int codedHeight)
@@ -78,9 +111,11 @@ AVCodecContext* CFFMPEGVideoEncoder::DoGetContext(
         av_opt_set(m_context->priv_data, "profile", "baseline", 0);
         av_opt_set(m_context->priv_data, "level", "3", 0);
 
-        // to reduce cpu consumption
-        m_context->thread_count = 2;
-        m_context->thread_type = FF_THREAD_SLICE;
+        if (!m_threadLease)
+            m_threadLease = GetThreadBudget().Register(ECK_ENCODER, codedWidth, codedHeight);
+        else
+            m_threadLease->SetResolution(codedWidth, codedHeight);
+        applyThreadAllocation(m_context.get(), m_threadLease->Allocation());
     }
     else
     {
@@ -27,6 +27,7 @@ extern "C"
 #include "FFmpegMutex.h"
 #include "FrameLagHandler.h"
 #include "MMCodingExports.h"
+#include "ThreadBudget.h"
 
 namespace NMMSS
 {
@@ -276,11 +277,13 @@ std::vector<uint8_t> m_extradata;
 class CFFMPEGVideoDecoder : public CFFMPEGBase
 {
 public:
-    CFFMPEGVideoDecoder(DECLARE_LOGGER_ARG, IAllocator* allocator, int concurrentCount)
+    CFFMPEGVideoDecoder(DECLARE_LOGGER_ARG, IAllocator* allocator, bool multithreaded)
         : CFFMPEGBase(GET_LOGGER_PTR)
         , m_FFmpegAllocator(allocator)
         , m_swsAllocator(allocator)
-        , m_concurrentCount(concurrentCount)
+        , m_multithreaded(multithreaded)
+        , m_threadGeneration(0)
+        , m_threadsChanged(false)
         , m_isFirstSuccessfulDecoding(false)
     {
     }
@@ -303,7 +306,8 @@ public:
         }
 
         if( !IsValidVideoContext(codecID, codedWidth, codedHeight)
-            || (isKeyFrame && (lowres != GetContext()->lowres)) )
+            || (isKeyFrame && (lowres != GetContext()->lowres))
+            || (isKeyFrame && IsThreadAllocationChanged()) )
         {
             boost::mutex::scoped_lock lock(NMMSS::CFFmpegMutex::Get());
             AVCodec* codec = avcodec_find_decoder(codecID);
@@ -333,7 +337,7 @@ public:
             codecCtx->flags2 |= AV_CODEC_FLAG2_FAST;
             codecCtx->thread_safe_callbacks = 1;
 
-            setupMultithreaded(codecCtx);
+            setupThreading(codecCtx, codedWidth, codedHeight);
 
             av_codec_set_lowres(codecCtx, lowres);
 
@@ -401,6 +405,8 @@ public:
         if (get_pic)
         {
             m_isFirstSuccessfulDecoding = true;
+            if (m_threadLease)
+                m_threadLease->SetResolution(m_frame->width, m_frame->height);
         }
 
         m_lagHandler.RegisterInputFrame(dts, preroll, isKeyFrame);
@@ -465,15 +471,23 @@ public:
         return 0;
     }
 
+    // True once the budget has moved the threads of the open context, until the
+    // next key frame reopens it; the pictures it still holds are to be drained first.
+    bool IsThreadAllocationChanged();
+
 private:
-    void setupMultithreaded(AVCodecContext* const codecCtx);
+    void setupThreading(AVCodecContext* const codecCtx, int codedWidth, int codedHeight);
 
 private:
     SwsContextPtr m_swsContext;
     NMMSS::CFFmpegAllocator m_FFmpegAllocator, m_swsAllocator;
     AVFramePtr m_frame;
     FrameLagHandler m_lagHandler;
-    int m_concurrentCount;
+    const bool m_multithreaded;
+    CThreadBudget::PLease m_threadLease;
+    SThreadAllocation m_threads;
+    uint64_t m_threadGeneration;
+    bool m_threadsChanged;
     bool m_isFirstSuccessfulDecoding;
 };
 
@@ -678,6 +692,7 @@ private:
 
     const NMMSS::EVideoCodingPreset m_quality;
     AVCodec* m_codec;
+    CThreadBudget::PLease m_threadLease;
 };
 
 #ifdef _MSC_VER
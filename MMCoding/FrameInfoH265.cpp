@@ -1,22 +1,9 @@
 #include "FrameInfo.h"
 #include "GetBits.h"
+#include "StartCode.h"
 
 #include <vector>
 
-static const uint8_t* FindStartCodeH265(const uint8_t *p, const uint8_t *end)
-{
-    p += 3;
-    while (p < end)
-    {
-        if (p[-1] > 1)   p += 3;
-        else if (p[-2])  p += 2;
-        else if (p[-3] | (p[-1]-1)) ++p;
-        else break;
-    }
-    
-    return (p < end) ? p : end;
-}
-
 bool NMMSS::FindFrameInfoH265(NMMSS::CFrameInfo& info, const uint8_t *buffer, int buffer_size)
 {
     const uint8_t *p = buffer;
@@ -24,7 +11,7 @@ bool NMMSS::FindFrameInfoH265(NMMSS::CFrameInfo& info, const uint8_t *buffer, in
     
     for (;;)
     {
-        p = FindStartCodeH265(p, end);
+        p = NMMSS::FindStartCode(p, end);
         if (p >= end) return false;
     
         uint8_t unit_type = (*(p++) & 0x7E) >> 1;
@@ -1,19 +1,6 @@
 #include "FrameInfo.h"
 #include "GetBits.h"
-
-static const uint8_t* FindStartCodeMPEG2(const uint8_t *p, const uint8_t *end)
-{
-    p += 3;
-    while (p < end)
-    {
-        if (p[-1] > 1)   p += 3;
-        else if (p[-2])  p += 2;
-        else if (p[-3] | (p[-1]-1)) ++p;
-        else break;
-    }
-
-    return (p < end) ? p : end;
-}
+#include "StartCode.h"
 
 bool NMMSS::FindFrameInfoMPEG2(NMMSS::CFrameInfo& info, const uint8_t *buffer, int buffer_size)
 {
@@ -22,7 +9,7 @@ bool NMMSS::FindFrameInfoMPEG2(NMMSS::CFrameInfo& info, const uint8_t *buffer, i
 
     for (;;)
     {
-        p = FindStartCodeMPEG2(p, end);
+        p = NMMSS::FindStartCode(p, end);
         if (p >= end) return false;
         int offset = 0;
         if (0xB3 == p[0])
@@ -0,0 +1,144 @@
+#include "G711.h"
+
+namespace
+{
+    const uint8_t SIGN_BIT = 0x80;
+    const uint8_t QUANT_MASK = 0x0f;
+    const uint8_t SEG_MASK = 0x70;
+    const int SEG_SHIFT = 4;
+    const int BIAS = 0x84;
+
+    // Linear samples are looked up by their upper 14 bits.
+    const int LINEAR_LEVELS = 16384;
+
+    int alawToLinear(uint8_t a)
+    {
+        a ^= 0x55;
+        int t = a & QUANT_MASK;
+        const int seg = (a & SEG_MASK) >> SEG_SHIFT;
+        if (seg)
+            t = (t + t + 1 + 32) << (seg + 2);
+        else
+            t = (t + t + 1) << 3;
+        return (a & SIGN_BIT) ? t : -t;
+    }
+
+    int ulawToLinear(uint8_t u)
+    {
+        u = ~u;
+        int t = ((u & QUANT_MASK) << 3) + BIAS;
+        t <<= (u & SEG_MASK) >> SEG_SHIFT;
+        return (u & SIGN_BIT) ? (BIAS - t) : (t - BIAS);
+    }
+
+    // Each linear level gets the code whose value is nearest, the boundaries
+    // lying halfway between the values of neighbouring codes.
+    void buildEncodeTable(uint8_t* table, int (*toLinear)(uint8_t), uint8_t mask)
+    {
+        const int middle = LINEAR_LEVELS / 2;
+        int j = 1;
+        table[middle] = mask;
+        for (int i = 0; i < 127; ++i)
+        {
+            const int v1 = toLinear(uint8_t(i ^ mask));
+            const int v2 = toLinear(uint8_t((i + 1) ^ mask));
+            const int v = (v1 + v2 + 4) >> 3;
+            for (; j < v; ++j)
+            {
+                table[middle - j] = uint8_t(i ^ (mask ^ 0x80));
+                table[middle + j] = uint8_t(i ^ mask);
+            }
+        }
+        for (; j < middle; ++j)
+        {
+            table[middle - j] = uint8_t(127 ^ (mask ^ 0x80));
+            table[middle + j] = uint8_t(127 ^ mask);
+        }
+        table[0] = table[1];
+    }
+
+    struct STables
+    {
+        STables()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                ALawToLinear[i] = int16_t(alawToLinear(uint8_t(i)));
+                ULawToLinear[i] = int16_t(ulawToLinear(uint8_t(i)));
+            }
+            buildEncodeTable(LinearToALaw, alawToLinear, 0xd5);
+            buildEncodeTable(LinearToULaw, ulawToLinear, 0xff);
+        }
+
+        int16_t ALawToLinear[256];
+        int16_t ULawToLinear[256];
+        uint8_t LinearToALaw[LINEAR_LEVELS];
+        uint8_t LinearToULaw[LINEAR_LEVELS];
+    };
+
+    const STables& tables()
+    {
+        static const STables t;
+        return t;
+    }
+
+    // Four samples per iteration keep the independent lookups in flight.
+    void decode(const int16_t* table, const uint8_t* in, int16_t* out, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            out[i] = table[in[i]];
+            out[i + 1] = table[in[i + 1]];
+            out[i + 2] = table[in[i + 2]];
+            out[i + 3] = table[in[i + 3]];
+        }
+        for (; i < count; ++i)
+            out[i] = table[in[i]];
+    }
+
+    inline uint32_t level(int16_t sample)
+    {
+        return uint32_t(sample + 32768) >> 2;
+    }
+
+    void encode(const uint8_t* table, const int16_t* in, uint8_t* out, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            out[i] = table[level(in[i])];
+            out[i + 1] = table[level(in[i + 1])];
+            out[i + 2] = table[level(in[i + 2])];
+            out[i + 3] = table[level(in[i + 3])];
+        }
+        for (; i < count; ++i)
+            out[i] = table[level(in[i])];
+    }
+}
+
+namespace NMMSS
+{
+    namespace NG711
+    {
+        void DecodeALaw(const uint8_t* in, int16_t* out, size_t count)
+        {
+            decode(tables().ALawToLinear, in, out, count);
+        }
+
+        void DecodeULaw(const uint8_t* in, int16_t* out, size_t count)
+        {
+            decode(tables().ULawToLinear, in, out, count);
+        }
+
+        void EncodeALaw(const int16_t* in, uint8_t* out, size_t count)
+        {
+            encode(tables().LinearToALaw, in, out, count);
+        }
+
+        void EncodeULaw(const int16_t* in, uint8_t* out, size_t count)
+        {
+            encode(tables().LinearToULaw, in, out, count);
+        }
+    }
+}
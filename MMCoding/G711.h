@@ -0,0 +1,24 @@
+#ifndef G711_HEADER
+#define G711_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include "MMCodingExports.h"
+
+namespace NMMSS
+{
+    namespace NG711
+    {
+        // Companding through lookup tables built the way the pcm_alaw and
+        // pcm_mulaw codecs of libavcodec build theirs, so that the output is
+        // bit identical to theirs: linear samples go to the nearest level
+        // instead of being truncated as by the reference G.711 code.
+        MMCODING_CLASS_DECLSPEC void DecodeALaw(const uint8_t* in, int16_t* out, size_t count);
+        MMCODING_CLASS_DECLSPEC void DecodeULaw(const uint8_t* in, int16_t* out, size_t count);
+
+        MMCODING_CLASS_DECLSPEC void EncodeALaw(const int16_t* in, uint8_t* out, size_t count);
+        MMCODING_CLASS_DECLSPEC void EncodeULaw(const int16_t* in, uint8_t* out, size_t count);
+    }
+}
+
+#endif //G711_HEADER
@@ -4,6 +4,7 @@
 
 #include <cmath>
 #include "Transforms.h"
+#include "PixelMaskSpans.h"
 #include "../FilterImpl.h"
 #include "../PtimeFromQword.h"
 #include "../Distributor.h"
@@ -19,10 +20,12 @@ namespace
         NMMSS::PPixelMaskProvider m_provider;
         bool                      m_invert;
         boost::posix_time::ptime  m_timestamp;
-        uint32_t                  m_width;
-        uint32_t                  m_height;
         uint32_t                  m_blurSize;
         NMMSS::TPixelMask         m_mask;
+        NMMSS::CPixelMaskSpans    m_spans;
+        bool                      m_inPlace;
+        uint32_t                  m_bodySize;
+        NMMSS::PAllocator         m_allocator;
         NMMSS::PSample            m_maskedSample;
         NMMSS::ETransformResult   m_result;
 
@@ -31,6 +34,9 @@ namespace
         CPixelMaskTransformer(DECLARE_LOGGER_ARG, NMMSS::PPixelMaskProvider provider, bool invert)
             : m_provider(provider)
             , m_invert(invert)
+            , m_blurSize(0)
+            , m_inPlace(false)
+            , m_bodySize(0)
         {
             INIT_LOGGER_HOLDER;
         }
@@ -43,8 +49,12 @@ namespace
             if (!std::get<0>(m_mask) || !std::get<1>(m_mask) || !std::get<2>(m_mask))
                 return NMMSS::ETHROUGH;
 
-            m_maskedSample = holder.GetAllocator()->Alloc(sample->Header().nBodySize);
-            m_maskedSample->Header().nBodySize = sample->Header().nBodySize;
+            // A sample nobody else holds is masked where it is, the others are
+            // copied first. The copy is allocated only once masking is certain.
+            m_inPlace = 1 == sample->GetCounter();
+            m_bodySize = sample->Header().nBodySize;
+            m_allocator = holder.GetAllocator();
+            m_maskedSample.Reset();
 
             try
             {
@@ -52,10 +62,17 @@ namespace
 
                 if (NMMSS::ETRANSFORMED == m_result)
                 {
-                    m_maskedSample->Header().dtTimeBegin = sample->Header().dtTimeBegin;
-                    m_maskedSample->Header().dtTimeEnd = sample->Header().dtTimeEnd;
+                    if (m_inPlace)
+                    {
+                        holder.AddSample(NMMSS::PSample(sample, NCorbaHelpers::ShareOwnership()));
+                    }
+                    else
+                    {
+                        m_maskedSample->Header().dtTimeBegin = sample->Header().dtTimeBegin;
+                        m_maskedSample->Header().dtTimeEnd = sample->Header().dtTimeEnd;
 
-                    holder.AddSample(m_maskedSample);
+                        holder.AddSample(m_maskedSample);
+                    }
                 }
             }
             catch (std::exception & e)
@@ -74,121 +91,76 @@ namespace
 
         void operator()(NMMSS::NMediaType::Video::fccGREY::SubtypeHeader* header, uint8_t* body)
         {
-            uint8_t* maskBody = m_maskedSample->GetBody();
-            memcpy(maskBody, body, m_maskedSample->Header().nBodySize);
-            NMMSS::NMediaType::Video::fccGREY::SubtypeHeader* subheader = 0;
-            NMMSS::NMediaType::MakeMediaTypeStruct<NMMSS::NMediaType::Video::fccGREY>(m_maskedSample->GetHeader(), &subheader);
-            memcpy(subheader, header, sizeof(NMMSS::NMediaType::Video::fccGREY::SubtypeHeader));
+            if (!BuildSpans(header->nWidth, header->nHeight))
+            {
+                m_result = NMMSS::ETHROUGH;
+                return;
+            }
 
-            DoMask(maskBody + subheader->nOffset, 0, 0, subheader->nPitch, 0, 0, 0, 0);
+            uint8_t* target = PrepareTarget<NMMSS::NMediaType::Video::fccGREY>(header, body);
+            m_spans.Pixelate(target + header->nOffset, header->nPitch, 0, 0, 0, 0, 1, 1, m_blurSize);
 
             m_result = NMMSS::ETRANSFORMED;
         }
 
         void operator()(NMMSS::NMediaType::Video::fccI420::SubtypeHeader* header, uint8_t* body)
         {
-            DoConvert<NMMSS::NMediaType::Video::fccI420>(header, body, 2, 2);
+            DoMask<NMMSS::NMediaType::Video::fccI420>(header, body, 2, 2);
         }
 
         void operator()(NMMSS::NMediaType::Video::fccY42B::SubtypeHeader* header, uint8_t* body)
         {
-            DoConvert<NMMSS::NMediaType::Video::fccY42B>(header, body, 2, 1);
+            DoMask<NMMSS::NMediaType::Video::fccY42B>(header, body, 2, 1);
         }
 
     private:
 
         template <typename THeader>
-        void DoConvert(typename THeader::SubtypeHeader* header, uint8_t* body, uint8_t uvXFactor, uint8_t uvYFactor)
+        void DoMask(typename THeader::SubtypeHeader* header, uint8_t* body, uint8_t uvXFactor, uint8_t uvYFactor)
         {
-            m_width = header->nWidth;
-            m_height = header->nHeight;
-
-            static const int MIN_BLUR_SIZE = 16;
-            static const int BLUR_FACTOR = 64;
-            
-            m_blurSize = std::max(MIN_BLUR_SIZE, (int)std::sqrt(std::pow(m_width, 2) + std::pow(m_height, 2)) / BLUR_FACTOR);
-            
-            uint8_t* maskBody = m_maskedSample->GetBody();
-            memcpy(maskBody, body, m_maskedSample->Header().nBodySize);
-            typename THeader::SubtypeHeader* subheader = 0;
-            NMMSS::NMediaType::MakeMediaTypeStruct<THeader>(m_maskedSample->GetHeader(), &subheader);
-            memcpy(subheader, header, sizeof(typename THeader::SubtypeHeader));
+            if (!BuildSpans(header->nWidth, header->nHeight))
+            {
+                m_result = NMMSS::ETHROUGH;
+                return;
+            }
 
-            DoMask(maskBody + subheader->nOffset,
-                maskBody + subheader->nOffsetU,
-                maskBody + subheader->nOffsetV,
-                subheader->nPitch,
-                subheader->nPitchU,
-                subheader->nPitchV,
-                uvXFactor,
-                uvYFactor
-            );
+            uint8_t* target = PrepareTarget<THeader>(header, body);
+            m_spans.Pixelate(target + header->nOffset, header->nPitch,
+                target + header->nOffsetU, header->nPitchU,
+                target + header->nOffsetV, header->nPitchV,
+                uvXFactor, uvYFactor, m_blurSize);
 
             m_result = NMMSS::ETRANSFORMED;
         }
 
-        void DoMask(uint8_t* pY, uint8_t* pU, uint8_t* pV, uint32_t yPitch, uint32_t uPitch, uint32_t vPitch, uint8_t xUVFactor, uint8_t yUVFactor)
+        // Returns false if the mask covers no pixel of the frame.
+        bool BuildSpans(uint32_t width, uint32_t height)
         {
-            uint32_t maskW = std::get<1>(m_mask);
-            uint32_t maskH = std::get<2>(m_mask);
+            static const int MIN_BLUR_SIZE = 16;
+            static const int BLUR_FACTOR = 64;
 
-            unsigned char* mask = std::get<0>(m_mask).get();
+            m_blurSize = std::max(MIN_BLUR_SIZE, (int)std::sqrt(std::pow(width, 2) + std::pow(height, 2)) / BLUR_FACTOR);
 
-            if (maskW < m_width)
-            {
-                float scaleW = float(m_width) / maskW;
-                float scaleH = float(m_height) / maskH;
+            m_spans.Build(std::get<0>(m_mask).get(), std::get<1>(m_mask), std::get<2>(m_mask), width, height, m_invert);
+            return !m_spans.Empty();
+        }
 
-                for (uint32_t my = 0; my < maskH; ++my)
-                {
-                    for (uint32_t mx = 0; mx < maskW; ++mx)
-                    {
-                        if ((!m_invert && mask[my * maskW + mx]) || (m_invert && !mask[my * maskW + mx]))
-                        {
-                            for (uint32_t y = uint32_t(scaleH * my); y < uint32_t(scaleH * (my + 1)); ++y)
-                            {
-                                for (uint32_t x = uint32_t(scaleW * mx); x < uint32_t(scaleW * (mx + 1)); ++x)
-                                {
-                                    int32_t xx = x - x % m_blurSize;
-                                    int32_t yy = y - y % m_blurSize;
-
-                                    pY[yPitch * y + x] = pY[yPitch * yy + xx];
-
-                                    if (pU)
-                                        pU[uPitch * (y / yUVFactor) + x / xUVFactor] = pU[uPitch * (yy / yUVFactor) + xx / xUVFactor];
-                                    if (pV)
-                                        pV[vPitch * (y / yUVFactor) + x / xUVFactor] = pV[vPitch * (yy / yUVFactor) + xx / xUVFactor];
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-            else
-            {
-                float scaleW = float(maskW) / m_width;
-                float scaleH = float(maskH) / m_height;
+        // The body to mask: the incoming one, or a copy in a new sample with the same layout.
+        template <typename THeader>
+        uint8_t* PrepareTarget(typename THeader::SubtypeHeader* header, uint8_t* body)
+        {
+            if (m_inPlace)
+                return body;
 
-                for (uint32_t y = 0; y < m_height; ++y)
-                {
-                    for (uint32_t x = 0; x < m_width; ++x)
-                    {
-                        uint32_t index = uint32_t(scaleH * y) * maskW + uint32_t(scaleW * x);
-                        if ((!m_invert && mask[index]) || (m_invert && !mask[index]))
-                        {
-                            int32_t xx = x - x % m_blurSize;
-                            int32_t yy = y - y % m_blurSize;
-
-                            pY[yPitch * y + x] = pY[yPitch * yy + xx];
-
-                            if (pU)
-                                pU[uPitch * (y / yUVFactor) + x / xUVFactor] = pU[uPitch * (yy / yUVFactor) + xx / xUVFactor];
-                            if (pV)
-                                pV[vPitch * (y / yUVFactor) + x / xUVFactor] = pV[vPitch * (yy / yUVFactor) + xx / xUVFactor];
-                        }
-                    }
-                }
-            }
+            m_maskedSample = m_allocator->Alloc(m_bodySize);
+            m_maskedSample->Header().nBodySize = m_bodySize;
+
+            uint8_t* maskBody = m_maskedSample->GetBody();
+            memcpy(maskBody, body, m_bodySize);
+            typename THeader::SubtypeHeader* subheader = 0;
+            NMMSS::NMediaType::MakeMediaTypeStruct<THeader>(m_maskedSample->GetHeader(), &subheader);
+            memcpy(subheader, header, sizeof(typename THeader::SubtypeHeader));
+            return maskBody;
         }
     };
 
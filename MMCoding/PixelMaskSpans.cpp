@@ -0,0 +1,144 @@
+#include "PixelMaskSpans.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace NMMSS
+{
+    CPixelMaskSpans::CPixelMaskSpans()
+        : m_maskWidth(0)
+        , m_maskHeight(0)
+        , m_width(0)
+        , m_height(0)
+    {
+    }
+
+    void CPixelMaskSpans::buildScaling(uint32_t maskWidth, uint32_t maskHeight, uint32_t width, uint32_t height)
+    {
+        if (maskWidth == m_maskWidth && maskHeight == m_maskHeight && width == m_width && height == m_height)
+            return;
+
+        m_maskWidth = maskWidth;
+        m_maskHeight = maskHeight;
+        m_width = width;
+        m_height = height;
+
+        m_columnBegin.assign(maskWidth, 0);
+        m_columnEnd.assign(maskWidth, 0);
+        m_lineRow.assign(height, -1);
+
+        // The mapping of the per pixel masking: a mask narrower than the frame is
+        // stretched cell by cell, a larger one is sampled at every pixel.
+        if (maskWidth < width)
+        {
+            const float scaleW = float(width) / maskWidth;
+            const float scaleH = float(height) / maskHeight;
+
+            for (uint32_t mx = 0; mx < maskWidth; ++mx)
+            {
+                m_columnBegin[mx] = std::min(uint32_t(scaleW * mx), width);
+                m_columnEnd[mx] = std::min(uint32_t(scaleW * (mx + 1)), width);
+            }
+            for (uint32_t my = 0; my < maskHeight; ++my)
+            {
+                for (uint32_t y = uint32_t(scaleH * my); y < std::min(uint32_t(scaleH * (my + 1)), height); ++y)
+                    m_lineRow[y] = int32_t(my);
+            }
+        }
+        else
+        {
+            const float scaleW = float(maskWidth) / width;
+            const float scaleH = float(maskHeight) / height;
+
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                const uint32_t mx = std::min(uint32_t(scaleW * x), maskWidth - 1);
+                if (m_columnBegin[mx] == m_columnEnd[mx])
+                    m_columnBegin[mx] = x;
+                m_columnEnd[mx] = x + 1;
+            }
+            for (uint32_t y = 0; y < height; ++y)
+                m_lineRow[y] = int32_t(std::min(uint32_t(scaleH * y), maskHeight - 1));
+        }
+    }
+
+    void CPixelMaskSpans::Build(const unsigned char* mask, uint32_t maskWidth, uint32_t maskHeight, uint32_t width, uint32_t height, bool invert)
+    {
+        buildScaling(maskWidth, maskHeight, width, height);
+
+        m_runs.clear();
+        m_rowRuns.assign(maskHeight + 1, 0);
+        for (uint32_t my = 0; my < maskHeight; ++my)
+        {
+            m_rowRuns[my] = uint32_t(m_runs.size());
+            const unsigned char* row = mask + size_t(my) * maskWidth;
+            for (uint32_t mx = 0; mx < maskWidth; ++mx)
+            {
+                if ((0 != row[mx]) == invert || m_columnBegin[mx] == m_columnEnd[mx])
+                    continue;
+
+                if (m_runs.size() > m_rowRuns[my] && m_runs.back().second == m_columnBegin[mx])
+                    m_runs.back().second = m_columnEnd[mx];
+                else
+                    m_runs.push_back(std::make_pair(m_columnBegin[mx], m_columnEnd[mx]));
+            }
+        }
+        m_rowRuns[maskHeight] = uint32_t(m_runs.size());
+    }
+
+    bool CPixelMaskSpans::Empty() const
+    {
+        return m_runs.empty();
+    }
+
+    uint32_t CPixelMaskSpans::MaskedLines() const
+    {
+        uint32_t lines = 0;
+        for (int32_t row : m_lineRow)
+        {
+            if (row >= 0 && m_rowRuns[row] != m_rowRuns[row + 1])
+                ++lines;
+        }
+        return lines;
+    }
+
+    void CPixelMaskSpans::Pixelate(uint8_t* y, uint32_t yPitch, uint8_t* u, uint32_t uPitch, uint8_t* v, uint32_t vPitch,
+        uint32_t uvXFactor, uint32_t uvYFactor, uint32_t blurSize) const
+    {
+        if (m_runs.empty())
+            return;
+
+        for (uint32_t line = 0; line < m_height; ++line)
+        {
+            const int32_t row = m_lineRow[line];
+            if (row < 0)
+                continue;
+
+            const uint32_t blockLine = line - line % blurSize;
+            uint8_t* dstY = y + size_t(line) * yPitch;
+            const uint8_t* srcY = y + size_t(blockLine) * yPitch;
+
+            for (uint32_t r = m_rowRuns[row]; r < m_rowRuns[row + 1]; ++r)
+            {
+                // Each part of the run within one block takes the value of the block's corner.
+                for (uint32_t x = m_runs[r].first, end; x < m_runs[r].second; x = end)
+                {
+                    const uint32_t blockX = x - x % blurSize;
+                    end = std::min(m_runs[r].second, blockX + blurSize);
+
+                    std::memset(dstY + x, srcY[blockX], end - x);
+
+                    if (u && v)
+                    {
+                        const uint32_t cx = x / uvXFactor;
+                        const uint32_t count = (end - 1) / uvXFactor - cx + 1;
+                        const size_t dst = size_t(line / uvYFactor);
+                        const size_t src = size_t(blockLine / uvYFactor);
+                        std::memset(u + dst * uPitch + cx, u[src * uPitch + blockX / uvXFactor], count);
+                        std::memset(v + dst * vPitch + cx, v[src * vPitch + blockX / uvXFactor], count);
+                    }
+                }
+            }
+        }
+    }
+}
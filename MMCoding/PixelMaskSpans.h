@@ -0,0 +1,53 @@
+#ifndef PIXEL_MASK_SPANS_HEADER
+#define PIXEL_MASK_SPANS_HEADER
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "MMCodingExports.h"
+
+namespace NMMSS
+{
+    // Masked pixels of a frame as runs per line, built from a mask of an
+    // IPixelMaskProvider. Masking then touches the covered pixels only, with
+    // no per pixel lookups in the mask.
+    class MMCODING_CLASS_DECLSPEC CPixelMaskSpans
+    {
+    public:
+        CPixelMaskSpans();
+
+        // A mask cell is masked if non zero, or if zero when inverted. The mask is
+        // stretched over the frame; scaling tables are kept while the sizes stay.
+        void Build(const unsigned char* mask, uint32_t maskWidth, uint32_t maskHeight, uint32_t width, uint32_t height, bool invert);
+
+        bool Empty() const;
+        // Number of frame lines with masked pixels.
+        uint32_t MaskedLines() const;
+
+        // Replaces every masked pixel with the top left pixel of its blurSize block.
+        // Chroma planes are optional; the factors are their subsampling.
+        void Pixelate(uint8_t* y, uint32_t yPitch, uint8_t* u, uint32_t uPitch, uint8_t* v, uint32_t vPitch,
+            uint32_t uvXFactor, uint32_t uvYFactor, uint32_t blurSize) const;
+
+    private:
+        void buildScaling(uint32_t maskWidth, uint32_t maskHeight, uint32_t width, uint32_t height);
+
+        uint32_t m_maskWidth;
+        uint32_t m_maskHeight;
+        uint32_t m_width;
+        uint32_t m_height;
+
+        // Pixels [begin, end) of the frame covered by each mask column, possibly none.
+        std::vector<uint32_t> m_columnBegin;
+        std::vector<uint32_t> m_columnEnd;
+        // Mask row of each frame line, -1 if the mask does not cover it.
+        std::vector<int32_t> m_lineRow;
+
+        // Runs [first, second) of every mask row; those of row r are
+        // m_runs[m_rowRuns[r]] up to m_runs[m_rowRuns[r + 1]].
+        std::vector<std::pair<uint32_t, uint32_t>> m_runs;
+        std::vector<uint32_t> m_rowRuns;
+    };
+}
+
+#endif //PIXEL_MASK_SPANS_HEADER
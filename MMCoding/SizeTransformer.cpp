@@ -4,6 +4,7 @@
 
 extern "C"
 {
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 }
 
@@ -19,17 +20,27 @@ namespace
             : m_width(width)
             , m_height(height)
             , m_storeAspectRatio(storeAspectRatio)
-            , m_downscaleStepY(1)
-            , m_downscaleStepX(1)            
+            , m_sampleWidth(0)
+            , m_sampleHeight(0)
+            , m_cropLeft(0)
+            , m_cropTop(0)
+            , m_cropWidth(0)
+            , m_cropHeight(0)
             , m_crop_x(toInterval(crop_x, 0.f, 1.f))
             , m_crop_y(toInterval(crop_y, 0.f, 1.f))
             , m_crop_width (toInterval(crop_width,  0.f, 1.f- m_crop_x))
             , m_crop_height(toInterval(crop_height, 0.f, 1.f- m_crop_y))
-            , m_crop(crop && isCrop(m_crop_x, m_crop_x, m_crop_width, m_crop_height))
+            , m_crop(crop && isCrop(m_crop_x, m_crop_y, m_crop_width, m_crop_height))
+            , m_swsContext(nullptr)
         {
             INIT_LOGGER_HOLDER;
         }
 
+        ~CBiTransformer()
+        {
+            sws_freeContext(m_swsContext);
+        }
+
         NMMSS::ETransformResult operator()(NMMSS::ISample* sample, NMMSS::CDeferredAllocSampleHolder& holder)
         {
             if (!sample)
@@ -72,72 +83,90 @@ namespace
         {
             if (SetScalingContext(header))
             {
-                //  
-                const uint32_t yWidth = header->nWidth;
-                const uint32_t yHeight = header->nHeight;
-
-                //  
-                //        ,      
-                //          
-                const uint32_t scaledYWidth = yWidth / m_downscaleStepX / 2 * 2;
-                const uint32_t scaledYHeight = yHeight / m_downscaleStepY / 2 * 2;
-                const uint32_t scaledYPitch = GetScaledPitch(scaledYWidth);
-
-                m_scaleSample = allocateSample(AV_PIX_FMT_GRAY8, scaledYPitch, scaledYHeight);
-                if (m_scaleSample)
-                {
-                    NMMSS::NMediaType::Video::fccGREY::SubtypeHeader *subheader = 0;
-                    NMMSS::NMediaType::MakeMediaTypeStruct<NMMSS::NMediaType::Video::fccGREY>
-                        (m_scaleSample->GetHeader(), &subheader);
+                m_result = NMMSS::EFAILED;
+
+                AVPicture picture;
+                picture.data[0] = body + header->nOffset;
+                picture.linesize[0] = header->nPitch;
+                picture.data[1] = picture.data[2] = nullptr;
+                picture.linesize[1] = picture.linesize[2] = 0;
 
-                    subheader->nOffset = 0;
-                    subheader->nPitch = scaledYPitch;
-                    subheader->nHeight = scaledYHeight;
-                    subheader->nWidth = scaledYWidth;
+                AVPicture scalePicture;
+                if (!DoScale(picture, AV_PIX_FMT_GRAY8, header->nWidth, header->nHeight, scalePicture))
+                    return;
 
-                    m_scaleSample->Header().nBodySize = scaledYHeight * scaledYPitch;
+                NMMSS::NMediaType::Video::fccGREY::SubtypeHeader *subheader = 0;
+                NMMSS::NMediaType::MakeMediaTypeStruct<NMMSS::NMediaType::Video::fccGREY>
+                    (m_scaleSample->GetHeader(), &subheader);
 
-                    m_result = NMMSS::ETRANSFORMED;
-                }
+                subheader->nOffset = (uint32_t)(scalePicture.data[0] - m_scaleSample->GetBody());
+                subheader->nPitch = scalePicture.linesize[0];
+                subheader->nHeight = m_sampleHeight;
+                subheader->nWidth = m_sampleWidth;
+
+                m_result = NMMSS::ETRANSFORMED;
             }
         }
 
         void operator()(NMMSS::NMediaType::Video::fccI420::SubtypeHeader* header, uint8_t* body)
         {
             if (SetScalingContext(header))
-                DoConvert<NMMSS::NMediaType::Video::fccI420>(header, body, false);
+                DoConvert<NMMSS::NMediaType::Video::fccI420>(header, body, AV_PIX_FMT_YUV420P);
         }
 
         void operator()(NMMSS::NMediaType::Video::fccY42B::SubtypeHeader* header, uint8_t* body)
         {
             if (SetScalingContext(header))
-                DoConvert<NMMSS::NMediaType::Video::fccY42B>(header, body, true);
+                DoConvert<NMMSS::NMediaType::Video::fccY42B>(header, body, AV_PIX_FMT_YUV422P);
         }
 
     private:
+        // Computes the exact output size: the frame is fitted into the requested box (never upscaled)
+        // and the crop window is taken from the fitted frame.
         template <typename THeader>
         bool SetScalingContext(const THeader* header)
         {
-            if (0 != m_height)
+            const uint32_t yWidth = header->nWidth;
+            const uint32_t yHeight = header->nHeight;
+
+            double ratioX = (0 != m_width) ? std::min(1.0, double(m_width) / yWidth) : 0.0;
+            double ratioY = (0 != m_height) ? std::min(1.0, double(m_height) / yHeight) : 0.0;
+
+            if (0 == m_width)
+                ratioX = (0 == m_height) ? 1.0 : ratioY;
+            if (0 == m_height)
+                ratioY = ratioX;
+
+            if (m_storeAspectRatio)
+                ratioX = ratioY = std::min(ratioX, ratioY);
+
+            //        ,      
+            //          
+            const uint32_t scaledYWidth = (ratioX < 1.0) ? std::max<uint32_t>(2, uint32_t(yWidth * ratioX + 0.5) / 2 * 2) : yWidth;
+            const uint32_t scaledYHeight = (ratioY < 1.0) ? std::max<uint32_t>(2, uint32_t(yHeight * ratioY + 0.5) / 2 * 2) : yHeight;
+
+            m_resize = (scaledYWidth != yWidth || scaledYHeight != yHeight);
+
+            if (m_crop)
             {
-                while (m_height < header->nHeight / m_downscaleStepY)
-                    m_downscaleStepY *= 2;
+                m_sampleWidth = std::max<uint32_t>(2, uint32_t(scaledYWidth * m_crop_width) / 2 * 2);
+                m_sampleHeight = std::max<uint32_t>(2, uint32_t(scaledYHeight * m_crop_height) / 2 * 2);
+
+                m_cropLeft = uint32_t(yWidth * m_crop_x) / 2 * 2;
+                m_cropTop = uint32_t(yHeight * m_crop_y) / 2 * 2;
+                m_cropWidth = std::max<uint32_t>(2, std::min(uint32_t(yWidth * m_crop_width), yWidth - m_cropLeft));
+                m_cropHeight = std::max<uint32_t>(2, std::min(uint32_t(yHeight * m_crop_height), yHeight - m_cropTop));
             }
-            if (0 != m_width)
+            else
             {
-                while (m_width < header->nWidth / m_downscaleStepX)
-                    m_downscaleStepX *= 2;
-            }
-
-            m_downscaleStepY = (0 == m_height) ? m_downscaleStepX : m_downscaleStepY;
-            m_downscaleStepX = (0 == m_width) ? m_downscaleStepY : m_downscaleStepX;
+                m_sampleWidth = scaledYWidth;
+                m_sampleHeight = scaledYHeight;
 
-            if (m_storeAspectRatio)
-                m_downscaleStepY = m_downscaleStepX = (m_downscaleStepY < m_downscaleStepX) ?
-            m_downscaleStepX : m_downscaleStepY;
+                m_cropLeft = m_cropTop = 0;
+                m_cropWidth = yWidth;
+                m_cropHeight = yHeight;
+            }
 
-            m_resize = !(1 == m_downscaleStepY && 1 == m_downscaleStepX);
-            
             if (m_resize || m_crop)
                 return true;
 
@@ -145,105 +174,76 @@ namespace
             return false;
         }
 
-        template <typename THeader>
-        void DoConvert(typename THeader::SubtypeHeader* header, uint8_t* body, bool is422)
+        // Scales the crop window of the source picture straight into a newly allocated output sample.
+        bool DoScale(const AVPicture& picture, AVPixelFormat format, uint32_t yWidth, uint32_t yHeight, AVPicture& scalePicture)
         {
-            m_result = NMMSS::EFAILED;
+            if (m_cropLeft + m_cropWidth > yWidth || m_cropTop + m_cropHeight > yHeight)
+                return false;
 
-            //  
-            const uint32_t yWidth = header->nWidth;
-            const uint32_t yHeight = header->nHeight;
-
-            //  
-            //        ,      
-            //          
-            const uint32_t scaledYWidth = yWidth / m_downscaleStepX / 2 * 2;
-            const uint32_t scaledYHeight = yHeight / m_downscaleStepY / 2 * 2;
-
-            int sampleYWidth = m_crop ? (int)(scaledYWidth * m_crop_width) : scaledYWidth;
-            int sampleYHeight = m_crop ? (int)(scaledYHeight * m_crop_height) : scaledYHeight;
-
-            const uint32_t scaledYPitch = GetScaledPitch(sampleYWidth);
-            const uint32_t scaledUVWidth = sampleYWidth / 2;
-            const uint32_t scaledUVPitch = GetScaledPitch(scaledUVWidth);
-
-            // 
-            m_scaleSample = allocateSample(AV_PIX_FMT_YUV420P, scaledYPitch, sampleYHeight);
-
-            if (m_scaleSample)
+            // The crop window is addressed plane by plane: av_picture_crop refuses a left band on GREY.
+            AVPicture cropPicture = picture;
+            if (m_crop)
             {
-                typename THeader::SubtypeHeader *subheader = 0;
-                NMMSS::NMediaType::MakeMediaTypeStruct<THeader>(m_scaleSample->GetHeader(), &subheader);
-
-                subheader->nOffset = 0;
-                subheader->nHeight = scaledYHeight;
-                subheader->nWidth = scaledYWidth;
-                subheader->nPitch = scaledYPitch;
-                subheader->nPitchU = scaledUVPitch;
-                subheader->nPitchV = scaledUVPitch;
-
-                AVPicture picture;
-                picture.data[0] = body + header->nOffset;
-                picture.data[1] = body + header->nOffsetV;
-                picture.data[2] = body + header->nOffsetU;
-                picture.linesize[0] = header->nPitch;
-                picture.linesize[1] = header->nPitchV;
-                picture.linesize[2] = header->nPitchU;
-
-                AVPicture scalePicture;
-                AVPicture cropPicture;   
-
-                BOOST_SCOPE_EXIT_TPL(&scalePicture, m_resize, m_crop)
-                {
-                    if (m_resize && m_crop)
-                        avpicture_free(&scalePicture);
-                }
-                BOOST_SCOPE_EXIT_END
+                const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+                if (!desc)
+                    return false;
 
-                if (m_resize)
+                for (int i = 0; i < 3 && cropPicture.data[i]; ++i)
                 {
-                    if (m_crop)
-                        avpicture_alloc(&scalePicture, AV_PIX_FMT_YUV420P, scaledYWidth, scaledYHeight);
-                    else
-                        avpicture_fill(&scalePicture, m_scaleSample->GetBody(), AV_PIX_FMT_YUV420P, scaledYWidth, scaledYHeight);
-
-                    SwsContext *resize = sws_getContext(header->nWidth, header->nHeight, AV_PIX_FMT_YUV420P,
-                        scaledYWidth, scaledYHeight, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
-
-                    if (!resize)
-                        return;
-
-                    sws_scale(resize, picture.data, picture.linesize, 0, header->nHeight, scalePicture.data, scalePicture.linesize);
-                    sws_freeContext(resize);
+                    const int shiftX = (0 == i) ? 0 : desc->log2_chroma_w;
+                    const int shiftY = (0 == i) ? 0 : desc->log2_chroma_h;
+                    cropPicture.data[i] += (m_cropTop >> shiftY) * cropPicture.linesize[i] + (m_cropLeft >> shiftX);
                 }
-                
-                AVPicture &resPictureRef = m_resize ? scalePicture : picture;
+            }
 
-                if (m_crop)
-                {
-                    AVPicture tmpPict;
+            // 
+            const uint32_t scaledYPitch = GetScaledPitch(m_sampleWidth);
+            m_scaleSample = allocateSample(format, scaledYPitch, m_sampleHeight);
+            if (!m_scaleSample)
+                return false;
 
-                    if (0 != av_picture_crop(&tmpPict, &resPictureRef, AV_PIX_FMT_YUV420P, (uint32_t)(scaledYHeight*m_crop_y), (uint32_t)(scaledYWidth*m_crop_x)))
-                        return;
-                    
-                    avpicture_fill(&cropPicture, m_scaleSample->GetBody(), AV_PIX_FMT_YUV420P, sampleYWidth, sampleYHeight);
-                    av_picture_copy(&cropPicture, &tmpPict, AV_PIX_FMT_YUV420P, sampleYWidth, sampleYHeight);
+            avpicture_fill(&scalePicture, m_scaleSample->GetBody(), format, scaledYPitch, m_sampleHeight);
 
-                    subheader->nHeight = sampleYHeight;
-                    subheader->nWidth = sampleYWidth;
-                }
+            // Area averaging keeps the detail of arbitrary downscale ratios, the unscaled crop is a plain copy.
+            m_swsContext = sws_getCachedContext(m_swsContext, m_cropWidth, m_cropHeight, format,
+                m_sampleWidth, m_sampleHeight, format, m_resize ? SWS_AREA : SWS_POINT, NULL, NULL, NULL);
+            if (!m_swsContext)
+                return false;
 
-                AVPicture &finalPictureRef = m_crop ? cropPicture : resPictureRef;
+            sws_scale(m_swsContext, cropPicture.data, cropPicture.linesize, 0, m_cropHeight, scalePicture.data, scalePicture.linesize);
+            return true;
+        }
 
-                subheader->nOffset = (uint32_t)(finalPictureRef.data[0] - m_scaleSample->GetBody());
-                subheader->nOffsetV = (uint32_t)(finalPictureRef.data[1] - m_scaleSample->GetBody());
-                subheader->nOffsetU = (uint32_t)(finalPictureRef.data[2] - m_scaleSample->GetBody());
-                subheader->nPitch = finalPictureRef.linesize[0];
-                subheader->nPitchV = finalPictureRef.linesize[1];
-                subheader->nPitchU = finalPictureRef.linesize[2];
+        template <typename THeader>
+        void DoConvert(typename THeader::SubtypeHeader* header, uint8_t* body, AVPixelFormat format)
+        {
+            m_result = NMMSS::EFAILED;
 
-                m_result = NMMSS::ETRANSFORMED;
-            }
+            AVPicture picture;
+            picture.data[0] = body + header->nOffset;
+            picture.data[1] = body + header->nOffsetV;
+            picture.data[2] = body + header->nOffsetU;
+            picture.linesize[0] = header->nPitch;
+            picture.linesize[1] = header->nPitchV;
+            picture.linesize[2] = header->nPitchU;
+
+            AVPicture scalePicture;
+            if (!DoScale(picture, format, header->nWidth, header->nHeight, scalePicture))
+                return;
+
+            typename THeader::SubtypeHeader *subheader = 0;
+            NMMSS::NMediaType::MakeMediaTypeStruct<THeader>(m_scaleSample->GetHeader(), &subheader);
+
+            subheader->nHeight = m_sampleHeight;
+            subheader->nWidth = m_sampleWidth;
+            subheader->nOffset = (uint32_t)(scalePicture.data[0] - m_scaleSample->GetBody());
+            subheader->nOffsetV = (uint32_t)(scalePicture.data[1] - m_scaleSample->GetBody());
+            subheader->nOffsetU = (uint32_t)(scalePicture.data[2] - m_scaleSample->GetBody());
+            subheader->nPitch = scalePicture.linesize[0];
+            subheader->nPitchV = scalePicture.linesize[1];
+            subheader->nPitchU = scalePicture.linesize[2];
+
+            m_result = NMMSS::ETRANSFORMED;
         }
 
         uint32_t GetScaledPitch(uint32_t width)
@@ -281,8 +281,12 @@ namespace
 
         bool m_storeAspectRatio;
 
-        uint32_t m_downscaleStepY;
-        uint32_t m_downscaleStepX;
+        uint32_t m_sampleWidth;
+        uint32_t m_sampleHeight;
+        uint32_t m_cropLeft;
+        uint32_t m_cropTop;
+        uint32_t m_cropWidth;
+        uint32_t m_cropHeight;
 
         NMMSS::PSample m_scaleSample;
         NMMSS::ETransformResult m_result;
@@ -295,8 +299,7 @@ namespace
         const float m_crop_height;
         const bool m_crop;
 
-        std::unique_ptr<NMMSS::CFFmpegAllocator> m_swsAllocator;
-        NMMSS::AVFramePtr m_swsFrame;
+        SwsContext* m_swsContext;
 
         NMMSS::PAllocator m_allocator;
     };
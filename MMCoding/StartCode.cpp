@@ -0,0 +1,115 @@
+#include "StartCode.h"
+#include "CpuFeatures.h"
+
+namespace
+{
+    const uint8_t* findStartCodeScalar(const uint8_t* p, const uint8_t* end)
+    {
+        if (end - p < 3)
+            return end;
+
+        p += 3;
+        while (p < end)
+        {
+            if (p[-1] > 1)   p += 3;
+            else if (p[-2])  p += 2;
+            else if (p[-3] | (p[-1]-1)) ++p;
+            else break;
+        }
+
+        return (p < end) ? p : end;
+    }
+
+#ifdef MMCODING_X86
+    inline unsigned lowestBit(uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    // Every position q of a block is tested at once for q[0] == 0, q[1] == 0, q[2] == 1
+    // with three overlapping unaligned loads. Positions too close to the end for a whole
+    // block are left to the scalar loop.
+    MMCODING_TARGET("sse2")
+    const uint8_t* findStartCodeSSE2(const uint8_t* p, const uint8_t* end)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        while (end - p >= 16 + 2)
+        {
+            const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+            const __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+            const __m128i match = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                _mm_cmpeq_epi8(b2, one));
+            const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+            if (mask)
+                return p + lowestBit(mask) + 3;
+            p += 16;
+        }
+        return findStartCodeScalar(p, end);
+    }
+
+    MMCODING_TARGET("avx2")
+    const uint8_t* findStartCodeAVX2(const uint8_t* p, const uint8_t* end)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi8(1);
+        while (end - p >= 32 + 2)
+        {
+            const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+            const __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+            const __m256i match = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+                _mm256_cmpeq_epi8(b2, one));
+            const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+            if (mask)
+                return p + lowestBit(mask) + 3;
+            p += 32;
+        }
+        return findStartCodeScalar(p, end);
+    }
+#endif // MMCODING_X86
+
+    NMMSS::FStartCodeScanner selectStartCodeScanner()
+    {
+        if (auto scanner = NMMSS::GetStartCodeScanner(NMMSS::ESCS_AVX2))
+            return scanner;
+        if (auto scanner = NMMSS::GetStartCodeScanner(NMMSS::ESCS_SSE2))
+            return scanner;
+        return findStartCodeScalar;
+    }
+}
+
+namespace NMMSS
+{
+    const uint8_t* FindStartCode(const uint8_t* p, const uint8_t* end)
+    {
+        static const FStartCodeScanner scanner = selectStartCodeScanner();
+        return scanner(p, end);
+    }
+
+    FStartCodeScanner GetStartCodeScanner(EStartCodeScanner scanner)
+    {
+        switch (scanner)
+        {
+        case ESCS_SCALAR:
+            return findStartCodeScalar;
+#ifdef MMCODING_X86
+        case ESCS_SSE2:
+            return IsSSE2Supported() ? findStartCodeSSE2 : nullptr;
+        case ESCS_AVX2:
+            return IsAVX2Supported() ? findStartCodeAVX2 : nullptr;
+#endif
+        default:
+            return nullptr;
+        }
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef START_CODE_HEADER
+#define START_CODE_HEADER
+
+#include <cstdint>
+#include "MMCodingExports.h"
+
+namespace NMMSS
+{
+    // Annex-B (H.264, H.265) and MPEG-2 start code scanning.
+    // Returns a pointer to the first byte after the first 00 00 01 sequence in [p, end),
+    // or end if there is no such sequence or it ends the buffer.
+    MMCODING_DECLSPEC const uint8_t* FindStartCode(const uint8_t* p, const uint8_t* end);
+
+    enum EStartCodeScanner
+    {
+        ESCS_SCALAR,
+        ESCS_SSE2,
+        ESCS_AVX2
+    };
+
+    using FStartCodeScanner = const uint8_t* (*)(const uint8_t* p, const uint8_t* end);
+
+    // Particular implementation, nullptr if it is not supported by this CPU or build.
+    // FindStartCode dispatches to the best supported one.
+    MMCODING_DECLSPEC FStartCodeScanner GetStartCodeScanner(EStartCodeScanner scanner);
+}
+
+#endif //START_CODE_HEADER
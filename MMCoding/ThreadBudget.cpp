@@ -0,0 +1,228 @@
+#include "ThreadBudget.h"
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace
+{
+    // Below this many pixels per thread the threading overhead eats the gain.
+    const uint64_t MIN_PIXELS_PER_THREAD = 320 * 240;
+    // As many as the frame threading of libavcodec makes use of.
+    const uint32_t MAX_DECODER_THREADS = 16;
+    // Encoders run sliced, and more slices cost compression.
+    const uint32_t MAX_ENCODER_THREADS = 4;
+    // An encoder spends about twice the time of a decoder on a picture.
+    const uint64_t ENCODER_COST = 2;
+    // A context keeps its threads while they are within a quarter of its ideal share.
+    const uint32_t REBALANCE_HYSTERESIS = 4;
+}
+
+namespace NMMSS
+{
+    CThreadBudget::CLease::CLease(CThreadBudget& budget, uint64_t id, uint32_t width, uint32_t height)
+        : m_budget(budget)
+        , m_id(id)
+        , m_width(width)
+        , m_height(height)
+    {
+    }
+
+    CThreadBudget::CLease::~CLease()
+    {
+        m_budget.unregister(m_id);
+    }
+
+    SThreadAllocation CThreadBudget::CLease::Allocation() const
+    {
+        return m_budget.allocation(m_id);
+    }
+
+    void CThreadBudget::CLease::SetResolution(uint32_t width, uint32_t height)
+    {
+        if (width == m_width && height == m_height)
+            return;
+        m_width = width;
+        m_height = height;
+        m_budget.resize(m_id, width, height);
+    }
+
+    CThreadBudget::CThreadBudget(uint32_t cores)
+        : m_cores(std::max(cores, 1u))
+        , m_lastId(0)
+        , m_generation(0)
+    {
+    }
+
+    CThreadBudget::PLease CThreadBudget::Register(ECodingContextKind kind, uint32_t width, uint32_t height, bool fixed)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        SContext context;
+        context.Entry.Id = ++m_lastId;
+        context.Entry.Kind = kind;
+        context.Entry.Fixed = fixed;
+        context.Entry.Allocation = { 1, ETM_SINGLE };
+        setResolution(context, width, height);
+        m_contexts.push_back(context);
+        rebalance();
+        return PLease(new CLease(*this, context.Entry.Id, width, height));
+    }
+
+    SThreadBudgetStatistics CThreadBudget::GetStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        SThreadBudgetStatistics st;
+        st.Cores = m_cores;
+        st.Generation = m_generation.load(std::memory_order_relaxed);
+        st.Contexts.reserve(m_contexts.size());
+        for (const auto& c : m_contexts)
+            st.Contexts.push_back(c.Entry);
+        return st;
+    }
+
+    SThreadAllocation CThreadBudget::allocation(uint64_t id) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& c : m_contexts)
+        {
+            if (c.Entry.Id == id)
+                return c.Entry.Allocation;
+        }
+        return { 1, ETM_SINGLE };
+    }
+
+    void CThreadBudget::resize(uint64_t id, uint32_t width, uint32_t height)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& c : m_contexts)
+        {
+            if (c.Entry.Id == id)
+            {
+                setResolution(c, width, height);
+                rebalance();
+                return;
+            }
+        }
+    }
+
+    void CThreadBudget::unregister(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_contexts.erase(std::remove_if(m_contexts.begin(), m_contexts.end(),
+            [id](const SContext& c) { return c.Entry.Id == id; }), m_contexts.end());
+        rebalance();
+    }
+
+    void CThreadBudget::setResolution(SContext& context, uint32_t width, uint32_t height)
+    {
+        context.Entry.Width = width;
+        context.Entry.Height = height;
+
+        const uint64_t pixels = uint64_t(width) * height;
+        const bool encoder = ECK_ENCODER == context.Entry.Kind;
+        context.Pixels = encoder ? pixels * ENCODER_COST : pixels;
+        // Until the resolution is known the context stays single threaded:
+        // reopening it later with more threads loses no buffered pictures.
+        context.MaxThreads = context.Entry.Fixed ? 1 : uint32_t(std::min<uint64_t>(std::max<uint64_t>(pixels / MIN_PIXELS_PER_THREAD, 1),
+            encoder ? MAX_ENCODER_THREADS : MAX_DECODER_THREADS));
+    }
+
+    void CThreadBudget::handOut(std::vector<uint32_t>& threads, uint32_t total) const
+    {
+        // The spare cores go one by one to the most loaded thread.
+        for (; total < m_cores; ++total)
+        {
+            size_t best = m_contexts.size();
+            uint64_t bestLoad = 0;
+            for (size_t i = 0; i < m_contexts.size(); ++i)
+            {
+                const uint64_t load = m_contexts[i].Pixels / threads[i];
+                if (threads[i] < m_contexts[i].MaxThreads && load > bestLoad)
+                {
+                    best = i;
+                    bestLoad = load;
+                }
+            }
+            if (best == m_contexts.size())
+                break;
+            ++threads[best];
+        }
+    }
+
+    void CThreadBudget::rebalance()
+    {
+        // One thread each is the floor even when there are more contexts than cores.
+        std::vector<uint32_t> ideal(m_contexts.size(), 1);
+        handOut(ideal, uint32_t(ideal.size()));
+
+        // Every change reopens a decoder, so the current split is only adjusted: threads are
+        // taken from the contexts that miss them least and handed to the most loaded ones.
+        std::vector<uint32_t> threads(m_contexts.size());
+        uint32_t total = 0;
+        for (size_t i = 0; i < m_contexts.size(); ++i)
+        {
+            threads[i] = std::min(m_contexts[i].Entry.Allocation.Threads, m_contexts[i].MaxThreads);
+            total += threads[i];
+        }
+
+        const uint32_t limit = std::max(m_cores, uint32_t(m_contexts.size()));
+        for (; total > limit; --total)
+        {
+            size_t best = m_contexts.size();
+            uint64_t bestLoad = std::numeric_limits<uint64_t>::max();
+            for (size_t i = 0; i < m_contexts.size(); ++i)
+            {
+                if (threads[i] < 2)
+                    continue;
+                const uint64_t load = m_contexts[i].Pixels / (threads[i] - 1);
+                if (load < bestLoad)
+                {
+                    best = i;
+                    bestLoad = load;
+                }
+            }
+            if (best == m_contexts.size())
+                break;
+            --threads[best];
+        }
+        handOut(threads, total);
+
+        // Once the adjusted split strays too far from the ideal one it is dropped for it.
+        for (size_t i = 0; i < m_contexts.size(); ++i)
+        {
+            const uint32_t drift = threads[i] > ideal[i] ? threads[i] - ideal[i] : ideal[i] - threads[i];
+            if (drift * REBALANCE_HYSTERESIS > ideal[i])
+            {
+                threads = ideal;
+                break;
+            }
+        }
+
+        bool changed = false;
+        for (size_t i = 0; i < m_contexts.size(); ++i)
+        {
+            SThreadAllocation allocation = { threads[i], ETM_SINGLE };
+            if (threads[i] > 1)
+                allocation.Mode = ECK_ENCODER == m_contexts[i].Entry.Kind ? ETM_SLICE : ETM_FRAME;
+
+            if (allocation != m_contexts[i].Entry.Allocation)
+            {
+                m_contexts[i].Entry.Allocation = allocation;
+                changed = true;
+            }
+        }
+        if (changed)
+            m_generation.fetch_add(1, std::memory_order_release);
+    }
+
+    CThreadBudget& GetThreadBudget()
+    {
+        static CThreadBudget budget(std::thread::hardware_concurrency());
+        return budget;
+    }
+
+    SThreadBudgetStatistics GetThreadBudgetStatistics()
+    {
+        return GetThreadBudget().GetStatistics();
+    }
+}
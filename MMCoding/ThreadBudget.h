@@ -0,0 +1,135 @@
+#ifndef THREAD_BUDGET_HEADER
+#define THREAD_BUDGET_HEADER
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "MMCodingExports.h"
+
+namespace NMMSS
+{
+    enum ECodingContextKind
+    {
+        ECK_DECODER,
+        ECK_ENCODER
+    };
+
+    enum EThreadingMode
+    {
+        ETM_SINGLE,
+        // Slices of one picture in parallel: no added latency.
+        ETM_SLICE,
+        // Consecutive pictures in parallel, falling back to slices where the
+        // codec can not: scales with any stream, delays output by a frame per thread.
+        ETM_FRAME
+    };
+
+    struct SThreadAllocation
+    {
+        uint32_t Threads;
+        EThreadingMode Mode;
+
+        bool operator==(const SThreadAllocation& other) const
+        {
+            return Threads == other.Threads && Mode == other.Mode;
+        }
+        bool operator!=(const SThreadAllocation& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    struct SThreadBudgetEntry
+    {
+        uint64_t Id;
+        ECodingContextKind Kind;
+        // Fixed contexts always run a single thread, yet take their core.
+        bool Fixed;
+        uint32_t Width;
+        uint32_t Height;
+        SThreadAllocation Allocation;
+    };
+
+    struct SThreadBudgetStatistics
+    {
+        uint32_t Cores;
+        // Incremented whenever some allocation changes.
+        uint64_t Generation;
+        std::vector<SThreadBudgetEntry> Contexts;
+    };
+
+    // Splits the cores among the live ffmpeg coding contexts. Every context
+    // gets a thread; spare cores go to the context with the most pixels per
+    // thread, up to as many threads as its resolution can use. Allocations
+    // are adjusted whenever a context comes, goes or changes resolution,
+    // touching as few contexts as possible, and recomputed once they stray
+    // too far from the ideal split; contexts pick them up when they are
+    // (re)opened. Contexts that can not be threaded are registered as fixed,
+    // so that they count all the same.
+    class MMCODING_CLASS_DECLSPEC CThreadBudget
+    {
+    public:
+        explicit CThreadBudget(uint32_t cores);
+
+        class MMCODING_CLASS_DECLSPEC CLease
+        {
+        public:
+            ~CLease();
+
+            SThreadAllocation Allocation() const;
+            // Cheap when the resolution stays; zero if not known yet.
+            void SetResolution(uint32_t width, uint32_t height);
+
+        private:
+            friend class CThreadBudget;
+            CLease(CThreadBudget& budget, uint64_t id, uint32_t width, uint32_t height);
+            CLease(const CLease&) = delete;
+            CLease& operator=(const CLease&) = delete;
+
+            CThreadBudget& m_budget;
+            const uint64_t m_id;
+            uint32_t m_width;
+            uint32_t m_height;
+        };
+        typedef std::unique_ptr<CLease> PLease;
+
+        PLease Register(ECodingContextKind kind, uint32_t width, uint32_t height, bool fixed = false);
+
+        // Lock free, to be polled for changes before asking a lease for its allocation.
+        uint64_t Generation() const
+        {
+            return m_generation.load(std::memory_order_acquire);
+        }
+
+        SThreadBudgetStatistics GetStatistics() const;
+
+    private:
+        struct SContext
+        {
+            SThreadBudgetEntry Entry;
+            uint64_t Pixels;
+            uint32_t MaxThreads;
+        };
+
+        SThreadAllocation allocation(uint64_t id) const;
+        void resize(uint64_t id, uint32_t width, uint32_t height);
+        void unregister(uint64_t id);
+        void handOut(std::vector<uint32_t>& threads, uint32_t total) const;
+        void rebalance();
+        static void setResolution(SContext& context, uint32_t width, uint32_t height);
+
+        const uint32_t m_cores;
+        mutable std::mutex m_mutex;
+        std::vector<SContext> m_contexts;
+        uint64_t m_lastId;
+        std::atomic<uint64_t> m_generation;
+    };
+
+    // The budget of the process, sized by the hardware concurrency.
+    MMCODING_CLASS_DECLSPEC CThreadBudget& GetThreadBudget();
+    MMCODING_CLASS_DECLSPEC SThreadBudgetStatistics GetThreadBudgetStatistics();
+}
+
+#endif //THREAD_BUDGET_HEADER
@@ -1,4 +1,5 @@
 #include "ImageTransformerBase.h"
+#include "YuvOverlay.h"
 #include <SDL.h>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/detail/utf8_codecvt_facet.hpp>
@@ -12,6 +13,7 @@ GCC_SUPPRESS_WARNING_BEGIN((-Wunused-local-typedefs)(-Wparentheses));
 GCC_SUPPRESS_WARNING_END();
 
 #include <boost/algorithm/string.hpp>
+#include <memory>
 
 
 #ifdef _MSC_VER
@@ -21,17 +23,34 @@ GCC_SUPPRESS_WARNING_END();
 
 namespace
 {
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    const uint32_t RGBA_RMASK = 0xff000000;
+    const uint32_t RGBA_GMASK = 0x00ff0000;
+    const uint32_t RGBA_BMASK = 0x0000ff00;
+    const uint32_t RGBA_AMASK = 0x000000ff;
+#else
+    const uint32_t RGBA_RMASK = 0x000000ff;
+    const uint32_t RGBA_GMASK = 0x0000ff00;
+    const uint32_t RGBA_BMASK = 0x00ff0000;
+    const uint32_t RGBA_AMASK = 0xff000000;
+#endif
+
     class CWatermarkTransformer : public CImageTransformerBase
     {
         SDL_Surface*              m_watermarkSurface;
-        SDL_Rect                  m_watermarkPlace;
         float                     m_x1;
         float                     m_y1;
         float                     m_x2;
         float                     m_y2;
-        bool                      m_initialized;
+        uint8_t                   m_opacity;
         boost::gil::rgba8_image_t m_image;
 
+        // Watermark converted for the geometry of the last frame.
+        NMMSS::NOverlay::SYuvOverlay m_overlay;
+        AVPixelFormat             m_overlayFormat;
+        uint32_t                  m_overlayWidth;
+        uint32_t                  m_overlayHeight;
+
     public:
 
         CWatermarkTransformer(DECLARE_LOGGER_ARG, const std::wstring& watermark, float opacity = 1.0F, float x1 = 0.0F, float y1 = 0.0F, float x2 = 1.0F, float y2 = 1.0F)
@@ -41,7 +60,10 @@ namespace
             , m_y1(y1)
             , m_x2(x2)
             , m_y2(y2)
-            , m_initialized(false)
+            , m_opacity(uint8_t(std::max(std::min(opacity, 1.0f), 0.0f) * 255))
+            , m_overlayFormat(AV_PIX_FMT_NONE)
+            , m_overlayWidth(0)
+            , m_overlayHeight(0)
         {
             if (m_x1 > m_x2) std::swap(m_x1, m_x2);
             if (m_y1 > m_y2) std::swap(m_y1, m_y2);
@@ -88,18 +110,7 @@ namespace
                         boost::gil::read_and_convert_image(path.generic_string(), m_image, boost::gil::jpeg_tag());
                     }
 
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-                    uint32_t rmask = 0xff000000;
-                    uint32_t gmask = 0x00ff0000;
-                    uint32_t bmask = 0x0000ff00;
-                    uint32_t amask = 0x000000ff;
-#else
-                    uint32_t rmask = 0x000000ff;
-                    uint32_t gmask = 0x0000ff00;
-                    uint32_t bmask = 0x00ff0000;
-                    uint32_t amask = 0xff000000;
-#endif
-                    m_watermarkSurface = SDL_CreateRGBSurfaceFrom(m_image._view.begin().x(), m_image.width(), m_image.height(), 32, m_image.width() * 4, rmask, gmask, bmask, amask);
+                    m_watermarkSurface = SDL_CreateRGBSurfaceFrom(m_image._view.begin().x(), m_image.width(), m_image.height(), 32, m_image.width() * 4, RGBA_RMASK, RGBA_GMASK, RGBA_BMASK, RGBA_AMASK);
                 }
             }
 
@@ -109,8 +120,8 @@ namespace
                 throw std::runtime_error("Unable to load watermark image");
             }
 
-            SDL_SetSurfaceBlendMode(m_watermarkSurface, SDL_BLENDMODE_BLEND);
-            SDL_SetSurfaceAlphaMod(m_watermarkSurface, opacity * 255);
+            // The surface is only scaled, with its alpha, the opacity is applied when blending.
+            SDL_SetSurfaceBlendMode(m_watermarkSurface, SDL_BLENDMODE_NONE);
         }
 
         ~CWatermarkTransformer()
@@ -120,41 +131,63 @@ namespace
 
     private:
 
-        void Transform(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height)
+        void Transform(AVPicture& picture, AVPixelFormat format, uint32_t width, uint32_t height) override
         {
-            // make source picture
-            AVPicture rgbPicture1, rgbPicture2;
-            avpicture_alloc(&rgbPicture1, AV_PIX_FMT_RGB24, width, height);
-
-            SwsContext* rgbContext = sws_getContext(width, height, format, width, height, AV_PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
-            sws_scale(rgbContext, picture.data, picture.linesize, 0, height, rgbPicture1.data, rgbPicture1.linesize);
-            
-            // create frame surface
-            SDL_Surface *frameSurface = SDL_CreateRGBSurfaceFrom(rgbPicture1.data[0], width, height, 24, rgbPicture1.linesize[0], 0, 0, 0, 0);
-
-            InitWatermarkMapping(width, height);
-            SDL_BlitScaled(m_watermarkSurface, NULL, frameSurface, &m_watermarkPlace);
-
-            // make result picture
-            avpicture_fill(&rgbPicture2, (uint8_t*)frameSurface->pixels, AV_PIX_FMT_RGB24, width, height);
-            avpicture_fill(&picture, m_sample->GetBody(), format, width, height);
-
-            SwsContext* fmtContext = sws_getContext(width, height, AV_PIX_FMT_RGB24, width, height, format, SWS_BICUBIC, NULL, NULL, NULL);
-            sws_scale(fmtContext, rgbPicture2.data, rgbPicture2.linesize, 0, height, picture.data, picture.linesize);
-
-            SDL_FreeSurface(frameSurface);
-            sws_freeContext(rgbContext);
-            sws_freeContext(fmtContext);
-            avpicture_free(&rgbPicture1);
+            // The frame is copied as is, only the pixels under the watermark are blended.
+            AVPicture output;
+            avpicture_fill(&output, m_sample->GetBody(), format, width, height);
+            av_picture_copy(&output, &picture, format, width, height);
+            picture = output;
+
+            const NMMSS::NOverlay::SYuvOverlay& overlay = GetOverlay(format, width, height);
+            NMMSS::NOverlay::BlendPlane(overlay.Luma, picture.data[0], picture.linesize[0]);
+            if (AV_PIX_FMT_GRAY8 != format)
+            {
+                // The base transformer puts the V plane first.
+                NMMSS::NOverlay::BlendPlane(overlay.V, picture.data[1], picture.linesize[1]);
+                NMMSS::NOverlay::BlendPlane(overlay.U, picture.data[2], picture.linesize[2]);
+            }
         }
 
-        void InitWatermarkMapping(uint32_t width, uint32_t height)
+        const NMMSS::NOverlay::SYuvOverlay& GetOverlay(AVPixelFormat format, uint32_t width, uint32_t height)
         {
-            if (m_initialized)
-                return;
+            if (format == m_overlayFormat && width == m_overlayWidth && height == m_overlayHeight)
+                return m_overlay;
+
+            const SDL_Rect place = GetWatermarkPlace(width, height);
 
-            m_initialized = true;
+            NMMSS::NOverlay::SFrameLayout layout;
+            layout.Width = width;
+            layout.Height = height;
+            layout.HasChroma = AV_PIX_FMT_GRAY8 != format;
+            layout.ChromaShiftX = 1;
+            layout.ChromaShiftY = AV_PIX_FMT_YUV420P == format ? 1 : 0;
 
+            if (place.w > 0 && place.h > 0)
+            {
+                std::shared_ptr<SDL_Surface> scaled(SDL_CreateRGBSurface(0, place.w, place.h, 32, RGBA_RMASK, RGBA_GMASK, RGBA_BMASK, RGBA_AMASK), SDL_FreeSurface);
+                if (!scaled || SDL_BlitScaled(m_watermarkSurface, NULL, scaled.get(), NULL))
+                {
+                    _err_ << __FUNCTION__ << ". " << SDL_GetError();
+                    throw std::runtime_error("Unable to scale watermark image");
+                }
+
+                m_overlay = NMMSS::NOverlay::MakeYuvOverlay(static_cast<const uint8_t*>(scaled->pixels), scaled->pitch,
+                    place.x, place.y, place.w, place.h, m_opacity, layout);
+            }
+            else
+            {
+                m_overlay = NMMSS::NOverlay::MakeYuvOverlay(nullptr, 0, 0, 0, 0, 0, m_opacity, layout);
+            }
+
+            m_overlayFormat = format;
+            m_overlayWidth = width;
+            m_overlayHeight = height;
+            return m_overlay;
+        }
+
+        SDL_Rect GetWatermarkPlace(uint32_t width, uint32_t height) const
+        {
             int16_t x = width * m_x1;
             int16_t y = height * m_y1;
             uint16_t _w = width * (m_x2 - m_x1);
@@ -173,7 +206,7 @@ namespace
             if(_h > h)
                 y += (_h - h) / 2;
 
-            m_watermarkPlace = { x, y, w, h };
+            return SDL_Rect{ x, y, w, h };
         }
     };
 }
@@ -0,0 +1,235 @@
+#include "YuvOverlay.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+
+using namespace NMMSS::NOverlay;
+
+namespace
+{
+    // BT.601 limited range, as the frames are converted by swscale.
+    uint8_t rgbToY(int r, int g, int b)
+    {
+        return uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    }
+
+    uint8_t rgbToU(int r, int g, int b)
+    {
+        return uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    }
+
+    uint8_t rgbToV(int r, int g, int b)
+    {
+        return uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+
+    // Exact round(v / 255) for v <= 255 * 255.
+    inline uint32_t divide255(uint32_t v)
+    {
+        v += 128;
+        return (v + (v >> 8)) >> 8;
+    }
+
+    void resetPlane(SOverlayPlane& plane, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+    {
+        plane.X = x;
+        plane.Y = y;
+        plane.Width = width;
+        plane.Height = height;
+        plane.Color.assign(size_t(width) * height, 0);
+        plane.Alpha.assign(size_t(width) * height, 0);
+    }
+
+    void blendRowScalar(uint8_t* dst, const uint8_t* color, const uint8_t* alpha, uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (alpha[i])
+                dst[i] = uint8_t(std::min<uint32_t>(255, color[i] + divide255(dst[i] * (255u - alpha[i]))));
+        }
+    }
+
+#ifdef MMCODING_X86
+    // Both vector kernels widen to 16 bit lanes, where dst * (255 - alpha) fits,
+    // and divide by 255 the same way as divide255().
+
+    MMCODING_TARGET("sse2")
+    __m128i blendHalfSSE2(__m128i dst, __m128i inverse)
+    {
+        const __m128i rounding = _mm_set1_epi16(128);
+        __m128i v = _mm_add_epi16(_mm_mullo_epi16(dst, inverse), rounding);
+        return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+    }
+
+    MMCODING_TARGET("sse2")
+    void blendRowSSE2(uint8_t* dst, const uint8_t* color, const uint8_t* alpha, uint32_t count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi8(-1);
+        uint32_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            const __m128i inverse = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(alpha + i)), ones);
+            const __m128i lo = blendHalfSSE2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(inverse, zero));
+            const __m128i hi = blendHalfSSE2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(inverse, zero));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(color + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), c));
+        }
+        blendRowScalar(dst + i, color + i, alpha + i, count - i);
+    }
+
+    MMCODING_TARGET("avx2")
+    __m256i blendHalfAVX2(__m256i dst, __m256i inverse)
+    {
+        const __m256i rounding = _mm256_set1_epi16(128);
+        __m256i v = _mm256_add_epi16(_mm256_mullo_epi16(dst, inverse), rounding);
+        return _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), 8);
+    }
+
+    MMCODING_TARGET("avx2")
+    void blendRowAVX2(uint8_t* dst, const uint8_t* color, const uint8_t* alpha, uint32_t count)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i ones = _mm256_set1_epi8(-1);
+        uint32_t i = 0;
+        for (; i + 32 <= count; i += 32)
+        {
+            // Unpacking and packing both work within 128 bit lanes, so the pixel order is kept.
+            const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            const __m256i inverse = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(alpha + i)), ones);
+            const __m256i lo = blendHalfAVX2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(inverse, zero));
+            const __m256i hi = blendHalfAVX2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(inverse, zero));
+            const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(color + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), c));
+        }
+        blendRowSSE2(dst + i, color + i, alpha + i, count - i);
+    }
+#endif // MMCODING_X86
+
+    FBlendRow selectBlendKernel()
+    {
+        if (auto kernel = NMMSS::NOverlay::GetBlendKernel(EBK_AVX2))
+            return kernel;
+        if (auto kernel = NMMSS::NOverlay::GetBlendKernel(EBK_SSE2))
+            return kernel;
+        return blendRowScalar;
+    }
+}
+
+namespace NMMSS
+{
+    namespace NOverlay
+    {
+        SYuvOverlay MakeYuvOverlay(const uint8_t* rgba, uint32_t pitch, int x, int y, uint32_t width, uint32_t height,
+            uint8_t opacity, const SFrameLayout& layout)
+        {
+            SYuvOverlay overlay;
+
+            const int64_t x0 = std::max<int64_t>(x, 0);
+            const int64_t y0 = std::max<int64_t>(y, 0);
+            const int64_t x1 = std::min<int64_t>(int64_t(x) + width, layout.Width);
+            const int64_t y1 = std::min<int64_t>(int64_t(y) + height, layout.Height);
+            if (x0 >= x1 || y0 >= y1)
+            {
+                resetPlane(overlay.Luma, 0, 0, 0, 0);
+                resetPlane(overlay.U, 0, 0, 0, 0);
+                resetPlane(overlay.V, 0, 0, 0, 0);
+                return overlay;
+            }
+
+            auto pixel = [&](int64_t fx, int64_t fy)
+            {
+                return rgba + (fy - y) * pitch + (fx - x) * 4;
+            };
+            auto alphaOf = [opacity](const uint8_t* p)
+            {
+                return (uint32_t(p[3]) * opacity + 127) / 255;
+            };
+
+            SOverlayPlane& luma = overlay.Luma;
+            resetPlane(luma, uint32_t(x0), uint32_t(y0), uint32_t(x1 - x0), uint32_t(y1 - y0));
+            for (int64_t fy = y0; fy < y1; ++fy)
+            {
+                for (int64_t fx = x0; fx < x1; ++fx)
+                {
+                    const uint8_t* p = pixel(fx, fy);
+                    const uint32_t a = alphaOf(p);
+                    const size_t i = size_t(fy - y0) * luma.Width + size_t(fx - x0);
+                    luma.Alpha[i] = uint8_t(a);
+                    luma.Color[i] = uint8_t((rgbToY(p[0], p[1], p[2]) * a + 127) / 255);
+                }
+            }
+
+            if (!layout.HasChroma)
+            {
+                resetPlane(overlay.U, 0, 0, 0, 0);
+                resetPlane(overlay.V, 0, 0, 0, 0);
+                return overlay;
+            }
+
+            const uint32_t sx = layout.ChromaShiftX;
+            const uint32_t sy = layout.ChromaShiftY;
+            const int64_t cx0 = x0 >> sx;
+            const int64_t cy0 = y0 >> sy;
+            const int64_t cx1 = ((x1 - 1) >> sx) + 1;
+            const int64_t cy1 = ((y1 - 1) >> sy) + 1;
+            resetPlane(overlay.U, uint32_t(cx0), uint32_t(cy0), uint32_t(cx1 - cx0), uint32_t(cy1 - cy0));
+            resetPlane(overlay.V, uint32_t(cx0), uint32_t(cy0), uint32_t(cx1 - cx0), uint32_t(cy1 - cy0));
+
+            const uint32_t blockSize = 1u << (sx + sy);
+            for (int64_t cy = cy0; cy < cy1; ++cy)
+            {
+                for (int64_t cx = cx0; cx < cx1; ++cx)
+                {
+                    uint32_t sumA = 0, sumU = 0, sumV = 0;
+                    for (int64_t fy = std::max(cy << sy, y0); fy < std::min((cy + 1) << sy, y1); ++fy)
+                    {
+                        for (int64_t fx = std::max(cx << sx, x0); fx < std::min((cx + 1) << sx, x1); ++fx)
+                        {
+                            const uint8_t* p = pixel(fx, fy);
+                            const uint32_t a = alphaOf(p);
+                            sumA += a;
+                            sumU += rgbToU(p[0], p[1], p[2]) * a;
+                            sumV += rgbToV(p[0], p[1], p[2]) * a;
+                        }
+                    }
+
+                    const size_t i = size_t(cy - cy0) * overlay.U.Width + size_t(cx - cx0);
+                    const uint32_t full = blockSize * 255;
+                    overlay.U.Alpha[i] = overlay.V.Alpha[i] = uint8_t((sumA + blockSize / 2) / blockSize);
+                    overlay.U.Color[i] = uint8_t((sumU + full / 2) / full);
+                    overlay.V.Color[i] = uint8_t((sumV + full / 2) / full);
+                }
+            }
+            return overlay;
+        }
+
+        FBlendRow GetBlendKernel(EBlendKernel kernel)
+        {
+            switch (kernel)
+            {
+            case EBK_SCALAR:
+                return blendRowScalar;
+#ifdef MMCODING_X86
+            case EBK_SSE2:
+                return IsSSE2Supported() ? blendRowSSE2 : nullptr;
+            case EBK_AVX2:
+                return IsAVX2Supported() ? blendRowAVX2 : nullptr;
+#endif
+            default:
+                return nullptr;
+            }
+        }
+
+        void BlendPlane(const SOverlayPlane& overlay, uint8_t* data, uint32_t pitch)
+        {
+            static const FBlendRow kernel = selectBlendKernel();
+            for (uint32_t row = 0; row < overlay.Height; ++row)
+            {
+                const size_t offset = size_t(row) * overlay.Width;
+                kernel(data + size_t(overlay.Y + row) * pitch + overlay.X, &overlay.Color[offset], &overlay.Alpha[offset], overlay.Width);
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef YUV_OVERLAY_HEADER
+#define YUV_OVERLAY_HEADER
+
+#include <cstdint>
+#include <vector>
+#include "MMCodingExports.h"
+
+namespace NMMSS
+{
+    namespace NOverlay
+    {
+        // Overlay pixels of one plane at their place in the frame, premultiplied
+        // by their alpha: blending is then one multiply per frame pixel.
+        struct SOverlayPlane
+        {
+            uint32_t X;
+            uint32_t Y;
+            uint32_t Width;
+            uint32_t Height;
+            std::vector<uint8_t> Color;
+            std::vector<uint8_t> Alpha;
+        };
+
+        struct SYuvOverlay
+        {
+            SOverlayPlane Luma;
+            // Empty for single plane formats.
+            SOverlayPlane U;
+            SOverlayPlane V;
+        };
+
+        struct SFrameLayout
+        {
+            uint32_t Width;
+            uint32_t Height;
+            bool HasChroma;
+            // log2 of the chroma subsampling.
+            uint32_t ChromaShiftX;
+            uint32_t ChromaShiftY;
+        };
+
+        // Converts an RGBA image (straight alpha, R first in memory) placed with its
+        // top left corner at (x, y) into the planes of the layout, clipped to the frame.
+        // Chroma is averaged over each subsampled block, weighted by alpha; blocks
+        // the image covers partly are blended partly.
+        MMCODING_CLASS_DECLSPEC SYuvOverlay MakeYuvOverlay(const uint8_t* rgba, uint32_t pitch, int x, int y, uint32_t width, uint32_t height,
+            uint8_t opacity, const SFrameLayout& layout);
+
+        // dst = color + dst * (255 - alpha) / 255 for count pixels.
+        typedef void (*FBlendRow)(uint8_t* dst, const uint8_t* color, const uint8_t* alpha, uint32_t count);
+
+        enum EBlendKernel
+        {
+            EBK_SCALAR,
+            EBK_SSE2,
+            EBK_AVX2
+        };
+
+        // Particular implementation, nullptr if it is not supported by this CPU or build.
+        // All of them give the same result.
+        MMCODING_CLASS_DECLSPEC FBlendRow GetBlendKernel(EBlendKernel kernel);
+
+        // Blends the plane into a frame plane with the best supported kernel.
+        MMCODING_CLASS_DECLSPEC void BlendPlane(const SOverlayPlane& overlay, uint8_t* data, uint32_t pitch);
+    }
+}
+
+#endif //YUV_OVERLAY_HEADER
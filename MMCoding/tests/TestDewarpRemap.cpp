@@ -0,0 +1,307 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../DewarpRemap.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace NMMSS::NDewarp;
+
+namespace
+{
+    struct SKernel
+    {
+        const char* Name;
+        FRemapRows Remap;
+    };
+
+    std::vector<SKernel> supportedKernels()
+    {
+        const SKernel all[] =
+        {
+            { "scalar", GetRemapKernel(ERK_SCALAR) },
+            { "avx2", GetRemapKernel(ERK_AVX2) },
+            { "dispatched", RemapRows }
+        };
+        std::vector<SKernel> result;
+        for (const auto& k : all)
+        {
+            if (k.Remap)
+                result.push_back(k);
+        }
+        return result;
+    }
+
+    SRemapKey makeKey(uint32_t destWidth, uint32_t destHeight, uint32_t srcWidth, uint32_t srcHeight, float view)
+    {
+        SRemapKey key;
+        key.View = { view };
+        key.DestWidth = destWidth;
+        key.DestHeight = destHeight;
+        key.SrcWidth = srcWidth;
+        key.SrcHeight = srcHeight;
+        key.UVXFactor = 2;
+        key.UVYFactor = 2;
+        return key;
+    }
+
+    // A circle of the source around its centre, shown as a ring the way the perimeter view does.
+    FMapPoint fisheyeMap(const SRemapKey& key)
+    {
+        return [key](uint32_t x, uint32_t y, float& srcX, float& srcY)
+        {
+            const float radius = 0.5f * std::min(key.SrcWidth, key.SrcHeight);
+            const float theta = 6.2831853f * x / key.DestWidth;
+            const float r = (1.2f - float(y) / key.DestHeight) * radius;
+            srcX = 0.5f * key.SrcWidth + r * std::cos(theta);
+            srcY = 0.5f * key.SrcHeight + r * std::sin(theta);
+            return r <= radius;
+        };
+    }
+
+    std::vector<uint8_t> randomImage(uint32_t pitch, uint32_t height, uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> image(size_t(pitch) * height);
+        for (auto& b : image)
+            b = uint8_t(random());
+        return image;
+    }
+
+    // The per pixel lookup the transformer used before: nearest source pixel of
+    // each destination pixel, its chroma taken from the same source position.
+    struct SNearestHooks
+    {
+        SNearestHooks(const SRemapKey& key, const FMapPoint& map)
+            : Key(key)
+            , Hooks(size_t(key.DestWidth) * key.DestHeight)
+        {
+            for (uint32_t y = 0; y < key.DestHeight; ++y)
+            {
+                for (uint32_t x = 0; x < key.DestWidth; ++x)
+                {
+                    float srcX, srcY;
+                    const bool valid = map(x, y, srcX, srcY);
+                    const int ix = int(srcX), iy = int(srcY);
+                    Hooks[size_t(y) * key.DestWidth + x] = valid && ix >= 0 && ix < int(key.SrcWidth) && iy >= 0 && iy < int(key.SrcHeight)
+                        ? std::make_pair(uint32_t(ix), uint32_t(iy))
+                        : std::make_pair(UINT32_MAX, UINT32_MAX);
+                }
+            }
+        }
+
+        void Remap(const SPlane& y, const SPlane& u, const SPlane& v) const
+        {
+            for (uint32_t row = 0; row < Key.DestHeight; ++row)
+            {
+                for (uint32_t x = 0; x < Key.DestWidth; ++x)
+                {
+                    const auto& hook = Hooks[size_t(row) * Key.DestWidth + x];
+                    if (hook.first >= Key.SrcWidth || hook.second >= Key.SrcHeight)
+                        continue;
+                    y.Dst[row * y.DstPitch + x] = y.Src[hook.second * y.SrcPitch + hook.first];
+                    const uint32_t srcUV = (hook.second / Key.UVYFactor) * u.SrcPitch + hook.first / Key.UVXFactor;
+                    const uint32_t dstUV = (row / Key.UVYFactor) * u.DstPitch + x / Key.UVXFactor;
+                    u.Dst[dstUV] = u.Src[srcUV];
+                    v.Dst[dstUV] = v.Src[srcUV];
+                }
+            }
+        }
+
+        const SRemapKey Key;
+        std::vector<std::pair<uint32_t, uint32_t>> Hooks;
+    };
+
+    struct SFrames
+    {
+        SFrames(const SRemapKey& key)
+            : SrcY(randomImage(key.SrcWidth, key.SrcHeight, 1))
+            , SrcU(randomImage(key.SrcWidth / 2, key.SrcHeight / 2, 2))
+            , SrcV(randomImage(key.SrcWidth / 2, key.SrcHeight / 2, 3))
+            , DstY(size_t(key.DestWidth) * key.DestHeight)
+            , DstU(size_t(key.DestWidth / 2) * key.DestHeight / 2)
+            , DstV(DstU.size())
+            , Y{ SrcY.data(), key.SrcWidth, DstY.data(), key.DestWidth }
+            , U{ SrcU.data(), key.SrcWidth / 2, DstU.data(), key.DestWidth / 2 }
+            , V{ SrcV.data(), key.SrcWidth / 2, DstV.data(), key.DestWidth / 2 }
+        {
+        }
+
+        std::vector<uint8_t> SrcY, SrcU, SrcV, DstY, DstU, DstV;
+        SPlane Y, U, V;
+    };
+
+    template <typename F>
+    double millisecondsPerFrame(int frames, F remap)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i)
+            remap();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(DewarpKernelsMatchScalar)
+{
+    // Odd sizes and a map leaving the image on every side cover all group kinds.
+    const SRemapKey key = makeKey(203, 61, 97, 83, 0.0f);
+    const PRemapTable table = BuildRemapTable(key, [](uint32_t x, uint32_t y, float& srcX, float& srcY)
+    {
+        srcX = -3.0f + x * 0.53f + std::sin(y * 0.3f) * 4.0f;
+        srcY = -2.0f + y * 1.47f + (x % 7) * 0.11f;
+        return 0 != (x + y) % 29;
+    });
+
+    const uint32_t srcPitch = key.SrcWidth + 3;
+    const std::vector<uint8_t> src = randomImage(srcPitch, key.SrcHeight, 7);
+    const uint32_t dstPitch = key.DestWidth + 5;
+
+    std::vector<uint8_t> expected(size_t(dstPitch) * key.DestHeight, 0x5A);
+    SPlane plane = { src.data(), srcPitch, expected.data(), dstPitch };
+    GetRemapKernel(ERK_SCALAR)(table->Luma, plane, 0, key.DestHeight);
+
+    for (const auto& k : supportedKernels())
+    {
+        BOOST_TEST_MESSAGE("Dewarp kernel available: " << k.Name);
+        std::vector<uint8_t> actual(expected.size(), 0x5A);
+        plane.Dst = actual.data();
+        // In two parts, as the transformer splits frames.
+        k.Remap(table->Luma, plane, 0, 17);
+        k.Remap(table->Luma, plane, 17, key.DestHeight);
+        BOOST_CHECK_MESSAGE(expected == actual, k.Name);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(DewarpInterpolatesBilinearly)
+{
+    const uint32_t width = 64, height = 16;
+    std::vector<uint8_t> src(width * height);
+    for (uint32_t y = 0; y < height; ++y)
+        for (uint32_t x = 0; x < width; ++x)
+            src[y * width + x] = uint8_t(3 * x + 5 * y);
+
+    SRemapKey key = makeKey(48, 8, width, height, 0.0f);
+    key.UVXFactor = key.UVYFactor = 0;
+    const PRemapTable table = BuildRemapTable(key, [](uint32_t x, uint32_t y, float& srcX, float& srcY)
+    {
+        srcX = 2.0f + x * 1.13f;
+        srcY = 1.5f + y * 1.37f;
+        return true;
+    });
+    BOOST_CHECK_EQUAL(table->Chroma.Width, 0u);
+
+    std::vector<uint8_t> dst(key.DestWidth * key.DestHeight);
+    for (const auto& k : supportedKernels())
+    {
+        const SPlane plane = { src.data(), width, dst.data(), key.DestWidth };
+        k.Remap(table->Luma, plane, 0, key.DestHeight);
+        for (uint32_t y = 0; y < key.DestHeight; ++y)
+        {
+            for (uint32_t x = 0; x < key.DestWidth; ++x)
+            {
+                // The source is linear, so is its interpolation between pixel centres.
+                const float expected = 3.0f * (2.0f + x * 1.13f - 0.5f) + 5.0f * (1.5f + y * 1.37f - 0.5f);
+                BOOST_CHECK_LE(std::abs(dst[y * key.DestWidth + x] - expected), 1.0f);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(DewarpChromaFollowsLuma)
+{
+    const SRemapKey key = makeKey(64, 32, 80, 60, 0.0f);
+    const PRemapTable table = BuildRemapTable(key, fisheyeMap(key));
+    const SPlaneMap& chroma = table->Chroma;
+    BOOST_REQUIRE_EQUAL(chroma.Width, 32u);
+    BOOST_REQUIRE_EQUAL(chroma.Height, 16u);
+    BOOST_CHECK_EQUAL(chroma.SrcWidth, 40u);
+    BOOST_CHECK_EQUAL(chroma.SrcHeight, 30u);
+
+    for (uint32_t y = 0; y < chroma.Height; ++y)
+    {
+        for (uint32_t x = 0; x < chroma.Width; ++x)
+        {
+            const uint32_t lumaTap = table->Luma.Taps[(2 * y) * table->Luma.Width + 2 * x];
+            const uint32_t chromaTap = chroma.Taps[y * chroma.Width + x];
+            BOOST_CHECK_EQUAL(INVALID_TAP == lumaTap, INVALID_TAP == chromaTap);
+            if (INVALID_TAP == chromaTap)
+                continue;
+            BOOST_CHECK_LE(std::abs(int(chromaTap & 0xFFFF) - int(lumaTap & 0xFFFF) / 2), 1);
+            BOOST_CHECK_LE(std::abs(int(chromaTap >> 16) - int(lumaTap >> 16) / 2), 1);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(DewarpTablesAreShared)
+{
+    const SRemapKey key = makeKey(32, 16, 64, 48, 12345.0f);
+    const SRemapCacheStatistics before = GetRemapCacheStatistics();
+
+    PRemapTable first = GetRemapTable(key, fisheyeMap(key));
+    PRemapTable second = GetRemapTable(key, fisheyeMap(key));
+    BOOST_CHECK(first == second);
+
+    SRemapKey other = key;
+    other.View[0] = 54321.0f;
+    PRemapTable third = GetRemapTable(other, fisheyeMap(other));
+    BOOST_CHECK(first != third);
+
+    SRemapCacheStatistics after = GetRemapCacheStatistics();
+    BOOST_CHECK_EQUAL(after.Builds - before.Builds, 2u);
+    BOOST_CHECK_EQUAL(after.Hits - before.Hits, 1u);
+
+    // Nobody uses the table any more: it is built again.
+    first.reset();
+    second.reset();
+    PRemapTable fourth = GetRemapTable(key, fisheyeMap(key));
+    BOOST_CHECK_EQUAL(GetRemapCacheStatistics().Builds - before.Builds, 3u);
+}
+
+BOOST_AUTO_TEST_CASE(DewarpBenchmark)
+{
+    const SRemapKey key = makeKey(1920, 1080, 2560, 1920, 0.0f);
+    const FMapPoint map = fisheyeMap(key);
+    const PRemapTable table = BuildRemapTable(key, map);
+    const SNearestHooks hooks(key, map);
+    SFrames frames(key);
+    const int FRAMES = 10;
+
+    const double nearest = millisecondsPerFrame(FRAMES, [&]() { hooks.Remap(frames.Y, frames.U, frames.V); });
+    BOOST_TEST_MESSAGE("Dewarp 1920x1080 I420, nearest per pixel hooks: " << nearest << " ms/frame");
+
+    for (const auto& k : supportedKernels())
+    {
+        const double ms = millisecondsPerFrame(FRAMES, [&]()
+        {
+            k.Remap(table->Luma, frames.Y, 0, table->Luma.Height);
+            k.Remap(table->Chroma, frames.U, 0, table->Chroma.Height);
+            k.Remap(table->Chroma, frames.V, 0, table->Chroma.Height);
+        });
+        BOOST_TEST_MESSAGE("Dewarp 1920x1080 I420, bilinear " << k.Name << ": " << ms << " ms/frame");
+    }
+
+    const uint32_t STRIPES = 4;
+    const double threaded = millisecondsPerFrame(FRAMES, [&]()
+    {
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < STRIPES; ++i)
+        {
+            threads.emplace_back([&, i]()
+            {
+                RemapRows(table->Luma, frames.Y, table->Luma.Height * i / STRIPES, table->Luma.Height * (i + 1) / STRIPES);
+                RemapRows(table->Chroma, frames.U, table->Chroma.Height * i / STRIPES, table->Chroma.Height * (i + 1) / STRIPES);
+                RemapRows(table->Chroma, frames.V, table->Chroma.Height * i / STRIPES, table->Chroma.Height * (i + 1) / STRIPES);
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+    });
+    BOOST_TEST_MESSAGE("Dewarp 1920x1080 I420, bilinear dispatched in " << STRIPES << " stripes: " << threaded << " ms/frame");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
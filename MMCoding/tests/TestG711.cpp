@@ -0,0 +1,262 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../G711.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+using namespace NMMSS::NG711;
+
+namespace
+{
+    typedef void (*FDecode)(const uint8_t*, int16_t*, size_t);
+    typedef void (*FEncode)(const int16_t*, uint8_t*, size_t);
+
+    std::vector<int16_t> decodeAll(FDecode decode)
+    {
+        std::vector<uint8_t> codes(256);
+        for (int i = 0; i < 256; ++i)
+            codes[i] = uint8_t(i);
+        std::vector<int16_t> values(256);
+        decode(codes.data(), values.data(), codes.size());
+        return values;
+    }
+
+    void checkNearest(FDecode decode, FEncode encode)
+    {
+        const std::vector<int16_t> values = decodeAll(decode);
+
+        std::vector<int16_t> samples;
+        for (int v = -32768; v <= 32767; ++v)
+            samples.push_back(int16_t(v));
+        std::vector<uint8_t> codes(samples.size());
+        encode(samples.data(), codes.data(), samples.size());
+
+        size_t farOff = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            int best = 65536;
+            for (int16_t value : values)
+                best = std::min(best, std::abs(value - samples[i]));
+            // Samples are looked up by their upper 14 bits, which rounds
+            // positive and negative ones in opposite directions.
+            const int error = std::abs(values[codes[i]] - samples[i]);
+            if (error > best + 8)
+                ++farOff;
+        }
+        BOOST_CHECK_EQUAL(farOff, 0u);
+    }
+
+    // The segment search of the reference G.711 code, sample by sample.
+    uint8_t referenceULaw(int16_t sample)
+    {
+        int v = sample >> 2;
+        uint8_t mask = 0xff;
+        if (v < 0)
+        {
+            v = -v;
+            mask = 0x7f;
+        }
+        v = std::min(v, 8159) + (0x84 >> 2);
+        int seg = 0;
+        for (int end = 0x3f; seg < 8 && v > end; end = (end << 1) | 1)
+            ++seg;
+        return uint8_t(((seg << 4) | ((v >> (seg + 1)) & 0x0f)) ^ mask);
+    }
+
+    // build_xlaw_table of libavcodec/pcm_tablegen.h as it is written there,
+    // kept apart from G711.cpp so that a change to the tables shows up here.
+    int libavAlaw2linear(unsigned char a_val)
+    {
+        int t, seg;
+        a_val ^= 0x55;
+        t = a_val & 0xf;
+        seg = ((unsigned)a_val & 0x70) >> 4;
+        if (seg) t = (t + t + 1 + 32) << (seg + 2);
+        else     t = (t + t + 1) << 3;
+        return (a_val & 0x80) ? t : -t;
+    }
+
+    int libavUlaw2linear(unsigned char u_val)
+    {
+        int t;
+        u_val = ~u_val;
+        t = ((u_val & 0xf) << 3) + 0x84;
+        t <<= ((unsigned)u_val & 0x70) >> 4;
+        return (u_val & 0x80) ? (0x84 - t) : (t - 0x84);
+    }
+
+    std::vector<uint8_t> libavBuildXlawTable(int (*xlaw2linear)(unsigned char), int mask)
+    {
+        std::vector<uint8_t> linear_to_xlaw(16384);
+        int i, j, v, v1, v2;
+
+        j = 1;
+        linear_to_xlaw[8192] = mask;
+        for (i = 0; i < 127; i++) {
+            v1 = xlaw2linear(i ^ mask);
+            v2 = xlaw2linear((i + 1) ^ mask);
+            v = (v1 + v2 + 4) >> 3;
+            for (; j < v; j += 1) {
+                linear_to_xlaw[8192 - j] = (i ^ (mask ^ 0x80));
+                linear_to_xlaw[8192 + j] = (i ^ mask);
+            }
+        }
+        for (; j < 8192; j++) {
+            linear_to_xlaw[8192 - j] = (127 ^ (mask ^ 0x80));
+            linear_to_xlaw[8192 + j] = (127 ^ mask);
+        }
+        linear_to_xlaw[0] = linear_to_xlaw[1];
+        return linear_to_xlaw;
+    }
+
+    struct SEncoded
+    {
+        explicit SEncoded(FEncode encode)
+            : Codes(65536)
+        {
+            for (int v = -32768; v <= 32767; ++v)
+                Samples.push_back(int16_t(v));
+            encode(Samples.data(), Codes.data(), Samples.size());
+        }
+
+        uint8_t Code(int sample) const
+        {
+            return Codes[sample + 32768];
+        }
+
+        // FNV-1a of the codes of all samples in ascending order.
+        uint32_t Checksum() const
+        {
+            uint32_t hash = 2166136261u;
+            for (uint8_t c : Codes)
+                hash = (hash ^ c) * 16777619u;
+            return hash;
+        }
+
+        std::vector<int16_t> Samples;
+        std::vector<uint8_t> Codes;
+    };
+
+    void checkLibav(FEncode encode, int (*xlaw2linear)(unsigned char), int mask)
+    {
+        const SEncoded encoded(encode);
+        const std::vector<uint8_t> table = libavBuildXlawTable(xlaw2linear, mask);
+
+        size_t differing = 0;
+        for (size_t i = 0; i < encoded.Samples.size(); ++i)
+            differing += table[(encoded.Samples[i] + 32768) >> 2] != encoded.Codes[i];
+        BOOST_CHECK_EQUAL(differing, 0u);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(G711DecodesKnownCodes)
+{
+    const std::vector<int16_t> ulaw = decodeAll(DecodeULaw);
+    BOOST_CHECK_EQUAL(ulaw[0x00], -32124);
+    BOOST_CHECK_EQUAL(ulaw[0x80], 32124);
+    BOOST_CHECK_EQUAL(ulaw[0x7f], 0);
+    BOOST_CHECK_EQUAL(ulaw[0xff], 0);
+
+    const std::vector<int16_t> alaw = decodeAll(DecodeALaw);
+    BOOST_CHECK_EQUAL(alaw[0x2a], -32256);
+    BOOST_CHECK_EQUAL(alaw[0xaa], 32256);
+    BOOST_CHECK_EQUAL(alaw[0x55], -8);
+    BOOST_CHECK_EQUAL(alaw[0xd5], 8);
+}
+
+BOOST_AUTO_TEST_CASE(G711RoundTripsEveryCode)
+{
+    std::vector<uint8_t> codes(256);
+    for (int i = 0; i < 256; ++i)
+        codes[i] = uint8_t(i);
+
+    std::vector<int16_t> values(codes.size());
+    std::vector<uint8_t> coded(codes.size());
+
+    DecodeALaw(codes.data(), values.data(), codes.size());
+    EncodeALaw(values.data(), coded.data(), codes.size());
+    BOOST_CHECK(codes == coded);
+
+    DecodeULaw(codes.data(), values.data(), codes.size());
+    EncodeULaw(values.data(), coded.data(), codes.size());
+    // Both zeros of mu-law are coded as the positive one.
+    codes[0x7f] = 0xff;
+    BOOST_CHECK(codes == coded);
+}
+
+BOOST_AUTO_TEST_CASE(G711EncodesToNearestLevel)
+{
+    checkNearest(DecodeALaw, EncodeALaw);
+    checkNearest(DecodeULaw, EncodeULaw);
+}
+
+BOOST_AUTO_TEST_CASE(G711EncodesAsLibavcodec)
+{
+    checkLibav(EncodeALaw, libavAlaw2linear, 0xd5);
+    checkLibav(EncodeULaw, libavUlaw2linear, 0xff);
+
+    // Pinned from pcm_alaw and pcm_mulaw, should both sides change alike.
+    const SEncoded alaw(EncodeALaw);
+    BOOST_CHECK_EQUAL(alaw.Checksum(), 0x163c1cf1u);
+    BOOST_CHECK_EQUAL(alaw.Code(-32768), 0x2a);
+    BOOST_CHECK_EQUAL(alaw.Code(-1000), 0x7a);
+    BOOST_CHECK_EQUAL(alaw.Code(-1), 0x55);
+    BOOST_CHECK_EQUAL(alaw.Code(0), 0xd5);
+    BOOST_CHECK_EQUAL(alaw.Code(4096), 0x9a);
+    BOOST_CHECK_EQUAL(alaw.Code(32767), 0xaa);
+
+    const SEncoded ulaw(EncodeULaw);
+    BOOST_CHECK_EQUAL(ulaw.Checksum(), 0x36ff2c91u);
+    BOOST_CHECK_EQUAL(ulaw.Code(-32768), 0x00);
+    BOOST_CHECK_EQUAL(ulaw.Code(-1000), 0x4e);
+    BOOST_CHECK_EQUAL(ulaw.Code(-1), 0x7e);
+    BOOST_CHECK_EQUAL(ulaw.Code(3), 0xff);
+    BOOST_CHECK_EQUAL(ulaw.Code(4), 0xfe);
+    BOOST_CHECK_EQUAL(ulaw.Code(4096), 0xaf);
+    BOOST_CHECK_EQUAL(ulaw.Code(32767), 0x80);
+}
+
+BOOST_AUTO_TEST_CASE(G711Benchmark)
+{
+    // A minute of 8 kHz audio.
+    const size_t COUNT = 8000 * 60;
+    std::mt19937 random(7);
+    std::normal_distribution<float> speech(0.0f, 3000.0f);
+    std::vector<int16_t> samples(COUNT);
+    for (auto& s : samples)
+        s = int16_t(std::max(-32768.0f, std::min(32767.0f, speech(random))));
+    std::vector<uint8_t> codes(COUNT), reference(COUNT);
+    std::vector<int16_t> decoded(COUNT);
+
+    auto measure = [](const std::function<void()>& f)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    const double segments = measure([&] {
+        for (size_t i = 0; i < COUNT; ++i)
+            reference[i] = referenceULaw(samples[i]);
+    });
+    const double encoding = measure([&] { EncodeULaw(samples.data(), codes.data(), COUNT); });
+    const double decoding = measure([&] { DecodeULaw(codes.data(), decoded.data(), COUNT); });
+
+    size_t differing = 0;
+    for (size_t i = 0; i < COUNT; ++i)
+        differing += reference[i] != codes[i];
+    // Rounding and truncation part ways only near the level boundaries.
+    BOOST_CHECK_LT(differing, COUNT / 2);
+
+    BOOST_TEST_MESSAGE("G.711 mu-law, a minute at 8 kHz: segment search " << segments << " ms, table encoding "
+        << encoding << " ms, table decoding " << decoding << " ms");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
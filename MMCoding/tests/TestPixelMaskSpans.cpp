@@ -0,0 +1,139 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../PixelMaskSpans.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+    struct SFrame
+    {
+        SFrame(uint32_t width, uint32_t height, uint32_t uvXFactor, uint32_t uvYFactor)
+            : Width(width)
+            , Height(height)
+            , UVXFactor(uvXFactor)
+            , UVYFactor(uvYFactor)
+            , Pitch(width + 7)
+            , ChromaPitch(width / uvXFactor + 3)
+            , Y(Pitch * height)
+            , U(ChromaPitch * (height / uvYFactor))
+            , V(U.size())
+        {
+            std::mt19937 random(width * height);
+            for (auto* plane : { &Y, &U, &V })
+                for (auto& p : *plane)
+                    p = uint8_t(random());
+        }
+
+        uint32_t Width, Height, UVXFactor, UVYFactor, Pitch, ChromaPitch;
+        std::vector<uint8_t> Y, U, V;
+    };
+
+    // The per pixel masking the spans replace.
+    void referenceMask(SFrame& f, const std::vector<unsigned char>& mask, uint32_t maskW, uint32_t maskH, bool invert, uint32_t blurSize)
+    {
+        auto apply = [&](uint32_t x, uint32_t y)
+        {
+            const uint32_t xx = x - x % blurSize;
+            const uint32_t yy = y - y % blurSize;
+            f.Y[f.Pitch * y + x] = f.Y[f.Pitch * yy + xx];
+            f.U[f.ChromaPitch * (y / f.UVYFactor) + x / f.UVXFactor] = f.U[f.ChromaPitch * (yy / f.UVYFactor) + xx / f.UVXFactor];
+            f.V[f.ChromaPitch * (y / f.UVYFactor) + x / f.UVXFactor] = f.V[f.ChromaPitch * (yy / f.UVYFactor) + xx / f.UVXFactor];
+        };
+
+        if (maskW < f.Width)
+        {
+            const float scaleW = float(f.Width) / maskW;
+            const float scaleH = float(f.Height) / maskH;
+            for (uint32_t my = 0; my < maskH; ++my)
+                for (uint32_t mx = 0; mx < maskW; ++mx)
+                    if (!mask[my * maskW + mx] == invert)
+                        for (uint32_t y = uint32_t(scaleH * my); y < uint32_t(scaleH * (my + 1)); ++y)
+                            for (uint32_t x = uint32_t(scaleW * mx); x < uint32_t(scaleW * (mx + 1)); ++x)
+                                apply(x, y);
+        }
+        else
+        {
+            const float scaleW = float(maskW) / f.Width;
+            const float scaleH = float(maskH) / f.Height;
+            for (uint32_t y = 0; y < f.Height; ++y)
+                for (uint32_t x = 0; x < f.Width; ++x)
+                    if (!mask[uint32_t(scaleH * y) * maskW + uint32_t(scaleW * x)] == invert)
+                        apply(x, y);
+        }
+    }
+
+    std::vector<unsigned char> makeMask(uint32_t width, uint32_t height, uint32_t seed)
+    {
+        // Boxes, as the track and shape providers produce them.
+        std::mt19937 random(seed);
+        std::vector<unsigned char> mask(width * height, 0);
+        for (int box = 0; box < 4; ++box)
+        {
+            const uint32_t x0 = random() % width, y0 = random() % height;
+            const uint32_t x1 = std::min<uint32_t>(width, x0 + 1 + random() % (width / 3));
+            const uint32_t y1 = std::min<uint32_t>(height, y0 + 1 + random() % (height / 3));
+            for (uint32_t y = y0; y < y1; ++y)
+                for (uint32_t x = x0; x < x1; ++x)
+                    mask[y * width + x] = 1;
+        }
+        return mask;
+    }
+
+    void checkAgainstReference(uint32_t width, uint32_t height, uint32_t maskW, uint32_t maskH, uint32_t uvYFactor, bool invert)
+    {
+        const uint32_t BLUR_SIZE = 16;
+        const std::vector<unsigned char> mask = makeMask(maskW, maskH, width + maskW);
+
+        SFrame expected(width, height, 2, uvYFactor);
+        referenceMask(expected, mask, maskW, maskH, invert, BLUR_SIZE);
+
+        SFrame actual(width, height, 2, uvYFactor);
+        NMMSS::CPixelMaskSpans spans;
+        spans.Build(mask.data(), maskW, maskH, width, height, invert);
+        spans.Pixelate(actual.Y.data(), actual.Pitch, actual.U.data(), actual.ChromaPitch, actual.V.data(), actual.ChromaPitch,
+            actual.UVXFactor, actual.UVYFactor, BLUR_SIZE);
+
+        BOOST_CHECK(expected.Y == actual.Y);
+        BOOST_CHECK(expected.U == actual.U);
+        BOOST_CHECK(expected.V == actual.V);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(PixelMaskStretchedMatchesPerPixel)
+{
+    checkAgainstReference(640, 360, 240, 180, 2, false);
+    checkAgainstReference(1000, 562, 240, 180, 1, false);
+    checkAgainstReference(640, 360, 240, 180, 2, true);
+}
+
+BOOST_AUTO_TEST_CASE(PixelMaskSampledMatchesPerPixel)
+{
+    checkAgainstReference(176, 144, 240, 180, 2, false);
+    checkAgainstReference(240, 180, 240, 180, 1, true);
+}
+
+BOOST_AUTO_TEST_CASE(PixelMaskTouchesMaskedLinesOnly)
+{
+    const uint32_t MASK_W = 240, MASK_H = 180;
+    std::vector<unsigned char> mask(MASK_W * MASK_H, 0);
+    // One cell row of a 1920x1080 frame is six lines.
+    for (uint32_t x = 10; x < 20; ++x)
+        mask[50 * MASK_W + x] = 1;
+
+    NMMSS::CPixelMaskSpans spans;
+    spans.Build(mask.data(), MASK_W, MASK_H, 1920, 1080, false);
+    BOOST_CHECK(!spans.Empty());
+    BOOST_CHECK_EQUAL(spans.MaskedLines(), 6u);
+
+    std::fill(mask.begin(), mask.end(), 0);
+    spans.Build(mask.data(), MASK_W, MASK_H, 1920, 1080, false);
+    BOOST_CHECK(spans.Empty());
+    BOOST_CHECK_EQUAL(spans.MaskedLines(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,503 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../Transforms.h"
+#include "../../ConnectionBroker.h"
+#include "../../MediaType.h"
+#include "ConnectionResource.h"
+
+#include <Logging/log2.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+extern "C"
+{
+#include <libswscale/swscale.h>
+}
+
+using namespace NMMSS::NMediaType;
+
+namespace
+{
+    enum EFormat
+    {
+        EF_I420,
+        EF_Y42B,
+        EF_GREY
+    };
+
+    struct SFormat
+    {
+        const char* Name;
+        EFormat Format;
+    };
+
+    const SFormat FORMATS[] =
+    {
+        { "I420", EF_I420 },
+        { "Y42B", EF_Y42B },
+        { "GREY", EF_GREY }
+    };
+
+    const uint8_t CHROMA_LEVEL = 128;
+
+    // Plane geometry of a frame, pitches aligned to 16 bytes.
+    struct SPlanes
+    {
+        SPlanes(EFormat format, int width, int height)
+        {
+            const int chromaWidth = (EF_GREY == format) ? 0 : width / 2;
+            const int chromaHeight = (EF_I420 == format) ? height / 2 : height;
+
+            const int widths[3] = { width, chromaWidth, chromaWidth };
+            const int heights[3] = { height, chromaHeight, chromaHeight };
+            for (int i = 0; i < 3; ++i)
+            {
+                Width[i] = widths[i];
+                Height[i] = (0 == widths[i]) ? 0 : heights[i];
+                Pitch[i] = (widths[i] + 0xf) & ~0xf;
+                Offset[i] = Size;
+                Size += uint32_t(Pitch[i]) * Height[i];
+            }
+        }
+
+        int Width[3];
+        int Height[3];
+        int Pitch[3];
+        uint32_t Offset[3];
+        uint32_t Size = 0;
+    };
+
+    template <typename TMediaType>
+    void fillPlanarHeader(NMMSS::ISample* sample, const SPlanes& planes)
+    {
+        typename TMediaType::SubtypeHeader* subheader = nullptr;
+        MakeMediaTypeStruct<TMediaType>(sample->GetHeader(), &subheader);
+        subheader->nWidth = planes.Width[0];
+        subheader->nHeight = planes.Height[0];
+        subheader->nOffset = planes.Offset[0];
+        subheader->nPitch = planes.Pitch[0];
+        subheader->nOffsetV = planes.Offset[1];
+        subheader->nPitchV = planes.Pitch[1];
+        subheader->nOffsetU = planes.Offset[2];
+        subheader->nPitchU = planes.Pitch[2];
+    }
+
+    // Luma rises from left to right, V from top to bottom and U stays flat, so the output
+    // tells a scaled picture from a constant one and each plane from the others.
+    NMMSS::PSample makeFrame(EFormat format, int width, int height)
+    {
+        static NMMSS::PAllocatorFactory factory(NMMSS::GetLocalAllocatorFactory());
+        const SPlanes planes(format, width, height);
+        NMMSS::PAllocator allocator(factory->CreateAllocator(NMMSS::SAllocatorRequirements(1, planes.Size, 0), nullptr));
+        NMMSS::PSample sample(allocator->Alloc(planes.Size));
+        BOOST_REQUIRE(!!sample);
+        sample->Header().nBodySize = planes.Size;
+
+        uint8_t* body = sample->GetBody();
+        for (int y = 0; y < planes.Height[0]; ++y)
+        {
+            for (int x = 0; x < planes.Width[0]; ++x)
+                body[planes.Offset[0] + y * planes.Pitch[0] + x] = uint8_t(x * 255 / (width - 1));
+        }
+        for (int y = 0; y < planes.Height[1]; ++y)
+        {
+            for (int x = 0; x < planes.Width[1]; ++x)
+            {
+                body[planes.Offset[1] + y * planes.Pitch[1] + x] = uint8_t(y * 255 / (planes.Height[1] - 1));
+                body[planes.Offset[2] + y * planes.Pitch[2] + x] = CHROMA_LEVEL;
+            }
+        }
+
+        if (EF_I420 == format)
+            fillPlanarHeader<Video::fccI420>(sample.Get(), planes);
+        else if (EF_Y42B == format)
+            fillPlanarHeader<Video::fccY42B>(sample.Get(), planes);
+        else
+        {
+            Video::fccGREY::SubtypeHeader* subheader = nullptr;
+            MakeMediaTypeStruct<Video::fccGREY>(sample->GetHeader(), &subheader);
+            subheader->nWidth = width;
+            subheader->nHeight = height;
+            subheader->nOffset = planes.Offset[0];
+            subheader->nPitch = planes.Pitch[0];
+        }
+        return sample;
+    }
+
+    // The planes of a frame as the filter described them.
+    struct SPicture
+    {
+        explicit SPicture(NMMSS::ISample* sample)
+        {
+            uint8_t* body = sample->GetBody();
+            if (CheckMediaType<Video::fccGREY>(&sample->Header()))
+            {
+                const Video::fccGREY::SubtypeHeader& h = sample->SubHeader<Video::fccGREY>();
+                Width = h.nWidth;
+                Height = h.nHeight;
+                Data[0] = body + h.nOffset;
+                Pitch[0] = h.nPitch;
+            }
+            else if (CheckMediaType<Video::fccI420>(&sample->Header()))
+                read(sample->SubHeader<Video::fccI420>(), body, 2);
+            else if (CheckMediaType<Video::fccY42B>(&sample->Header()))
+                read(sample->SubHeader<Video::fccY42B>(), body, 1);
+        }
+
+        template <typename TSubtypeHeader>
+        void read(const TSubtypeHeader& h, uint8_t* body, int chromaRowStep)
+        {
+            Width = h.nWidth;
+            Height = h.nHeight;
+            ChromaHeight = h.nHeight / chromaRowStep;
+            Data[0] = body + h.nOffset;
+            Data[1] = body + h.nOffsetV;
+            Data[2] = body + h.nOffsetU;
+            Pitch[0] = h.nPitch;
+            Pitch[1] = h.nPitchV;
+            Pitch[2] = h.nPitchU;
+        }
+
+        uint8_t At(int plane, int x, int y) const
+        {
+            return Data[plane][y * Pitch[plane] + x];
+        }
+
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+        uint32_t ChromaHeight = 0;
+        uint8_t* Data[3] = { nullptr, nullptr, nullptr };
+        int Pitch[3] = { 0, 0, 0 };
+    };
+
+    class CFrameSource : public NMMSS::IPullStyleSource, public virtual NCorbaHelpers::CRefcountedImpl
+    {
+    public:
+        NMMSS::SAllocatorRequirements GetAllocatorRequirements() override
+        {
+            return NMMSS::SAllocatorRequirements(0);
+        }
+
+        void OnConnected(TConnection* connection) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sink = NMMSS::PPullStyleSink(connection->GetOtherSide(), NCorbaHelpers::ShareOwnership());
+        }
+
+        void OnDisconnected(TConnection*) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sink.Reset();
+        }
+
+        void Request(unsigned int count) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_requested += count;
+        }
+
+        bool Send(NMMSS::ISample* sample)
+        {
+            NMMSS::PPullStyleSink sink;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_sink || 0 == m_requested)
+                    return false;
+                --m_requested;
+                sink = m_sink;
+            }
+            sink->Receive(sample);
+            return true;
+        }
+
+    private:
+        std::mutex m_mutex;
+        NMMSS::PPullStyleSink m_sink;
+        unsigned int m_requested = 0;
+    };
+
+    class CFrameSink : public NMMSS::IPullStyleSink, public virtual NCorbaHelpers::CRefcountedImpl
+    {
+    public:
+        NMMSS::SAllocatorRequirements GetAllocatorRequirements() override
+        {
+            return NMMSS::SAllocatorRequirements(0);
+        }
+
+        void OnConnected(TConnection* connection) override
+        {
+            NMMSS::PPullStyleSource source(connection->GetOtherSide(), NCorbaHelpers::ShareOwnership());
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_source = source;
+            }
+            source->Request(1);
+        }
+
+        void OnDisconnected(TConnection*) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_source.Reset();
+        }
+
+        void Receive(NMMSS::ISample* sample) override
+        {
+            NMMSS::PPullStyleSource source;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_last = NMMSS::PSample(sample, NCorbaHelpers::ShareOwnership());
+                ++m_received;
+                source = m_source;
+            }
+            if (source)
+                source->Request(1);
+        }
+
+        NMMSS::PSample Last()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_last;
+        }
+
+        size_t Received()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_received;
+        }
+
+    private:
+        std::mutex m_mutex;
+        NMMSS::PPullStyleSource m_source;
+        NMMSS::PSample m_last;
+        size_t m_received = 0;
+    };
+
+    typedef NCorbaHelpers::CAutoPtr<CFrameSource> PFrameSource;
+    typedef NCorbaHelpers::CAutoPtr<CFrameSink> PFrameSink;
+
+    // The size filter between a test source and a test sink.
+    class CScaler : public NLogging::WithLogger
+    {
+    public:
+        CScaler(uint32_t width, uint32_t height, bool crop = false,
+                float cropX = 0.f, float cropY = 0.f, float cropWidth = 1.f, float cropHeight = 1.f)
+            : WithLogger(NLogging::PLogger(NLogging::CreateConsoleLogger(NLogging::LEVEL_ERROR)).Get())
+            , m_source(new CFrameSource())
+            , m_sink(new CFrameSink())
+        {
+            NMMSS::PPullFilter filter(NMMSS::CreateSizeFilter(GET_LOGGER_PTR, width, height, crop, cropX, cropY, cropWidth, cropHeight));
+            m_connections.emplace_back(NMMSS::CConnectionResource(m_source.Get(), filter->GetSink(), GET_LOGGER_PTR));
+            m_connections.emplace_back(NMMSS::CConnectionResource(filter->GetSource(), m_sink.Get(), GET_LOGGER_PTR));
+        }
+
+        NMMSS::PSample Scale(NMMSS::ISample* frame)
+        {
+            const size_t received = m_sink->Received();
+            BOOST_REQUIRE(m_source->Send(frame));
+            BOOST_REQUIRE_EQUAL(m_sink->Received(), received + 1);
+            return m_sink->Last();
+        }
+
+    private:
+        PFrameSource m_source;
+        PFrameSink m_sink;
+        std::vector<NMMSS::CConnectionResource> m_connections;
+    };
+
+    // The luma gradient survives the scaling and the chroma planes stay where they were.
+    void checkPicture(const SPicture& picture, EFormat format, uint8_t left, uint8_t right)
+    {
+        const int middle = int(picture.Height) / 2;
+        const int tolerance = 8;
+        BOOST_CHECK_LE(std::abs(int(picture.At(0, 1, middle)) - left), tolerance);
+        BOOST_CHECK_LE(std::abs(int(picture.At(0, picture.Width - 2, middle)) - right), tolerance);
+        BOOST_CHECK_LT(picture.At(0, 1, middle), picture.At(0, picture.Width - 2, middle));
+
+        if (EF_GREY == format)
+            return;
+
+        const int chromaMiddle = int(picture.Width) / 4;
+        BOOST_CHECK_LE(std::abs(int(picture.At(2, chromaMiddle, int(picture.ChromaHeight) / 2)) - CHROMA_LEVEL), 1);
+        BOOST_CHECK_LT(picture.At(1, chromaMiddle, 1), picture.At(1, chromaMiddle, picture.ChromaHeight - 2));
+    }
+
+    double megapixelsPerSecond(int pixels, int frames, const std::function<void()>& scale)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i)
+            scale();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return double(pixels) * frames / seconds / 1e6;
+    }
+
+    // The former scaling: the downscale step doubled until the frame fits,
+    // a bicubic context created and freed for every frame, 4:2:0 whatever the input.
+    int formerScaledSize(int size, int requested)
+    {
+        int step = 1;
+        while (requested < size / step)
+            step *= 2;
+        return size / step / 2 * 2;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(SizeTransformerFitsRequestedBox)
+{
+    struct SCase
+    {
+        int SourceWidth;
+        int SourceHeight;
+        uint32_t Width;
+        uint32_t Height;
+        uint32_t ExpectedWidth;
+        uint32_t ExpectedHeight;
+    };
+
+    const SCase CASES[] =
+    {
+        { 1920, 1080, 1280, 720, 1280, 720 },
+        // The narrower side decides, the other keeps the aspect ratio.
+        { 1920, 1080, 700, 500, 700, 394 },
+        { 1920, 1080, 1000, 0, 1000, 562 },
+        { 1920, 1080, 0, 270, 480, 270 },
+        // Odd sizes are rounded down to even ones.
+        { 1280, 720, 333, 0, 332, 186 }
+    };
+
+    for (const SFormat& f : FORMATS)
+    {
+        for (const SCase& c : CASES)
+        {
+            BOOST_TEST_CONTEXT(f.Name << " " << c.SourceWidth << "x" << c.SourceHeight << " to " << c.Width << "x" << c.Height)
+            {
+                CScaler scaler(c.Width, c.Height);
+                const NMMSS::PSample frame = makeFrame(f.Format, c.SourceWidth, c.SourceHeight);
+                const NMMSS::PSample scaled = scaler.Scale(frame.Get());
+                BOOST_REQUIRE(!!scaled);
+                BOOST_CHECK(scaled.Get() != frame.Get());
+
+                const SPicture picture(scaled.Get());
+                BOOST_CHECK_EQUAL(picture.Width, c.ExpectedWidth);
+                BOOST_CHECK_EQUAL(picture.Height, c.ExpectedHeight);
+                checkPicture(picture, f.Format, 0, 255);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SizeTransformerDoesNotUpscale)
+{
+    for (const SFormat& f : FORMATS)
+    {
+        BOOST_TEST_CONTEXT(f.Name)
+        {
+            CScaler scaler(1280, 960);
+            const NMMSS::PSample frame = makeFrame(f.Format, 640, 480);
+            const NMMSS::PSample passed = scaler.Scale(frame.Get());
+            BOOST_REQUIRE(!!passed);
+
+            const SPicture picture(passed.Get());
+            BOOST_CHECK_EQUAL(picture.Width, 640u);
+            BOOST_CHECK_EQUAL(picture.Height, 480u);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SizeTransformerCropsScaledFrame)
+{
+    for (const SFormat& f : FORMATS)
+    {
+        BOOST_TEST_CONTEXT(f.Name)
+        {
+            // The window is taken from the frame fitted into 960x540: the right half of the upper middle.
+            CScaler scaler(960, 540, true, 0.5f, 0.25f, 0.5f, 0.5f);
+            const NMMSS::PSample frame = makeFrame(f.Format, 1920, 1080);
+            const NMMSS::PSample cropped = scaler.Scale(frame.Get());
+            BOOST_REQUIRE(!!cropped);
+
+            const SPicture picture(cropped.Get());
+            BOOST_CHECK_EQUAL(picture.Width, 480u);
+            BOOST_CHECK_EQUAL(picture.Height, 270u);
+            checkPicture(picture, f.Format, 128, 255);
+        }
+
+        BOOST_TEST_CONTEXT(f.Name << " without scaling")
+        {
+            CScaler scaler(0, 0, true, 0.25f, 0.f, 0.5f, 1.f);
+            const NMMSS::PSample frame = makeFrame(f.Format, 640, 480);
+            const NMMSS::PSample cropped = scaler.Scale(frame.Get());
+            BOOST_REQUIRE(!!cropped);
+
+            const SPicture picture(cropped.Get());
+            BOOST_CHECK_EQUAL(picture.Width, 320u);
+            BOOST_CHECK_EQUAL(picture.Height, 480u);
+            checkPicture(picture, f.Format, 64, 191);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SizeTransformerBenchmark)
+{
+    const int WIDTH = 1920;
+    const int HEIGHT = 1080;
+    const int FRAMES = 20;
+    const uint32_t REQUESTS[][2] = { { 1280, 720 }, { 700, 394 } };
+
+    for (const auto& request : REQUESTS)
+    {
+        for (const SFormat& f : FORMATS)
+        {
+            const NMMSS::PSample frame = makeFrame(f.Format, WIDTH, HEIGHT);
+
+            // The filter: exact size, area averaging through a cached context, straight into the output sample.
+            CScaler scaler(request[0], request[1]);
+            const double area = megapixelsPerSecond(WIDTH * HEIGHT, FRAMES, [&]()
+            {
+                BOOST_REQUIRE(!!scaler.Scale(frame.Get()));
+            });
+
+            // The former path did not scale GREY at all.
+            if (EF_GREY == f.Format)
+            {
+                BOOST_TEST_MESSAGE("Scale " << WIDTH << "x" << HEIGHT << " " << f.Name << " to " << request[0] << "x" << request[1]
+                    << ": area averaging " << area << " Mpix/s");
+                continue;
+            }
+
+            const SPicture source(frame.Get());
+            const uint8_t* sourceData[4] = { source.Data[0], source.Data[2], source.Data[1], nullptr };
+            const int sourcePitch[4] = { source.Pitch[0], source.Pitch[2], source.Pitch[1], 0 };
+
+            const int formerWidth = formerScaledSize(WIDTH, request[0]);
+            const int formerHeight = formerScaledSize(HEIGHT, request[1]);
+            const SPlanes formerPlanes(EF_I420, formerWidth, formerHeight);
+            std::vector<uint8_t> formerBuffer(formerPlanes.Size);
+            uint8_t* formerData[4] = { formerBuffer.data() + formerPlanes.Offset[0], formerBuffer.data() + formerPlanes.Offset[2],
+                formerBuffer.data() + formerPlanes.Offset[1], nullptr };
+            const int formerPitch[4] = { formerPlanes.Pitch[0], formerPlanes.Pitch[2], formerPlanes.Pitch[1], 0 };
+
+            const double bicubic = megapixelsPerSecond(WIDTH * HEIGHT, FRAMES, [&]()
+            {
+                SwsContext* resize = sws_getContext(WIDTH, HEIGHT, AV_PIX_FMT_YUV420P,
+                    formerWidth, formerHeight, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+                BOOST_REQUIRE(resize);
+                sws_scale(resize, sourceData, sourcePitch, 0, HEIGHT, formerData, formerPitch);
+                sws_freeContext(resize);
+            });
+
+            BOOST_TEST_MESSAGE("Scale " << WIDTH << "x" << HEIGHT << " " << f.Name << " to " << request[0] << "x" << request[1]
+                << ": former bicubic to " << formerWidth << "x" << formerHeight << " " << bicubic
+                << " Mpix/s, area averaging " << area << " Mpix/s");
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,207 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../StartCode.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // Straightforward definition the optimised scanners are checked against.
+    const uint8_t* referenceFindStartCode(const uint8_t* p, const uint8_t* end)
+    {
+        for (; end - p >= 3; ++p)
+        {
+            if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+                return p + 3;
+        }
+        return end;
+    }
+
+    struct SScanner
+    {
+        const char* Name;
+        NMMSS::FStartCodeScanner Scan;
+    };
+
+    std::vector<SScanner> supportedScanners()
+    {
+        const SScanner all[] =
+        {
+            { "scalar", NMMSS::GetStartCodeScanner(NMMSS::ESCS_SCALAR) },
+            { "sse2", NMMSS::GetStartCodeScanner(NMMSS::ESCS_SSE2) },
+            { "avx2", NMMSS::GetStartCodeScanner(NMMSS::ESCS_AVX2) },
+            { "dispatched", NMMSS::FindStartCode }
+        };
+        std::vector<SScanner> result;
+        for (const auto& s : all)
+        {
+            if (s.Scan)
+                result.push_back(s);
+        }
+        return result;
+    }
+
+    // Offsets of all start codes as a parser finds them, scanning from the previous hit.
+    std::vector<size_t> scanAll(NMMSS::FStartCodeScanner scan, const std::vector<uint8_t>& data)
+    {
+        std::vector<size_t> result;
+        const uint8_t* begin = data.data();
+        const uint8_t* end = begin + data.size();
+        for (const uint8_t* p = scan(begin, end); p < end; p = scan(p, end))
+            result.push_back(p - begin);
+        return result;
+    }
+
+    size_t find(NMMSS::FStartCodeScanner scan, const std::vector<uint8_t>& data)
+    {
+        return scan(data.data(), data.data() + data.size()) - data.data();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(StartCodeScannersAvailable)
+{
+    BOOST_REQUIRE(NMMSS::GetStartCodeScanner(NMMSS::ESCS_SCALAR) != nullptr);
+    for (const auto& s : supportedScanners())
+        BOOST_TEST_MESSAGE("Start code scanner available: " << s.Name);
+}
+
+BOOST_AUTO_TEST_CASE(StartCodeSmallBuffersExhaustive)
+{
+    // Every buffer up to 8 bytes long over an alphabet that can form start codes,
+    // emulation prevention bytes and non-matching values.
+    const uint8_t ALPHABET[] = { 0x00, 0x01, 0x03, 0x80 };
+    const size_t MAX_SIZE = 8;
+
+    const auto scanners = supportedScanners();
+    std::vector<uint8_t> data;
+    for (size_t size = 0; size <= MAX_SIZE; ++size)
+    {
+        data.resize(size);
+        size_t combinations = size_t(1) << (2 * size);
+        for (size_t c = 0; c < combinations; ++c)
+        {
+            for (size_t i = 0; i < size; ++i)
+                data[i] = ALPHABET[(c >> (2 * i)) & 3];
+
+            const size_t expected = find(referenceFindStartCode, data);
+            for (const auto& s : scanners)
+                BOOST_REQUIRE_MESSAGE(find(s.Scan, data) == expected, s.Name << ": size " << size << ", combination " << c);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(StartCodePatternAtEveryOffsetAndTail)
+{
+    // Places every 5-byte pattern at every offset of a buffer longer than two AVX2 blocks
+    // and cuts the buffer at every length, so that matches straddle block boundaries
+    // and fall into the scalar tail.
+    const uint8_t ALPHABET[] = { 0x00, 0x01, 0x03, 0x55 };
+    const size_t PATTERN_SIZE = 5;
+    const size_t BUFFER_SIZE = 72;
+
+    const auto scanners = supportedScanners();
+    std::vector<uint8_t> buffer(BUFFER_SIZE);
+    std::vector<uint8_t> data;
+    for (size_t c = 0; c < (size_t(1) << (2 * PATTERN_SIZE)); ++c)
+    {
+        for (size_t offset = 0; offset + PATTERN_SIZE <= BUFFER_SIZE; ++offset)
+        {
+            std::fill(buffer.begin(), buffer.end(), uint8_t(0x55));
+            for (size_t i = 0; i < PATTERN_SIZE; ++i)
+                buffer[offset + i] = ALPHABET[(c >> (2 * i)) & 3];
+
+            for (size_t size = offset; size <= BUFFER_SIZE; ++size)
+            {
+                data.assign(buffer.begin(), buffer.begin() + size);
+                const size_t expected = find(referenceFindStartCode, data);
+                for (const auto& s : scanners)
+                {
+                    BOOST_REQUIRE_MESSAGE(find(s.Scan, data) == expected,
+                        s.Name << ": pattern " << c << ", offset " << offset << ", size " << size);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(StartCodeEmulationPrevention)
+{
+    struct SCase
+    {
+        std::vector<uint8_t> Data;
+        size_t Expected;
+    };
+    const SCase cases[] =
+    {
+        // Emulation prevention byte breaks the start code.
+        { { 0x00, 0x00, 0x03, 0x01, 0x65 }, 5 },
+        { { 0x00, 0x00, 0x03, 0x00, 0x00, 0x01, 0x67 }, 6 },
+        { { 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x01 }, 7 },
+        // Four byte start code.
+        { { 0x00, 0x00, 0x00, 0x01, 0x65 }, 4 },
+        // Trailing zeros before the start code.
+        { { 0x65, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x41 }, 7 },
+        // Start code at the very end has no NAL header and is not reported.
+        { { 0x65, 0x88, 0x00, 0x00, 0x01 }, 5 },
+        { { 0x00, 0x00 }, 2 },
+        { { 0x00, 0x01 }, 2 },
+    };
+
+    for (const auto& s : supportedScanners())
+    {
+        for (const auto& c : cases)
+            BOOST_CHECK_EQUAL(find(s.Scan, c.Data), c.Expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(StartCodeRandomStream)
+{
+    // Zero heavy random stream, scanned hit by hit the way the frame info parsers do.
+    std::mt19937 random(20161016);
+    std::uniform_int_distribution<int> byte(0, 7);
+    std::vector<uint8_t> data(1 << 20);
+    for (auto& b : data)
+    {
+        int v = byte(random);
+        b = uint8_t(v < 5 ? 0 : v - 4);
+    }
+
+    const auto expected = scanAll(referenceFindStartCode, data);
+    BOOST_REQUIRE(!expected.empty());
+    for (const auto& s : supportedScanners())
+        BOOST_CHECK_MESSAGE(scanAll(s.Scan, data) == expected, s.Name);
+}
+
+BOOST_AUTO_TEST_CASE(StartCodeBenchmark)
+{
+    // Compressed slice data: random bytes with no start codes, 16 MB scanned several times.
+    const size_t SIZE = 16 << 20;
+    const int PASSES = 8;
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> data(SIZE);
+    for (auto& b : data)
+        b = uint8_t(byte(random));
+    for (size_t i = 2; i < SIZE; ++i)
+    {
+        if (data[i - 2] == 0 && data[i - 1] == 0 && data[i] == 1)
+            data[i] = 2;
+    }
+
+    for (const auto& s : supportedScanners())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < PASSES; ++i)
+            BOOST_REQUIRE_EQUAL(find(s.Scan, data), SIZE);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        BOOST_TEST_MESSAGE("Start code scanner " << s.Name << ": "
+            << (double(SIZE) * PASSES / elapsed.count() / 1e9) << " GB/s");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
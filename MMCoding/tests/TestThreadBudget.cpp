@@ -0,0 +1,265 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../ThreadBudget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace NMMSS;
+
+namespace
+{
+    uint32_t totalThreads(const CThreadBudget& budget)
+    {
+        uint32_t total = 0;
+        for (const auto& c : budget.GetStatistics().Contexts)
+            total += c.Allocation.Threads;
+        return total;
+    }
+
+    class CBarrier
+    {
+    public:
+        explicit CBarrier(uint32_t count)
+            : m_count(count)
+            , m_waiting(0)
+            , m_generation(0)
+        {
+        }
+
+        void Wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const uint64_t generation = m_generation;
+            if (++m_waiting == m_count)
+            {
+                m_waiting = 0;
+                ++m_generation;
+                m_condition.notify_all();
+                return;
+            }
+            m_condition.wait(lock, [&] { return generation != m_generation; });
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        const uint32_t m_count;
+        uint32_t m_waiting;
+        uint64_t m_generation;
+    };
+
+    struct SStream
+    {
+        uint32_t Width;
+        uint32_t Height;
+    };
+
+    // Models decoding rather than decodes: every stream walks its picture sliced
+    // over its threads, which meet at the end of each frame the way slice threading does.
+    double decodeStreams(const std::vector<SStream>& streams, const std::vector<uint32_t>& threads, uint32_t frames)
+    {
+        std::vector<std::vector<uint8_t>> pictures;
+        for (const auto& s : streams)
+            pictures.emplace_back(size_t(s.Width) * s.Height, uint8_t(s.Width));
+
+        std::vector<std::unique_ptr<CBarrier>> barriers;
+        for (uint32_t t : threads)
+            barriers.emplace_back(new CBarrier(t));
+
+        std::vector<uint32_t> sums(std::accumulate(threads.begin(), threads.end(), 0u));
+        std::vector<std::thread> workers;
+
+        const auto start = std::chrono::steady_clock::now();
+        uint32_t worker = 0;
+        for (size_t s = 0; s < streams.size(); ++s)
+        {
+            for (uint32_t t = 0; t < threads[s]; ++t, ++worker)
+            {
+                workers.emplace_back([&, s, t, worker]
+                {
+                    const std::vector<uint8_t>& picture = pictures[s];
+                    const size_t begin = picture.size() * t / threads[s];
+                    const size_t end = picture.size() * (t + 1) / threads[s];
+                    uint32_t sum = 0;
+                    for (uint32_t f = 0; f < frames; ++f)
+                    {
+                        for (size_t i = begin; i < end; ++i)
+                            sum = sum * 31 + picture[i];
+                        barriers[s]->Wait();
+                    }
+                    sums[worker] = sum;
+                });
+            }
+        }
+        for (auto& w : workers)
+            w.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return streams.size() * frames / seconds;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(ThreadBudgetGivesSingleStreamAllCores)
+{
+    CThreadBudget budget(8);
+    CThreadBudget::PLease lease = budget.Register(ECK_DECODER, 1920, 1080);
+    BOOST_CHECK_EQUAL(lease->Allocation().Threads, 8u);
+    BOOST_CHECK_EQUAL(lease->Allocation().Mode, ETM_FRAME);
+
+    // The cap follows the resolution.
+    CThreadBudget wide(64);
+    CThreadBudget::PLease big = wide.Register(ECK_DECODER, 3840, 2160);
+    BOOST_CHECK_EQUAL(big->Allocation().Threads, 16u);
+    CThreadBudget::PLease small = wide.Register(ECK_DECODER, 352, 288);
+    BOOST_CHECK_EQUAL(small->Allocation().Threads, 1u);
+    BOOST_CHECK_EQUAL(small->Allocation().Mode, ETM_SINGLE);
+}
+
+BOOST_AUTO_TEST_CASE(ThreadBudgetNeverOversubscribes)
+{
+    CThreadBudget budget(8);
+    std::vector<CThreadBudget::PLease> leases;
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+        leases.push_back(budget.Register(ECK_DECODER, i % 3 ? 640 : 1920, i % 3 ? 360 : 1080));
+        BOOST_CHECK_LE(totalThreads(budget), std::max(8u, i + 1));
+    }
+    for (const auto& lease : leases)
+        BOOST_CHECK_EQUAL(lease->Allocation().Threads, 1u);
+
+    // Cores freed by streams going away are handed back out.
+    leases.resize(2);
+    BOOST_CHECK_EQUAL(totalThreads(budget), 8u);
+    BOOST_CHECK_GT(leases[0]->Allocation().Threads, leases[1]->Allocation().Threads);
+}
+
+BOOST_AUTO_TEST_CASE(ThreadBudgetWeighsByResolution)
+{
+    CThreadBudget budget(8);
+    CThreadBudget::PLease hd = budget.Register(ECK_DECODER, 1920, 1080);
+    CThreadBudget::PLease sd = budget.Register(ECK_DECODER, 960, 540);
+    BOOST_CHECK_EQUAL(hd->Allocation().Threads, 6u);
+    BOOST_CHECK_EQUAL(sd->Allocation().Threads, 2u);
+
+    CThreadBudget::PLease encoder = budget.Register(ECK_ENCODER, 1920, 1080);
+    BOOST_CHECK_EQUAL(encoder->Allocation().Mode, ETM_SLICE);
+    BOOST_CHECK_LE(encoder->Allocation().Threads, 4u);
+    BOOST_CHECK_EQUAL(totalThreads(budget), 8u);
+}
+
+BOOST_AUTO_TEST_CASE(ThreadBudgetRebalancesOnResolution)
+{
+    CThreadBudget budget(4);
+    CThreadBudget::PLease lease = budget.Register(ECK_DECODER, 0, 0);
+    BOOST_CHECK_EQUAL(lease->Allocation().Threads, 1u);
+    const uint64_t generation = budget.GetStatistics().Generation;
+
+    lease->SetResolution(1280, 720);
+    BOOST_CHECK_EQUAL(lease->Allocation().Threads, 4u);
+    BOOST_CHECK_GT(budget.GetStatistics().Generation, generation);
+
+    const SThreadBudgetStatistics st = budget.GetStatistics();
+    BOOST_CHECK_EQUAL(st.Cores, 4u);
+    BOOST_REQUIRE_EQUAL(st.Contexts.size(), 1u);
+    BOOST_CHECK_EQUAL(st.Contexts[0].Width, 1280u);
+    BOOST_CHECK_EQUAL(st.Contexts[0].Height, 720u);
+    BOOST_CHECK_EQUAL(st.Contexts[0].Allocation.Threads, 4u);
+
+    lease.reset();
+    BOOST_CHECK(budget.GetStatistics().Contexts.empty());
+}
+
+BOOST_AUTO_TEST_CASE(ThreadBudgetCountsFixedContexts)
+{
+    CThreadBudget budget(4);
+    CThreadBudget::PLease hd = budget.Register(ECK_DECODER, 1920, 1080);
+    BOOST_CHECK_EQUAL(hd->Allocation().Threads, 4u);
+    const uint64_t generation = budget.Generation();
+
+    // A single threaded decoder keeps its one thread and takes a core from the others.
+    CThreadBudget::PLease fixed = budget.Register(ECK_DECODER, 1920, 1080, true);
+    BOOST_CHECK_EQUAL(fixed->Allocation().Threads, 1u);
+    BOOST_CHECK_EQUAL(fixed->Allocation().Mode, ETM_SINGLE);
+    BOOST_CHECK_EQUAL(hd->Allocation().Threads, 3u);
+    BOOST_CHECK_GT(budget.Generation(), generation);
+
+    fixed->SetResolution(3840, 2160);
+    BOOST_CHECK_EQUAL(fixed->Allocation().Threads, 1u);
+
+    const SThreadBudgetStatistics st = budget.GetStatistics();
+    BOOST_REQUIRE_EQUAL(st.Contexts.size(), 2u);
+    BOOST_CHECK(!st.Contexts[0].Fixed);
+    BOOST_CHECK(st.Contexts[1].Fixed);
+    BOOST_CHECK_EQUAL(st.Generation, budget.Generation());
+
+    fixed.reset();
+    BOOST_CHECK_EQUAL(hd->Allocation().Threads, 4u);
+}
+
+BOOST_AUTO_TEST_CASE(ThreadBudgetKeepsThreadsOnSmallChanges)
+{
+    CThreadBudget budget(16);
+    std::vector<CThreadBudget::PLease> leases;
+    for (uint32_t i = 0; i < 4; ++i)
+        leases.push_back(budget.Register(ECK_DECODER, 1920, 1080));
+    for (const auto& lease : leases)
+        BOOST_CHECK_EQUAL(lease->Allocation().Threads, 4u);
+
+    // A small stream takes its core from a single decoder instead of reshuffling them all.
+    CThreadBudget::PLease cif = budget.Register(ECK_DECODER, 352, 288);
+    BOOST_CHECK_EQUAL(cif->Allocation().Threads, 1u);
+    uint32_t reopened = 0;
+    for (const auto& lease : leases)
+        reopened += lease->Allocation().Threads != 4u;
+    BOOST_CHECK_EQUAL(reopened, 1u);
+    BOOST_CHECK_EQUAL(totalThreads(budget), 16u);
+
+    // And the core goes back where it came from.
+    cif.reset();
+    for (const auto& lease : leases)
+        BOOST_CHECK_EQUAL(lease->Allocation().Threads, 4u);
+}
+
+// A synthetic model, not a decoder: each stream sums its picture sliced over its
+// threads, which meet at every frame. It compares the splits, not real codecs.
+BOOST_AUTO_TEST_CASE(ThreadBudgetBenchmark)
+{
+    const uint32_t FRAMES = 25;
+    std::vector<SStream> streams;
+    for (uint32_t i = 0; i < 16; ++i)
+        streams.push_back(i % 4 ? SStream{ 640, 360 } : SStream{ 1920, 1080 });
+
+    // The former fixed split: nine threads over the decoders running when a
+    // decoder was created, whatever the cores and the resolution.
+    const uint32_t MAGIC_FFMPEG_THREAD_COUNT = 9;
+    const uint32_t count = uint32_t(streams.size());
+    std::vector<uint32_t> fixed;
+    for (uint32_t running = 1; running <= count; ++running)
+        fixed.push_back((MAGIC_FFMPEG_THREAD_COUNT + running - 1) / running);
+
+    CThreadBudget budget(std::thread::hardware_concurrency());
+    std::vector<CThreadBudget::PLease> leases;
+    for (const auto& s : streams)
+        leases.push_back(budget.Register(ECK_DECODER, s.Width, s.Height));
+    std::vector<uint32_t> budgeted;
+    for (const auto& lease : leases)
+        budgeted.push_back(lease->Allocation().Threads);
+    BOOST_CHECK_LE(totalThreads(budget), std::max<uint32_t>(budget.GetStatistics().Cores, count));
+
+    const double before = decodeStreams(streams, fixed, FRAMES);
+    const double after = decodeStreams(streams, budgeted, FRAMES);
+    BOOST_TEST_MESSAGE("Synthetic model, 16 streams on " << budget.GetStatistics().Cores << " cores, fixed split to "
+        << std::accumulate(fixed.begin(), fixed.end(), 0u) << " threads: " << before << " frames/s");
+    BOOST_TEST_MESSAGE("Synthetic model, 16 streams on " << budget.GetStatistics().Cores << " cores, budgeted "
+        << totalThreads(budget) << " threads: " << after << " frames/s");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,246 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../YuvOverlay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace NMMSS::NOverlay;
+
+namespace
+{
+    struct SKernel
+    {
+        const char* Name;
+        FBlendRow Blend;
+    };
+
+    std::vector<SKernel> supportedKernels()
+    {
+        const SKernel all[] =
+        {
+            { "scalar", GetBlendKernel(EBK_SCALAR) },
+            { "sse2", GetBlendKernel(EBK_SSE2) },
+            { "avx2", GetBlendKernel(EBK_AVX2) }
+        };
+        std::vector<SKernel> result;
+        for (const auto& k : all)
+        {
+            if (k.Blend)
+                result.push_back(k);
+        }
+        return result;
+    }
+
+    struct SRgb
+    {
+        float R, G, B;
+    };
+
+    SRgb yuvToRgb(float y, float u, float v)
+    {
+        y = 1.164f * (y - 16.0f);
+        u -= 128.0f;
+        v -= 128.0f;
+        return { y + 1.596f * v, y - 0.391f * u - 0.813f * v, y + 2.018f * u };
+    }
+
+    float rgbToY(const SRgb& c) { return 16.0f + 0.257f * c.R + 0.504f * c.G + 0.098f * c.B; }
+    float rgbToU(const SRgb& c) { return 128.0f - 0.148f * c.R - 0.291f * c.G + 0.439f * c.B; }
+    float rgbToV(const SRgb& c) { return 128.0f + 0.439f * c.R - 0.368f * c.G - 0.071f * c.B; }
+
+    struct SFrame
+    {
+        SFrame(uint32_t width, uint32_t height, uint32_t shiftY, uint32_t seed)
+            : Width(width)
+            , Height(height)
+            , ShiftY(shiftY)
+            , ChromaWidth(width / 2)
+            , ChromaHeight(height >> shiftY)
+            , Y(width * height)
+            , U(ChromaWidth * ChromaHeight)
+            , V(U.size())
+        {
+            // Kept within the RGB gamut, so that the round trip through RGB does not clip.
+            std::mt19937 random(seed);
+            std::uniform_int_distribution<int> luma(60, 180), chroma(110, 146);
+            for (auto& p : Y) p = uint8_t(luma(random));
+            for (auto& p : U) p = uint8_t(chroma(random));
+            for (auto& p : V) p = uint8_t(chroma(random));
+        }
+
+        uint32_t Width, Height, ShiftY, ChromaWidth, ChromaHeight;
+        std::vector<uint8_t> Y, U, V;
+    };
+
+    std::vector<uint8_t> randomWatermark(uint32_t width, uint32_t height, uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> rgba(width * height * 4);
+        for (size_t i = 0; i < rgba.size(); i += 4)
+        {
+            rgba[i] = uint8_t(random());
+            rgba[i + 1] = uint8_t(random());
+            rgba[i + 2] = uint8_t(random());
+            // Mostly transparent or opaque, as logos are.
+            const uint32_t a = random() % 4;
+            rgba[i + 3] = uint8_t(0 == a ? 0 : 1 == a ? 255 : random());
+        }
+        return rgba;
+    }
+
+    // The previous pipeline: the frame converted to RGB, the watermark blended
+    // there and the result converted back with chroma averaged over each block.
+    SFrame blendInRgb(const SFrame& frame, const std::vector<uint8_t>& rgba, int x, int y, uint32_t w, uint32_t h, uint8_t opacity)
+    {
+        std::vector<SRgb> rgb(frame.Width * frame.Height);
+        for (uint32_t py = 0; py < frame.Height; ++py)
+        {
+            for (uint32_t px = 0; px < frame.Width; ++px)
+            {
+                const uint32_t c = (py >> frame.ShiftY) * frame.ChromaWidth + px / 2;
+                SRgb& p = rgb[py * frame.Width + px];
+                p = yuvToRgb(frame.Y[py * frame.Width + px], frame.U[c], frame.V[c]);
+
+                const int wx = int(px) - x, wy = int(py) - y;
+                if (wx < 0 || wy < 0 || wx >= int(w) || wy >= int(h))
+                    continue;
+                const uint8_t* m = &rgba[(wy * w + wx) * 4];
+                const float a = m[3] * opacity / (255.0f * 255.0f);
+                p.R = m[0] * a + p.R * (1.0f - a);
+                p.G = m[1] * a + p.G * (1.0f - a);
+                p.B = m[2] * a + p.B * (1.0f - a);
+            }
+        }
+
+        SFrame result = frame;
+        for (uint32_t i = 0; i < rgb.size(); ++i)
+            result.Y[i] = uint8_t(std::lround(rgbToY(rgb[i])));
+        const uint32_t blockHeight = 1 << frame.ShiftY;
+        for (uint32_t cy = 0; cy < frame.ChromaHeight; ++cy)
+        {
+            for (uint32_t cx = 0; cx < frame.ChromaWidth; ++cx)
+            {
+                float u = 0.0f, v = 0.0f;
+                for (uint32_t py = cy * blockHeight; py < (cy + 1) * blockHeight; ++py)
+                {
+                    for (uint32_t px = cx * 2; px < cx * 2 + 2; ++px)
+                    {
+                        u += rgbToU(rgb[py * frame.Width + px]);
+                        v += rgbToV(rgb[py * frame.Width + px]);
+                    }
+                }
+                result.U[cy * frame.ChromaWidth + cx] = uint8_t(std::lround(u / (2 * blockHeight)));
+                result.V[cy * frame.ChromaWidth + cx] = uint8_t(std::lround(v / (2 * blockHeight)));
+            }
+        }
+        return result;
+    }
+
+    int maxDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+    {
+        int result = 0;
+        for (size_t i = 0; i < a.size(); ++i)
+            result = std::max(result, std::abs(int(a[i]) - int(b[i])));
+        return result;
+    }
+
+    void checkAgainstRgbBlending(uint32_t shiftY, int x, int y)
+    {
+        const uint32_t W = 96, H = 64, WM_W = 37, WM_H = 23;
+        const uint8_t OPACITY = 200;
+        const SFrame frame(W, H, shiftY, 11);
+        const std::vector<uint8_t> rgba = randomWatermark(WM_W, WM_H, 12);
+
+        const SFrameLayout layout = { W, H, true, 1, shiftY };
+        const SYuvOverlay overlay = MakeYuvOverlay(rgba.data(), WM_W * 4, x, y, WM_W, WM_H, OPACITY, layout);
+        SFrame actual = frame;
+        BlendPlane(overlay.Luma, actual.Y.data(), W);
+        BlendPlane(overlay.U, actual.U.data(), actual.ChromaWidth);
+        BlendPlane(overlay.V, actual.V.data(), actual.ChromaWidth);
+
+        const SFrame expected = blendInRgb(frame, rgba, x, y, WM_W, WM_H, OPACITY);
+        BOOST_CHECK_LE(maxDifference(expected.Y, actual.Y), 2);
+        BOOST_CHECK_LE(maxDifference(expected.U, actual.U), 2);
+        BOOST_CHECK_LE(maxDifference(expected.V, actual.V), 2);
+
+        // Pixels away from the watermark are left exactly as they were.
+        for (uint32_t py = 0; py < H; ++py)
+        {
+            for (uint32_t px = 0; px < W; ++px)
+            {
+                if (int(px) < x - 1 || int(px) > x + int(WM_W) || int(py) < y - 1 || int(py) > y + int(WM_H))
+                {
+                    const uint32_t c = (py >> shiftY) * actual.ChromaWidth + px / 2;
+                    BOOST_REQUIRE_EQUAL(frame.Y[py * W + px], actual.Y[py * W + px]);
+                    BOOST_REQUIRE_EQUAL(frame.U[c], actual.U[c]);
+                    BOOST_REQUIRE_EQUAL(frame.V[c], actual.V[c]);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMCoding)
+
+BOOST_AUTO_TEST_CASE(OverlayKernelsMatchScalar)
+{
+    std::mt19937 random(5);
+    std::vector<uint8_t> alpha(200), color(200), frame(200);
+    for (size_t i = 0; i < alpha.size(); ++i)
+    {
+        alpha[i] = uint8_t(i % 3 ? random() : i % 2 * 255);
+        color[i] = uint8_t(random() % 256 * alpha[i] / 255);
+        frame[i] = uint8_t(random());
+    }
+
+    for (uint32_t count : { 1u, 15u, 16u, 31u, 33u, 200u })
+    {
+        std::vector<uint8_t> expected(frame);
+        GetBlendKernel(EBK_SCALAR)(expected.data(), color.data(), alpha.data(), count);
+        for (const auto& k : supportedKernels())
+        {
+            std::vector<uint8_t> actual(frame);
+            k.Blend(actual.data(), color.data(), alpha.data(), count);
+            BOOST_CHECK_MESSAGE(expected == actual, k.Name << " " << count);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(OverlayMatchesRgbBlendingI420)
+{
+    checkAgainstRgbBlending(1, 13, 7);
+}
+
+BOOST_AUTO_TEST_CASE(OverlayMatchesRgbBlendingY42B)
+{
+    checkAgainstRgbBlending(0, 20, 10);
+}
+
+BOOST_AUTO_TEST_CASE(OverlayIsClippedToFrame)
+{
+    const std::vector<uint8_t> rgba = randomWatermark(10, 10, 3);
+    const SFrameLayout layout = { 16, 16, true, 1, 1 };
+
+    const SYuvOverlay partly = MakeYuvOverlay(rgba.data(), 40, 11, -3, 10, 10, 255, layout);
+    BOOST_CHECK_EQUAL(partly.Luma.X, 11u);
+    BOOST_CHECK_EQUAL(partly.Luma.Y, 0u);
+    BOOST_CHECK_EQUAL(partly.Luma.Width, 5u);
+    BOOST_CHECK_EQUAL(partly.Luma.Height, 7u);
+    BOOST_CHECK_EQUAL(partly.U.X, 5u);
+    BOOST_CHECK_EQUAL(partly.U.Width, 3u);
+    BOOST_CHECK_EQUAL(partly.U.Height, 4u);
+
+    const SYuvOverlay outside = MakeYuvOverlay(rgba.data(), 40, 16, 0, 10, 10, 255, layout);
+    BOOST_CHECK_EQUAL(outside.Luma.Width, 0u);
+    BOOST_CHECK_EQUAL(outside.U.Width, 0u);
+
+    const SFrameLayout grey = { 16, 16, false, 0, 0 };
+    const SYuvOverlay lumaOnly = MakeYuvOverlay(rgba.data(), 40, 0, 0, 10, 10, 255, grey);
+    BOOST_CHECK_EQUAL(lumaOnly.Luma.Width, 10u);
+    BOOST_CHECK_EQUAL(lumaOnly.U.Width, 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
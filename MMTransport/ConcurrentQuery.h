@@ -0,0 +1,180 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+namespace NMMSS
+{
+    namespace NIntervalSequence
+    {
+        /// Asks several sources at once and keeps their answers across rounds: a source that misses
+        /// the deadline of one round is not asked again in the next one, its late answer is kept instead.
+        template <typename TResult>
+        class CConcurrentQuery
+        {
+        public:
+            /// Fills the result of a source, may throw.
+            typedef std::function<void(size_t source, TResult& result)> FAsk;
+            /// Hands a task to other threads, false when it was not taken.
+            typedef std::function<bool(const std::function<void()>& task)> FPost;
+            typedef std::vector<boost::optional<TResult>> TResults;
+
+            CConcurrentQuery(size_t sources, FAsk ask)
+                : m_state(std::make_shared<SState>(sources, std::move(ask)))
+            {
+            }
+
+            /// Posts the sources that are neither answered nor asked yet, then waits up to deadline for
+            /// the first answer and up to deadline from then on for the others. A source whose task is
+            /// not taken is asked next round. Returns true when every source has answered. The first
+            /// error of the round is thrown, the failed sources are asked again next round.
+            bool Run(const FPost& post, std::chrono::milliseconds deadline)
+            {
+                const std::shared_ptr<SState> state = m_state;
+                std::unique_lock<std::mutex> lock(state->Mutex);
+                ++state->Rounds;
+                for (size_t i = 0; i < state->Sources.size(); ++i)
+                {
+                    if (ESS_WAITING != state->Sources[i].State)
+                        continue;
+                    state->Sources[i].State = ESS_ASKED;
+                    ++state->Running;
+
+                    lock.unlock();
+                    const bool posted = post([state, i]() { ask(state, i); });
+                    lock.lock();
+
+                    if (!posted)
+                    {
+                        state->Sources[i].State = ESS_WAITING;
+                        --state->Running;
+                    }
+                }
+
+                state->Changed.wait_until(lock, std::chrono::steady_clock::now() + deadline,
+                    [&state] { return state->Replies > 0 || 0 == state->Running; });
+                state->Changed.wait_until(lock, std::chrono::steady_clock::now() + deadline,
+                    [&state] { return 0 == state->Running; });
+
+                std::exception_ptr error;
+                bool complete = true;
+                for (SSource& s : state->Sources)
+                {
+                    if (ESS_FAILED == s.State)
+                    {
+                        if (!error)
+                            error = s.Error;
+                        s.Error = std::exception_ptr();
+                        s.State = ESS_WAITING;
+                    }
+                    complete = complete && ESS_ANSWERED == s.State;
+                }
+                lock.unlock();
+
+                if (error)
+                    std::rethrow_exception(error);
+                return complete;
+            }
+
+            TResults Results() const
+            {
+                std::lock_guard<std::mutex> lock(m_state->Mutex);
+                TResults results(m_state->Sources.size());
+                for (size_t i = 0; i < results.size(); ++i)
+                {
+                    if (ESS_ANSWERED == m_state->Sources[i].State)
+                        results[i] = m_state->Sources[i].Result;
+                }
+                return results;
+            }
+
+            size_t Answered() const
+            {
+                std::lock_guard<std::mutex> lock(m_state->Mutex);
+                size_t answered = 0;
+                for (const SSource& s : m_state->Sources)
+                    answered += ESS_ANSWERED == s.State;
+                return answered;
+            }
+
+            size_t Rounds() const
+            {
+                std::lock_guard<std::mutex> lock(m_state->Mutex);
+                return m_state->Rounds;
+            }
+
+        private:
+            enum ESourceState
+            {
+                ESS_WAITING,
+                ESS_ASKED,
+                ESS_ANSWERED,
+                ESS_FAILED
+            };
+
+            struct SSource
+            {
+                ESourceState State = ESS_WAITING;
+                TResult Result;
+                std::exception_ptr Error;
+            };
+
+            // Shared with the tasks, which may outlive the query.
+            struct SState
+            {
+                SState(size_t sources, FAsk ask)
+                    : Ask(std::move(ask))
+                    , Sources(sources)
+                {
+                }
+
+                const FAsk Ask;
+                std::mutex Mutex;
+                std::condition_variable Changed;
+                std::vector<SSource> Sources;
+                size_t Running = 0;
+                size_t Replies = 0;
+                size_t Rounds = 0;
+            };
+
+            static void ask(const std::shared_ptr<SState>& state, size_t i)
+            {
+                TResult result;
+                std::exception_ptr error;
+                try
+                {
+                    state->Ask(i, result);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(state->Mutex);
+                SSource& s = state->Sources[i];
+                if (error)
+                {
+                    s.State = ESS_FAILED;
+                    s.Error = error;
+                }
+                else
+                {
+                    s.State = ESS_ANSWERED;
+                    s.Result = std::move(result);
+                }
+                --state->Running;
+                ++state->Replies;
+                state->Changed.notify_all();
+            }
+
+            const std::shared_ptr<SState> m_state;
+        };
+    }
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include "IntervalSequence.h"
+
+namespace
+{
+    using namespace NMMSS::NIntervalSequence;
+
+    boost::posix_time::time_duration getIntervalShift(const boost::posix_time::time_period& interval, const boost::posix_time::ptime& t)
+    {
+        return (t < interval.begin()) ? interval.begin() - t : boost::posix_time::seconds(0);
+    }
+
+    /// The first interval that has not ended by the time given.
+    const boost::posix_time::time_period* findSuitableInterval(const TPeriods& intervals, const boost::posix_time::ptime& t)
+    {
+        auto it = std::upper_bound(intervals.begin(), intervals.end(), t,
+            [](const boost::posix_time::ptime& t, const boost::posix_time::time_period& period) { return t < period.end(); });
+        return (it != intervals.end()) ? &*it : nullptr;
+    }
+}
+
+namespace NMMSS
+{
+    namespace NIntervalSequence
+    {
+        TPeriods ClipToPeriod(const boost::posix_time::time_period& period, const TPeriods& intervals)
+        {
+            TPeriods result;
+            for (const auto& interval : intervals)
+            {
+                auto clipped = period.intersection(interval);
+                if (!clipped.is_null())
+                {
+                    result.push_back(clipped);
+                }
+            }
+            return result;
+        }
+
+        TPlannedIntervals Merge(const std::vector<TPeriods>& sources, boost::posix_time::ptime position)
+        {
+            TPlannedIntervals planned;
+            for (;;)
+            {
+                SPlannedInterval best;
+                for (size_t i = 0; i < sources.size(); ++i)
+                {
+                    const boost::posix_time::time_period* interval = findSuitableInterval(sources[i], position);
+                    if (nullptr == interval)
+                        continue;
+
+                    auto currShift = getIntervalShift(*interval, position);
+                    auto prevShift = getIntervalShift(best.Interval, position);
+                    if (std::numeric_limits<size_t>::max() == best.Source || currShift < prevShift
+                        || (currShift == prevShift && interval->end() > best.Interval.end()))
+                    {
+                        best.Source = i;
+                        best.Interval = *interval;
+                    }
+                }
+
+                if (std::numeric_limits<size_t>::max() == best.Source)
+                    return planned;
+
+                position = best.Interval.end();
+
+                if (!planned.empty())
+                {
+                    boost::posix_time::time_period& last = planned.back().Interval;
+                    if (last.end() > best.Interval.begin())
+                    {
+                        last = boost::posix_time::time_period(last.begin(), best.Interval.begin());
+                    }
+                }
+
+                planned.push_back(best);
+            }
+        }
+
+        int NextToPrepare(const TPlannedIntervals& planned, int active)
+        {
+            if (active < 0 || active + 1 >= int(planned.size()))
+                return -1;
+            return planned[active + 1].Source != planned[active].Source ? active + 1 : -1;
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "Exports.h"
+
+namespace NMMSS
+{
+    namespace NIntervalSequence
+    {
+        typedef std::vector<boost::posix_time::time_period> TPeriods;
+
+        /// A recorded interval and the index of the storage that plays it.
+        struct SPlannedInterval
+        {
+            boost::posix_time::time_period Interval = { boost::posix_time::ptime(boost::date_time::min_date_time), boost::posix_time::ptime(boost::date_time::min_date_time) };
+            size_t Source = std::numeric_limits<size_t>::max();
+        };
+        typedef std::vector<SPlannedInterval> TPlannedIntervals;
+
+        /// The recorded intervals of a storage that overlap the planned period, cut to it.
+        MMTRANSPORT_CLASS_DECLSPEC TPeriods ClipToPeriod(const boost::posix_time::time_period& period, const TPeriods& intervals);
+
+        /// Chains the recorded intervals of several storages, each sorted by time, from position on.
+        /// Every step takes the interval that resumes playback soonest, the one lasting longer on a tie,
+        /// and cuts the previous one short where the two overlap.
+        MMTRANSPORT_CLASS_DECLSPEC TPlannedIntervals Merge(const std::vector<TPeriods>& sources, boost::posix_time::ptime position);
+
+        /// The planned interval whose storage is opened while the active one plays, -1 when there is
+        /// none: the next interval, unless the active storage plays it on.
+        MMTRANSPORT_CLASS_DECLSPEC int NextToPrepare(const TPlannedIntervals& planned, int active);
+    }
+}
@@ -88,6 +88,15 @@ namespace NMMSS
         MMSS::ENetworkTransport transport = MMSS::EAUTO, MMSS::QualityOfService const* qos = nullptr,
         EFrameBufferingPolicy bufferingPolicy = EFrameBufferingPolicy::Buffered);
 
+    struct SSinkReconnectStatistics
+    {
+        std::size_t Waiting = 0;    // sink endpoints waiting for their next connection attempt
+        std::size_t Connecting = 0; // connection attempts in progress
+    };
+
+    // State of the process-wide reconnect queue of sink endpoints.
+    MMTRANSPORT_DECLSPEC SSinkReconnectStatistics GetSinkReconnectStatistics();
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
     class PSinkEndpoinConnectionWrapper
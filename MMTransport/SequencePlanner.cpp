@@ -1,13 +1,19 @@
 // documentation https://doc.axxonsoft.com/confluence/pages/viewpage.action?pageId=138449538
 
 #include <string>
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <tuple>
 
 #include <boost/thread.hpp> 
 #include <boost/asio.hpp>
 #include <boost/thread/reverse_lock.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/optional.hpp>
 #include <boost/date_time/posix_time/ptime.hpp>
 #include <CorbaHelpers/RefcountedImpl.h>
+#include <Executors/DynamicThreadPool.h>
 #include <Utils/TimedExecution.h>
 #include <Utils/TimeJitter.h>
 #include "../Sample.h"
@@ -17,11 +23,20 @@
 #include "SourceFactory.h"
 #include "MMTransport.h"
 #include "StatisticsCollectorImpl.h"
+#include "IntervalSequence.h"
+#include "ConcurrentQuery.h"
 #include "../EndOfStreamSample.h"
 
 namespace
 {
     const unsigned long MAX_INTERVALS = 32768;
+    // Storages are given this much time to answer a history query: the first one from
+    // the query on, the others from the first answer on. Planning is retried later when
+    // some have not answered, their answers are kept for the retry.
+    const std::chrono::milliseconds HISTORY_QUERY_DEADLINE(3000);
+    // Rounds after which planning goes on without the storages that have not answered yet.
+    const size_t MAX_HISTORY_QUERY_ROUNDS = 3;
+    const int MAX_HISTORY_QUERY_THREADS = 8;
 
     class CSequencedSource : 
         public virtual NMMSS::IStatisticsProvider, 
@@ -31,7 +46,6 @@ namespace
     {
         using PWeakSequencedSource = NCorbaHelpers::CWeakPtr<CSequencedSource>;
         using PSequencedSource = NCorbaHelpers::CAutoPtr<CSequencedSource>;
-        using TTimePeriodList = std::vector<boost::posix_time::time_period>;
         using TLock = boost::mutex::scoped_lock;
         using PStatisticsCollector = boost::scoped_ptr<NMMSS::IStatisticsCollectorImpl>;
 
@@ -50,13 +64,7 @@ namespace
         };
         using PSharedData = std::shared_ptr<SSharedData>;
 
-        /// The structure is designed to store the time interval and its Storage Source processor
-        struct SIntervalInfo
-        {
-            boost::posix_time::time_period Interval = { boost::posix_time::ptime(boost::date_time::min_date_time), boost::posix_time::ptime(boost::date_time::min_date_time) };
-            size_t Processor = std::numeric_limits<size_t>::max();
-        };
-        typedef std::vector<SIntervalInfo>  TPlanedIntervals;
+        using TPlanedIntervals = NMMSS::NIntervalSequence::TPlannedIntervals;
 
         class CStorageSourceProcessor:
             public NMMSS::IPullStyleSink,
@@ -153,22 +161,6 @@ namespace
                 }
             }
 
-            void BuildPeriod(const boost::posix_time::time_period& totalPeriod)
-            {
-                NMMSS::IStorageSourceClient::IntervalList_t intervals;
-                GetHistory(totalPeriod.begin(), totalPeriod.end(), MAX_INTERVALS, intervals);
-
-                m_intervals.clear();
-                for (const auto& interval : intervals)
-                {
-                    auto period = totalPeriod.intersection({ NMMSS::PtimeFromQword(interval.beginTime), NMMSS::PtimeFromQword(interval.endTime) });
-                    if (!period.is_null())
-                    {
-                        m_intervals.push_back(period);
-                    }
-                }
-            }
-
             template<typename F>
             void execAndCheckExceptions(const char* location, const F& f)
             {
@@ -208,40 +200,6 @@ namespace
                 });
             }
 
-            void GetBoundary(boost::posix_time::ptime& lower, boost::posix_time::ptime& upper)
-            {
-                NMMSS::IStorageSourceClient::IntervalList_t intervals;
-                GetHistory(boost::posix_time::min_date_time, boost::posix_time::max_date_time, 1, intervals);
-                if (!intervals.empty())
-                {
-                    lower = NMMSS::PtimeFromQword(intervals[0].beginTime);
-                    upper = NMMSS::PtimeFromQword(intervals[0].endTime);
-                }
-            }
-
-            boost::posix_time::time_duration getIntervalShift(const boost::posix_time::time_period& interval, const boost::posix_time::ptime& t)
-            {
-                return (t < interval.begin()) ? interval.begin() - t : boost::posix_time::seconds(0);
-            }
-
-            bool OfferBestInterval(SIntervalInfo* srcInterval)
-            {
-                boost::posix_time::time_period interval = GetSuitableEnumeratorInterval();
-                if (!interval.is_null())
-                {
-                    auto currShift = getIntervalShift(interval, m_sharedData->TimePosition);
-                    auto prevShift = getIntervalShift(srcInterval->Interval, m_sharedData->TimePosition);
-                    if (std::numeric_limits<size_t>::max() == srcInterval->Processor || currShift < prevShift
-                        || (currShift == prevShift && interval.end() > srcInterval->Interval.end()))
-                    {
-                        srcInterval->Processor = m_index;
-                        srcInterval->Interval = interval;
-                        return true;
-                    }
-                }
-                return false;
-            }
-
             void Start(TLock& lock, const boost::posix_time::time_period& interval)
             {
                 _log_ << "Sequence planner " << m_sharedData.get() << ": interval " << interval << " processor " << m_index;
@@ -250,6 +208,24 @@ namespace
                 resetSinkConnection(lock);
             }
 
+            /// Opens the storage endpoint for the interval that is played next, so that Start only has to seek it.
+            void Prepare(TLock& lock, const boost::posix_time::time_period& interval)
+            {
+                if (m_sinkEP)
+                    return;
+
+                _dbg_ << "Sequence planner " << m_sharedData.get() << ": prepare interval " << interval << " processor " << m_index;
+                std::string sTime = boost::posix_time::to_iso_string(m_sharedData->Mode & NMMSS::PMF_REVERSE ? interval.end() : interval.begin());
+                NMMSS::EPlayModeFlags mode = m_sharedData->Mode;
+                NMMSS::EEndpointStartPosition startPos = m_sharedData->FramePosition;
+                m_justStarted = false;
+
+                execAndCheckExceptions(__FUNCTION__, [&]
+                {
+                    createConnection(lock, sTime, startPos, mode);
+                });
+            }
+
             void DoRequest(TLock& lock, int count)
             {
                 if (m_sharedData->IsRunnable(m_savedSessionOut) && m_pullSrc)
@@ -354,19 +330,11 @@ namespace
                 }
             }
 
-            boost::posix_time::time_period GetSuitableEnumeratorInterval()
-            {
-                auto it = std::upper_bound(m_intervals.begin(), m_intervals.end(), m_sharedData->TimePosition,
-                    [](const boost::posix_time::ptime& t, const boost::posix_time::time_period& period) { return t < period.end(); });
-                return (it != m_intervals.end()) ? *it : boost::posix_time::time_period(boost::posix_time::ptime(), boost::posix_time::ptime());
-            }
-
             NMMSS::PStorageSourceClient     m_storageSource;
             PSharedData                     m_sharedData;
             size_t                          m_index;
             NMMSS::PStorageEndpointClient   m_sourceEP;
             NMMSS::PSinkEndpoint            m_sinkEP;
-            TTimePeriodList                 m_intervals;
             NMMSS::PPullStyleSource         m_pullSrc;
             boost::posix_time::time_period  m_interval;
             bool                            m_endReached = false;
@@ -375,6 +343,10 @@ namespace
             std::uint32_t m_savedSessionOut = 0;
         };
         typedef NCorbaHelpers::CAutoPtr<CStorageSourceProcessor> PStorageSourceProcessor;
+        using TIntervalList = NMMSS::IStorageSourceClient::IntervalList_t;
+        using THistoryQuery = NMMSS::NIntervalSequence::CConcurrentQuery<TIntervalList>;
+        using THistoryResults = THistoryQuery::TResults;
+        using THistoryKey = std::tuple<boost::posix_time::ptime, boost::posix_time::ptime, std::uint32_t>;
 
     public:
         CSequencedSource(DECLARE_LOGGER_ARG, const NMMSS::StorageSourcesList_t& storageSources, const std::string& beginTime,
@@ -386,6 +358,9 @@ namespace
             auto executor = NExecutors::CreateDynamicThreadPool(GET_THIS_LOGGER_PTR, "SeqPlanner", MAX_QUEUE_LENGTH, 0, 1);
             m_timer = NUtils::CreateSteadyTimerExecutor(executor);
 
+            const int queryThreads = std::max(1, std::min<int>(storageSources.size(), MAX_HISTORY_QUERY_THREADS));
+            m_historyPool = NExecutors::CreateDynamicThreadPool(GET_THIS_LOGGER_PTR, "SeqPlanHistory", 2 * queryThreads, 0, queryThreads);
+
             _log_ << "Create sequence planner " << m_sharedData.get();
 
             m_sharedData->TimePosition = boost::posix_time::from_iso_string(beginTime);
@@ -444,7 +419,7 @@ namespace
             m_sharedData->RequestedCount += count;
             if (!m_planedIntervals.empty() && m_activeInterval >= 0 && m_activeInterval < (int)m_planedIntervals.size())
             {
-                m_storageProcs[m_planedIntervals[m_activeInterval].Processor]->DoRequest(lock, count);
+                m_storageProcs[m_planedIntervals[m_activeInterval].Source]->DoRequest(lock, count);
             }
         }
 
@@ -469,6 +444,7 @@ namespace
         {
             ++m_sharedData->SessionIn;
             clearIntervals();
+            m_historyQueries.clear();
             postRerunnable(m_sharedData->SessionOut, &CSequencedSource::startPlaying);
         }
 
@@ -570,15 +546,72 @@ namespace
             if (m_activeInterval + 1 < (int)m_planedIntervals.size())
             {
                 auto interval = m_planedIntervals[m_activeInterval + 1];
-                m_storageProcs[interval.Processor]->Start(lock, interval.Interval);
+                m_storageProcs[interval.Source]->Start(lock, interval.Interval);
                 ++m_activeInterval;
                 m_discontinuity = true;
+                postRerunnable(m_sharedData->SessionOut, &CSequencedSource::prepareNextInterval);
                 return true;
             }
             clearIntervals();
             return false;
         }
 
+        void prepareNextInterval(TLock& lock, std::uint32_t sessionId)
+        {
+            const int next = NMMSS::NIntervalSequence::NextToPrepare(m_planedIntervals, m_activeInterval);
+            if (next >= 0)
+                m_storageProcs[m_planedIntervals[next].Source]->Prepare(lock, m_planedIntervals[next].Interval);
+        }
+
+        /// Asks all storages for their history at once. When some have not answered in time, planning
+        /// is retried as if they were busy; the query is kept so that the retry waits for their late
+        /// answers instead of asking again. After MAX_HISTORY_QUERY_ROUNDS rounds with some answers,
+        /// planning goes on without the storages still silent.
+        THistoryResults queryHistory(TLock& lock, const boost::posix_time::ptime& beginTime, const boost::posix_time::ptime& endTime,
+            std::uint32_t maxCount)
+        {
+            if (m_storageProcs.empty())
+                return THistoryResults();
+
+            const THistoryKey key(beginTime, endTime, maxCount);
+            std::shared_ptr<THistoryQuery>& entry = m_historyQueries[key];
+            if (!entry)
+            {
+                auto procs = m_storageProcs;
+                entry = std::make_shared<THistoryQuery>(procs.size(),
+                    [procs, beginTime, endTime, maxCount](size_t i, TIntervalList& intervals)
+                {
+                    procs[i]->GetHistory(beginTime, endTime, maxCount, intervals);
+                });
+            }
+            const std::shared_ptr<THistoryQuery> query = entry;
+
+            bool complete = false;
+            {
+                NExecutors::PDynamicThreadPool pool = m_historyPool;
+                boost::reverse_lock<TLock> unlock(lock);
+                complete = query->Run([pool](const std::function<void()>& task) { return pool->Post(task); }, HISTORY_QUERY_DEADLINE);
+            }
+
+            if (!complete)
+            {
+                const size_t answered = query->Answered();
+                if (0 == answered || query->Rounds() < MAX_HISTORY_QUERY_ROUNDS)
+                {
+                    _wrn_ << "Sequence planner " << m_sharedData.get() << ": " << m_storageProcs.size() - answered
+                        << " storage(s) did not answer history request in time, planning is retried";
+                    throw NMMSS::XServerError(NMMSS::EServerStatus::BUSY_TRY_LATER, "history request is not answered in time");
+                }
+                _wrn_ << "Sequence planner " << m_sharedData.get() << ": planning without " << m_storageProcs.size() - answered
+                    << " storage(s) that did not answer history request in " << query->Rounds() << " rounds";
+            }
+
+            auto it = m_historyQueries.find(key);
+            if (m_historyQueries.end() != it && it->second == query)
+                m_historyQueries.erase(it);
+            return query->Results();
+        }
+
         void buildIntervalsSequence(TLock& lock, std::uint32_t sessionId)
         {
             clearIntervals();
@@ -590,52 +623,37 @@ namespace
 
             static const boost::posix_time::time_duration HISTORY_PORTION = boost::posix_time::hours(24);
 
+            // The position moves only once the history is known, planning may be retried.
+            boost::posix_time::ptime position = m_sharedData->TimePosition;
             if (m_sharedData->Mode & NMMSS::PMF_REVERSE)
             {
-                m_sharedData->TimePosition -= HISTORY_PORTION;
+                position -= HISTORY_PORTION;
             }
             if (m_sharedData->FramePosition == NMMSS::espOneFrameBack)
             {
-                m_sharedData->TimePosition = std::min(m_sharedData->TimePosition, m_upperTime - boost::posix_time::milliseconds(1));
+                position = std::min(position, m_upperTime - boost::posix_time::milliseconds(1));
             }
 
-            boost::posix_time::ptime beginTime = m_sharedData->TimePosition;
+            boost::posix_time::ptime beginTime = position;
             boost::posix_time::ptime endTime = beginTime + HISTORY_PORTION;
 
-            for (auto proc : m_storageProcs)
+            const THistoryResults history = queryHistory(lock, beginTime, endTime, MAX_INTERVALS);
+            std::vector<NMMSS::NIntervalSequence::TPeriods> recorded(history.size());
+            for (size_t i = 0; i < history.size(); ++i)
             {
-                boost::reverse_lock<TLock> unlock(lock);
-                proc->BuildPeriod({ beginTime, endTime });
+                if (!history[i])
+                    continue;
+
+                NMMSS::NIntervalSequence::TPeriods intervals;
+                for (const auto& interval : *history[i])
+                    intervals.emplace_back(NMMSS::PtimeFromQword(interval.beginTime), NMMSS::PtimeFromQword(interval.endTime));
+                recorded[i] = NMMSS::NIntervalSequence::ClipToPeriod({ beginTime, endTime }, intervals);
             }
 
             if (m_sharedData->IsRunnable(sessionId))
             {
-                bool offered;
-                do
-                {
-                    offered = false;
-                    SIntervalInfo info;
-
-                    for (auto proc : m_storageProcs)
-                        offered |= proc->OfferBestInterval(&info);
-
-                    if (offered)
-                    {
-                        m_sharedData->TimePosition = info.Interval.end();
-
-                        if (!m_planedIntervals.empty())
-                        {
-                            boost::posix_time::time_period& last = m_planedIntervals.back().Interval;
-                            if (last.end() > info.Interval.begin())
-                            {
-                                last = boost::posix_time::time_period(last.begin(), info.Interval.begin());
-                            }
-                        }
-
-                        m_planedIntervals.push_back(info);
-                    }
-                }
-                while (offered);
+                m_sharedData->TimePosition = position;
+                m_planedIntervals = NMMSS::NIntervalSequence::Merge(recorded, position);
 
                 if (m_sharedData->Mode & NMMSS::PMF_REVERSE)
                 {
@@ -665,16 +683,19 @@ namespace
             m_lowerTime = boost::posix_time::ptime();
             m_upperTime = boost::posix_time::ptime();
 
-            for (auto proc : m_storageProcs)
+            if (!m_sharedData->IsRunnable(sessionId))
             {
-                boost::posix_time::ptime lower;
-                boost::posix_time::ptime upper;
+                return false;
+            }
 
-                if (m_sharedData->IsRunnable(sessionId))
-                {
-                    boost::reverse_lock<TLock> unlock(lock);
-                    proc->GetBoundary(lower, upper);
-                }
+            const THistoryResults history = queryHistory(lock, boost::posix_time::min_date_time, boost::posix_time::max_date_time, 1);
+            for (const auto& intervals : history)
+            {
+                if (!intervals || intervals->empty())
+                    continue;
+
+                boost::posix_time::ptime lower = NMMSS::PtimeFromQword((*intervals)[0].beginTime);
+                boost::posix_time::ptime upper = NMMSS::PtimeFromQword((*intervals)[0].endTime);
 
                 if (!lower.is_not_a_date_time() && (m_lowerTime.is_not_a_date_time() || lower < m_lowerTime))
                     m_lowerTime = lower;
@@ -719,9 +740,11 @@ namespace
         }
 
         NUtils::PSteadyTimerExecutor            m_timer;
+        NExecutors::PDynamicThreadPool          m_historyPool;
         PStatisticsCollector                    m_measurer;
         PSharedData m_sharedData = std::make_shared<SSharedData>();
         std::vector<PStorageSourceProcessor>    m_storageProcs;
+        std::map<THistoryKey, std::shared_ptr<THistoryQuery>> m_historyQueries;
         TPlanedIntervals                        m_planedIntervals;
         boost::posix_time::ptime                m_lowerTime;
         boost::posix_time::ptime                m_upperTime;
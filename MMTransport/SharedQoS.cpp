@@ -0,0 +1,79 @@
+#include <map>
+#include <sstream>
+
+#include "SharedQoS.h"
+#include "QualityOfService.h"
+
+namespace
+{
+    bool ToStartFrom(MMSS::QoSRequest::StartFrom const& r, NMMSS::EStartFrom& start)
+    {
+        switch (r.from)
+        {
+        case MMSS::QoSRequest::StartFrom::NextKeyFrame:
+            start = NMMSS::EStartFrom::NextKeyFrame;
+            return true;
+        case MMSS::QoSRequest::StartFrom::PrevKeyFrame:
+            start = NMMSS::EStartFrom::PrevKeyFrame;
+            return true;
+        case MMSS::QoSRequest::StartFrom::Preroll:
+            start = NMMSS::EStartFrom::Preroll;
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+namespace NMMSS
+{
+    namespace NSharedSources
+    {
+        SSharedQoS MakeSharedQoS(MMSS::QualityOfService const& qos)
+        {
+            SSharedQoS result{ std::string(), MMSS::QualityOfService(), NMMSS::EStartFrom{} };
+
+            std::map<MMSS::EQoSRequest, CORBA::ULong> last;
+            for (CORBA::ULong i = 0; i < qos.length(); ++i)
+                last[qos[i]._d()] = i;
+
+            std::ostringstream key;
+            key.precision(17);
+            key << "qos;";
+            for (auto const& r : last)
+            {
+                MMSS::UQoSRequest const& u = qos[r.second];
+                switch (u._d())
+                {
+                case MMSS::QOS_OnlyKeyFrames:
+                    if (!u.onlyKeyFrames().enabled)
+                        continue;
+                    key << "k;";
+                    break;
+                case MMSS::QOS_FrameRate:
+                    key << "r" << u.frameRate().fps << ',' << bool(u.frameRate().preroll) << ';';
+                    break;
+                case MMSS::QOS_FrameGeometry:
+                    key << "g" << u.frameGeometry().width << 'x' << u.frameGeometry().height << ';';
+                    break;
+                case MMSS::QOS_DecoderRequirements:
+                    key << "d" << u.decoderRequirements().deviceTypeMask
+                        << ',' << u.decoderRequirements().deviceIdMask
+                        << ',' << u.decoderRequirements().memoryTypeMask
+                        << ',' << u.decoderRequirements().targetProcessId << ';';
+                    break;
+                case MMSS::QOS_StartFrom:
+                    if (!ToStartFrom(u.startFrom(), result.Start))
+                        return SSharedQoS();
+                    continue;
+                default:
+                    // Buffer and PlaybackDepth describe the state of a particular connection.
+                    return SSharedQoS();
+                }
+                detail::push_back(result.QoS, u);
+            }
+            result.Key = key.str();
+            return result;
+        }
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include <MMIDL/MMQualityOfServiceC.h>
+#include "../MMSS.h"
+
+#include "Exports.h"
+
+namespace NMMSS
+{
+    namespace NSharedSources
+    {
+        /// QoS in the form the shared sources are keyed by: one request per kind (the
+        /// last one wins, as it does when the policy applies them in order), sorted
+        /// by kind, with no-op requests dropped. The start position is split off
+        /// because the distributor honours it for every sink separately.
+        /// An empty Key means the QoS carries per-connection state and must not be shared.
+        struct SSharedQoS
+        {
+            std::string Key;
+            MMSS::QualityOfService QoS;
+            NMMSS::EStartFrom Start;
+        };
+
+        MMTRANSPORT_CLASS_DECLSPEC SSharedQoS MakeSharedQoS(MMSS::QualityOfService const& qos);
+    }
+}
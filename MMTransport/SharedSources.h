@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <CorbaHelpers/RefcountedImpl.h>
+
+namespace NMMSS
+{
+    namespace NSharedSources
+    {
+        /// Sources shared by key and held weakly: a source lives as long as a connection uses it.
+        template <typename TShared>
+        class CSharedSources
+        {
+        public:
+            typedef NCorbaHelpers::CAutoPtr<TShared> PShared;
+            typedef NCorbaHelpers::CWeakPtr<TShared> WPShared;
+            /// Makes the source for a key, null when it cannot.
+            typedef std::function<PShared()> FCreate;
+
+            /// The live source of key, or the one create makes. create runs unlocked, so a slow
+            /// factory holds up no other connection. When another connection registers the key
+            /// meanwhile, its source is shared and the one just made is dropped.
+            PShared Acquire(std::string const& key, FCreate const& create)
+            {
+                if (PShared source = Find(key))
+                    return source;
+
+                PShared created = create();
+                if (!created)
+                    return PShared();
+
+                // Declared before the lock: references taken while sweeping expired
+                // entries may turn out to be the last ones.
+                std::vector<PShared> alive;
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                auto it = m_sources.find(key);
+                if (it != m_sources.end())
+                {
+                    PShared source = it->second;
+                    if (source)
+                        return source;
+                }
+
+                for (auto i = m_sources.begin(); i != m_sources.end();)
+                {
+                    PShared source = i->second;
+                    if (source)
+                    {
+                        alive.push_back(source);
+                        ++i;
+                    }
+                    else
+                        i = m_sources.erase(i);
+                }
+                m_sources[key] = WPShared(created);
+                return created;
+            }
+
+            PShared Find(std::string const& key) const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_sources.find(key);
+                return it != m_sources.end() ? PShared(it->second) : PShared();
+            }
+
+            /// The keys registered, expired ones included until the next source is made.
+            size_t Size() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_sources.size();
+            }
+
+        private:
+            mutable std::mutex m_mutex;
+            std::unordered_map<std::string, WPShared> m_sources;
+        };
+    }
+}
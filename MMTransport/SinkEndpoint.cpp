@@ -1,6 +1,12 @@
 
 #include <ace/OS.h>
+#include <map>
+#include <deque>
 #include <string>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
 #include <initializer_list>
 
 #include <boost/thread/thread.hpp>
@@ -12,6 +18,7 @@
 #include <boost/function.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/enable_shared_from_this.hpp>
 
 #include <CorbaHelpers/Container.h>
 #include <CorbaHelpers/Refcounted.h>
@@ -20,6 +27,7 @@
 #include <CorbaHelpers/UnhandledException.h>
 #include <CorbaHelpers/Unicode.h>
 #include <CorbaHelpers/CorbaStl.h>
+#include <Executors/DynamicThreadPool.h>
 
 #include "ConnectionInitiator.h"
 #include "../MMSS.h"
@@ -123,6 +131,247 @@ std::string getLoggerPrefix(const void* ptr, const std::string& endpointName)
     return oss.str();
 }
 
+// "hosts/Server1/DeviceIpint.1/SourceEndpoint.video:0:0" -> "Server1".
+std::string getRemoteHost(const std::string& endpointName)
+{
+    const char HOSTS_PREFIX[] = "hosts/";
+    std::string::size_type begin = 0;
+    if (0 == endpointName.compare(0, sizeof(HOSTS_PREFIX) - 1, HOSTS_PREFIX))
+        begin = sizeof(HOSTS_PREFIX) - 1;
+    return endpointName.substr(begin, endpointName.find('/', begin) - begin);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Reconnect queue shared by all sink endpoints of the process. Waiting sinks
+// are kept ordered by deadline and woken by a single reactor timer. The
+// connection RPC is blocking, so due attempts run on a thread pool rather than
+// on the reactor, but no more than MAX_ATTEMPTS of them at once and no more
+// than MAX_ATTEMPTS_PER_HOST towards one server, so a restarted server is not
+// hit by all its former clients at the same moment.
+class CReconnectScheduler : public boost::enable_shared_from_this<CReconnectScheduler>
+{
+    typedef std::chrono::steady_clock TClock;
+
+public:
+    typedef boost::function0<void> FAttempt;
+
+    static const std::size_t MAX_ATTEMPTS = 32;
+    static const std::size_t MAX_ATTEMPTS_PER_HOST = 4;
+
+    explicit CReconnectScheduler(DECLARE_LOGGER_ARG)
+        :   m_reactor(NCorbaHelpers::GetReactorInstanceShared())
+        ,   m_pool(getAttemptPool(GET_LOGGER_PTR))
+        ,   m_timer(m_reactor->GetIO())
+        ,   m_attempts(0)
+        ,   m_random(std::random_device()())
+    {
+    }
+
+    ~CReconnectScheduler()
+    {
+        m_timer.cancel();
+    }
+
+    // Replaces an attempt already scheduled for the same id. An empty host
+    // is not limited per host. Failures escaping the attempt go to its logger.
+    void Schedule(const void* id, const std::string& host, boost::posix_time::time_duration delay, FAttempt attempt,
+        NLogging::PLogger logger)
+    {
+        SAttempt replaced;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            replaced = removeLocked(id);
+
+            const TClock::time_point deadline = TClock::now() + std::chrono::milliseconds(delay.total_milliseconds());
+            const TQueue::iterator it = m_queue.insert(std::make_pair(deadline, SAttempt{ id, host, attempt, logger }));
+            m_index[id] = it;
+            if (m_queue.begin() == it)
+                armTimer(lock);
+        }
+    }
+
+    void Cancel(const void* id)
+    {
+        SAttempt removed;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            removed = removeLocked(id);
+        }
+    }
+
+    // Equal jitter: somewhere in the upper half of the backoff, so sinks
+    // dropped at the same moment spread their retries.
+    boost::posix_time::time_duration Jitter(boost::posix_time::time_duration delay)
+    {
+        const std::int64_t ms = delay.total_milliseconds();
+        boost::mutex::scoped_lock lock(m_mutex);
+        std::uniform_int_distribution<std::int64_t> distribution(ms / 2, ms);
+        return boost::posix_time::milliseconds(distribution(m_random));
+    }
+
+    NMMSS::SSinkReconnectStatistics GetStatistics()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        NMMSS::SSinkReconnectStatistics st;
+        st.Waiting = m_queue.size() + m_ready.size();
+        st.Connecting = m_attempts;
+        return st;
+    }
+
+private:
+    struct SAttempt
+    {
+        const void* Id;
+        std::string Host;
+        FAttempt Run;
+        NLogging::PLogger Logger;
+    };
+    typedef std::multimap<TClock::time_point, SAttempt> TQueue;
+
+    // The caller destroys the returned attempt after releasing the lock:
+    // it may hold the last reference to its endpoint.
+    SAttempt removeLocked(const void* id)
+    {
+        SAttempt removed = SAttempt();
+        auto it = m_index.find(id);
+        if (m_index.end() != it)
+        {
+            removed = std::move(it->second->second);
+            m_queue.erase(it->second);
+            m_index.erase(it);
+            return removed;
+        }
+
+        auto ready = std::find_if(m_ready.begin(), m_ready.end(), [id](const SAttempt& a) { return a.Id == id; });
+        if (m_ready.end() != ready)
+        {
+            removed = std::move(*ready);
+            m_ready.erase(ready);
+        }
+        return removed;
+    }
+
+    void armTimer(boost::mutex::scoped_lock& lock)
+    {
+        if (m_queue.empty())
+            return;
+        m_timer.expires_at(m_queue.begin()->first);
+        m_timer.async_wait(boost::bind(&CReconnectScheduler::onTimer,
+            boost::weak_ptr<CReconnectScheduler>(shared_from_this()), boost::asio::placeholders::error));
+    }
+
+    static void onTimer(boost::weak_ptr<CReconnectScheduler> weak, const boost::system::error_code& error)
+    {
+        if (boost::asio::error::operation_aborted == error)
+            return;
+        if (boost::shared_ptr<CReconnectScheduler> self = weak.lock())
+            self->dispatchDue();
+    }
+
+    void dispatchDue()
+    {
+        std::vector<SAttempt> runnable;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            const TClock::time_point now = TClock::now();
+            while (!m_queue.empty() && m_queue.begin()->first <= now)
+            {
+                m_index.erase(m_queue.begin()->second.Id);
+                m_ready.push_back(std::move(m_queue.begin()->second));
+                m_queue.erase(m_queue.begin());
+            }
+            takeRunnable(lock, runnable);
+            armTimer(lock);
+        }
+        start(runnable);
+    }
+
+    void takeRunnable(boost::mutex::scoped_lock& lock, std::vector<SAttempt>& runnable)
+    {
+        for (auto it = m_ready.begin(); it != m_ready.end() && m_attempts < MAX_ATTEMPTS; )
+        {
+            std::size_t& hostAttempts = m_hostAttempts[it->Host];
+            if (!it->Host.empty() && hostAttempts >= MAX_ATTEMPTS_PER_HOST)
+            {
+                ++it;
+                continue;
+            }
+            ++hostAttempts;
+            ++m_attempts;
+            runnable.push_back(std::move(*it));
+            it = m_ready.erase(it);
+        }
+    }
+
+    // The pool outlives every scheduler: the last reference to one may well
+    // be released by an attempt running on it.
+    static NExecutors::PDynamicThreadPool getAttemptPool(DECLARE_LOGGER_ARG)
+    {
+        static const NExecutors::PDynamicThreadPool pool =
+            NExecutors::CreateDynamicThreadPool(GET_LOGGER_PTR, "SinkReconnect", MAX_ATTEMPTS, 0, MAX_ATTEMPTS);
+        return pool;
+    }
+
+    void start(std::vector<SAttempt>& runnable)
+    {
+        boost::shared_ptr<CReconnectScheduler> self(shared_from_this());
+        for (SAttempt& a : runnable)
+        {
+            auto task = [self, a = std::move(a)]()
+            {
+                ExecuteCatchUnhandled<FAttempt>(a.Run, a.Logger, "CSinkEndpoint::ReconnectAttempt");
+                self->onAttemptDone(a.Host);
+            };
+            if (!m_pool->Post(task))
+                task();
+        }
+    }
+
+    void onAttemptDone(const std::string& host)
+    {
+        std::vector<SAttempt> runnable;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            --m_attempts;
+            auto it = m_hostAttempts.find(host);
+            if (m_hostAttempts.end() != it && 0 == --it->second)
+                m_hostAttempts.erase(it);
+            takeRunnable(lock, runnable);
+        }
+        start(runnable);
+    }
+
+private:
+    NExecutors::PReactor m_reactor;
+    NExecutors::PDynamicThreadPool m_pool;
+    boost::asio::steady_timer m_timer;
+    boost::mutex m_mutex;
+    TQueue m_queue;
+    std::map<const void*, TQueue::iterator> m_index;
+    std::deque<SAttempt> m_ready;   // due, but over the concurrency limits
+    std::map<std::string, std::size_t> m_hostAttempts;
+    std::size_t m_attempts;
+    std::mt19937 m_random;
+};
+
+typedef boost::shared_ptr<CReconnectScheduler> PReconnectScheduler;
+
+boost::mutex g_reconnectSchedulerMutex;
+boost::weak_ptr<CReconnectScheduler> g_reconnectScheduler;
+
+PReconnectScheduler GetReconnectSchedulerInstance(DECLARE_LOGGER_ARG)
+{
+    boost::mutex::scoped_lock lock(g_reconnectSchedulerMutex);
+    PReconnectScheduler res = g_reconnectScheduler.lock();
+    if (!res)
+    {
+        res.reset(new CReconnectScheduler(GET_LOGGER_PTR));
+        g_reconnectScheduler = res;
+    }
+    return res;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 class CSinkEndpoint 
@@ -151,56 +400,59 @@ private:
         }
     }
 
-    void ReconnectThreadProcedure()
+    void ReconnectAttempt()
     {
-        // НЕ СТАВЬТЕ ЗДЕСЬ НИКАКИХ ЛОГГЕРОВ И Т.Д.!!
-        {
-            TRACE_BLOCK;
+        TRACE_BLOCK;
 
-            const unsigned int DEFAULT_TIME_TO_SLEEP = 8; // seconds
-            boost::posix_time::seconds timeToSleep = m_rpcSteps->RemakeTimeout();
+        const boost::posix_time::seconds MAX_RECONNECT_DELAY(8);
 
-            boost::recursive_mutex::scoped_lock lock(m_mutex);
-            while (ES_Open_Disconnected == m_state && m_rpcSteps->IsReconnectPossible())
-            {
-                _trc_ << "Connecting...";
+        boost::recursive_mutex::scoped_lock lock(m_mutex);
+        if (ES_Open_Disconnected != m_state || !m_rpcSteps->IsReconnectPossible())
+            return;
 
-                try
-                {
-                    Connect(lock);
-                    m_connectionAttempts = 0;
-                    m_error = "";
-                }   
-                catch(const CORBA::Exception& e)
-                {
-                    if (m_error != e._name())
-                    {
-                        m_error = e._name();
-                        _err_ << __FUNCTION__ << ". " << m_error;
-                    }
-                }
-                catch(const std::exception& e)
-                {
-                    if (m_error != e.what())
-                    {
-                        m_error = e.what();
-                        _err_ << __FUNCTION__ << ". " << m_error;
-                    }
-                }
+        _trc_ << "Connecting...";
 
-                if (ES_Open_Disconnected == m_state && m_rpcSteps->IsReconnectPossible())
-                {
-                    m_rpcSteps->CleanUp();
-                    if (timeToSleep < boost::posix_time::seconds(DEFAULT_TIME_TO_SLEEP))
-                        timeToSleep *= 2;
-                    this->m_conditionStateChanged.timed_wait(lock,
-                        boost::get_system_time() + boost::posix_time::seconds(timeToSleep));
-                }
+        try
+        {
+            Connect(lock);
+            m_connectionAttempts = 0;
+            m_error = "";
+        }
+        catch(const CORBA::Exception& e)
+        {
+            if (m_error != e._name())
+            {
+                m_error = e._name();
+                _err_ << __FUNCTION__ << ". " << m_error;
+            }
+        }
+        catch(const std::exception& e)
+        {
+            if (m_error != e.what())
+            {
+                m_error = e.what();
+                _err_ << __FUNCTION__ << ". " << m_error;
             }
-            this->m_threadReconnect.reset();
+        }
+
+        if (ES_Open_Disconnected == m_state && m_rpcSteps->IsReconnectPossible())
+        {
+            m_rpcSteps->CleanUp();
+            if (m_reconnectDelay < MAX_RECONNECT_DELAY)
+                m_reconnectDelay *= 2;
+            ScheduleAttempt(m_reconnectScheduler->Jitter(m_reconnectDelay), lock);
         }
     }
 
+    void ScheduleAttempt(boost::posix_time::time_duration delay, boost::recursive_mutex::scoped_lock& lock)
+    {
+        if(!lock)
+            throw std::logic_error("CSinkEndpoint::ScheduleAttempt(): lock should be acquired");
+        m_reconnectScheduler->Schedule(this, m_remoteHost, delay,
+            boost::bind(&CSinkEndpoint::ReconnectAttempt, NCorbaHelpers::ShareRefcounted(this)),
+            NLogging::PLogger(GET_LOGGER_PTR, NCorbaHelpers::ShareOwnership()));
+    }
+
     void InitReconnect(boost::recursive_mutex::scoped_lock &lock)
     {
         if(!lock)
@@ -209,11 +461,8 @@ private:
             return;
         if (m_rpcSteps->IsReconnectPossible())
         {
-            m_threadReconnect.reset(new boost::thread(
-                boost::bind(ExecuteCatchUnhandled<boost::function0<void> >,
-                    boost::function0<void>(boost::bind(&CSinkEndpoint::ReconnectThreadProcedure, NCorbaHelpers::ShareRefcounted(this))),
-                        NLogging::PLogger(GET_LOGGER_PTR, NCorbaHelpers::ShareOwnership()), 
-                        "CSinkEndpoint::ReconnectThreadProcedure")));
+            m_reconnectDelay = m_rpcSteps->RemakeTimeout();
+            ScheduleAttempt(boost::posix_time::seconds(0), lock);
         }
     }
 
@@ -602,28 +851,12 @@ private:
 private:
     void SheduleReconnect(boost::recursive_mutex::scoped_lock &lock)
     {
-            const int seconds=(1<<(std::max<int>(++m_connectionAttempts, 3)));
-            boost::posix_time::time_duration timeout=boost::posix_time::seconds(seconds);
-            m_connectTimer.expires_from_now(timeout);
-            m_connectTimer.async_wait(boost::bind(&CSinkEndpoint::NextReconnectTimeout, 
-                NCorbaHelpers::CAutoPtr<CSinkEndpoint>(this, NCorbaHelpers::ShareOwnership()),
-                boost::asio::placeholders::error));
-    }
-
-    void NextReconnectTimeout(const boost::system::error_code& error)
-    {
-        if (!error)
-        {
-            boost::recursive_mutex::scoped_lock lock(m_mutex);
-            if(IsOpen(lock))
-            {
-                InitReconnect(lock);
-            }
-        }
-        else
-        {
-            _log_ << "Reconnect timer error: " << error.message();
-        }
+        if(ES_Open_Disconnected!=m_state || !m_rpcSteps->IsReconnectPossible())
+            return;
+        // 8 seconds after the first drop, doubling while the connection keeps dropping, up to 64.
+        const int seconds=(1<<(std::min<int>(std::max<int>(++m_connectionAttempts, 3), 6)));
+        m_reconnectDelay = m_rpcSteps->RemakeTimeout();
+        ScheduleAttempt(m_reconnectScheduler->Jitter(boost::posix_time::seconds(seconds)), lock);
     }
 
     MMSS::NetworkTransportSeq* generateTransport()
@@ -655,10 +888,11 @@ public:
         :   NLogging::WithLogger(GET_LOGGER_PTR, getLoggerPrefix(this, endpointName))
         ,   m_sink(sink, NCorbaHelpers::ShareOwnership())
         ,   m_rpcSteps(std::move(rpcSteps))
-        ,   m_reactor(NCorbaHelpers::GetReactorFromPool())
+        ,   m_reconnectScheduler(GetReconnectSchedulerInstance(GET_LOGGER_PTR))
+        ,   m_remoteHost(getRemoteHost(endpointName))
         ,   m_state(ES_Closed)
         ,   m_connectionAttempts(0)
-        ,   m_connectTimer(m_reactor->GetIO())
+        ,   m_reconnectDelay(boost::posix_time::seconds(0))
         ,   m_transport(transport)
         ,   m_qos( qos ? *qos : MMSS::QualityOfService() )
         ,   m_bufferingPolicy(bufferingPolicy)
@@ -671,10 +905,6 @@ public:
     virtual ~CSinkEndpoint()
     {
         Destroy();
-
-        std::unique_ptr<boost::thread> threadReconnect( std::move(m_threadReconnect) );
-        if(threadReconnect.get() && (threadReconnect->get_id()!=boost::this_thread::get_id()))
-            threadReconnect->join();
         _log_ << "destroyed";
     }
 
@@ -712,7 +942,7 @@ public:
 
         ChangeState(ES_Closing, lock);
 
-        m_connectTimer.cancel();
+        m_reconnectScheduler->Cancel(this);
         Disconnect(lock);
 
         ChangeState(ES_Closed, lock);
@@ -732,7 +962,6 @@ public:
         try
         {
             DestroyUnSafely();
-            m_connectTimer.cancel();
         }
         catch (const std::exception &e)
         {
@@ -824,17 +1053,17 @@ private:
     NMMSS::PConnectionInitiator m_connectionInitiator;
     PSink m_sink;
     NMMSS::PConnectionRpcSteps m_rpcSteps;
-    NExecutors::PReactor m_reactor;
+    PReconnectScheduler m_reconnectScheduler;
+    const std::string m_remoteHost;
     ESinkEndpointState m_state;
     int m_connectionAttempts;
-    boost::asio::deadline_timer m_connectTimer;
+    boost::posix_time::time_duration m_reconnectDelay;
     MMSS::ENetworkTransport m_transport;
     std::string m_cookie;
     MMSS::QualityOfService m_qos;
     NMMSS::EFrameBufferingPolicy m_bufferingPolicy;
     PConnectionBase m_sourceConnection;
     boost::condition m_conditionStateChanged;
-    std::unique_ptr<boost::thread> m_threadReconnect;
     std::string m_error;
     boost::recursive_mutex m_mutex;
 };
@@ -1115,4 +1344,14 @@ ISinkEndpoint* CreatePullConnectionByEndpointClient(DECLARE_LOGGER_ARG,
         sink, transport, qos, bufferingPolicy);
 }
 
+SSinkReconnectStatistics GetSinkReconnectStatistics()
+{
+    PReconnectScheduler scheduler;
+    {
+        boost::mutex::scoped_lock lock(g_reconnectSchedulerMutex);
+        scheduler = g_reconnectScheduler.lock();
+    }
+    return scheduler ? scheduler->GetStatistics() : SSinkReconnectStatistics();
+}
+
 }
@@ -15,6 +15,7 @@
 #include <CorbaHelpers/ListenEndpoints.h>
 #include <CorbaHelpers/Uuid.h>
 #include <CorbaHelpers/Unicode.h>
+#include <CorbaHelpers/RefcountedImpl.h>
 
 #include <MMIDL/MMEndpointS.h>
 #include <MMIDL/MMStorageS.h>
@@ -26,12 +27,87 @@
 #include "MMTransport.h"
 #include "SourceFactory.h"
 #include "QualityOfService.h"
+#include "SharedQoS.h"
+#include "SharedSources.h"
 #include "ConnectionAcceptor.h"
+#include "../ConnectionResource.h"
 
 #include <unordered_map>
 
 namespace
 {
+    using NMMSS::NSharedSources::SSharedQoS;
+    using NMMSS::NSharedSources::MakeSharedQoS;
+
+    // One QoS-aware source fed into a distributor, so that all connections with
+    // equivalent QoS reuse the same decimation/scaling/transcoding chain.
+    class CSharedSource
+        : public NCorbaHelpers::CWeakReferableImpl
+        , public NLogging::WithLogger
+    {
+    public:
+        CSharedSource(DECLARE_LOGGER_ARG, NMMSS::IQoSAwareSource* source, std::string const& key)
+            : NLogging::WithLogger(GET_LOGGER_PTR)
+            , m_source(source, NCorbaHelpers::ShareOwnership())
+            , m_key(key)
+        {
+            m_distributor = NMMSS::CreateDistributor(GET_LOGGER_PTR, NMMSS::NAugment::UnbufferedDistributor{});
+            if (!m_distributor)
+                throw std::runtime_error("CSharedSource: Cannot create distributor");
+
+            m_connection = NMMSS::CConnectionResource(m_source.Get(), m_distributor->GetSink(), GET_LOGGER_PTR);
+            if (!m_connection)
+                throw std::runtime_error("CSharedSource: Cannot connect distributor with source");
+        }
+        NMMSS::IPullStyleSource* CreateSource(NMMSS::EStartFrom startFrom)
+        {
+            return m_distributor->CreateSource(startFrom);
+        }
+        void ReprocessQoS()
+        {
+            m_source->ReprocessQoS();
+        }
+        std::string const& Key() const
+        {
+            return m_key;
+        }
+    private:
+        NMMSS::PQoSAwareSource m_source;
+        std::string const m_key;
+        NMMSS::PDistributor m_distributor;
+        NMMSS::CConnectionResource m_connection;
+    };
+    using PSharedSource = NCorbaHelpers::CAutoPtr<CSharedSource>;
+
+    // A connection's view of a shared source. QoS changes cannot be applied to
+    // the shared chain, CProxySource moves the connection to another source instead.
+    class CSharedSourceLeg
+        : public virtual NMMSS::IQoSAwareSource
+        , public NMMSS::CProxySourceImpl<NMMSS::IPullStyleSource>
+        , public NCorbaHelpers::CRefcountedImpl
+    {
+        using Base = NMMSS::CProxySourceImpl<NMMSS::IPullStyleSource>;
+    public:
+        CSharedSourceLeg(CSharedSource* shared, NMMSS::IPullStyleSource* source)
+            : Base(nullptr)
+            , m_shared(shared, NCorbaHelpers::ShareOwnership())
+        {
+            Base::setPin(source, NCorbaHelpers::TakeOwnership());
+        }
+        bool Serves(MMSS::QualityOfService const& qos) const
+        {
+            return MakeSharedQoS(qos).Key == m_shared->Key();
+        }
+        void ModifyQoS(MMSS::QualityOfService const&) override
+        {}
+        void ReprocessQoS() override
+        {
+            m_shared->ReprocessQoS();
+        }
+    private:
+        PSharedSource m_shared;
+    };
+
     class CProxySource
         : public virtual NMMSS::IQoSAwareSource
         , public NMMSS::CProxySourceImpl<NMMSS::IQoSAwareSource>
@@ -40,9 +116,12 @@ namespace
         using Base = NMMSS::CProxySourceImpl<NMMSS::IQoSAwareSource>;
 
     public:
-        CProxySource(std::function<void()> onDestroy)
+        using FCreateSource = std::function<NMMSS::IQoSAwareSource*(MMSS::QualityOfService const&)>;
+
+        CProxySource(std::function<void()> onDestroy, FCreateSource createSource)
             : Base( nullptr, NCorbaHelpers::ShareOwnership() )
             , m_onDestroy( onDestroy )
+            , m_createSource( createSource )
         {}
         ~CProxySource()
         {
@@ -62,13 +141,23 @@ namespace
     public:
         void ModifyQoS( MMSS::QualityOfService const& qos ) override
         {
-            if( auto pin = Base::getPin() )
-                pin->ModifyQoS( qos );
-            else
+            auto pin = Base::getPin();
             {
                 boost::unique_lock<boost::mutex> lock (m_mutex);
                 m_qos = qos;
             }
+            if( !pin )
+                return;
+
+            auto leg = dynamic_cast<CSharedSourceLeg*>( pin.Get() );
+            if( nullptr == leg )
+                pin->ModifyQoS( qos );
+            else if( !leg->Serves( qos ) )
+            {
+                NMMSS::PQoSAwareSource src( m_createSource( qos ) );
+                if( src )
+                    SetSource( src.Get() );
+            }
         }
         void ReprocessQoS() override
         {
@@ -79,6 +168,7 @@ namespace
         mutable boost::mutex m_mutex;
         MMSS::QualityOfService m_qos;
         std::function<void()> m_onDestroy;
+        FCreateSource m_createSource;
     };
     using PProxySource = NCorbaHelpers::CAutoPtr<CProxySource>;
     using PWeakProxySource = NCorbaHelpers::CWeakPtr<CProxySource>;
@@ -140,10 +230,10 @@ namespace
             ap.alignment = req.nAlignment;
         }
         NMMSS::ITcpConnectionAcceptor::FHandler makeTcpConnectionHandler(
-            PProxySource const& proxy, MMSS::QualityOfService const& qos, const MMSS::ConnectionInfo& ci )
+            PProxySource const& proxy, const MMSS::ConnectionInfo& ci )
         {
             return boost::bind(&CSourceEndpoint::connectTcpOutputChannel, 
-                NCorbaHelpers::ShareRefcounted(this), proxy, qos, ci._d(), _1);
+                NCorbaHelpers::ShareRefcounted(this), proxy, ci._d(), _1);
         }
         static NMMSS::FOnNetworkDisconnect makeDisconnectHandler(PProxySource proxy)
         {
@@ -151,18 +241,55 @@ namespace
             return [weak] () { if (PProxySource proxy = weak) proxy->Disconnect(); };
         }
 
+        NMMSS::IQoSAwareSource* createSource(MMSS::QualityOfService const& qos)
+        {
+            if (!canShareSources())
+                return m_sourceFactory->CreateSource(qos);
+
+            SSharedQoS shared(MakeSharedQoS(qos));
+            if (shared.Key.empty())
+                return m_sourceFactory->CreateSource(qos);
+
+            PSharedSource source(acquireSharedSource(shared));
+            if (!source)
+                return nullptr;
+
+            NMMSS::IPullStyleSource* leg = source->CreateSource(shared.Start);
+            if (nullptr == leg)
+                return nullptr;
+            return new CSharedSourceLeg(source.Get(), leg);
+        }
+        PSharedSource acquireSharedSource(SSharedQoS const& shared)
+        {
+            // The factory builds the whole chain, which may take a while: other
+            // connections are served meanwhile, see CSharedSources::Acquire.
+            PSharedSource created;
+            PSharedSource source = m_sharedSources.Acquire(shared.Key, [this, &shared, &created]()
+            {
+                NMMSS::PQoSAwareSource src(m_sourceFactory->CreateSource(shared.QoS));
+                if (src)
+                    created = PSharedSource(new CSharedSource(GET_LOGGER_PTR, src.Get(), shared.Key));
+                return created;
+            });
+
+            if (source && source.Get() == created.Get())
+                _dbg_ << "Create shared source for QoS " << shared.Key << ", " << m_sharedSources.Size() << " shared source(s)";
+            else if (source)
+                _dbg_ << "Share source for QoS " << shared.Key;
+            return source;
+        }
+
     private:
 
         void connectTcpOutputChannel(
             PProxySource const& proxy,
-            MMSS::QualityOfService const& qos,
             MMSS::ENetworkTransport transportType,
             NMMSS::PTCPSocket sock)
         {
             if(!sock)
                 return;
 
-            NMMSS::PQoSAwareSource src( m_sourceFactory->CreateSource(qos) );
+            NMMSS::PQoSAwareSource src( createSource(proxy->GetQoS()) );
 
             if(!src)
                 return; //??? at least close the socket
@@ -186,12 +313,11 @@ namespace
             NMMSS::GetConnectionBroker()->SetConnection(sink.Get(), proxy.Get(), GET_LOGGER_PTR);
         }
         void connectUdpOutputChannel( PProxySource const& proxy
-            , MMSS::QualityOfService const& qos
             , MMSS::ENetworkTransport transportType
             , NMMSS::PUDPSocket controlPeer
             , NMMSS::PUDPSocket dataPeer)
         {
-            NMMSS::PQoSAwareSource src( m_sourceFactory->CreateSource(qos) );
+            NMMSS::PQoSAwareSource src( createSource(proxy->GetQoS()) );
             if(!src)
                 return; //??? at least close the socket
 
@@ -210,11 +336,10 @@ namespace
             NMMSS::GetConnectionBroker()->SetConnection(sink.Get(), proxy.Get(), GET_LOGGER_PTR);
         }
         void connectUdpMulticastOutputChannel( PProxySource const& proxy
-            , MMSS::QualityOfService const& qos
             , const MMSS::ConnectionInfo& ci
             , NMMSS::PUDPSocket peer)
         {
-            NMMSS::PQoSAwareSource src( m_sourceFactory->CreateSource(qos) );
+            NMMSS::PQoSAwareSource src( createSource(proxy->GetQoS()) );
             if(!src)
                 return; //??? at least close the socket
 
@@ -268,8 +393,10 @@ namespace
             std::string cookie(newCookie());
             cookieOut = CORBA::string_dup(cookie.c_str());
 
+            NCorbaHelpers::CWeakPtr<CSourceEndpoint> weak(this);
             auto proxy = NCorbaHelpers::MakeRefcounted<CProxySource>(
-                boost::bind(&CSourceEndpoint::onProxyDestroy, NCorbaHelpers::CWeakPtr<CSourceEndpoint>(this), cookie));
+                boost::bind(&CSourceEndpoint::onProxyDestroy, weak, cookie),
+                boost::bind(&CSourceEndpoint::onProxyCreateSource, weak, _1));
             proxy->ModifyQoS(qos);
             {
                 boost::unique_lock<boost::mutex> cookieLock(m_cookieMutex);
@@ -277,7 +404,7 @@ namespace
             }
             if (MMSS::EINPROC == sinkPrefs[chosen])
             {
-                auto src = NCorbaHelpers::TakeRefcounted(m_sourceFactory->CreateSource(qos));
+                auto src = NCorbaHelpers::TakeRefcounted(createSource(qos));
                 proxy->SetSource( src.Get() );
                 MMSS::InprocConnectionInfo inproc;
                 inproc.pullSourcePtr=(CORBA::ULongLong)(NMMSS::IPullStyleSource*)(proxy.Dup());
@@ -305,7 +432,7 @@ namespace
 
                 _log_ << "Create UDP connection " << udp.address.in() << ":" << udp.controlPort << "&" << udp.dataPort;
 
-                connectUdpOutputChannel(proxy, qos, connInfo->_d(), controlPeer, dataPeer);
+                connectUdpOutputChannel(proxy, connInfo->_d(), controlPeer, dataPeer);
                 return;
             }
             else if (MMSS::EMULTICAST == sinkPrefs[chosen])
@@ -344,7 +471,7 @@ namespace
 
                         connInfo->mcast(m_multicastData);
 
-                        connectUdpMulticastOutputChannel(proxy, qos, *connInfo, controlPeer);
+                        connectUdpMulticastOutputChannel(proxy, *connInfo, controlPeer);
                     }
                 }
                 else
@@ -408,7 +535,7 @@ namespace
             }
 
             m_tcpConnectionAcceptor->Register(cookie,
-                makeTcpConnectionHandler(proxy, qos, *connInfo),
+                makeTcpConnectionHandler(proxy, *connInfo),
                 std::chrono::seconds(60));
         }
         void RequestQoS(const char* cookie, MMSS::QualityOfService const& qos)
@@ -466,6 +593,8 @@ namespace
         using CookieMap = std::unordered_map<std::string, PWeakProxySource>;
         CookieMap m_cookieMap;
 
+        NMMSS::NSharedSources::CSharedSources<CSharedSource> m_sharedSources;
+
         NMMSS::PTCPConnectionAcceptor m_tcpConnectionAcceptor;
         NMMSS::PUDPConnectionAcceptor m_udpConnectionAcceptor;
 
@@ -546,8 +675,23 @@ namespace
             ep->OnProxyDestroy(cookie);
         }
 
+        static NMMSS::IQoSAwareSource* onProxyCreateSource(NCorbaHelpers::CWeakPtr<CSourceEndpoint> endpoint, MMSS::QualityOfService const& qos)
+        {
+            NCorbaHelpers::CAutoPtr<CSourceEndpoint> ep (endpoint.Dup());
+            if( ep == nullptr )
+                return nullptr;
+
+            return ep->createSource(qos);
+        }
+
     protected:
 
+        // Whether connections with equivalent QoS may be served by one source.
+        virtual bool canShareSources() const
+        {
+            return true;
+        }
+
         virtual void OnProxyDestroy(const std::string& cookie)
         {
             boost::unique_lock<boost::mutex> cookieLock(m_cookieMutex);
@@ -661,6 +805,16 @@ namespace
             , m_sourceImpl(pSourceImpl)
         {}
 
+    protected:
+
+        // The seekable source is played back for a single session.
+        bool canShareSources() const override
+        {
+            return false;
+        }
+
+    public:
+
         void Seek(const char* time, MMSS::EStartPosition startPos, CORBA::Long mode, CORBA::ULong sessionId)
         {
             NMMSS::PSeekableSource sourceImpl = m_sourceImpl;
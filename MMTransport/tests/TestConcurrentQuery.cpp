@@ -0,0 +1,156 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../ConcurrentQuery.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+using namespace NMMSS::NIntervalSequence;
+
+namespace
+{
+    typedef CConcurrentQuery<std::vector<int>> TQuery;
+    typedef std::chrono::steady_clock TClock;
+
+    // Storages answering their index after their latency, each on a thread of its own.
+    struct SFakeStorages
+    {
+        explicit SFakeStorages(std::vector<std::chrono::milliseconds> latencies)
+            : Latencies(std::move(latencies))
+            , Asked(Latencies.size())
+        {
+            for (auto& a : Asked)
+                a = 0;
+        }
+
+        ~SFakeStorages()
+        {
+            for (auto& t : Threads)
+                t.join();
+        }
+
+        TQuery::FAsk Ask()
+        {
+            return [this](size_t i, std::vector<int>& result)
+            {
+                ++Asked[i];
+                const int running = ++Running;
+                int peak = Peak;
+                while (running > peak && !Peak.compare_exchange_weak(peak, running))
+                    ;
+                std::this_thread::sleep_for(Latencies[i]);
+                --Running;
+                if (Failures > 0 && 0 == i && Failures-- > 0)
+                    throw std::runtime_error("storage is busy");
+                result.push_back(int(i));
+            };
+        }
+
+        TQuery::FPost Post()
+        {
+            return [this](const std::function<void()>& task)
+            {
+                Threads.emplace_back(task);
+                return true;
+            };
+        }
+
+        const std::vector<std::chrono::milliseconds> Latencies;
+        std::vector<std::atomic<int>> Asked;
+        std::atomic<int> Running{ 0 };
+        std::atomic<int> Peak{ 0 };
+        std::atomic<int> Failures{ 0 };
+        std::vector<std::thread> Threads;
+    };
+
+    double millisecondsSince(TClock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(TClock::now() - start).count();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMTransport)
+
+BOOST_AUTO_TEST_CASE(ConcurrentQueryAsksStoragesAtOnce)
+{
+    SFakeStorages storages(std::vector<std::chrono::milliseconds>(4, std::chrono::milliseconds(200)));
+    TQuery query(4, storages.Ask());
+
+    const auto start = TClock::now();
+    BOOST_CHECK(query.Run(storages.Post(), std::chrono::milliseconds(2000)));
+    // One after another they would take 800 ms.
+    BOOST_CHECK_LT(millisecondsSince(start), 600.0);
+    BOOST_CHECK_EQUAL(storages.Peak.load(), 4);
+
+    const TQuery::TResults results = query.Results();
+    BOOST_REQUIRE_EQUAL(results.size(), 4u);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        BOOST_REQUIRE(results[i]);
+        BOOST_CHECK_EQUAL(results[i]->at(0), int(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentQueryKeepsLateAnswers)
+{
+    SFakeStorages storages({ std::chrono::milliseconds(10), std::chrono::milliseconds(400) });
+    TQuery query(2, storages.Ask());
+
+    // The slow storage misses the deadline counted from the first answer.
+    const auto start = TClock::now();
+    BOOST_CHECK(!query.Run(storages.Post(), std::chrono::milliseconds(100)));
+    BOOST_CHECK_LT(millisecondsSince(start), 350.0);
+    BOOST_CHECK_EQUAL(query.Answered(), 1u);
+    BOOST_CHECK(query.Results()[0]);
+    BOOST_CHECK(!query.Results()[1]);
+
+    // The retry waits for its answer instead of asking again.
+    BOOST_CHECK(query.Run(storages.Post(), std::chrono::milliseconds(2000)));
+    BOOST_CHECK_EQUAL(storages.Asked[0].load(), 1);
+    BOOST_CHECK_EQUAL(storages.Asked[1].load(), 1);
+    BOOST_CHECK_EQUAL(query.Rounds(), 2u);
+    BOOST_REQUIRE(query.Results()[1]);
+    BOOST_CHECK_EQUAL(query.Results()[1]->at(0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentQueryBoundsSilentStorages)
+{
+    SFakeStorages storages({ std::chrono::milliseconds(600) });
+    TQuery query(1, storages.Ask());
+
+    const auto start = TClock::now();
+    BOOST_CHECK(!query.Run(storages.Post(), std::chrono::milliseconds(100)));
+    BOOST_CHECK_LT(millisecondsSince(start), 450.0);
+    BOOST_CHECK_EQUAL(query.Answered(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentQueryRetriesRefusedTasks)
+{
+    SFakeStorages storages({ std::chrono::milliseconds(10), std::chrono::milliseconds(10) });
+    TQuery query(2, storages.Ask());
+
+    // A full pool does not make the planner ask inline and wait without a bound.
+    BOOST_CHECK(!query.Run([](const std::function<void()>&) { return false; }, std::chrono::milliseconds(100)));
+    BOOST_CHECK_EQUAL(storages.Asked[0].load(), 0);
+    BOOST_CHECK_EQUAL(query.Answered(), 0u);
+
+    BOOST_CHECK(query.Run(storages.Post(), std::chrono::milliseconds(2000)));
+    BOOST_CHECK_EQUAL(query.Answered(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentQueryAsksFailedStoragesAgain)
+{
+    SFakeStorages storages({ std::chrono::milliseconds(10), std::chrono::milliseconds(10) });
+    storages.Failures = 1;
+    TQuery query(2, storages.Ask());
+
+    BOOST_CHECK_THROW(query.Run(storages.Post(), std::chrono::milliseconds(2000)), std::runtime_error);
+    BOOST_CHECK_EQUAL(query.Answered(), 1u);
+
+    BOOST_CHECK(query.Run(storages.Post(), std::chrono::milliseconds(2000)));
+    BOOST_CHECK_EQUAL(storages.Asked[0].load(), 2);
+    BOOST_CHECK_EQUAL(storages.Asked[1].load(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../IntervalSequence.h"
+
+using namespace NMMSS::NIntervalSequence;
+namespace bpt = boost::posix_time;
+
+namespace
+{
+    const bpt::ptime ORIGIN(boost::gregorian::date(2020, 1, 1));
+
+    bpt::time_period period(int beginSeconds, int endSeconds)
+    {
+        return bpt::time_period(ORIGIN + bpt::seconds(beginSeconds), ORIGIN + bpt::seconds(endSeconds));
+    }
+
+    bpt::ptime at(int seconds)
+    {
+        return ORIGIN + bpt::seconds(seconds);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMTransport)
+
+BOOST_AUTO_TEST_CASE(IntervalSequenceClipsToPeriod)
+{
+    const TPeriods clipped = ClipToPeriod(period(10, 20), { period(0, 5), period(8, 12), period(14, 16), period(18, 30), period(25, 40) });
+    BOOST_REQUIRE_EQUAL(clipped.size(), 3u);
+    BOOST_CHECK(clipped[0] == period(10, 12));
+    BOOST_CHECK(clipped[1] == period(14, 16));
+    BOOST_CHECK(clipped[2] == period(18, 20));
+}
+
+BOOST_AUTO_TEST_CASE(IntervalSequenceChainsStorages)
+{
+    std::vector<TPeriods> sources(2);
+    sources[0] = { period(0, 10), period(30, 40) };
+    sources[1] = { period(15, 20), period(45, 50) };
+
+    const TPlannedIntervals planned = Merge(sources, at(0));
+    BOOST_REQUIRE_EQUAL(planned.size(), 4u);
+    BOOST_CHECK_EQUAL(planned[0].Source, 0u);
+    BOOST_CHECK(planned[0].Interval == period(0, 10));
+    BOOST_CHECK_EQUAL(planned[1].Source, 1u);
+    BOOST_CHECK(planned[1].Interval == period(15, 20));
+    BOOST_CHECK_EQUAL(planned[2].Source, 0u);
+    BOOST_CHECK(planned[2].Interval == period(30, 40));
+    BOOST_CHECK_EQUAL(planned[3].Source, 1u);
+    BOOST_CHECK(planned[3].Interval == period(45, 50));
+}
+
+BOOST_AUTO_TEST_CASE(IntervalSequenceStartsFromPosition)
+{
+    std::vector<TPeriods> sources(1);
+    sources[0] = { period(0, 10), period(20, 30) };
+
+    // The interval playing at the position is kept whole, the ones over are skipped.
+    const TPlannedIntervals planned = Merge(sources, at(25));
+    BOOST_REQUIRE_EQUAL(planned.size(), 1u);
+    BOOST_CHECK(planned[0].Interval == period(20, 30));
+
+    BOOST_CHECK(Merge(sources, at(30)).empty());
+}
+
+BOOST_AUTO_TEST_CASE(IntervalSequencePrefersLongerOnTie)
+{
+    std::vector<TPeriods> sources(3);
+    sources[0] = { period(0, 10) };
+    sources[1] = { period(0, 25) };
+    sources[2] = { period(5, 30) };
+
+    // Of the storages recording at the start the one lasting longer wins. The one
+    // recording past it plays next, from its own start on, and cuts the winner short.
+    const TPlannedIntervals planned = Merge(sources, at(0));
+    BOOST_REQUIRE_EQUAL(planned.size(), 2u);
+    BOOST_CHECK_EQUAL(planned[0].Source, 1u);
+    BOOST_CHECK(planned[0].Interval == period(0, 5));
+    BOOST_CHECK_EQUAL(planned[1].Source, 2u);
+    BOOST_CHECK(planned[1].Interval == period(5, 30));
+}
+
+BOOST_AUTO_TEST_CASE(IntervalSequenceCutsOverlaps)
+{
+    std::vector<TPeriods> sources(2);
+    sources[0] = { period(0, 10) };
+    sources[1] = { period(12, 20) };
+
+    // A gap on the first storage is filled by the second, which starts before the first resumes.
+    sources[0].push_back(period(15, 30));
+    const TPlannedIntervals planned = Merge(sources, at(0));
+    BOOST_REQUIRE_EQUAL(planned.size(), 3u);
+    BOOST_CHECK(planned[0].Interval == period(0, 10));
+    BOOST_CHECK_EQUAL(planned[1].Source, 1u);
+    BOOST_CHECK(planned[1].Interval == period(12, 15));
+    BOOST_CHECK_EQUAL(planned[2].Source, 0u);
+    BOOST_CHECK(planned[2].Interval == period(15, 30));
+}
+
+BOOST_AUTO_TEST_CASE(IntervalSequencePreparesNextStorage)
+{
+    std::vector<TPeriods> sources(2);
+    sources[0] = { period(0, 10), period(20, 30) };
+    sources[1] = { period(10, 20), period(40, 50) };
+    const TPlannedIntervals planned = Merge(sources, at(0));
+    BOOST_REQUIRE_EQUAL(planned.size(), 4u);
+
+    // Nothing plays yet, then every switch to another storage is opened ahead.
+    BOOST_CHECK_EQUAL(NextToPrepare(planned, -1), -1);
+    BOOST_CHECK_EQUAL(NextToPrepare(planned, 0), 1);
+    BOOST_CHECK_EQUAL(NextToPrepare(planned, 1), 2);
+    BOOST_CHECK_EQUAL(NextToPrepare(planned, 3), -1);
+
+    // The storage playing on needs no second endpoint.
+    TPlannedIntervals same = planned;
+    same[1].Source = same[0].Source;
+    BOOST_CHECK_EQUAL(NextToPrepare(same, 0), -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
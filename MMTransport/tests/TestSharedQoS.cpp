@@ -0,0 +1,69 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../SharedQoS.h"
+#include "../QualityOfService.h"
+
+using namespace NMMSS::NSharedSources;
+
+namespace
+{
+    MMSS::QoSRequest::FrameRate frameRate(float fps)
+    {
+        return MMSS::QoSRequest::FrameRate{ fps, false };
+    }
+
+    MMSS::QoSRequest::FrameGeometry frameGeometry(CORBA::Long width, CORBA::Long height)
+    {
+        MMSS::QoSRequest::FrameGeometry geometry;
+        geometry.width = width;
+        geometry.height = height;
+        return geometry;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MMTransport)
+
+BOOST_AUTO_TEST_CASE(SharedQoSIgnoresOrderAndRepeats)
+{
+    const SSharedQoS shared = MakeSharedQoS(NMMSS::MakeQualityOfService(frameRate(5.f), frameGeometry(640, 360)));
+    BOOST_REQUIRE(!shared.Key.empty());
+    BOOST_CHECK_EQUAL(shared.QoS.length(), 2u);
+
+    // The last frame rate wins, as it does when the policy applies the requests, and disabled
+    // key frame filtering changes nothing.
+    const SSharedQoS equivalent = MakeSharedQoS(NMMSS::MakeQualityOfService(
+        frameGeometry(640, 360), frameRate(10.f), MMSS::QoSRequest::OnlyKeyFrames{ false }, frameRate(5.f)));
+    BOOST_CHECK_EQUAL(equivalent.Key, shared.Key);
+    BOOST_CHECK_EQUAL(equivalent.QoS.length(), 2u);
+
+    BOOST_CHECK_NE(MakeSharedQoS(NMMSS::MakeQualityOfService(frameRate(10.f), frameGeometry(640, 360))).Key, shared.Key);
+    BOOST_CHECK_NE(MakeSharedQoS(NMMSS::MakeQualityOfService(frameRate(5.f), frameGeometry(640, 360),
+        MMSS::QoSRequest::OnlyKeyFrames{ true })).Key, shared.Key);
+}
+
+BOOST_AUTO_TEST_CASE(SharedQoSSplitsStartPosition)
+{
+    const SSharedQoS shared = MakeSharedQoS(NMMSS::MakeQualityOfService(
+        MMSS::QoSRequest::StartFrom{ MMSS::QoSRequest::StartFrom::Preroll }, frameRate(5.f)));
+
+    // Connections starting from different positions share the chain, the distributor starts each one.
+    BOOST_CHECK_EQUAL(shared.Key, MakeSharedQoS(NMMSS::MakeQualityOfService(frameRate(5.f))).Key);
+    BOOST_CHECK(NMMSS::EStartFrom::Preroll == shared.Start);
+    BOOST_REQUIRE_EQUAL(shared.QoS.length(), 1u);
+    BOOST_CHECK(MMSS::QOS_FrameRate == shared.QoS[0]._d());
+}
+
+BOOST_AUTO_TEST_CASE(SharedQoSKeepsConnectionStateApart)
+{
+    MMSS::QoSRequest::Buffer buffer;
+    buffer.duration = 1000;
+    buffer.start = CORBA::string_dup("");
+    buffer.discontinuty = false;
+    BOOST_CHECK(MakeSharedQoS(NMMSS::MakeQualityOfService(frameRate(5.f), buffer)).Key.empty());
+
+    MMSS::QoSRequest::PlaybackDepth depth;
+    depth.seconds = 10;
+    BOOST_CHECK(MakeSharedQoS(NMMSS::MakeQualityOfService(depth)).Key.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
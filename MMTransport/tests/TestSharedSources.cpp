@@ -0,0 +1,123 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../SharedSources.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+using namespace NMMSS::NSharedSources;
+
+namespace
+{
+    // Stands for the chain shared by connections, counts the ones alive.
+    class CFakeShared : public NCorbaHelpers::CWeakReferableImpl
+    {
+    public:
+        explicit CFakeShared(std::atomic<int>& alive)
+            : m_alive(alive)
+        {
+            ++m_alive;
+        }
+        ~CFakeShared()
+        {
+            --m_alive;
+        }
+    private:
+        std::atomic<int>& m_alive;
+    };
+
+    typedef CSharedSources<CFakeShared> TSources;
+
+    struct SFactory
+    {
+        TSources::FCreate Create()
+        {
+            return [this]() { ++Created; return TSources::PShared(new CFakeShared(Alive)); };
+        }
+
+        std::atomic<int> Created{ 0 };
+        std::atomic<int> Alive{ 0 };
+    };
+}
+
+BOOST_AUTO_TEST_SUITE(MMTransport)
+
+BOOST_AUTO_TEST_CASE(SharedSourcesShareEquivalentQoS)
+{
+    SFactory factory;
+    TSources sources;
+
+    const TSources::PShared first = sources.Acquire("qos;r5,0;", factory.Create());
+    const TSources::PShared second = sources.Acquire("qos;r5,0;", factory.Create());
+    BOOST_REQUIRE(first);
+    BOOST_CHECK(first.Get() == second.Get());
+    BOOST_CHECK_EQUAL(factory.Created.load(), 1);
+
+    const TSources::PShared other = sources.Acquire("qos;r10,0;", factory.Create());
+    BOOST_CHECK(other.Get() != first.Get());
+    BOOST_CHECK_EQUAL(factory.Created.load(), 2);
+    BOOST_CHECK_EQUAL(sources.Size(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(SharedSourcesReleaseWithLastLeg)
+{
+    SFactory factory;
+    TSources sources;
+
+    TSources::PShared first = sources.Acquire("qos;r5,0;", factory.Create());
+    TSources::PShared second = sources.Acquire("qos;r5,0;", factory.Create());
+    first.reset();
+    BOOST_CHECK_EQUAL(factory.Alive.load(), 1);
+    second.reset();
+    BOOST_CHECK_EQUAL(factory.Alive.load(), 0);
+    BOOST_CHECK(!sources.Find("qos;r5,0;"));
+
+    // The next connection gets a chain of its own, the expired entry is swept meanwhile.
+    const TSources::PShared other = sources.Acquire("qos;r10,0;", factory.Create());
+    BOOST_CHECK_EQUAL(sources.Size(), 1u);
+    const TSources::PShared again = sources.Acquire("qos;r5,0;", factory.Create());
+    BOOST_CHECK_EQUAL(factory.Created.load(), 3);
+    BOOST_CHECK_EQUAL(factory.Alive.load(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(SharedSourcesCreateUnlocked)
+{
+    SFactory factory;
+    TSources sources;
+    const TSources::PShared other = sources.Acquire("qos;r10,0;", factory.Create());
+
+    // Both connections build their chain at once, and the registry stays usable meanwhile.
+    std::mutex mutex;
+    std::condition_variable entered;
+    int creating = 0;
+    std::atomic<int> served{ 0 };
+    const auto create = [&]()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ++creating;
+            entered.notify_all();
+            entered.wait_for(lock, std::chrono::seconds(5), [&creating]() { return 2 == creating; });
+        }
+        if (sources.Find("qos;r10,0;"))
+            ++served;
+        return factory.Create()();
+    };
+
+    TSources::PShared results[2];
+    std::thread racer([&]() { results[0] = sources.Acquire("qos;r5,0;", create); });
+    results[1] = sources.Acquire("qos;r5,0;", create);
+    racer.join();
+
+    BOOST_CHECK_EQUAL(creating, 2);
+    BOOST_CHECK_EQUAL(served.load(), 2);
+    BOOST_REQUIRE(results[0]);
+    BOOST_CHECK(results[0].Get() == results[1].Get());
+    // The source that lost the race is dropped once nobody holds it.
+    BOOST_CHECK_EQUAL(factory.Created.load(), 3);
+    BOOST_CHECK_EQUAL(factory.Alive.load(), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()